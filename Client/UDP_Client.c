@@ -4,14 +4,62 @@
  * UDP interaction
  *
  * Client sends three messages to Server
- *  - To set the value for a specific key in Server
- *     --set <key> <value>
+ *  - To set the value for a specific key in Server, optionally
+ *    expiring after <ttl> seconds
+ *     --set <key> <value> [<ttl>]
  *  - To get the value for a key from Server
  *     --get <key>
  *  - To delete a key-value pair from Server db
  *     --del <key>
+ *  - To set or overwrite a value, to overwrite it only while it
+ *    still has the <version> --gets returned, to add to or subtract
+ *    from a decimal value and to append to a value
+ *     --put <key> <value> [<ttl>]
+ *     --cas <key> <value> <version> [<ttl>]
+ *     --incr <key> <delta>, --decr <key> <delta>
+ *     --append <key> <value>
+ *     --gets <key>
  *  - To stop server and delete all entries
  *      --fin fin
+ *  - To change the Server log level, text protocol only
+ *      --loglevel error|warn|info|debug
+ *  - To print the Server counters and latency histograms
+ *      --stats
+ *  - Multi-key commands, keys read from a file or stdin ("-"),
+ *    one key (or "key value" for --mset) per line; as many keys as
+ *    fit are packed in each datagram
+ *      --mset <file>
+ *      --mget <file>
+ *      --mdel <file>
+ *  - To list keys in order, a page of <count> keys per datagram, when
+ *    the Server runs with --index ordered
+ *     --scan <from> <to> [<count>]     keys from <= key < to
+ *     --prefix <prefix> [<count>]      keys starting with prefix
+ *  - --binary anywhere after --server <ipaddress>:<port> sends the
+ *    commands in the binary framing of Common/kv_proto.h
+ *  - --server <ipaddress>:<port>,<ipaddress>:<port>,... spreads the
+ *    keys over several Servers by consistent hashing (kv_ring.h):
+ *    a command goes to the Server of its key, the keys of a multi-key
+ *    command are packed per Server and the datagrams sent together,
+ *    --scan/--prefix merge the keys of all Servers, --fin, --stats
+ *    and --loglevel go to every Server
+ *  - --tcp anywhere after --server connects to the Server's --tcp
+ *    port instead, every command and reply framed by its length
+ *  - Over UDP a command without reply is resent under the same
+ *    request id after --timeout <ms> (default 200), waiting twice as
+ *    long each time, at most --retries <N> times (default 3). The
+ *    Server answers a resent update from its reply cache, so it takes
+ *    effect once; text commands carry the id as a "#<id> " prefix
+ *  - --psk <file> seals every command and opens every reply with the
+ *    pre-shared key the Server runs with (--psk), over UDP or --tcp
+ *  - --value-file <file|-> in place of <value> reads the value from a
+ *    file; with --binary a value too big for one datagram is put in
+ *    chunks and read back in ranges
+ *  - Persistent sessions over one socket, binary protocol, with up to
+ *    --window requests in flight, matched to replies by request id
+ *      --interactive           prompt for commands on stdin
+ *      --script <file|->       run one command per line
+ *    Session lines: set <key> <value...> | get <key> | del <key> | fin
  *
  *  Author: Kapil
  *
@@ -21,49 +69,208 @@
 #include <stdlib.h> 
 #include <unistd.h> 
 #include <string.h> 
+#include <errno.h>
+#include <poll.h>
 #include <sys/types.h> 
 #include <sys/socket.h> 
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
 
-/* Maximum number of characters in command*/
-#define MAXLINE 1024 
-#define MAXCHAR 256
-
-#define IPADDR 1
-#define PORTNUM 2
+#include "../Common/kv_proto.h"
+#include "kv_client.h"
+#include "kv_ring.h"
 
-#define MIN_PORTNO 1
-#define MAX_PORTNO 65535
+/* Maximum number of characters in command, one datagram with room
+   to seal it*/
+#define MAXLINE KV_PROTO_MAX_PAYLOAD
+#define MAXCHAR 256
+/* Max value length, same limit as the Server store; a --put value
+   bigger than a datagram is sent in chunks*/
+#define MAXVALUE (1000 * 1024)
+/* reads of a chunked value restarted when it changes meanwhile*/
+#define CHUNK_READ_TRIES 5
+/* Largest UDP payload over IPv4, packed multi-key replies*/
+#define MAXREPLY 65507
+/* Max keys packed in one multi-key datagram*/
+#define MAXKEYS 512
+/* Keys per --scan/--prefix page unless given, the Server caps it*/
+#define SCAN_PAGE 100
 
 #define FAILURE -1
 #define SUCCESS 0
 
+/* one command of request_replies(), to one Server*/
+struct exchange{
+    int sockfd;
+    struct sockaddr_in *servaddr;
+    const void *req;
+    int req_len;
+    void *reply;
+    int size;
+    int reply_len;          /* set, -1 on error or with errno ETIMEDOUT*/
+};
+
+/* multi-key datagram being packed for one Server*/
+struct multi_batch{
+    char buffer[MAXLINE];
+    int buf_len;
+    uint32_t req_id;
+    char (*keys)[MAXCHAR + 1];
+    int num_keys;
+    char *reply;
+};
+
+/* keys of --scan/--prefix gathered from every Server*/
+struct scan_keys{
+    char (*keys)[MAXCHAR + 1];
+    long num;
+    long cap;
+};
+
 /* Function prototypes*/
 void error(char *msg);
-int validate_ip_addr(char *ip_addr);
+int run_command(int sockfd, struct sockaddr_in *servaddr, int argc, char **argv);
+int run_multi(char *cmd, char *path);
+int send_multi(struct multi_batch *batches);
+int print_multi(struct multi_batch *b, int num_bytes);
+int binary_opcode(char *cmd);
+int print_binary_reply(unsigned char *reply, int num_bytes, uint32_t req_id);
+int put_chunked(int sockfd, struct sockaddr_in *servaddr, const char *key, const char *value,
+                uint32_t value_len, uint32_t ttl);
+int get_chunked(int sockfd, struct sockaddr_in *servaddr, int opcode, const char *key);
+int run_scan(int sockfd, struct sockaddr_in *servaddr, char *cmd, char *first, char *to,
+             int count, struct scan_keys *out);
+int run_scan_all(char *cmd, char *first, char *to, int count);
+static void scan_add(struct scan_keys *out, const char *key);
+char *read_value_file(const char *path);
+int run_session(char *path, int argc, char **argv);
+int request_reply(int sockfd, struct sockaddr_in *servaddr, const void *req, int req_len,
+                  void *reply, int size);
+int request_replies(struct exchange *x, int num);
+int send_sealed(int sockfd, struct sockaddr_in *servaddr, const void *req, int req_len);
+int recv_sealed(int sockfd, void *reply, int size);
+void session_reply(struct kv_conn *conn, const struct kv_reply *reply);
+
+/* --binary given on the command line*/
+static int binary_mode;
+/* --tcp given on the command line*/
+static int tcp_mode;
+/* --timeout and --retries of a UDP request*/
+static int reply_timeout_ms = KV_CLIENT_DEFAULT_TIMEOUT_MS;
+static int reply_retries = KV_CLIENT_DEFAULT_RETRIES;
+/* --psk given on the command line*/
+static unsigned char psk[KV_CRYPTO_KEY];
+static struct kv_seal seal;
+/* request id of the next binary request*/
+static uint32_t next_req_id;
+/* --quiet in session mode: only the summary is printed*/
+static int session_quiet;
+/* Servers of --server, a socket each*/
+static struct kv_ring ring;
+static int *node_fds;
 
 /* main function*/
 int main(int argc, char **argv) 
 { 
-    int sockfd; 
-    int portno;
-    int num_bytes;
-    int count = 1;
-    char *ip_addr;
-    char *port_num;
-    char buffer[MAXLINE]; 
-    char *split_str;
-    struct sockaddr_in servaddr; 
-    unsigned int len;
+    int multi;
+    int update;
+    int session;
+    int stats;
+    int scan;
+    int first;
+    int last;
+    int status = SUCCESS;
+    int i;
     
+    /* --binary and --tcp are flags, drop them so the positional checks
+       below apply*/
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i],"--binary")==0 || strcmp(argv[i],"--tcp")==0)
+        {
+            if (argv[i][2] == 'b')
+                binary_mode = 1;
+            else
+                tcp_mode = 1;
+            memmove(&argv[i], &argv[i+1], (argc - i) * sizeof(char *));
+            argc--;
+            i--;
+        }
+    }
+    /* --value-file <file> stands in for the value argument, for values
+       longer than a command line argument may be*/
+    for (i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i],"--value-file")==0)
+        {
+            argv[i] = read_value_file(argv[i+1]);
+            memmove(&argv[i+1], &argv[i+2], (argc - i - 1) * sizeof(char *));
+            argc--;
+            break;
+        }
+    }
+    /* --timeout <ms> and --retries <N> apply to any command*/
+    for (i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i],"--timeout")==0 || strcmp(argv[i],"--retries")==0)
+        {
+            if (argv[i][2] == 't')
+                reply_timeout_ms = atoi(argv[i+1]);
+            else
+                reply_retries = atoi(argv[i+1]);
+            memmove(&argv[i], &argv[i+2], (argc - i - 1) * sizeof(char *));
+            argc -= 2;
+            i--;
+        }
+    }
+    if (reply_timeout_ms < 1 || reply_retries < 0)
+    {
+        error("Incorrect Input : --timeout must be > 0");
+    }
+    /* --psk <file> seals the commands*/
+    for (i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i],"--psk")==0)
+        {
+            if (kv_crypto_load_psk(argv[i+1], psk) != 0)
+                error("Incorrect Input : --psk file must hold 64 hex digits");
+            if (kv_seal_init(&seal, psk) != SUCCESS)
+                error("Starting sealed session");
+            memmove(&argv[i], &argv[i+2], (argc - i - 1) * sizeof(char *));
+            argc -= 2;
+            break;
+        }
+    }
+    next_req_id = (uint32_t)getpid() << 16;
+
+    session = (argc >= 4 && (strcmp(argv[3],"--interactive")==0 || strcmp(argv[3],"--script")==0));
+    stats = (argc == 4 && strcmp(argv[3],"--stats")==0);
+
     /*validate input parameters*/
-    if (argc < 5) 
+    if (argc < 5 && !session && !stats) 
     {
       printf("usage: %s --server <ipaddress>:<port> --get <key>\n", argv[0]);
-      printf("usage: %s --server <ipaddress>:<port> --set <key> <value>\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --set <key> <value> [<ttl seconds>]\n", argv[0]);
       printf("usage: %s --server <ipaddress>:<port> --del <key>\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --put <key> <value> [<ttl seconds>]\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --cas <key> <value> <version> [<ttl seconds>]\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --incr|--decr <key> <delta>\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --append <key> <value>\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --gets <key>\n", argv[0]);
       printf("usage: %s --server <ipaddress>:<port> --fin fin\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --loglevel error|warn|info|debug\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --stats\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --mset|--mget|--mdel <file|->\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --scan <from> <to> [<count>]\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --prefix <prefix> [<count>]\n", argv[0]);
+      printf("usage: %s --server <ipaddress>:<port> --interactive|--script <file|->\n"
+             "       [--window <N>] [--quiet]\n", argv[0]);
+      printf("       --server <ipaddress>:<port>,<ipaddress>:<port>,... spreads the keys over several Servers\n");
+      printf("       add --binary to use the binary protocol\n");
+      printf("       add --tcp to connect to the Server's --tcp port\n");
+      printf("       add --timeout <ms> --retries <N> to set how long a UDP reply is waited for\n");
+      printf("       add --psk <file> to seal the commands with the Server's pre-shared key\n");
+      printf("       --value-file <file|-> in place of <value> reads the value from a file\n");
 
       error("Incorrect Input");
     }
@@ -73,101 +280,294 @@ int main(int argc, char **argv)
         error("Incorrect Input : --server expected");
     }
 
-    if (!(strncmp(argv[3],"--set",5)==0 || strncmp(argv[3],"--get",5)==0 || strncmp(argv[3],"--del",5)==0 || strncmp(argv[3],"--fin",5)==0))
+    multi = (strncmp(argv[3],"--mset",6)==0 || strncmp(argv[3],"--mget",6)==0 || strncmp(argv[3],"--mdel",6)==0);
+
+    update = (strcmp(argv[3],"--put")==0 || strcmp(argv[3],"--cas")==0 || strcmp(argv[3],"--incr")==0 ||
+              strcmp(argv[3],"--decr")==0 || strcmp(argv[3],"--append")==0);
+
+    scan = (strcmp(argv[3],"--scan")==0 || strcmp(argv[3],"--prefix")==0);
+
+    if (!(multi || session || update || scan || strncmp(argv[3],"--set",5)==0 || strncmp(argv[3],"--get",5)==0 || strncmp(argv[3],"--del",5)==0 || strncmp(argv[3],"--fin",5)==0 || strcmp(argv[3],"--loglevel")==0 || stats))
     {
         error("Incorrect Input : --set or --get or --del expected");
     }
+    if (multi && argc != 5)
+    {
+        error("Incorrect Input : --mset/--mget/--mdel <file|-> expected");
+    }
 
     /* Validate Command formats*/
-    if (strncmp(argv[3],"--set",5)==0 && argc != 6)
+    if (strncmp(argv[3],"--set",5)==0 && argc != 6 && argc != 7)
+    {
+        error("Incorrect Input : --set <key> <value> [<ttl>] expected");
+    }
+    if (strncmp(argv[3],"--set",5)==0 && argc == 7 &&
+        (strspn(argv[6], "0123456789") != strlen(argv[6]) || strlen(argv[6]) > 9))
     {
-        error("Incorrect Input : --set <key> <value> expected");
+        error("Incorrect Input : ttl must be a number of seconds");
     }
     if (strncmp(argv[3],"--get",5)==0 && argc != 5)
     {
         error("Incorrect Input : --get <key> expected");
     }
+    if (strcmp(argv[3],"--put")==0 && argc != 6 && argc != 7)
+    {
+        error("Incorrect Input : --put <key> <value> [<ttl>] expected");
+    }
+    if (strcmp(argv[3],"--cas")==0 && argc != 7 && argc != 8)
+    {
+        error("Incorrect Input : --cas <key> <value> <version> [<ttl>] expected");
+    }
+    if ((strcmp(argv[3],"--incr")==0 || strcmp(argv[3],"--decr")==0) &&
+        (argc != 6 || strspn(argv[5], "0123456789") != strlen(argv[5]) || strlen(argv[5]) > 20))
+    {
+        error("Incorrect Input : --incr/--decr <key> <delta> expected");
+    }
+    if (strcmp(argv[3],"--append")==0 && argc != 6)
+    {
+        error("Incorrect Input : --append <key> <value> expected");
+    }
+    if (strcmp(argv[3],"--cas")==0 &&
+        (strspn(argv[6], "0123456789") != strlen(argv[6]) || strlen(argv[6]) > 20))
+    {
+        error("Incorrect Input : version must be the number --gets returned");
+    }
+    if ((strcmp(argv[3],"--put")==0 && argc == 7) || (strcmp(argv[3],"--cas")==0 && argc == 8))
+    {
+        if (strspn(argv[argc-1], "0123456789") != strlen(argv[argc-1]) || strlen(argv[argc-1]) > 9)
+            error("Incorrect Input : ttl must be a number of seconds");
+    }
     if (strncmp(argv[3],"--del",5)==0 && argc != 5)
     {
         error("Incorrect Input : --del <key> expected");
     }
+    if (strcmp(argv[3],"--scan")==0 && argc != 6 && argc != 7)
+    {
+        error("Incorrect Input : --scan <from> <to> [<count>] expected");
+    }
+    if (strcmp(argv[3],"--prefix")==0 && argc != 5 && argc != 6)
+    {
+        error("Incorrect Input : --prefix <prefix> [<count>] expected");
+    }
+    if (scan && argc == (strcmp(argv[3],"--scan")==0 ? 7 : 6) &&
+        (strspn(argv[argc-1], "0123456789") != strlen(argv[argc-1]) || atoi(argv[argc-1]) < 1 ||
+         strlen(argv[argc-1]) > 5))
+    {
+        error("Incorrect Input : count must be a number of keys");
+    }
+
+    if (stats && binary_mode)
+    {
+        error("Incorrect Input : --stats uses the text protocol");
+    }
+    if (strcmp(argv[3],"--loglevel")==0 && (argc != 5 || binary_mode))
+    {
+        error("Incorrect Input : --loglevel <level> expected, text protocol only");
+    }
+
+    if (strcmp(argv[3],"--script")==0 && argc < 5)
+    {
+        error("Incorrect Input : --script <file|-> expected");
+    }
 
     /* Max limit of 256 Characters*/
-    if (strlen(argv[4]) > MAXCHAR)
+    if (!multi && !session && !stats && strlen(argv[4]) > MAXCHAR)
     {
         error("Incorrect Input : Key length >256");
     }
-    if (argc == 6 && strlen(argv[5]) > MAXCHAR)
+    if (!session && argc >= 6 && strlen(argv[5]) > MAXVALUE)
     {
-        error("Incorrect Input : value length >256");
+        error("Incorrect Input : value length >1024000");
     }
     /* End of validation*/
 
-    /*Separating ipaddr and portno from <ipaddr>:<portno> format*/    
-    split_str = strtok(argv[2],":");
-
-    while (split_str != NULL)
+    if (kv_ring_parse(&ring, argv[2]) != SUCCESS)
     {
-        switch (count)
-        {
-            case IPADDR:
-                ip_addr = (char*)malloc(strlen(split_str)+1);
-                strncpy(ip_addr,split_str,strlen(split_str)+1);
-                ip_addr[strlen(split_str)]='\0';
-            break;
+        error("Incorrect IP addr and port input");
+    }
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        printf("\nPort number:%d, ipaddr:%s", ring.nodes[i].portno, ring.nodes[i].ip_addr);
+    }
 
-            case PORTNUM:
-                port_num = (char*)malloc(strlen(split_str)+1);
-                strncpy(port_num,split_str,strlen(split_str)+1);
-                port_num[strlen(split_str)]='\0';
-            break;
+    if (session)
+    {
+        if (strcmp(argv[3],"--script")==0)
+            status = run_session(argv[4], argc - 5, argv + 5);
+        else
+            status = run_session(NULL, argc - 4, argv + 4);
+        kv_ring_free(&ring);
+        return (status == SUCCESS) ? 0 : EXIT_FAILURE;
+    }
 
-            default:
-            break;
+    /* Creating a socket per Server*/ 
+    node_fds = malloc(ring.num_nodes * sizeof(int));
+    if (NULL == node_fds)
+    {
+        error("Socket allocation failed");
+    }
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        if ( (node_fds[i] = socket(AF_INET, tcp_mode ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0 ) { 
+            perror("Socket creation failed"); 
+            exit(EXIT_FAILURE); 
+        } 
+        if (tcp_mode && connect(node_fds[i], (const struct sockaddr *)&ring.nodes[i].addr,
+                                sizeof(ring.nodes[i].addr)) < 0)
+        {
+            perror("Connecting to Server");
+            exit(EXIT_FAILURE);
         }
-        split_str = strtok (NULL, ":");
-        count++; 
     }
 
-    /* Validation of ip address and port number*/
-    if (port_num == NULL || ip_addr == NULL)
+    if (multi)
     {
-        error("Incorrect IP addr and port input");
+        status = run_multi(argv[3], argv[4]);
+    }
+    else if (scan)
+    {
+        if (strcmp(argv[3],"--scan")==0)
+            status = run_scan_all(argv[3], argv[4], argv[5], argc > 6 ? atoi(argv[6]) : SCAN_PAGE);
+        else
+            status = run_scan_all(argv[3], argv[4], NULL, argc > 5 ? atoi(argv[5]) : SCAN_PAGE);
     }
     else
     {
-        portno = atoi(port_num);
-        
-        if (portno < MIN_PORTNO || portno > MAX_PORTNO)
+        /* --fin, --stats and --loglevel go to every Server, a command
+           on a key to the Server of the key*/
+        first = 0;
+        last = ring.num_nodes;
+        if (!stats && strncmp(argv[3],"--fin",5)!=0 && strcmp(argv[3],"--loglevel")!=0)
         {
-            error("portnumber invalid");
+            first = kv_ring_node(&ring, argv[4], strlen(argv[4]));
+            last = first + 1;
         }
-        if(validate_ip_addr(ip_addr) != 0)
+        for (i = first; i < last; i++)
         {
-            error("ip_address invalid");
+            if (ring.num_nodes > 1)
+                printf("\nServer %s:%d", ring.nodes[i].ip_addr, ring.nodes[i].portno);
+            if (run_command(node_fds[i], &ring.nodes[i].addr, argc, argv) != SUCCESS)
+                status = FAILURE;
         }
     }
-    printf("\nPort number:%d, ipaddr:%s",portno, ip_addr);
 
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        close(node_fds[i]);
+    }
+    free(node_fds);
+    kv_ring_free(&ring);
+    return (status == SUCCESS) ? 0 : EXIT_FAILURE;
+} 
 
-    /* Creating socket file descriptor*/ 
-    if ( (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) { 
-        perror("Socket creation failed"); 
-        exit(EXIT_FAILURE); 
-    } 
+/* Function: run_command() - To send a single command to one Server
+ * in parameters:
+ *   sockfd - socket of the Server
+ *   servaddr - Server address
+ *   argc - number of arguments
+ *   argv - command line, the command at argv[3]
+ *
+ * return:
+ *   status of the operation
+ */
+int run_command(int sockfd, struct sockaddr_in *servaddr, int argc, char **argv)
+{
+    int num_bytes;
+    int opcode;
+    int status = SUCCESS;
+    char buffer[MAXLINE]; 
+    /* --stats replies are larger than any command*/
+    static char reply[MAXREPLY + 1];
+    unsigned char *p;
+    size_t msg_len;
+    int i;
 
-    memset(&servaddr, 0, sizeof(servaddr)); 
-    
-    /* Filling server information*/ 
-    servaddr.sin_family = AF_INET; 
-    servaddr.sin_port = htons(portno); 
-    servaddr.sin_addr.s_addr = inet_addr(ip_addr); 
-    
-    /* message to be sent*/
+    if (binary_mode)
+    {
+        opcode = binary_opcode(argv[3]);
+
+        /* header, key, value and at most version and ttl*/
+        if (argc > 5 && KV_PROTO_HDR_LEN + 2 + strlen(argv[4]) + 4 + strlen(argv[5]) + 12 > MAXLINE)
+        {
+            if (opcode != KV_OP_PUT)
+                error("Incorrect Input : value too big for one datagram, only --put sends it in chunks");
+            return put_chunked(sockfd, servaddr, argv[4], argv[5], strlen(argv[5]),
+                               argc > 6 ? strtoul(argv[6], NULL, 10) : 0);
+        }
+
+        /* same command in binary framing, key and value length prefixed*/
+        p = kv_proto_put_header((unsigned char *)buffer, opcode, 0, next_req_id);
+        if (opcode != KV_OP_FIN)
+        {
+            p = kv_proto_put_u16(p, strlen(argv[4]));
+            p = kv_proto_put_bytes(p, argv[4], strlen(argv[4]));
+        }
+        if (opcode == KV_OP_INCR || opcode == KV_OP_DECR)
+        {
+            /* 20 digits may pass 2^64, the u64 field cannot carry it*/
+            errno = 0;
+            p = kv_proto_put_u64(p, strtoull(argv[5], NULL, 10));
+            if (errno == ERANGE)
+                error("Incorrect Input : delta must be below 2^64");
+        }
+        else if (argc > 5)
+        {
+            p = kv_proto_put_u32(p, strlen(argv[5]));
+            p = kv_proto_put_bytes(p, argv[5], strlen(argv[5]));
+        }
+        /* --cas carries the version before the optional ttl*/
+        i = 6;
+        if (opcode == KV_OP_CAS)
+        {
+            p = kv_proto_put_u64(p, strtoull(argv[i++], NULL, 10));
+        }
+        if (argc > i && opcode != KV_OP_INCR && opcode != KV_OP_DECR)
+        {
+            p = kv_proto_put_u32(p, strtoul(argv[i], NULL, 10));
+        }
+
+        printf("\nMessage sent to Server:%s %s%s%s (binary)\n", argv[3], argv[4],
+               argc > 5 ? " " : "", argc > 5 ? argv[5] : "");
+
+        num_bytes = request_reply(sockfd, servaddr, buffer, p - (unsigned char *)buffer,
+                                  buffer, MAXLINE);
+        if (num_bytes < 0)
+        {
+            perror("Receiving reply");
+            status = FAILURE;
+        }
+        else if ((opcode == KV_OP_GET || opcode == KV_OP_GETS) && num_bytes >= KV_PROTO_HDR_LEN &&
+            buffer[3] == KV_ST_NOSPACE)
+        {
+            /* value bigger than a datagram, read it in ranges*/
+            next_req_id++;
+            status = get_chunked(sockfd, servaddr, opcode, argv[4]);
+        }
+        else
+        {
+            status = print_binary_reply((unsigned char *)buffer, num_bytes, next_req_id);
+        }
+
+        return status;
+    }
+
+    /* message to be sent, arguments joined by one space*/
+    msg_len = 0;
+    for (i = 3; i < argc; i++)
+    {
+        msg_len += strlen(argv[i]) + 1;
+    }
+    if (msg_len + KV_PROTO_TEXT_ID_MAX > MAXLINE)
+    {
+        error("Incorrect Input : command too long for one datagram, use --binary --put");
+    }
     memset(&buffer, 0, sizeof(buffer)); 
     strcat(buffer,argv[3]);
-    strcat(buffer," ");
-    strcat(buffer,argv[4]);
+    if (argc > 4)
+    {
+        strcat(buffer," ");
+        strcat(buffer,argv[4]);
+    }
 
     /* Only in case of --set*/
     if (argc > 5)
@@ -175,86 +575,1234 @@ int main(int argc, char **argv)
         strcat(buffer," ");
         strcat(buffer,argv[5]);
     }    
+    if (argc > 6)
+    {
+        strcat(buffer," ");
+        strcat(buffer,argv[6]);
+    }
+    if (argc > 7)
+    {
+        strcat(buffer," ");
+        strcat(buffer,argv[7]);
+    }
     
     /* Send UDP message to Server*/
-    sendto(sockfd, (const char *)buffer, strlen(buffer), 
-        MSG_CONFIRM, (const struct sockaddr *) &servaddr, 
-            sizeof(servaddr)); 
     printf("\nMessage sent to Server:%s\n",buffer); 
     
     /* Receive a response from Server */
-    memset(&buffer, 0, sizeof(buffer));    
-    num_bytes = recvfrom(sockfd, (char *)buffer, MAXLINE, 
-                MSG_WAITALL, (struct sockaddr *) &servaddr, 
-                &len); 
-    buffer[num_bytes] = '\0'; 
-    
-    printf("Server response: %s\n", buffer); 
-    free(ip_addr);
-    free(port_num);
-    close(sockfd);
-    return 0;
-} 
+    num_bytes = request_reply(sockfd, servaddr, buffer, strlen(buffer), reply, MAXREPLY);
+    if (num_bytes < 0)
+    {
+        perror("Receiving reply");
+        status = FAILURE;
+    }
+    else
+    {
+        reply[num_bytes] = '\0'; 
+        printf("Server response: %s\n", reply); 
+    }
+    return status;
+}
 
-/* Function: validate_ip_addr() - To validate IP addr 
+/* Function: error() - To print error message 
  * in parameters: 
- *   ip_addr_in - IP addr to be validated
+ *   msg - message to be printed
  *
  * return:
- *   status of validation
+ *   void
  */
+void error(char *msg) 
+{
+  printf("\nERROR:%s\n",msg);
+  exit(EXIT_FAILURE);
+}
 
-int validate_ip_addr(char *ip_addr_in)
+/* Function: request_reply() - To send a command and wait for its reply
+ * in parameters:
+ *   sockfd - UDP socket, or TCP socket connected with --tcp
+ *   servaddr - Server address
+ *   req - command, a binary one carries its request id; may be the
+ *         same buffer as reply
+ *   req_len - length of req
+ *   reply - buffer for the reply
+ *   size - size of reply
+ *
+ * return:
+ *   reply length, -1 on error or with errno ETIMEDOUT when no reply came
+ */
+int request_reply(int sockfd, struct sockaddr_in *servaddr, const void *req, int req_len,
+                  void *reply, int size)
 {
-    char *split_str;
-    int count = 0;
-    int temp_ip=0;
-    int status = 0;
-    char *ip_addr;
+    struct exchange x = { sockfd, servaddr, req, req_len, reply, size, -1 };
 
-    ip_addr = (char*)malloc(strlen(ip_addr_in)+1);
-    strncpy(ip_addr,ip_addr_in,strlen(ip_addr_in)+1);
+    request_replies(&x, 1);
+    return x.reply_len;
+}
 
-   /*Separating ipaddr based on <num>.<num>.<num>.<num> format*/      
-    split_str = strtok(ip_addr,".");
+/* Function: request_replies() - To send commands to several Servers together
+ *   and wait for all their replies
+ *   Over UDP a command is resent under the same request id when no
+ *   reply comes within reply_timeout_ms, the wait doubling each time
+ *   (kv_backoff_ms()), and replies to earlier commands are skipped. A
+ *   text command gets a "#<id> " prefix, taken off the reply again.
+ *   Each command goes out on its own socket, one per Server.
+ * in parameters:
+ *   x - commands, reply_len set in each; a req may be the same buffer
+ *       as its reply
+ *   num - number of commands, at most KV_RING_MAX_NODES
+ *
+ * return:
+ *   SUCCESS when every command got its reply, FAILURE otherwise
+ */
+int request_replies(struct exchange *x, int num)
+{
+    static char (*sent)[MAXLINE + KV_PROTO_TEXT_ID_MAX];
+    static int sent_num;
+    struct pollfd pfd[KV_RING_MAX_NODES];
+    int which[KV_RING_MAX_NODES];
+    uint32_t req_id[KV_RING_MAX_NODES];
+    int sent_len[KV_RING_MAX_NODES];
+    int id_len[KV_RING_MAX_NODES];
+    int done[KV_RING_MAX_NODES];
+    unsigned char *r;
+    uint64_t deadline;
+    uint64_t now;
+    int waiting = 0;
+    int attempt;
+    int num_bytes;
+    int nfds;
+    int i;
+    int k;
 
-    while (split_str != NULL)
+    if (tcp_mode)
     {
-        status = FAILURE;
+        /* all sent before any reply is read, the Servers work meanwhile*/
+        for (i = 0; i < num; i++)
+            x[i].reply_len = send_sealed(x[i].sockfd, x[i].servaddr, x[i].req, x[i].req_len);
+        for (i = 0; i < num; i++)
+        {
+            if (x[i].reply_len == SUCCESS)
+                x[i].reply_len = recv_sealed(x[i].sockfd, x[i].reply, x[i].size);
+            if (x[i].reply_len < 0)
+                waiting++;
+        }
+        return waiting == 0 ? SUCCESS : FAILURE;
+    }
 
-        /* Only 3 dots in IP addr*/
-        if(count > 3)
+    if (num > sent_num)
+    {
+        free(sent);
+        sent = malloc(num * sizeof(*sent));
+        sent_num = (NULL == sent) ? 0 : num;
+        if (NULL == sent)
+            error("Request buffer allocation failed");
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        x[i].reply_len = -1;
+        id_len[i] = 0;
+        done[i] = 1;
+        if (*(const unsigned char *)x[i].req == KV_PROTO_MAGIC)
+        {
+            memcpy(sent[i], x[i].req, x[i].req_len);
+            sent_len[i] = x[i].req_len;
+            req_id[i] = (uint32_t)((unsigned char)sent[i][4] << 24 | (unsigned char)sent[i][5] << 16 |
+                                   (unsigned char)sent[i][6] << 8 | (unsigned char)sent[i][7]);
+        }
+        else
+        {
+            req_id[i] = next_req_id++;
+            id_len[i] = sprintf(sent[i], "#%u ", req_id[i]);
+            if (id_len[i] + x[i].req_len > MAXLINE)
+            {
+                errno = EMSGSIZE;
+                continue;
+            }
+            memcpy(sent[i] + id_len[i], x[i].req, x[i].req_len);
+            sent_len[i] = id_len[i] + x[i].req_len;
+        }
+        done[i] = 0;
+        waiting++;
+    }
+
+    for (attempt = 0; attempt <= reply_retries && waiting > 0; attempt++)
+    {
+        /* a resend is sealed again under a new counter, the Server
+           would drop a replayed one, and a new salt, the Server may
+           have turned the old one away*/
+        if (attempt > 0 && seal.on)
+            kv_seal_renew(&seal);
+        for (i = 0; i < num; i++)
+        {
+            if (!done[i])
+                send_sealed(x[i].sockfd, x[i].servaddr, sent[i], sent_len[i]);
+        }
+        deadline = kv_now_ns() + (uint64_t)kv_backoff_ms(reply_timeout_ms, attempt) * 1000000ULL;
+        while (waiting > 0 && (now = kv_now_ns()) < deadline)
+        {
+            nfds = 0;
+            for (i = 0; i < num; i++)
+            {
+                if (done[i])
+                    continue;
+                pfd[nfds].fd = x[i].sockfd;
+                pfd[nfds].events = POLLIN;
+                which[nfds++] = i;
+            }
+            if (poll(pfd, nfds, (int)((deadline - now + 999999) / 1000000)) <= 0)
+                continue;
+
+            for (k = 0; k < nfds; k++)
+            {
+                if (!(pfd[k].revents & (POLLIN | POLLERR)))
+                    continue;
+                i = which[k];
+                r = x[i].reply;
+                num_bytes = recv_sealed(x[i].sockfd, x[i].reply, x[i].size);
+                if (num_bytes < 0 && errno == EBADMSG)
+                    continue;
+                if (num_bytes < 0)
+                {
+                    done[i] = 1;
+                    waiting--;
+                    continue;
+                }
+                if (id_len[i] == 0 && num_bytes >= KV_PROTO_HDR_LEN && r[0] == KV_PROTO_MAGIC &&
+                    (uint32_t)(r[4] << 24 | r[5] << 16 | r[6] << 8 | r[7]) == req_id[i])
+                {
+                    x[i].reply_len = num_bytes;
+                }
+                else if (id_len[i] > 0 && num_bytes >= id_len[i] &&
+                         memcmp(x[i].reply, sent[i], id_len[i])==0)
+                {
+                    memmove(x[i].reply, r + id_len[i], num_bytes - id_len[i]);
+                    x[i].reply_len = num_bytes - id_len[i];
+                }
+                else
+                {
+                    /* late reply of an earlier command*/
+                    continue;
+                }
+                done[i] = 1;
+                waiting--;
+            }
+        }
+    }
+
+    if (waiting > 0)
+        errno = ETIMEDOUT;
+    for (i = 0; i < num; i++)
+    {
+        if (x[i].reply_len < 0)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* Function: send_sealed() - To send one command, sealed under --psk
+ * in parameters:
+ *   sockfd - UDP socket or connected TCP socket
+ *   servaddr - Server address
+ *   req - command
+ *   req_len - length of req, at most MAXLINE
+ *
+ * return:
+ *   status of the operation
+ */
+int send_sealed(int sockfd, struct sockaddr_in *servaddr, const void *req, int req_len)
+{
+    static unsigned char sealed[KV_PROTO_MAX_DATAGRAM];
+
+    if (seal.on)
+    {
+        req_len = kv_seal(&seal, req, req_len, sealed);
+        req = sealed;
+    }
+    if (tcp_mode)
+        return kv_send_frame(sockfd, req, req_len);
+    if (sendto(sockfd, req, req_len, MSG_CONFIRM, (const struct sockaddr *)servaddr,
+               sizeof(*servaddr)) < 0)
+        return FAILURE;
+    return SUCCESS;
+}
+
+/* Function: recv_sealed() - To receive one reply, opened under --psk
+ * in parameters:
+ *   sockfd - UDP socket or connected TCP socket
+ *   reply - buffer for the reply
+ *   size - size of reply
+ *
+ * return:
+ *   length of the reply, -1 on error; errno is EBADMSG when the reply
+ *   is not an authentic reply of the session
+ */
+int recv_sealed(int sockfd, void *reply, int size)
+{
+    static unsigned char sealed[KV_PROTO_MAX_DATAGRAM];
+    int num_bytes;
+
+    if (!seal.on)
+        return tcp_mode ? kv_recv_frame(sockfd, reply, size) : recvfrom(sockfd, reply, size, 0, NULL, NULL);
+
+    if (tcp_mode)
+        num_bytes = kv_recv_frame(sockfd, sealed, sizeof(sealed));
+    else
+        num_bytes = recvfrom(sockfd, sealed, sizeof(sealed), 0, NULL, NULL);
+    if (num_bytes < 0)
+        return -1;
+    num_bytes = kv_unseal(&seal, sealed, num_bytes);
+    if (num_bytes < 0)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (num_bytes > size)
+        num_bytes = size;
+    memcpy(reply, sealed + KV_PROTO_SEAL_HDR, num_bytes);
+    return num_bytes;
+}
+
+/* Function: run_multi() - To send keys of a file as multi-key datagrams
+ *   Every key is packed in the datagram of its Server. When one of
+ *   them is full the datagrams of all Servers go out together.
+ * in parameters:
+ *   cmd - --mset, --mget or --mdel
+ *   path - file with one key (or "key value") per line, "-" for stdin
+ *
+ * return:
+ *   status of the operation
+ */
+int run_multi(char *cmd, char *path)
+{
+    FILE *in;
+    char line[2 * MAXCHAR + 4];
+    struct multi_batch *batches;
+    struct multi_batch *b;
+    char *key;
+    char *value;
+    char *save_ptr;
+    unsigned char *p;
+    int entry_len;
+    int is_set = (strncmp(cmd,"--mset",6)==0);
+    int status = SUCCESS;
+    int i;
+    /* binary: header + u16 count, text: "--mxxx"*/
+    int start_len = binary_mode ? KV_PROTO_HDR_LEN + 2 : 6;
+
+    in = (strcmp(path,"-")==0) ? stdin : fopen(path, "r");
+    if (NULL == in)
+    {
+        perror("Opening key file");
+        return FAILURE;
+    }
+
+    batches = calloc(ring.num_nodes, sizeof(struct multi_batch));
+    if (NULL == batches)
+    {
+        error("Key buffer allocation failed");
+    }
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        b = &batches[i];
+        b->keys = malloc(MAXKEYS * sizeof(*b->keys));
+        b->reply = malloc(MAXREPLY + 1);
+        if (NULL == b->keys || NULL == b->reply)
+        {
+            error("Key buffer allocation failed");
+        }
+        b->buf_len = start_len;
+        if (binary_mode)
+            kv_proto_put_header((unsigned char *)b->buffer, binary_opcode(cmd), 0, 0);
+        else
+            memcpy(b->buffer, cmd, 6);
+    }
+
+    printf("\n");
+    while (status == SUCCESS && fgets(line, sizeof(line), in) != NULL)
+    {
+        key = strtok_r(line, " \t\r\n", &save_ptr);
+        if (NULL == key)
+            continue;
+        value = is_set ? strtok_r(NULL, " \t\r\n", &save_ptr) : NULL;
+
+        if (strlen(key) > MAXCHAR || (value != NULL && strlen(value) > MAXCHAR))
+        {
+            printf("%.40s: skipped, key or value length >256\n", key);
+            continue;
+        }
+        if (is_set && NULL == value)
+        {
+            printf("%s: skipped, value expected\n", key);
+            continue;
+        }
+        b = &batches[kv_ring_node(&ring, key, strlen(key))];
+
+        /* flush when the next key does not fit in the datagram*/
+        if (binary_mode)
+            entry_len = 2 + strlen(key) + (value ? 4 + strlen(value) : 0);
+        else
+            entry_len = 1 + strlen(key) + (value ? 1 + strlen(value) : 0);
+        /* a text datagram keeps room for its "#<id> " prefix*/
+        if (b->buf_len + entry_len >= MAXLINE - (binary_mode ? 0 : KV_PROTO_TEXT_ID_MAX) ||
+            b->num_keys == MAXKEYS)
+        {
+            status = send_multi(batches);
+        }
+
+        if (binary_mode)
+        {
+            p = kv_proto_put_u16((unsigned char *)b->buffer + b->buf_len, strlen(key));
+            p = kv_proto_put_bytes(p, key, strlen(key));
+            if (value != NULL)
+            {
+                p = kv_proto_put_u32(p, strlen(value));
+                p = kv_proto_put_bytes(p, value, strlen(value));
+            }
+            b->buf_len = p - (unsigned char *)b->buffer;
+        }
+        else
+        {
+            b->buf_len += sprintf(b->buffer + b->buf_len, " %s", key);
+            if (value != NULL)
+                b->buf_len += sprintf(b->buffer + b->buf_len, " %s", value);
+        }
+        strcpy(b->keys[b->num_keys++], key);
+    }
+
+    if (status == SUCCESS)
+        status = send_multi(batches);
+
+    if (in != stdin)
+        fclose(in);
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        free(batches[i].keys);
+        free(batches[i].reply);
+    }
+    free(batches);
+    return status;
+}
+
+/* Function: send_multi() - To send the packed datagrams of all Servers
+ *   and print the replies
+ *   The datagrams are in flight together, a Server's keys are printed
+ *   in the order of its datagram. The batches are emptied.
+ * in parameters:
+ *   batches - one per Server, binary headers filled in here
+ *
+ * return:
+ *   status of the operation
+ */
+int send_multi(struct multi_batch *batches)
+{
+    struct exchange x[KV_RING_MAX_NODES];
+    struct multi_batch *b;
+    int start_len = binary_mode ? KV_PROTO_HDR_LEN + 2 : 6;
+    int status = SUCCESS;
+    int num = 0;
+    int i;
+
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        b = &batches[i];
+        if (b->num_keys == 0)
+            continue;
+        if (binary_mode)
+        {
+            /* header written by run_multi(), request id and count go here*/
+            b->req_id = next_req_id++;
+            kv_proto_put_u16(kv_proto_put_u32((unsigned char *)b->buffer + 4, b->req_id),
+                             b->num_keys);
+        }
+        else
+        {
+            b->buffer[b->buf_len] = '\0';
+        }
+        x[num].sockfd = node_fds[i];
+        x[num].servaddr = &ring.nodes[i].addr;
+        x[num].req = b->buffer;
+        x[num].req_len = b->buf_len;
+        x[num].reply = b->reply;
+        x[num].size = MAXREPLY;
+        num++;
+    }
+    if (num == 0)
+        return SUCCESS;
+
+    request_replies(x, num);
+
+    num = 0;
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        b = &batches[i];
+        if (b->num_keys == 0)
+            continue;
+        if (x[num].reply_len < 0)
+        {
+            perror("Receiving reply");
+            status = FAILURE;
+        }
+        else if (print_multi(b, x[num].reply_len) != SUCCESS)
+        {
+            status = FAILURE;
+        }
+        num++;
+        b->buf_len = start_len;
+        b->num_keys = 0;
+    }
+    return status;
+}
+
+/* Function: print_multi() - To print the per-key replies of one datagram
+ * in parameters:
+ *   b - batch that was sent, its reply in b->reply
+ *   num_bytes - length of the reply
+ *
+ * return:
+ *   status of the operation
+ */
+int print_multi(struct multi_batch *b, int num_bytes)
+{
+    struct kv_proto_cursor c;
+    char *reply = b->reply;
+    char *line;
+    char *save_ptr;
+    const char *value;
+    uint32_t value_len;
+    int status;
+    int i;
+
+    reply[num_bytes] = '\0';
+
+    if (binary_mode)
+    {
+        /* header, u16 count, then status [+ u32 length + value] per key*/
+        kv_proto_cursor_init(&c, reply, num_bytes);
+        kv_proto_get_bytes(&c, 3);
+        status = kv_proto_get_u8(&c);
+        if (kv_proto_get_u32(&c) != b->req_id || status != KV_ST_SUCCESS)
+        {
+            printf("Server response: %s\n", kv_proto_status_str(status));
+            return FAILURE;
+        }
+        kv_proto_get_u16(&c);
+        for (i = 0; i < b->num_keys; i++)
+        {
+            status = kv_proto_get_u8(&c);
+            if (c.error)
+            {
+                printf("%s: NOREPLY\n", b->keys[i]);
+                continue;
+            }
+            if (status == KV_ST_SUCCESS && b->buffer[2] == KV_OP_MGET)
+            {
+                value_len = kv_proto_get_u32(&c);
+                value = kv_proto_get_bytes(&c, value_len);
+                printf("%s: SUCCESS %.*s\n", b->keys[i], value ? (int)value_len : 0, value ? value : "");
+            }
+            else
+            {
+                printf("%s: %s\n", b->keys[i], kv_proto_status_str(status));
+            }
+        }
+        return SUCCESS;
+    }
+
+    /* one reply line per key, same order as the request*/
+    line = strtok_r(reply, "\n", &save_ptr);
+    for (i = 0; i < b->num_keys; i++)
+    {
+        printf("%s: %s\n", b->keys[i], line ? line : "NOREPLY");
+        if (line != NULL)
+            line = strtok_r(NULL, "\n", &save_ptr);
+    }
+    return SUCCESS;
+}
+
+/* Function: binary_opcode() - To map a command to its binary opcode
+ * in parameters:
+ *   cmd - --set, --get, --del, --fin, --mset, --mget or --mdel
+ *
+ * return:
+ *   KV_OP_* opcode
+ */
+int binary_opcode(char *cmd)
+{
+    if (strncmp(cmd,"--mset",6)==0) return KV_OP_MSET;
+    if (strncmp(cmd,"--mget",6)==0) return KV_OP_MGET;
+    if (strncmp(cmd,"--mdel",6)==0) return KV_OP_MDEL;
+    if (strcmp(cmd,"--put")==0)     return KV_OP_PUT;
+    if (strcmp(cmd,"--cas")==0)     return KV_OP_CAS;
+    if (strcmp(cmd,"--incr")==0)    return KV_OP_INCR;
+    if (strcmp(cmd,"--decr")==0)    return KV_OP_DECR;
+    if (strcmp(cmd,"--append")==0)  return KV_OP_APPEND;
+    if (strncmp(cmd,"--gets",6)==0) return KV_OP_GETS;
+    if (strncmp(cmd,"--set",5)==0)  return KV_OP_SET;
+    if (strncmp(cmd,"--get",5)==0)  return KV_OP_GET;
+    if (strncmp(cmd,"--del",5)==0)  return KV_OP_DEL;
+    return KV_OP_FIN;
+}
+
+/* Function: print_binary_reply() - To decode and print a binary reply
+ * in parameters:
+ *   reply - received datagram
+ *   num_bytes - datagram length
+ *   req_id - request id the reply must carry
+ *
+ * return:
+ *   status of the operation
+ */
+int print_binary_reply(unsigned char *reply, int num_bytes, uint32_t req_id)
+{
+    struct kv_proto_cursor c;
+    const char *value;
+    uint32_t value_len;
+    uint64_t number;
+    int opcode;
+    int status;
+
+    if (num_bytes < KV_PROTO_HDR_LEN || reply[0] != KV_PROTO_MAGIC)
+    {
+        printf("Server response: malformed reply\n");
+        return FAILURE;
+    }
+
+    kv_proto_cursor_init(&c, reply, num_bytes);
+    kv_proto_get_bytes(&c, 2);
+    opcode = kv_proto_get_u8(&c);
+    status = kv_proto_get_u8(&c);
+    if (kv_proto_get_u32(&c) != req_id)
+    {
+        printf("Server response: request id mismatch\n");
+        return FAILURE;
+    }
+
+    if ((opcode == KV_OP_GET || opcode == KV_OP_GETS) && status == KV_ST_SUCCESS)
+    {
+        value_len = kv_proto_get_u32(&c);
+        value = kv_proto_get_bytes(&c, value_len);
+        number = (opcode == KV_OP_GETS) ? kv_proto_get_u64(&c) : 0;
+        if (NULL == value || c.error)
+        {
+            printf("Server response: malformed reply\n");
+            return FAILURE;
+        }
+        if (opcode == KV_OP_GETS)
+            printf("Server response: %.*s %llu\n", (int)value_len, value, (unsigned long long)number);
+        else
+            printf("Server response: %.*s\n", (int)value_len, value);
+    }
+    else if (opcode >= KV_OP_PUT && opcode <= KV_OP_APPEND && status == KV_ST_SUCCESS)
+    {
+        /* new version, or the new value of --incr/--decr*/
+        number = kv_proto_get_u64(&c);
+        if (c.error)
+        {
+            printf("Server response: malformed reply\n");
+            return FAILURE;
+        }
+        printf("Server response: SUCCESS %llu\n", (unsigned long long)number);
+    }
+    else if (opcode == KV_OP_FIN && status == KV_ST_SUCCESS)
+    {
+        printf("Server response: FIN\n");
+    }
+    else
+    {
+        printf("Server response: %s\n", kv_proto_status_str(status));
+    }
+    return SUCCESS;
+}
+
+/* Function: read_value_file() - To read a value given by --value-file
+ * in parameters:
+ *   path - file holding the value, "-" for stdin
+ *
+ * return:
+ *   NUL terminated file content, exits on failure
+ */
+char *read_value_file(const char *path)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *value = malloc(MAXVALUE + 2);
+    size_t len;
+
+    if (NULL == fp || NULL == value)
+    {
+        error("Incorrect Input : --value-file cannot be read");
+    }
+    len = fread(value, 1, MAXVALUE + 1, fp);
+    if (fp != stdin)
+        fclose(fp);
+    if (len > MAXVALUE)
+    {
+        error("Incorrect Input : value length >1024000");
+    }
+    if (memchr(value, '\0', len) != NULL)
+    {
+        error("Incorrect Input : value holds a NUL byte");
+    }
+    value[len] = '\0';
+    return value;
+}
+
+/* Function: chunk_exchange() - To send one chunk request, wait for its reply
+ * in parameters:
+ *   sockfd - socket
+ *   servaddr - Server address
+ *   req - request datagram, request id next_req_id
+ *   req_len - length of req
+ *   reply - buffer of MAXREPLY bytes
+ *   c - set to a cursor on the reply body
+ *
+ * return:
+ *   KV_ST_* status of the reply, FAILURE when the socket fails
+ */
+static int chunk_exchange(int sockfd, struct sockaddr_in *servaddr, unsigned char *req,
+                          int req_len, unsigned char *reply, struct kv_proto_cursor *c)
+{
+    int num_bytes;
+
+    /* late replies of earlier chunks are skipped by request_reply()*/
+    num_bytes = request_reply(sockfd, servaddr, req, req_len, reply, MAXREPLY);
+    if (num_bytes < KV_PROTO_HDR_LEN)
+        return FAILURE;
+
+    next_req_id++;
+    kv_proto_cursor_init(c, reply + KV_PROTO_HDR_LEN, num_bytes - KV_PROTO_HDR_LEN);
+    return reply[3];
+}
+
+/* Function: put_chunked() - To store a value bigger than one datagram
+ *   PUTCHUNKs of KV_PROTO_CHUNK bytes go out one at a time, each
+ *   waiting for its acknowledgement; the request id of the first one
+ *   names the upload.
+ * in parameters:
+ *   sockfd - socket
+ *   servaddr - Server address
+ *   key - key to be set
+ *   value - value bytes
+ *   value_len - length of value
+ *   ttl - seconds until the key expires, 0 = never
+ *
+ * return:
+ *   status of the operation
+ */
+int put_chunked(int sockfd, struct sockaddr_in *servaddr, const char *key, const char *value,
+                uint32_t value_len, uint32_t ttl)
+{
+    unsigned char *buffer = malloc(MAXREPLY);
+    struct kv_proto_cursor c;
+    unsigned char *p;
+    uint32_t upload_id = next_req_id;
+    uint32_t offset = 0;
+    uint32_t len;
+    int status = KV_ST_FAIL;
+
+    if (NULL == buffer)
+        return FAILURE;
+
+    printf("\nMessage sent to Server:--put %s <%u bytes in chunks> (binary)\n", key, value_len);
+    do
+    {
+        len = value_len - offset < KV_PROTO_CHUNK ? value_len - offset : KV_PROTO_CHUNK;
+        p = kv_proto_put_header(buffer, KV_OP_PUTCHUNK, 0, next_req_id);
+        p = kv_proto_put_u32(p, upload_id);
+        p = kv_proto_put_u16(p, strlen(key));
+        p = kv_proto_put_bytes(p, key, strlen(key));
+        p = kv_proto_put_u32(p, value_len);
+        p = kv_proto_put_u32(p, offset);
+        p = kv_proto_put_u32(p, len);
+        p = kv_proto_put_bytes(p, value + offset, len);
+        if (ttl != 0)
+            p = kv_proto_put_u32(p, ttl);
+
+        status = chunk_exchange(sockfd, servaddr, buffer, p - buffer, buffer, &c);
+        if (status != KV_ST_SUCCESS)
+            break;
+        offset = kv_proto_get_u32(&c);
+    } while (offset < value_len && !c.error);
+
+    if (status == KV_ST_SUCCESS && offset == value_len)
+        printf("Server response: SUCCESS %llu\n", (unsigned long long)kv_proto_get_u64(&c));
+    else
+        printf("Server response: %s\n", status == FAILURE ? "FAIL" : kv_proto_status_str(status));
+    free(buffer);
+    return status == FAILURE ? FAILURE : SUCCESS;
+}
+
+/* Function: get_chunked() - To read a value bigger than one datagram
+ *   The value is read in GETRANGEs and read again from the start
+ *   when its version changes in between.
+ * in parameters:
+ *   sockfd - socket
+ *   servaddr - Server address
+ *   opcode - KV_OP_GET or KV_OP_GETS, the latter prints the version
+ *   key - key to be read
+ *
+ * return:
+ *   status of the operation
+ */
+int get_chunked(int sockfd, struct sockaddr_in *servaddr, int opcode, const char *key)
+{
+    unsigned char *buffer = malloc(MAXREPLY);
+    struct kv_proto_cursor c;
+    unsigned char *p;
+    char *value = NULL;
+    const char *range;
+    uint64_t version = 0;
+    uint64_t range_version;
+    uint32_t value_len = 0;
+    uint32_t total;
+    uint32_t offset = 0;
+    uint32_t len;
+    int tries = 0;
+    int status = KV_ST_FAIL;
+
+    while (buffer != NULL && tries < CHUNK_READ_TRIES)
+    {
+        p = kv_proto_put_header(buffer, KV_OP_GETRANGE, 0, next_req_id);
+        p = kv_proto_put_u16(p, strlen(key));
+        p = kv_proto_put_bytes(p, key, strlen(key));
+        p = kv_proto_put_u32(p, offset);
+        p = kv_proto_put_u32(p, KV_PROTO_CHUNK);
+
+        status = chunk_exchange(sockfd, servaddr, buffer, p - buffer, buffer, &c);
+        if (status != KV_ST_SUCCESS)
             break;
+        range_version = kv_proto_get_u64(&c);
+        total = kv_proto_get_u32(&c);
+        len = kv_proto_get_u32(&c);
+        range = kv_proto_get_bytes(&c, len);
+        if (NULL == range || offset + len > total)
+        {
+            status = KV_ST_FAIL;
+            break;
+        }
+
+        /* first range, or the value changed: start over*/
+        if (offset == 0 || range_version != version || total != value_len)
+        {
+            if (offset != 0)
+            {
+                tries++;
+                offset = 0;
+                continue;
+            }
+            free(value);
+            value = malloc(total + 1);
+            if (NULL == value)
+                break;
+            version = range_version;
+            value_len = total;
+        }
+        memcpy(value + offset, range, len);
+        offset += len;
+        if (offset == value_len)
+            break;
+    }
+
+    if (status == KV_ST_SUCCESS && value != NULL && offset == value_len)
+    {
+        if (opcode == KV_OP_GETS)
+            printf("Server response: %.*s %llu\n", (int)value_len, value, (unsigned long long)version);
+        else
+            printf("Server response: %.*s\n", (int)value_len, value);
+    }
+    else
+    {
+        printf("Server response: %s\n", status == KV_ST_SUCCESS ? "FAIL" :
+               status == FAILURE ? "FAIL" : kv_proto_status_str(status));
+    }
+    free(value);
+    free(buffer);
+    return status == FAILURE ? FAILURE : SUCCESS;
+}
 
-        temp_ip = atoi(split_str);
+/* Function: run_scan() - To list the keys of a --scan or --prefix range
+ *   Pages are asked for one after the other, each one resuming after
+ *   the last key of the page before, until the Server reports the end.
+ * in parameters:
+ *   sockfd - socket
+ *   servaddr - Server address
+ *   cmd - --scan or --prefix
+ *   first - from key of --scan, prefix of --prefix
+ *   to - end key of --scan, NULL for --prefix
+ *   count - keys per page
+ *   out - keys are added here instead of printed, NULL to print them
+ *
+ * return:
+ *   status of the operation
+ */
+int run_scan(int sockfd, struct sockaddr_in *servaddr, char *cmd, char *first, char *to,
+             int count, struct scan_keys *out)
+{
+    unsigned char *buffer = malloc(MAXREPLY + 1);
+    struct kv_proto_cursor c;
+    unsigned char *p;
+    char after[MAXCHAR + 1] = "";
+    char *line;
+    char *next;
+    char *save_ptr;
+    const char *key;
+    const char *from;
+    int is_scan = (strcmp(cmd,"--scan")==0);
+    int have_after = 0;
+    int more = 1;
+    int num_bytes;
+    int key_len;
+    int status = SUCCESS;
+    int n;
+    int i;
+    long total = 0;
+
+    if (NULL == buffer)
+    {
+        error("Reply buffer allocation failed");
+    }
 
-        if(temp_ip>=0 && temp_ip < 256)
+    printf("\n");
+    while (more && status == SUCCESS)
+    {
+        if (binary_mode)
         {
-            status = SUCCESS;
+            /* SCAN resumes from the cursor, PREFIX sends it after the prefix*/
+            from = (is_scan && have_after) ? after : first;
+            p = kv_proto_put_header(buffer, is_scan ? KV_OP_SCAN : KV_OP_PREFIX, 0, next_req_id);
+            /* an empty end key leaves the range open*/
+            *p++ = (have_after ? KV_SCAN_AFTER : 0) | (is_scan && to[0] == '\0' ? KV_SCAN_OPEN : 0);
+            p = kv_proto_put_u16(p, count);
+            p = kv_proto_put_u16(p, strlen(from));
+            p = kv_proto_put_bytes(p, from, strlen(from));
+            from = is_scan ? to : after;
+            p = kv_proto_put_u16(p, strlen(from));
+            p = kv_proto_put_bytes(p, from, strlen(from));
+
+            n = chunk_exchange(sockfd, servaddr, buffer, p - buffer, buffer, &c);
+            if (n != KV_ST_SUCCESS)
+            {
+                printf("Server response: %s\n", n == FAILURE ? "FAIL" : kv_proto_status_str(n));
+                status = FAILURE;
+                break;
+            }
+            more = kv_proto_get_u8(&c);
+            n = kv_proto_get_u16(&c);
+            for (i = 0; i < n; i++)
+            {
+                key_len = kv_proto_get_u16(&c);
+                key = kv_proto_get_bytes(&c, key_len);
+                if (NULL == key || key_len > MAXCHAR)
+                    break;
+                if (NULL == out)
+                    printf("%.*s\n", key_len, key);
+                memcpy(after, key, key_len);
+                after[key_len] = '\0';
+                have_after = 1;
+                if (out != NULL)
+                    scan_add(out, after);
+                total++;
+            }
+            /* a page with no key would ask for the same page again*/
+            if (i < n || c.error || (more && n == 0))
+            {
+                printf("Server response: malformed reply\n");
+                status = FAILURE;
+            }
+            continue;
         }
 
-        split_str = strtok (NULL, ".");
-        count++;
- 
+        num_bytes = sprintf((char *)buffer, "%s %s%s%s %d%s%s", cmd, first, to ? " " : "",
+                            to ? to : "", count, have_after ? " " : "", have_after ? after : "");
+        num_bytes = request_reply(sockfd, servaddr, buffer, num_bytes, buffer, MAXREPLY);
+        if (num_bytes < 0)
+        {
+            perror("Receiving reply");
+            status = FAILURE;
+            break;
+        }
+        buffer[num_bytes] = '\0';
+
+        /* one key per line, the last line is END or MORE*/
+        n = 0;
+        line = strtok_r((char *)buffer, "\n", &save_ptr);
+        while (line != NULL)
+        {
+            next = strtok_r(NULL, "\n", &save_ptr);
+            if (NULL == next)
+                break;
+            if (NULL == out)
+                printf("%s\n", line);
+            if (strlen(line) <= MAXCHAR)
+            {
+                strcpy(after, line);
+                have_after = 1;
+                if (out != NULL)
+                    scan_add(out, after);
+            }
+            total++;
+            n++;
+            line = next;
+        }
+        if (NULL == line || (strcmp(line,"MORE")!=0 && strcmp(line,"END")!=0) ||
+            (strcmp(line,"MORE")==0 && n == 0))
+        {
+            printf("Server response: %s\n", line ? line : "NOREPLY");
+            status = FAILURE;
+            break;
+        }
+        more = (strcmp(line,"MORE")==0);
     }
 
-    if (count < 4)
-        status = FAILURE;
-    
-    free(ip_addr);
+    if (status == SUCCESS && NULL == out)
+        printf("Server response: %ld keys\n", total);
+    free(buffer);
     return status;
 }
 
+/* Function: scan_add() - To keep one key listed by a Server*/
+static void scan_add(struct scan_keys *out, const char *key)
+{
+    if (out->num == out->cap)
+    {
+        out->cap = out->cap ? out->cap * 2 : 1024;
+        out->keys = realloc(out->keys, out->cap * sizeof(*out->keys));
+        if (NULL == out->keys)
+            error("Key buffer allocation failed");
+    }
+    strcpy(out->keys[out->num++], key);
+}
 
-/* Function: error() - To print error message 
- * in parameters: 
- *   msg - message to be printed
+static int scan_cmp(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+/* Function: run_scan_all() - To list a --scan or --prefix range over all Servers
+ *   Each Server holds its own keys of the range; they are listed one
+ *   Server after the other and printed merged, in byte order.
+ * in parameters:
+ *   cmd - --scan or --prefix
+ *   first - from key of --scan, prefix of --prefix
+ *   to - end key of --scan, NULL for --prefix
+ *   count - keys per page
+ *
+ * return:
+ *   status of the operation
+ */
+int run_scan_all(char *cmd, char *first, char *to, int count)
+{
+    struct scan_keys keys = { NULL, 0, 0 };
+    int status = SUCCESS;
+    long k;
+    int i;
+
+    if (ring.num_nodes == 1)
+        return run_scan(node_fds[0], &ring.nodes[0].addr, cmd, first, to, count, NULL);
+
+    for (i = 0; i < ring.num_nodes && status == SUCCESS; i++)
+        status = run_scan(node_fds[i], &ring.nodes[i].addr, cmd, first, to, count, &keys);
+
+    if (status == SUCCESS)
+    {
+        qsort(keys.keys, keys.num, sizeof(*keys.keys), scan_cmp);
+        for (k = 0; k < keys.num; k++)
+            printf("%s\n", keys.keys[k]);
+        printf("Server response: %ld keys\n", keys.num);
+    }
+    free(keys.keys);
+    return status;
+}
+
+/* Function: session_reply() - To print one completed session request
+ *   fin goes to every Server, its line names the one that answered.
+ * in parameters:
+ *   conn - session connection the request was sent on
+ *   reply - completed request
  *
  * return:
  *   void
  */
-void error(char *msg) 
+void session_reply(struct kv_conn *conn, const struct kv_reply *reply)
 {
-  printf("\nERROR:%s\n",msg);
-  exit(EXIT_FAILURE);
+    static const char *op_names[] = { "", "set", "get", "del", "fin" };
+
+    if (session_quiet)
+        return;
+
+    if (reply->opcode == KV_OP_GET && reply->status == KV_ST_SUCCESS)
+        printf("%s %.*s: %.*s\n", op_names[reply->opcode], reply->key_len, reply->key,
+               (int)reply->value_len, reply->value);
+    else if (reply->opcode == KV_OP_FIN)
+        printf("fin %s:%d: %s\n", inet_ntoa(conn->servaddr.sin_addr), ntohs(conn->servaddr.sin_port),
+               reply->status == KV_ST_SUCCESS ? "FIN" : kv_proto_status_str(reply->status));
+    else
+        printf("%s %.*s: %s\n", op_names[reply->opcode], reply->key_len, reply->key,
+               kv_proto_status_str(reply->status));
+}
+
+/* Function: run_session() - To run many commands over one connection per Server
+ *   A command goes to the connection of its key's Server, fin to all
+ *   of them; each connection has its own window.
+ * in parameters:
+ *   path - script file, "-" for stdin, NULL for interactive mode
+ *   argc - number of session options
+ *   argv - session options
+ *
+ * return:
+ *   status of the operation
+ */
+int run_session(char *path, int argc, char **argv)
+{
+    struct kv_conn *conns;
+    struct kv_conn *conn;
+    FILE *in;
+    char line[2 * MAXCHAR + 16];
+    char *cmd;
+    char *key;
+    char *value;
+    char *save_ptr;
+    int window = KV_CLIENT_DEFAULT_WINDOW;
+    int timeout_ms = reply_timeout_ms;
+    int retries = reply_retries;
+    int interactive = (NULL == path);
+    int opcode;
+    int i;
+    uint64_t start;
+    double secs;
+    unsigned long completed = 0;
+    unsigned long retransmits = 0;
+    unsigned long timeouts = 0;
+
+    for (i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i],"--quiet")==0)
+            session_quiet = 1;
+        else if (i + 1 < argc && strcmp(argv[i],"--window")==0)
+            window = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i],"--timeout")==0)
+            timeout_ms = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i],"--retries")==0)
+            retries = atoi(argv[++i]);
+        else
+            error("Incorrect Input : unknown session option");
+    }
+    if (window < 1 || timeout_ms < 1 || retries < 0)
+    {
+        error("Incorrect Input : --window and --timeout must be > 0");
+    }
+    /* a prompt needs the answer of the previous command*/
+    if (interactive)
+        window = 1;
+
+    in = (interactive || strcmp(path,"-")==0) ? stdin : fopen(path, "r");
+    if (NULL == in)
+    {
+        perror("Opening script");
+        return FAILURE;
+    }
+
+    conns = calloc(ring.num_nodes, sizeof(struct kv_conn));
+    if (NULL == conns)
+    {
+        error("Opening session");
+    }
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        if (kv_conn_open(&conns[i], ring.nodes[i].ip_addr, ring.nodes[i].portno, window,
+                         timeout_ms, retries, session_reply, tcp_mode) != SUCCESS)
+        {
+            error("Opening session");
+        }
+        if (seal.on && kv_conn_seal(&conns[i], psk) != SUCCESS)
+        {
+            error("Opening session");
+        }
+    }
+
+    printf("\n");
+    start = kv_now_ns();
+    while (1)
+    {
+        if (interactive && isatty(STDIN_FILENO))
+        {
+            printf("kv> ");
+            fflush(stdout);
+        }
+        if (fgets(line, sizeof(line), in) == NULL)
+            break;
+
+        /* value is the rest of the line, it may contain spaces*/
+        cmd = strtok_r(line, " \t\r\n", &save_ptr);
+        if (NULL == cmd || cmd[0] == '#')
+            continue;
+        key = strtok_r(NULL, " \t\r\n", &save_ptr);
+        value = strtok_r(NULL, "\r\n", &save_ptr);
+
+        while (*cmd == '-')
+            cmd++;
+        if (strcmp(cmd,"quit")==0 || strcmp(cmd,"exit")==0)
+            break;
+        else if (strcmp(cmd,"set")==0 && key != NULL && value != NULL)
+            opcode = KV_OP_SET;
+        else if (strcmp(cmd,"get")==0 && key != NULL)
+            opcode = KV_OP_GET;
+        else if (strcmp(cmd,"del")==0 && key != NULL)
+            opcode = KV_OP_DEL;
+        else if (strcmp(cmd,"fin")==0)
+            opcode = KV_OP_FIN;
+        else
+        {
+            printf("unknown command: %s\n", cmd);
+            continue;
+        }
+
+        if (key != NULL && strlen(key) > MAXCHAR)
+        {
+            printf("%.40s: key length >256\n", key);
+            continue;
+        }
+        if (value != NULL && strlen(value) > MAXCHAR)
+        {
+            printf("%s: value length >256\n", key);
+            continue;
+        }
+
+        if (opcode == KV_OP_FIN)
+        {
+            for (i = 0; i < ring.num_nodes; i++)
+            {
+                kv_conn_submit(&conns[i], opcode, NULL, 0, NULL, 0, 0);
+                if (interactive)
+                    kv_conn_drain(&conns[i]);
+            }
+            continue;
+        }
+        conn = &conns[kv_ring_node(&ring, key, strlen(key))];
+        kv_conn_submit(conn, opcode, key, strlen(key), value, value ? strlen(value) : 0, 0);
+        if (interactive)
+            kv_conn_drain(conn);
+    }
+    for (i = 0; i < ring.num_nodes; i++)
+    {
+        kv_conn_drain(&conns[i]);
+        completed += conns[i].completed;
+        retransmits += conns[i].retransmits;
+        timeouts += conns[i].timeouts;
+    }
+
+    secs = (kv_now_ns() - start) / 1e9;
+    if (!interactive)
+    {
+        printf("%lu ops in %.3f s (%.0f ops/s), %lu retransmits, %lu timeouts\n",
+               completed, secs, secs > 0 ? completed / secs : 0.0,
+               retransmits, timeouts);
+    }
+
+    if (in != stdin)
+        fclose(in);
+    for (i = 0; i < ring.num_nodes; i++)
+        kv_conn_close(&conns[i]);
+    free(conns);
+    return SUCCESS;
 }
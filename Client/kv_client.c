@@ -0,0 +1,715 @@
+/* kv_client.c
+ *
+ * Persistent, windowed client connection, see kv_client.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "kv_client.h"
+
+#define FAILURE -1
+#define SUCCESS 0
+
+/* Function: kv_now_ns() - To read the monotonic clock
+ * in parameters:
+ *   none
+ *
+ * return:
+ *   time in nanoseconds
+ */
+uint64_t kv_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function: kv_conn_open() - To create the socket and request slots
+ * in parameters:
+ *   conn - connection to be initialised
+ *   ip_addr - Server IP address
+ *   portno - Server port
+ *   window - max requests in flight
+ *   timeout_ms - retransmit timeout
+ *   retries - retransmits before KV_ST_TIMEOUT
+ *   on_reply - called once per completed request
+ *   tcp - connect to the Server's --tcp port instead
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_conn_open(struct kv_conn *conn, char *ip_addr, int portno, int window,
+                 int timeout_ms, int retries, kv_reply_cb on_reply, int tcp)
+{
+    unsigned int nslots = 1;
+    unsigned int i;
+    int one = 1;
+
+    memset(conn, 0, sizeof(*conn));
+    conn->window = window;
+    conn->timeout_ms = timeout_ms;
+    conn->max_retries = retries;
+    conn->on_reply = on_reply;
+    conn->tcp = tcp;
+
+    /* twice the window so a free slot is always found quickly*/
+    while (nslots < (unsigned int)window * 2)
+        nslots *= 2;
+    conn->slot_mask = nslots - 1;
+
+    conn->pending = calloc(nslots, sizeof(struct kv_pending));
+    conn->reply_buf = malloc(tcp ? KV_CLIENT_STREAM_BUF : KV_CLIENT_MAXREPLY + 1);
+    if (NULL == conn->pending || NULL == conn->reply_buf)
+        return FAILURE;
+    for (i = 0; i < nslots; i++)
+    {
+        conn->pending[i].req = malloc(KV_CLIENT_REQ_BUF);
+        if (NULL == conn->pending[i].req)
+            return FAILURE;
+        conn->pending[i].req_cap = KV_CLIENT_REQ_BUF;
+    }
+
+    if ((conn->sockfd = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0)
+        return FAILURE;
+    if (tcp)
+        setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->servaddr.sin_family = AF_INET;
+    conn->servaddr.sin_port = htons(portno);
+    conn->servaddr.sin_addr.s_addr = inet_addr(ip_addr);
+
+    /* connected UDP socket: kernel drops datagrams from other peers*/
+    if (connect(conn->sockfd, (struct sockaddr *)&conn->servaddr, sizeof(conn->servaddr)) < 0)
+        return FAILURE;
+
+    conn->next_req_id = (uint32_t)getpid() << 16 ^ (uint32_t)kv_now_ns();
+    return SUCCESS;
+}
+
+/* Function: kv_send_frame() - To send one request on a TCP connection
+ * in parameters:
+ *   sockfd - connected TCP socket
+ *   buf - request as it would go in a datagram
+ *   len - length of buf
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_send_frame(int sockfd, const void *buf, int len)
+{
+    unsigned char prefix[KV_PROTO_FRAME_LEN];
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t n;
+    size_t left = KV_PROTO_FRAME_LEN + len;
+
+    kv_proto_put_u32(prefix, len);
+    iov[0].iov_base = prefix;
+    iov[0].iov_len = KV_PROTO_FRAME_LEN;
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    while (left > 0)
+    {
+        n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FAILURE;
+        left -= n;
+        /* partial write: skip what went out*/
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len)
+        {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_recv_frame() - To wait for one reply on a TCP connection
+ * in parameters:
+ *   sockfd - connected TCP socket
+ *   buf - buffer for the reply
+ *   size - size of buf
+ *
+ * return:
+ *   reply length, -1 on error or a reply bigger than size
+ */
+int kv_recv_frame(int sockfd, void *buf, int size)
+{
+    unsigned char prefix[KV_PROTO_FRAME_LEN];
+    struct kv_proto_cursor c;
+    uint32_t len;
+
+    if (recv(sockfd, prefix, sizeof(prefix), MSG_WAITALL) != sizeof(prefix))
+        return -1;
+    kv_proto_cursor_init(&c, prefix, sizeof(prefix));
+    len = kv_proto_get_u32(&c);
+    if (len > (uint32_t)size)
+        return -1;
+    if (len > 0 && recv(sockfd, buf, len, MSG_WAITALL) != (ssize_t)len)
+        return -1;
+    return (int)len;
+}
+
+/* Function: kv_backoff_ms() - To double a timeout for every retransmit
+ * in parameters:
+ *   timeout_ms - wait for the first reply
+ *   retries - retransmits made so far
+ *
+ * return:
+ *   wait in ms, not doubled past KV_CLIENT_MAX_BACKOFF_MS
+ */
+int kv_backoff_ms(int timeout_ms, int retries)
+{
+    long wait = timeout_ms;
+
+    while (retries-- > 0 && wait * 2 <= KV_CLIENT_MAX_BACKOFF_MS)
+        wait *= 2;
+    return (int)wait;
+}
+
+/* Function: kv_seal_init() - To start a sealed session
+ * in parameters:
+ *   seal - session
+ *   psk - pre-shared key of the Server
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_seal_init(struct kv_seal *seal, const unsigned char psk[KV_CRYPTO_KEY])
+{
+    memset(seal, 0, sizeof(*seal));
+    memcpy(seal->psk, psk, KV_CRYPTO_KEY);
+    if (kv_seal_renew(seal) != SUCCESS)
+        return FAILURE;
+    seal->on = 1;
+    return SUCCESS;
+}
+
+/* Function: kv_seal_renew() - To start a new session under a new salt
+ *   The salt is dated (Common/kv_proto.h), counters start over. The
+ *   previous session is kept for the replies still on their way.
+ * in parameters:
+ *   seal - session, psk set
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_seal_renew(struct kv_seal *seal)
+{
+    struct timespec ts;
+
+    memcpy(seal->old_salt, seal->salt, KV_CRYPTO_SALT);
+    memcpy(seal->old_key, seal->key, KV_CRYPTO_KEY);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    kv_proto_put_u64(seal->salt, (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    if (getrandom(seal->salt + 8, KV_CRYPTO_SALT - 8, 0) != KV_CRYPTO_SALT - 8)
+        return FAILURE;
+    kv_crypto_derive(seal->key, seal->psk, seal->salt);
+    seal->counter = 0;
+    return SUCCESS;
+}
+
+/* Function: kv_seal() - To seal one request under the next counter
+ * in parameters:
+ *   seal - session
+ *   in - request datagram, at most KV_PROTO_MAX_PAYLOAD bytes
+ *   len - length of in
+ *   out - buffer of len + KV_PROTO_SEAL_OVERHEAD bytes
+ *
+ * return:
+ *   length of the sealed datagram
+ */
+int kv_seal(struct kv_seal *seal, const void *in, int len, unsigned char *out)
+{
+    struct kv_crypto_op op;
+    int i;
+
+    seal->counter++;
+    out[0] = KV_PROTO_SEALED;
+    memcpy(out + 1, seal->salt, KV_CRYPTO_SALT);
+    for (i = 0; i < 8; i++)
+        out[17 + i] = (unsigned char)(seal->counter >> (56 - 8 * i));
+    memcpy(out + KV_PROTO_SEAL_HDR, in, len);
+
+    op.key = seal->key;
+    memset(op.nonce, 0, 4);
+    memcpy(op.nonce + 4, out + 17, 8);
+    op.aad = out;
+    op.aad_len = KV_PROTO_SEAL_HDR;
+    op.data = out + KV_PROTO_SEAL_HDR;
+    op.len = len;
+    kv_crypto_seal_batch(&op, 1);
+    return len + KV_PROTO_SEAL_OVERHEAD;
+}
+
+/* Function: kv_open_reply() - To open a sealed reply under a session key*/
+static int kv_open_reply(const unsigned char *key, unsigned char *buf, int len)
+{
+    struct kv_crypto_op op;
+
+    op.key = key;
+    memset(op.nonce, 0, 4);
+    op.nonce[3] = 1;
+    memcpy(op.nonce + 4, buf + 17, 8);
+    op.aad = buf;
+    op.aad_len = KV_PROTO_SEAL_HDR;
+    op.data = buf + KV_PROTO_SEAL_HDR;
+    op.len = len - KV_PROTO_SEAL_OVERHEAD;
+    if (kv_crypto_open_batch(&op, 1) != 1)
+        return -1;
+    return (int)op.len;
+}
+
+/* Function: kv_unseal() - To open a sealed reply in place
+ * in parameters:
+ *   seal - session
+ *   buf - sealed reply, the reply is at buf + KV_PROTO_SEAL_HDR after
+ *   len - length of buf
+ *
+ * return:
+ *   length of the reply, -1 when it is not an authentic reply of the
+ *   session or of the one before it
+ */
+int kv_unseal(const struct kv_seal *seal, unsigned char *buf, int len)
+{
+    if (len <= KV_PROTO_SEAL_OVERHEAD || buf[0] != KV_PROTO_SEALED)
+        return -1;
+    if (memcmp(buf + 1, seal->salt, KV_CRYPTO_SALT) == 0)
+        return kv_open_reply(seal->key, buf, len);
+    if (memcmp(buf + 1, seal->old_salt, KV_CRYPTO_SALT) == 0)
+        return kv_open_reply(seal->old_key, buf, len);
+    return -1;
+}
+
+/* Function: kv_conn_seal() - To seal the requests of a connection
+ *   Called once after kv_conn_open(), before the first request.
+ * in parameters:
+ *   conn - connection
+ *   psk - pre-shared key of the Server
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_conn_seal(struct kv_conn *conn, const unsigned char psk[KV_CRYPTO_KEY])
+{
+    conn->seal_buf = malloc(KV_PROTO_MAX_DATAGRAM);
+    if (NULL == conn->seal_buf)
+        return FAILURE;
+    return kv_seal_init(&conn->seal, psk);
+}
+
+/* Function: kv_conn_send() - To send or resend the request of a slot*/
+static void kv_conn_send(struct kv_conn *conn, struct kv_pending *slot)
+{
+    const unsigned char *buf = slot->req;
+    int len = slot->req_len;
+
+    if (conn->seal.on)
+    {
+        len = kv_seal(&conn->seal, slot->req, slot->req_len, conn->seal_buf);
+        buf = conn->seal_buf;
+        memcpy(slot->salt, conn->seal.salt, KV_CRYPTO_SALT);
+        memcpy(slot->key, conn->seal.key, KV_CRYPTO_KEY);
+    }
+    if (!conn->tcp)
+        send(conn->sockfd, buf, len, 0);
+    else if (!conn->closed && kv_send_frame(conn->sockfd, buf, len) != SUCCESS)
+        conn->closed = 1;
+}
+
+/* Function: kv_conn_complete() - To hand a finished request to the caller
+ * in parameters:
+ *   conn - connection
+ *   slot - request slot, freed here
+ *   status - KV_ST_* result
+ *   value - GET value or NULL
+ *   value_len - length of value
+ *
+ * return:
+ *   void
+ */
+static void kv_conn_complete(struct kv_conn *conn, struct kv_pending *slot, int status,
+                             const char *value, uint32_t value_len)
+{
+    struct kv_reply reply;
+    struct kv_proto_cursor c;
+
+    /* key is read back from the saved request*/
+    memset(&reply, 0, sizeof(reply));
+    reply.opcode = slot->req[2];
+    reply.status = status;
+    kv_proto_cursor_init(&c, slot->req + KV_PROTO_HDR_LEN, slot->req_len - KV_PROTO_HDR_LEN);
+    if (reply.opcode != KV_OP_FIN)
+    {
+        reply.key_len = kv_proto_get_u16(&c);
+        reply.key = kv_proto_get_bytes(&c, reply.key_len);
+    }
+    reply.value = value;
+    reply.value_len = value_len;
+    reply.latency_ns = kv_now_ns() - slot->first_sent_ns;
+    reply.tag = slot->tag;
+
+    slot->used = 0;
+    conn->inflight--;
+    conn->completed++;
+    if (status == KV_ST_TIMEOUT)
+        conn->timeouts++;
+
+    if (conn->on_reply != NULL)
+        conn->on_reply(conn, &reply);
+}
+
+/* Function: kv_conn_submit() - To send one request, waiting for room
+ * in parameters:
+ *   conn - connection
+ *   opcode - KV_OP_SET, KV_OP_PUT, KV_OP_GET, KV_OP_DEL or KV_OP_FIN
+ *   key - key bytes
+ *   key_len - length of key
+ *   value - value bytes for KV_OP_SET and KV_OP_PUT
+ *   value_len - length of value
+ *   tag - caller data returned in struct kv_reply
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_conn_submit(struct kv_conn *conn, int opcode, const char *key, int key_len,
+                   const char *value, int value_len, uint64_t tag)
+{
+    struct kv_pending *slot;
+    unsigned char *p;
+    int req_len = KV_PROTO_HDR_LEN + 2 + key_len + 4 + value_len;
+
+    if (req_len > KV_CLIENT_MAXREQ || conn->closed)
+        return FAILURE;
+
+    /* window full: complete at least one request first*/
+    while (conn->inflight >= conn->window)
+        kv_conn_poll(conn, -1);
+
+    /* skip ids whose slot is still taken by an older request*/
+    while (conn->pending[conn->next_req_id & conn->slot_mask].used)
+        conn->next_req_id++;
+    slot = &conn->pending[conn->next_req_id & conn->slot_mask];
+    if (req_len > slot->req_cap)
+    {
+        /* large values only: most slots keep the small buffer*/
+        p = realloc(slot->req, req_len);
+        if (NULL == p)
+            return FAILURE;
+        slot->req = p;
+        slot->req_cap = req_len;
+    }
+    slot->req_id = conn->next_req_id++;
+
+    p = kv_proto_put_header(slot->req, opcode, 0, slot->req_id);
+    if (opcode != KV_OP_FIN)
+    {
+        p = kv_proto_put_u16(p, key_len);
+        p = kv_proto_put_bytes(p, key, key_len);
+    }
+    if (opcode == KV_OP_SET || opcode == KV_OP_PUT)
+    {
+        p = kv_proto_put_u32(p, value_len);
+        p = kv_proto_put_bytes(p, value, value_len);
+    }
+    slot->req_len = p - slot->req;
+
+    slot->used = 1;
+    slot->retries = 0;
+    slot->tag = tag;
+    slot->first_sent_ns = kv_now_ns();
+    slot->deadline_ns = slot->first_sent_ns + (uint64_t)conn->timeout_ms * 1000000ULL;
+    if (conn->inflight == 0 || slot->deadline_ns < conn->next_scan_ns)
+        conn->next_scan_ns = slot->deadline_ns;
+    conn->inflight++;
+    conn->sent++;
+
+    kv_conn_send(conn, slot);
+    return SUCCESS;
+}
+
+/* Function: kv_conn_check_timeouts() - To retransmit or expire requests
+ * in parameters:
+ *   conn - connection
+ *   now - current time
+ *
+ * return:
+ *   void
+ */
+static void kv_conn_check_timeouts(struct kv_conn *conn, uint64_t now)
+{
+    struct kv_pending *slot;
+    uint64_t next = UINT64_MAX;
+    unsigned int i;
+    int renewed = 0;
+
+    for (i = 0; i <= conn->slot_mask; i++)
+    {
+        slot = &conn->pending[i];
+        if (!slot->used)
+            continue;
+
+        if (slot->deadline_ns <= now)
+        {
+            if (slot->retries >= conn->max_retries)
+            {
+                kv_conn_complete(conn, slot, KV_ST_TIMEOUT, NULL, 0);
+                continue;
+            }
+            slot->retries++;
+            slot->deadline_ns = now + (uint64_t)kv_backoff_ms(conn->timeout_ms, slot->retries) *
+                                      1000000ULL;
+            /* a TCP request is still on its way, only its time runs*/
+            if (!conn->tcp)
+            {
+                conn->retransmits++;
+                /* one new session for all the resends of a scan*/
+                if (conn->seal.on && !renewed)
+                {
+                    kv_seal_renew(&conn->seal);
+                    renewed = 1;
+                }
+                kv_conn_send(conn, slot);
+            }
+        }
+        if (slot->deadline_ns < next)
+            next = slot->deadline_ns;
+    }
+    conn->next_scan_ns = next;
+}
+
+/* Function: kv_conn_unseal() - To open a sealed reply of the connection
+ *   A reply to a request last sent under an older session opens with
+ *   the key its slot kept.
+ */
+static int kv_conn_unseal(struct kv_conn *conn, unsigned char *buf, int len)
+{
+    struct kv_pending *slot;
+    unsigned int i;
+    int n = kv_unseal(&conn->seal, buf, len);
+
+    if (n >= 0 || len <= KV_PROTO_SEAL_OVERHEAD || buf[0] != KV_PROTO_SEALED)
+        return n;
+    for (i = 0; i <= conn->slot_mask; i++)
+    {
+        slot = &conn->pending[i];
+        if (slot->used && memcmp(buf + 1, slot->salt, KV_CRYPTO_SALT) == 0)
+            return kv_open_reply(slot->key, buf, len);
+    }
+    return -1;
+}
+
+/* Function: kv_conn_handle_reply() - To match a reply to its request
+ * in parameters:
+ *   conn - connection
+ *   buf - reply datagram
+ *   len - datagram length
+ *
+ * return:
+ *   void
+ */
+static void kv_conn_handle_reply(struct kv_conn *conn, unsigned char *buf, int len)
+{
+    struct kv_proto_cursor c;
+    struct kv_pending *slot;
+    const char *value = NULL;
+    uint32_t value_len = 0;
+    uint32_t req_id;
+    int opcode;
+    int status;
+
+    if (conn->seal.on)
+    {
+        len = kv_conn_unseal(conn, buf, len);
+        buf += KV_PROTO_SEAL_HDR;
+    }
+    if (len < KV_PROTO_HDR_LEN || buf[0] != KV_PROTO_MAGIC)
+        return;
+
+    kv_proto_cursor_init(&c, buf, len);
+    kv_proto_get_bytes(&c, 2);
+    opcode = kv_proto_get_u8(&c);
+    status = kv_proto_get_u8(&c);
+    req_id = kv_proto_get_u32(&c);
+
+    /* late duplicate of an already answered (retransmitted) request*/
+    slot = &conn->pending[req_id & conn->slot_mask];
+    if (!slot->used || slot->req_id != req_id)
+        return;
+
+    if (opcode == KV_OP_GET && status == KV_ST_SUCCESS)
+    {
+        value_len = kv_proto_get_u32(&c);
+        value = kv_proto_get_bytes(&c, value_len);
+        if (NULL == value)
+            return;
+    }
+
+    kv_conn_complete(conn, slot, status, value, value_len);
+}
+
+/* Function: kv_conn_read_stream() - To take the replies a TCP connection has
+ *   A lost connection times out every request in flight.
+ */
+static void kv_conn_read_stream(struct kv_conn *conn)
+{
+    struct kv_proto_cursor c;
+    uint32_t len;
+    int off;
+    int n;
+    unsigned int i;
+
+    while (!conn->closed)
+    {
+        n = recv(conn->sockfd, conn->reply_buf + conn->reply_len,
+                 KV_CLIENT_STREAM_BUF - conn->reply_len, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            conn->closed = 1;
+            break;
+        }
+        conn->reply_len += n;
+
+        off = 0;
+        while (conn->reply_len - off >= KV_PROTO_FRAME_LEN)
+        {
+            kv_proto_cursor_init(&c, conn->reply_buf + off, KV_PROTO_FRAME_LEN);
+            len = kv_proto_get_u32(&c);
+            if (len > KV_CLIENT_MAXREPLY)
+            {
+                conn->closed = 1;
+                break;
+            }
+            if ((uint32_t)(conn->reply_len - off - KV_PROTO_FRAME_LEN) < len)
+                break;
+            kv_conn_handle_reply(conn, conn->reply_buf + off + KV_PROTO_FRAME_LEN, len);
+            off += KV_PROTO_FRAME_LEN + len;
+        }
+        memmove(conn->reply_buf, conn->reply_buf + off, conn->reply_len - off);
+        conn->reply_len -= off;
+    }
+
+    for (i = 0; i <= conn->slot_mask; i++)
+    {
+        if (conn->pending[i].used)
+            kv_conn_complete(conn, &conn->pending[i], KV_ST_TIMEOUT, NULL, 0);
+    }
+}
+
+/* Function: kv_conn_poll() - To receive replies and run timeouts
+ * in parameters:
+ *   conn - connection
+ *   wait_ms - 0 to only take what is queued, -1 to wait until at
+ *             least one request completes, else max time to wait
+ *
+ * return:
+ *   number of requests completed
+ */
+int kv_conn_poll(struct kv_conn *conn, int wait_ms)
+{
+    struct pollfd pfd;
+    unsigned long done = conn->completed;
+    uint64_t now = kv_now_ns();
+    uint64_t end = (wait_ms < 0) ? UINT64_MAX : now + (uint64_t)wait_ms * 1000000ULL;
+    uint64_t until;
+    int num_bytes;
+
+    pfd.fd = conn->sockfd;
+    pfd.events = POLLIN;
+
+    while (1)
+    {
+        if (conn->tcp)
+            kv_conn_read_stream(conn);
+        while (!conn->tcp && (num_bytes = recv(conn->sockfd, conn->reply_buf,
+                                               KV_CLIENT_MAXREPLY, MSG_DONTWAIT)) >= 0)
+        {
+            kv_conn_handle_reply(conn, conn->reply_buf, num_bytes);
+        }
+
+        now = kv_now_ns();
+        if (conn->inflight > 0 && now >= conn->next_scan_ns)
+            kv_conn_check_timeouts(conn, now);
+
+        if (conn->completed != done || conn->inflight == 0 || now >= end)
+            break;
+
+        /* sleep until a reply, the next retransmit or the caller limit*/
+        until = (conn->next_scan_ns < end) ? conn->next_scan_ns : end;
+        poll(&pfd, 1, (int)((until - now + 999999) / 1000000));
+    }
+
+    return (int)(conn->completed - done);
+}
+
+/* Function: kv_conn_drain() - To wait for all requests in flight
+ * in parameters:
+ *   conn - connection
+ *
+ * return:
+ *   void
+ */
+void kv_conn_drain(struct kv_conn *conn)
+{
+    while (conn->inflight > 0)
+        kv_conn_poll(conn, -1);
+}
+
+/* Function: kv_conn_close() - To release socket and buffers
+ * in parameters:
+ *   conn - connection
+ *
+ * return:
+ *   void
+ */
+void kv_conn_close(struct kv_conn *conn)
+{
+    unsigned int i;
+
+    if (conn->pending != NULL)
+    {
+        for (i = 0; i <= conn->slot_mask; i++)
+            free(conn->pending[i].req);
+        /* session keys of the slots*/
+        memset(conn->pending, 0, (conn->slot_mask + 1) * sizeof(struct kv_pending));
+    }
+    free(conn->pending);
+    free(conn->reply_buf);
+    free(conn->seal_buf);
+    if (conn->sockfd > 0)
+        close(conn->sockfd);
+    memset(conn, 0, sizeof(*conn));
+}
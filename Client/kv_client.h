@@ -0,0 +1,142 @@
+/* kv_client.h
+ *
+ * Persistent client connection to the UDP Server
+ * - One UDP socket, or with tcp one TCP connection to the Server's
+ *   --tcp port, is reused for any number of commands
+ * - Requests use the binary protocol of Common/kv_proto.h and up to
+ *   'window' of them are in flight at once; replies are matched back
+ *   by request id, in any order
+ * - A request without reply is retransmitted under the same request
+ *   id after 'timeout_ms', each retransmit waiting twice as long as the
+ *   one before (up to KV_CLIENT_MAX_BACKOFF_MS), and reported as
+ *   KV_ST_TIMEOUT after 'retries' retransmits. The Server answers a
+ *   resent update from its reply cache, so it takes effect once. TCP
+ *   does not lose requests, they are only timed out, and all of them
+ *   at once when the connection drops
+ * - kv_conn_seal() seals every request and opens every reply with a
+ *   session key derived from a pre-shared key (Server --psk); each
+ *   send, resends included, takes the next counter of the session.
+ *   A timeout scan that resends starts one new session
+ *   (kv_seal_renew()): the Server may have turned the old salt away.
+ *   Every request keeps the session of its last send, so a late reply
+ *   to it still opens
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_CLIENT_H
+#define KV_CLIENT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "../Common/kv_proto.h"
+#include "../Common/kv_crypto.h"
+
+/* Largest request accepted by the Server, room left to seal it*/
+#define KV_CLIENT_MAXREQ KV_PROTO_MAX_PAYLOAD
+/* Largest UDP payload over IPv4*/
+#define KV_CLIENT_MAXREPLY KV_PROTO_MAX_DATAGRAM
+/* TCP receive buffer, a whole reply frame and the next one's start*/
+#define KV_CLIENT_STREAM_BUF (2 * (KV_PROTO_FRAME_LEN + KV_CLIENT_MAXREPLY))
+/* request buffer of a slot at first, grown for bigger requests*/
+#define KV_CLIENT_REQ_BUF 1024
+
+#define KV_CLIENT_DEFAULT_WINDOW 64
+#define KV_CLIENT_DEFAULT_TIMEOUT_MS 200
+#define KV_CLIENT_DEFAULT_RETRIES 3
+/* longest wait for one reply once the timeout has been doubled*/
+#define KV_CLIENT_MAX_BACKOFF_MS 5000
+
+/* completed request handed to the reply callback*/
+struct kv_reply{
+    int opcode;
+    int status;             /* KV_ST_*, KV_ST_TIMEOUT if never answered*/
+    const char *key;        /* points into the saved request*/
+    int key_len;
+    const char *value;      /* GET value, points into the reply datagram*/
+    uint32_t value_len;
+    uint64_t latency_ns;    /* first send to reply*/
+    uint64_t tag;           /* caller data given to kv_conn_submit()*/
+};
+
+/* client end of a sealed session*/
+struct kv_seal{
+    int on;
+    uint64_t counter;       /* of the last datagram sealed*/
+    unsigned char salt[KV_CRYPTO_SALT];
+    unsigned char key[KV_CRYPTO_KEY];
+    /* session before the last kv_seal_renew(), its replies still open*/
+    unsigned char old_salt[KV_CRYPTO_SALT];
+    unsigned char old_key[KV_CRYPTO_KEY];
+    unsigned char psk[KV_CRYPTO_KEY];
+};
+
+struct kv_conn;
+typedef void (*kv_reply_cb)(struct kv_conn *conn, const struct kv_reply *reply);
+
+/* request waiting for its reply*/
+struct kv_pending{
+    int used;
+    uint32_t req_id;
+    int retries;
+    uint64_t first_sent_ns;
+    uint64_t deadline_ns;
+    uint64_t tag;
+    int req_len;
+    int req_cap;
+    unsigned char *req;     /* saved datagram for retransmit*/
+    /* session of the last send when sealed*/
+    unsigned char salt[KV_CRYPTO_SALT];
+    unsigned char key[KV_CRYPTO_KEY];
+};
+
+struct kv_conn{
+    int sockfd;
+    int tcp;                /* stream of length framed requests*/
+    int closed;             /* TCP connection lost*/
+    struct sockaddr_in servaddr;
+    int window;             /* max requests in flight*/
+    int timeout_ms;
+    int max_retries;
+    kv_reply_cb on_reply;
+    void *user;             /* caller context for on_reply*/
+
+    /* slot of a request is req_id & slot_mask*/
+    struct kv_pending *pending;
+    unsigned int slot_mask;
+    int inflight;
+    uint32_t next_req_id;
+    uint64_t next_scan_ns;
+    unsigned char *reply_buf;
+    int reply_len;          /* TCP bytes in reply_buf*/
+    struct kv_seal seal;
+    unsigned char *seal_buf;    /* sealed request being sent*/
+
+    /* counters*/
+    unsigned long sent;
+    unsigned long completed;
+    unsigned long retransmits;
+    unsigned long timeouts;
+};
+
+/* Function prototypes */
+uint64_t kv_now_ns(void);
+int kv_conn_open(struct kv_conn *conn, char *ip_addr, int portno, int window,
+                 int timeout_ms, int retries, kv_reply_cb on_reply, int tcp);
+int kv_send_frame(int sockfd, const void *buf, int len);
+int kv_recv_frame(int sockfd, void *buf, int size);
+int kv_backoff_ms(int timeout_ms, int retries);
+int kv_seal_init(struct kv_seal *seal, const unsigned char psk[KV_CRYPTO_KEY]);
+int kv_seal_renew(struct kv_seal *seal);
+int kv_seal(struct kv_seal *seal, const void *in, int len, unsigned char *out);
+int kv_unseal(const struct kv_seal *seal, unsigned char *buf, int len);
+int kv_conn_seal(struct kv_conn *conn, const unsigned char psk[KV_CRYPTO_KEY]);
+int kv_conn_submit(struct kv_conn *conn, int opcode, const char *key, int key_len,
+                   const char *value, int value_len, uint64_t tag);
+int kv_conn_poll(struct kv_conn *conn, int wait_ms);
+void kv_conn_drain(struct kv_conn *conn);
+void kv_conn_close(struct kv_conn *conn);
+
+#endif /* KV_CLIENT_H */
@@ -0,0 +1,204 @@
+/* kv_ring.c
+ *
+ * Consistent hash ring over the Servers of --server, see kv_ring.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "kv_ring.h"
+
+#define FAILURE -1
+#define SUCCESS 0
+
+/* Function: kv_ring_hash() - To hash a key or a point name
+ *   FNV-1a over the bytes, then the murmur3 finalizer so that keys
+ *   differing in their last byte land far apart on the ring.
+ * in parameters:
+ *   buf - bytes to hash
+ *   len - length of buf
+ *
+ * return:
+ *   64-bit hash
+ */
+uint64_t kv_ring_hash(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* ties, practically never, go to the Server listed first*/
+static int kv_ring_cmp(const void *a, const void *b)
+{
+    const struct kv_ring_point *pa = a;
+    const struct kv_ring_point *pb = b;
+
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+/* Function: kv_ring_add() - To read one <ip>:<port> of the list*/
+static int kv_ring_add(struct kv_ring *ring, const char *str, size_t len)
+{
+    struct kv_ring_node *node = &ring->nodes[ring->num_nodes];
+    const char *colon = memchr(str, ':', len);
+    char port[8];
+    char *end;
+    long portno;
+    int i;
+
+    if (NULL == colon || colon - str >= INET_ADDRSTRLEN ||
+        len - (colon - str) - 1 == 0 || len - (colon - str) - 1 >= sizeof(port))
+        return FAILURE;
+    memcpy(node->ip_addr, str, colon - str);
+    node->ip_addr[colon - str] = '\0';
+    memcpy(port, colon + 1, len - (colon - str) - 1);
+    port[len - (colon - str) - 1] = '\0';
+
+    portno = strtol(port, &end, 10);
+    if (*end != '\0' || portno < 1 || portno > 65535)
+        return FAILURE;
+    node->portno = portno;
+
+    memset(&node->addr, 0, sizeof(node->addr));
+    node->addr.sin_family = AF_INET;
+    node->addr.sin_port = htons(node->portno);
+    if (inet_pton(AF_INET, node->ip_addr, &node->addr.sin_addr) != 1)
+        return FAILURE;
+
+    /* listed twice, it would get twice the keys*/
+    for (i = 0; i < ring->num_nodes; i++)
+    {
+        if (ring->nodes[i].addr.sin_addr.s_addr == node->addr.sin_addr.s_addr &&
+            ring->nodes[i].addr.sin_port == node->addr.sin_port)
+            return FAILURE;
+    }
+    ring->num_nodes++;
+    return SUCCESS;
+}
+
+/* Function: kv_ring_parse() - To build the ring of a --server list
+ * in parameters:
+ *   ring - ring to be initialised
+ *   list - <ip>:<port>[,<ip>:<port>...]
+ *
+ * return:
+ *   status of the operation, FAILURE for a malformed or repeated
+ *   address or more than KV_RING_MAX_NODES of them
+ */
+int kv_ring_parse(struct kv_ring *ring, const char *list)
+{
+    struct kv_ring_point *point;
+    char name[INET_ADDRSTRLEN + 16];
+    const char *comma;
+    int name_len;
+    int i;
+    int v;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->nodes = calloc(KV_RING_MAX_NODES, sizeof(struct kv_ring_node));
+    if (NULL == ring->nodes)
+        return FAILURE;
+
+    while (1)
+    {
+        comma = strchr(list, ',');
+        if (ring->num_nodes == KV_RING_MAX_NODES ||
+            kv_ring_add(ring, list, comma ? (size_t)(comma - list) : strlen(list)) != SUCCESS)
+        {
+            kv_ring_free(ring);
+            return FAILURE;
+        }
+        if (NULL == comma)
+            break;
+        list = comma + 1;
+    }
+
+    ring->num_points = ring->num_nodes * KV_RING_VNODES;
+    ring->points = malloc(ring->num_points * sizeof(struct kv_ring_point));
+    if (NULL == ring->points)
+    {
+        kv_ring_free(ring);
+        return FAILURE;
+    }
+    point = ring->points;
+    for (i = 0; i < ring->num_nodes; i++)
+    {
+        for (v = 0; v < KV_RING_VNODES; v++)
+        {
+            name_len = snprintf(name, sizeof(name), "%s:%d#%d", ring->nodes[i].ip_addr,
+                                ring->nodes[i].portno, v);
+            point->hash = kv_ring_hash(name, name_len);
+            point->node = i;
+            point++;
+        }
+    }
+    qsort(ring->points, ring->num_points, sizeof(struct kv_ring_point), kv_ring_cmp);
+    return SUCCESS;
+}
+
+/* Function: kv_ring_node() - To find the Server of a key
+ * in parameters:
+ *   ring - ring
+ *   key - key
+ *   key_len - length of key
+ *
+ * return:
+ *   index of the Server in the --server list
+ */
+int kv_ring_node(const struct kv_ring *ring, const char *key, size_t key_len)
+{
+    uint64_t hash;
+    int lo = 0;
+    int hi = ring->num_points;
+    int mid;
+
+    if (ring->num_nodes == 1)
+        return 0;
+
+    /* first point at or after the hash*/
+    hash = kv_ring_hash(key, key_len);
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ring->points[lo == ring->num_points ? 0 : lo].node;
+}
+
+/* Function: kv_ring_free() - To release the ring
+ * in parameters:
+ *   ring - ring
+ *
+ * return:
+ *   void
+ */
+void kv_ring_free(struct kv_ring *ring)
+{
+    free(ring->nodes);
+    free(ring->points);
+    memset(ring, 0, sizeof(*ring));
+}
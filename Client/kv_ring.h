@@ -0,0 +1,59 @@
+/* kv_ring.h
+ *
+ * Consistent hashing of keys over several Servers
+ * - --server takes a comma separated list <ip>:<port>,<ip>:<port>,...
+ *   and every key lives on exactly one of them
+ * - Each Server is placed on a 64-bit hash ring at KV_RING_VNODES
+ *   points, hashes of "<ip>:<port>#<n>"; a key belongs to the Server
+ *   of the first point at or after the hash of the key, wrapping
+ *   around. The points depend on the address only, so the order of
+ *   the list does not matter
+ * - Adding or removing one of N Servers moves only the keys of the
+ *   points it takes or gives up, about 1/N of them; the virtual nodes
+ *   keep the share of each Server within a few percent of 1/N
+ * - The ring hash is not the Server's shard hash (Server/kv_hash.h),
+ *   so the keys of one Server still spread over all its shards
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_RING_H
+#define KV_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* points per Server on the ring*/
+#define KV_RING_VNODES 160
+#define KV_RING_MAX_NODES 64
+
+/* one Server of the list*/
+struct kv_ring_node{
+    char ip_addr[INET_ADDRSTRLEN];
+    int portno;
+    struct sockaddr_in addr;
+};
+
+/* point of a Server on the ring*/
+struct kv_ring_point{
+    uint64_t hash;
+    int node;
+};
+
+struct kv_ring{
+    struct kv_ring_node *nodes;     /* in list order*/
+    int num_nodes;
+    struct kv_ring_point *points;   /* sorted by hash*/
+    int num_points;
+};
+
+/* Function prototypes */
+uint64_t kv_ring_hash(const void *buf, size_t len);
+int kv_ring_parse(struct kv_ring *ring, const char *list);
+int kv_ring_node(const struct kv_ring *ring, const char *key, size_t key_len);
+void kv_ring_free(struct kv_ring *ring);
+
+#endif /* KV_RING_H */
@@ -0,0 +1,713 @@
+/* kvbench.c
+ *
+ * Load generator and latency benchmark for the UDP Server
+ *
+ * Every connection runs in its own thread on top of kv_client.c and
+ * keeps up to --window binary requests in flight.
+ *  - closed loop (default): a new request is sent as soon as the
+ *    window has room, measures the max throughput
+ *  - open loop (--rate R): requests are sent on a fixed schedule of R
+ *    ops/s over all connections, latency is measured from the
+ *    scheduled send time so a stalled Server is not hidden
+ *
+ * Latency is kept in the log-linear histograms of Common/kv_hist.h (32
+ * sub-buckets per power of 2) and reported as p50/p99/p999 per operation.
+ *
+ * usage: kvbench --server <ipaddress>:<port>[,<ipaddress>:<port>...] [options]
+ *   With several Servers every thread keeps a connection to each and
+ *   sends a key to its Server on the consistent hash ring (kv_ring.h)
+ *   --ops <N>            total operations (default 100000)
+ *   --duration <s>       run for s seconds instead of --ops
+ *   --conns <N>          connections/threads (default 1)
+ *   --window <N>         requests in flight per connection (default 64)
+ *   --rate <R>           open loop at R ops/s, 0 = closed loop
+ *   --mix <get:set:del>  operation weights (default 90:10:0), sets
+ *                        are sent as PUT so they overwrite a key
+ *   --keys <N>           key space (default 100000)
+ *   --dist uniform|zipf  key distribution (default uniform)
+ *   --zipf <theta>       zipf skew, 0 < theta < 1 (default 0.99)
+ *   --key-size <B>       key length (default 16)
+ *   --value-size <B>     value length (default 32)
+ *   --preload            set every key once before measuring
+ *   --timeout <ms>       retransmit timeout (default 200)
+ *   --retries <N>        retransmits before a timeout (default 3)
+ *   --tcp                connect to the Server's --tcp port, one
+ *                        connection per thread, window pipelined
+ *   --psk <file>         seal the requests with the Server's --psk
+ *
+ * usage: kvbench --crypto-bench
+ *   No Server: times sealing and opening one datagram in ns per op,
+ *   for a range of payload sizes, one datagram at a time and in
+ *   batches as large as the Server's --batch takes from recvmmsg
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <poll.h>
+
+#include "../Common/kv_hist.h"
+#include "kv_client.h"
+#include "kv_ring.h"
+
+#define FAILURE -1
+#define SUCCESS 0
+
+#define MAXCHAR 256
+/* largest value of a single datagram SET with the longest key, sealed
+   or not*/
+#define MAXVALUE (KV_CLIENT_MAXREQ - KV_PROTO_HDR_LEN - 2 - MAXCHAR - 4)
+
+/* operations measured, index = KV_OP_* - 1, a PUT counts as set*/
+#define NUM_OPS 3
+static const char *op_names[NUM_OPS] = { "set", "get", "del" };
+
+/* benchmark configuration, shared read-only by all threads*/
+struct bench_cfg{
+    struct kv_ring ring;    /* Servers of --server*/
+    long ops;
+    double duration;
+    int conns;
+    int window;
+    double rate;
+    int mix[NUM_OPS];       /* set, get, del weights*/
+    long keys;
+    int zipf;
+    double theta;
+    int key_size;
+    int value_size;
+    int preload;
+    int tcp;
+    int timeout_ms;
+    int retries;
+    int sealed;
+    unsigned char psk[KV_CRYPTO_KEY];
+};
+
+/* zipf generator state (Gray et al., "Quickly generating billion-record
+   synthetic databases"), zeta(n) is computed once*/
+struct zipf_gen{
+    long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+
+/* per connection thread*/
+struct bench_thread{
+    pthread_t tid;
+    int id;
+    struct bench_cfg *cfg;
+    struct zipf_gen *zipf;
+    struct kv_conn *conns;  /* one per Server*/
+    uint64_t rng;
+    long ops;               /* operations assigned to this thread*/
+    int open_loop;
+    struct kv_hist hist[NUM_OPS];
+    unsigned long hits[NUM_OPS];
+    unsigned long misses[NUM_OPS];
+    unsigned long timeouts[NUM_OPS];
+    char *value;
+};
+
+/* Function prototypes*/
+void error(char *msg);
+void usage(char *prog);
+void crypto_bench(void);
+
+/* Function: rng_next() - xorshift64* pseudo random number
+ * in parameters:
+ *   state - generator state, never 0
+ *
+ * return:
+ *   64 random bits
+ */
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_double(uint64_t *state)
+{
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Function: zipf_init() - To precompute zipf constants for n keys
+ * in parameters:
+ *   z - generator
+ *   n - number of keys
+ *   theta - skew
+ *
+ * return:
+ *   void
+ */
+static void zipf_init(struct zipf_gen *z, long n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+    long i;
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static long zipf_next(struct zipf_gen *z, uint64_t *rng)
+{
+    double u = rng_double(rng);
+    double uz = u * z->zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    return (long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha)) % z->n;
+}
+
+/* Function: pick_key() - To draw the next key number
+ * in parameters:
+ *   t - bench thread
+ *
+ * return:
+ *   key number in [0, keys)
+ */
+static long pick_key(struct bench_thread *t)
+{
+    uint64_t rank;
+
+    if (!t->cfg->zipf)
+        return rng_next(&t->rng) % t->cfg->keys;
+
+    /* scatter the popular ranks so hot keys do not share a shard*/
+    rank = zipf_next(t->zipf, &t->rng);
+    return (rank * 0x9E3779B97F4A7C15ULL >> 17) % t->cfg->keys;
+}
+
+static int make_key(struct bench_cfg *cfg, char *key, long num)
+{
+    return snprintf(key, MAXCHAR + 1, "key%0*ld", cfg->key_size > 3 ? cfg->key_size - 3 : 1, num);
+}
+
+/* Function: bench_reply() - To record one completed request
+ * in parameters:
+ *   conn - connection of the thread
+ *   reply - completed request
+ *
+ * return:
+ *   void
+ */
+static void bench_reply(struct kv_conn *conn, const struct kv_reply *reply)
+{
+    struct bench_thread *t = conn->user;
+    int op = (reply->opcode == KV_OP_PUT ? KV_OP_SET : reply->opcode) - 1;
+    uint64_t latency = reply->latency_ns;
+
+    if (op < 0 || op >= NUM_OPS)
+        return;
+
+    /* open loop: tag is the scheduled send time*/
+    if (t->open_loop)
+        latency = kv_now_ns() - reply->tag;
+
+    if (reply->status == KV_ST_TIMEOUT)
+    {
+        t->timeouts[op]++;
+        return;
+    }
+    if (reply->status == KV_ST_SUCCESS)
+        t->hits[op]++;
+    else
+        t->misses[op]++;
+    kv_hist_record(&t->hist[op], latency);
+}
+
+/* Function: bench_poll() - To take the replies of all connections of a thread
+ * in parameters:
+ *   t - thread
+ *   wait_ms - longest wait for a reply on any connection, 0 not to wait
+ *
+ * return:
+ *   void
+ */
+static void bench_poll(struct bench_thread *t, int wait_ms)
+{
+    struct pollfd pfd[KV_RING_MAX_NODES];
+    int num_nodes = t->cfg->ring.num_nodes;
+    int i;
+
+    if (num_nodes == 1)
+    {
+        kv_conn_poll(&t->conns[0], wait_ms);
+        return;
+    }
+    if (wait_ms > 0)
+    {
+        for (i = 0; i < num_nodes; i++)
+        {
+            pfd[i].fd = t->conns[i].sockfd;
+            pfd[i].events = POLLIN;
+        }
+        poll(pfd, num_nodes, wait_ms);
+    }
+    for (i = 0; i < num_nodes; i++)
+        kv_conn_poll(&t->conns[i], 0);
+}
+
+/* Function: bench_main() - Request loop of one connection thread
+ * in parameters:
+ *   arg - struct bench_thread
+ *
+ * return:
+ *   NULL
+ */
+static void *bench_main(void *arg)
+{
+    struct bench_thread *t = arg;
+    struct bench_cfg *cfg = t->cfg;
+    char key[MAXCHAR + 2];
+    int key_len;
+    int weight_sum = cfg->mix[0] + cfg->mix[1] + cfg->mix[2];
+    int w;
+    int opcode;
+    long done = 0;
+    uint64_t start = kv_now_ns();
+    uint64_t end = start + (uint64_t)(cfg->duration * 1e9);
+    uint64_t interval = 0;
+    uint64_t next_send = start;
+    uint64_t now;
+    int i;
+
+    if (t->open_loop)
+        interval = (uint64_t)(1e9 * cfg->conns / cfg->rate);
+
+    while (cfg->duration > 0 ? kv_now_ns() < end : done < t->ops)
+    {
+        if (t->open_loop)
+        {
+            /* wait for the schedule, serving replies meanwhile*/
+            while ((now = kv_now_ns()) < next_send)
+                bench_poll(t, (int)((next_send - now) / 1000000));
+        }
+
+        w = rng_next(&t->rng) % weight_sum;
+        if (w < cfg->mix[1])
+            opcode = KV_OP_GET;
+        else if (w < cfg->mix[1] + cfg->mix[0])
+            opcode = KV_OP_PUT;
+        else
+            opcode = KV_OP_DEL;
+
+        key_len = make_key(cfg, key, pick_key(t));
+        kv_conn_submit(&t->conns[kv_ring_node(&cfg->ring, key, key_len)], opcode, key, key_len,
+                       t->value,
+                       opcode == KV_OP_PUT ? cfg->value_size : 0,
+                       t->open_loop ? next_send : 0);
+        next_send += interval;
+        done++;
+
+        /* take replies that are already queued without blocking*/
+        bench_poll(t, 0);
+    }
+    for (i = 0; i < cfg->ring.num_nodes; i++)
+        kv_conn_drain(&t->conns[i]);
+    return NULL;
+}
+
+/* Function: parse_mix() - To parse the --mix get:set:del weights
+ * in parameters:
+ *   cfg - configuration
+ *   arg - "get:set:del"
+ *
+ * return:
+ *   status of the operation
+ */
+static int parse_mix(struct bench_cfg *cfg, char *arg)
+{
+    int get = 0;
+    int set = 0;
+    int del = 0;
+
+    if (sscanf(arg, "%d:%d:%d", &get, &set, &del) < 2)
+        return FAILURE;
+    if (get < 0 || set < 0 || del < 0 || get + set + del == 0)
+        return FAILURE;
+    cfg->mix[0] = set;
+    cfg->mix[1] = get;
+    cfg->mix[2] = del;
+    return SUCCESS;
+}
+
+/* Function: print_row() - To print one line of the latency table
+ * in parameters:
+ *   name - operation name
+ *   h - latency histogram
+ *   hits - successful replies
+ *   misses - other replies
+ *   timeouts - requests never answered
+ *
+ * return:
+ *   void
+ */
+static void print_row(const char *name, struct kv_hist *h, unsigned long hits,
+                      unsigned long misses, unsigned long timeouts)
+{
+    if (h->total == 0 && timeouts == 0)
+        return;
+    printf("%-4s %10lu %10lu %10lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+           hits, misses, timeouts,
+           h->total ? h->sum / 1000.0 / h->total : 0.0,
+           kv_hist_percentile(h, 50) / 1000.0, kv_hist_percentile(h, 99) / 1000.0,
+           kv_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+}
+
+/* Function: open_conns() - To open a connection to every Server
+ * in parameters:
+ *   cfg - configuration
+ *   conns - cfg->ring.num_nodes connections to be opened
+ *   on_reply - reply callback of the connections
+ *   user - context of the callback
+ *
+ * return:
+ *   status of the operation
+ */
+static int open_conns(struct bench_cfg *cfg, struct kv_conn *conns, kv_reply_cb on_reply,
+                      void *user)
+{
+    struct kv_ring_node *node;
+    int i;
+
+    for (i = 0; i < cfg->ring.num_nodes; i++)
+    {
+        node = &cfg->ring.nodes[i];
+        if (kv_conn_open(&conns[i], node->ip_addr, node->portno, cfg->window,
+                         cfg->timeout_ms, cfg->retries, on_reply, cfg->tcp) != SUCCESS ||
+            (cfg->sealed && kv_conn_seal(&conns[i], cfg->psk) != SUCCESS))
+            return FAILURE;
+        conns[i].user = user;
+    }
+    return SUCCESS;
+}
+
+/* main function*/
+int main(int argc, char **argv)
+{
+    struct bench_cfg cfg;
+    struct bench_thread *threads;
+    struct zipf_gen zipf;
+    struct kv_conn *preload;
+    struct kv_hist total[NUM_OPS + 1];
+    unsigned long hits[NUM_OPS + 1];
+    unsigned long misses[NUM_OPS + 1];
+    unsigned long timeouts[NUM_OPS + 1];
+    char key[MAXCHAR + 2];
+    char *value;
+    unsigned long preload_timeouts;
+    int key_len;
+    uint64_t start;
+    double secs;
+    long i;
+    int op;
+    int node;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ops = 100000;
+    cfg.conns = 1;
+    cfg.window = KV_CLIENT_DEFAULT_WINDOW;
+    cfg.mix[0] = 10;
+    cfg.mix[1] = 90;
+    cfg.keys = 100000;
+    cfg.theta = 0.99;
+    cfg.key_size = 16;
+    cfg.value_size = 32;
+    cfg.timeout_ms = KV_CLIENT_DEFAULT_TIMEOUT_MS;
+    cfg.retries = KV_CLIENT_DEFAULT_RETRIES;
+
+    if (argc == 2 && strcmp(argv[1],"--crypto-bench")==0)
+    {
+        crypto_bench();
+        return 0;
+    }
+    if (argc < 3 || strcmp(argv[1],"--server") != 0)
+        usage(argv[0]);
+
+    /*Servers of the <ipaddr>:<portno>[,<ipaddr>:<portno>...] list*/
+    if (kv_ring_parse(&cfg.ring, argv[2]) != SUCCESS)
+        error("Incorrect IP addr and port input");
+
+    for (i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i],"--preload")==0)
+            cfg.preload = 1;
+        else if (strcmp(argv[i],"--tcp")==0)
+            cfg.tcp = 1;
+        else if (i + 1 >= argc)
+            usage(argv[0]);
+        else if (strcmp(argv[i],"--ops")==0)
+            cfg.ops = atol(argv[++i]);
+        else if (strcmp(argv[i],"--duration")==0)
+            cfg.duration = atof(argv[++i]);
+        else if (strcmp(argv[i],"--conns")==0)
+            cfg.conns = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--window")==0)
+            cfg.window = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--rate")==0)
+            cfg.rate = atof(argv[++i]);
+        else if (strcmp(argv[i],"--mix")==0)
+        {
+            if (parse_mix(&cfg, argv[++i]) != SUCCESS)
+                error("--mix expects <get>:<set>[:<del>]");
+        }
+        else if (strcmp(argv[i],"--keys")==0)
+            cfg.keys = atol(argv[++i]);
+        else if (strcmp(argv[i],"--dist")==0)
+            cfg.zipf = (strcmp(argv[++i],"zipf")==0);
+        else if (strcmp(argv[i],"--zipf")==0)
+            cfg.theta = atof(argv[++i]);
+        else if (strcmp(argv[i],"--key-size")==0)
+            cfg.key_size = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--value-size")==0)
+            cfg.value_size = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--timeout")==0)
+            cfg.timeout_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--retries")==0)
+            cfg.retries = atoi(argv[++i]);
+        else if (strcmp(argv[i],"--psk")==0)
+        {
+            if (kv_crypto_load_psk(argv[++i], cfg.psk) != 0)
+                error("--psk file must hold 64 hex digits");
+            cfg.sealed = 1;
+        }
+        else
+            usage(argv[0]);
+    }
+
+    if (cfg.conns < 1 || cfg.window < 1 || cfg.keys < 1 || cfg.ops < 1)
+        error("--conns, --window, --keys and --ops must be > 0");
+    if (cfg.key_size < 4 || cfg.key_size > MAXCHAR || cfg.value_size < 1 || cfg.value_size > MAXVALUE)
+        error("--key-size must be 4..256 and --value-size 1..65196");
+    if (cfg.zipf && (cfg.theta <= 0 || cfg.theta >= 1))
+        error("--zipf theta must be between 0 and 1");
+
+    value = malloc(cfg.value_size);
+    threads = calloc(cfg.conns, sizeof(struct bench_thread));
+    if (NULL == value || NULL == threads)
+        error("Allocation failed");
+    for (i = 0; i < cfg.value_size; i++)
+        value[i] = 'a' + i % 26;
+
+    if (cfg.zipf)
+        zipf_init(&zipf, cfg.keys, cfg.theta);
+
+    if (cfg.preload)
+    {
+        preload = calloc(cfg.ring.num_nodes, sizeof(struct kv_conn));
+        if (NULL == preload)
+            error("Allocation failed");
+        if (open_conns(&cfg, preload, NULL, NULL) != SUCCESS)
+            error("Opening connection");
+        for (i = 0; i < cfg.keys; i++)
+        {
+            key_len = make_key(&cfg, key, i);
+            kv_conn_submit(&preload[kv_ring_node(&cfg.ring, key, key_len)], KV_OP_SET, key,
+                           key_len, value, cfg.value_size, 0);
+        }
+        preload_timeouts = 0;
+        for (i = 0; i < cfg.ring.num_nodes; i++)
+        {
+            kv_conn_drain(&preload[i]);
+            preload_timeouts += preload[i].timeouts;
+            kv_conn_close(&preload[i]);
+        }
+        printf("preloaded %ld keys, %lu timeouts\n", cfg.keys, preload_timeouts);
+        free(preload);
+    }
+
+    for (i = 0; i < cfg.conns; i++)
+    {
+        threads[i].id = i;
+        threads[i].cfg = &cfg;
+        threads[i].zipf = &zipf;
+        threads[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) ^ kv_now_ns();
+        threads[i].ops = cfg.ops / cfg.conns + (i < cfg.ops % cfg.conns);
+        threads[i].open_loop = (cfg.rate > 0);
+        threads[i].value = value;
+        threads[i].conns = calloc(cfg.ring.num_nodes, sizeof(struct kv_conn));
+        if (NULL == threads[i].conns)
+            error("Allocation failed");
+        if (open_conns(&cfg, threads[i].conns, bench_reply, &threads[i]) != SUCCESS)
+            error("Opening connection");
+    }
+
+    start = kv_now_ns();
+    for (i = 0; i < cfg.conns; i++)
+    {
+        if (pthread_create(&threads[i].tid, NULL, bench_main, &threads[i]) != 0)
+            error("Thread creation failed");
+    }
+    for (i = 0; i < cfg.conns; i++)
+        pthread_join(threads[i].tid, NULL);
+    secs = (kv_now_ns() - start) / 1e9;
+
+    memset(total, 0, sizeof(total));
+    memset(hits, 0, sizeof(hits));
+    memset(misses, 0, sizeof(misses));
+    memset(timeouts, 0, sizeof(timeouts));
+    for (i = 0; i < cfg.conns; i++)
+    {
+        for (op = 0; op < NUM_OPS; op++)
+        {
+            kv_hist_merge(&total[op], &threads[i].hist[op]);
+            kv_hist_merge(&total[NUM_OPS], &threads[i].hist[op]);
+            hits[op] += threads[i].hits[op];
+            misses[op] += threads[i].misses[op];
+            timeouts[op] += threads[i].timeouts[op];
+            hits[NUM_OPS] += threads[i].hits[op];
+            misses[NUM_OPS] += threads[i].misses[op];
+            timeouts[NUM_OPS] += threads[i].timeouts[op];
+        }
+    }
+
+    printf("%s loop, %s%s, %d servers, %d conns x window %d, %s keys %ld, mix get:set:del %d:%d:%d\n",
+           cfg.rate > 0 ? "open" : "closed", cfg.tcp ? "tcp" : "udp", cfg.sealed ? " sealed" : "",
+           cfg.ring.num_nodes, cfg.conns, cfg.window,
+           cfg.zipf ? "zipf" : "uniform", cfg.keys, cfg.mix[1], cfg.mix[0], cfg.mix[2]);
+    printf("%lu ops in %.3f s, throughput %.0f ops/s\n",
+           (unsigned long)total[NUM_OPS].total + timeouts[NUM_OPS], secs,
+           secs > 0 ? total[NUM_OPS].total / secs : 0.0);
+    printf("%-4s %10s %10s %10s %9s %9s %9s %9s %9s\n", "op", "success", "other",
+           "timeout", "mean(us)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (op = 0; op < NUM_OPS; op++)
+        print_row(op_names[op], &total[op], hits[op], misses[op], timeouts[op]);
+    print_row("all", &total[NUM_OPS], hits[NUM_OPS], misses[NUM_OPS], timeouts[NUM_OPS]);
+
+    for (i = 0; i < cfg.conns; i++)
+    {
+        for (node = 0; node < cfg.ring.num_nodes; node++)
+            kv_conn_close(&threads[i].conns[node]);
+        free(threads[i].conns);
+    }
+    free(threads);
+    free(value);
+    kv_ring_free(&cfg.ring);
+    return 0;
+}
+
+/* Function: crypto_bench() - To time sealing and opening datagrams
+ *   Every op is a seal and an open of one payload under the session
+ *   key, as a request costs the Server an open and its reply a seal.
+ *   A batch of 1 is what kv_conn pays per request; larger batches
+ *   are what a Server worker pays per recvmmsg batch, the 4 ChaCha20
+ *   lanes filled from several datagrams.
+ *
+ * return:
+ *   void
+ */
+void crypto_bench(void)
+{
+    static const int sizes[] = { 16, 64, 256, 1024, 8192 };
+    static const int batches[] = { 1, 4, 32, 256 };
+    struct kv_crypto_op *ops;
+    unsigned char key[KV_CRYPTO_KEY];
+    unsigned char salt[KV_CRYPTO_SALT];
+    unsigned char hdr[KV_PROTO_SEAL_HDR];
+    unsigned char *bufs;
+    uint64_t counter = 0;
+    uint64_t start;
+    double ns;
+    long rounds;
+    long r;
+    int s;
+    int b;
+    int i;
+
+    ops = calloc(batches[3], sizeof(struct kv_crypto_op));
+    bufs = malloc((size_t)batches[3] * (sizes[4] + KV_CRYPTO_TAG));
+    if (NULL == ops || NULL == bufs)
+        error("Allocation failed");
+    memset(bufs, 'a', (size_t)batches[3] * (sizes[4] + KV_CRYPTO_TAG));
+    memset(salt, 0x5a, sizeof(salt));
+    memset(hdr, 0, sizeof(hdr));
+    memset(key, 0x42, sizeof(key));
+    kv_crypto_derive(key, key, salt);
+
+    printf("%8s %6s %12s %10s\n", "payload", "batch", "ns/op", "MB/s");
+    for (s = 0; s < 5; s++)
+    {
+        for (b = 0; b < 4; b++)
+        {
+            /* about 16 MB sealed and opened per row*/
+            rounds = (16L << 20) / ((long)sizes[s] * batches[b]);
+            start = kv_now_ns();
+            for (r = 0; r < rounds; r++)
+            {
+                for (i = 0; i < batches[b]; i++)
+                {
+                    counter++;
+                    ops[i].key = key;
+                    memset(ops[i].nonce, 0, 4);
+                    memcpy(ops[i].nonce + 4, &counter, 8);
+                    ops[i].aad = hdr;
+                    ops[i].aad_len = sizeof(hdr);
+                    ops[i].data = bufs + (size_t)i * (sizes[s] + KV_CRYPTO_TAG);
+                    ops[i].len = sizes[s];
+                }
+                kv_crypto_seal_batch(ops, batches[b]);
+                if (kv_crypto_open_batch(ops, batches[b]) != batches[b])
+                    error("Opening a sealed datagram failed");
+            }
+            ns = (double)(kv_now_ns() - start) / ((double)rounds * batches[b]);
+            printf("%8d %6d %12.1f %10.1f\n", sizes[s], batches[b], ns, sizes[s] * 1e3 / ns);
+        }
+    }
+    free(ops);
+    free(bufs);
+}
+
+/* Function: usage() - To print command line format and exit
+ * in parameters:
+ *   prog - program name
+ *
+ * return:
+ *   void
+ */
+void usage(char *prog)
+{
+    printf("usage: %s --server <ipaddress>:<port>[,<ipaddress>:<port>...]\n"
+           "       [--ops <N> | --duration <s>]\n"
+           "       [--conns <N>] [--window <N>] [--rate <ops/s>] [--mix <get:set:del>]\n"
+           "       [--keys <N>] [--dist uniform|zipf] [--zipf <theta>]\n"
+           "       [--key-size <B>] [--value-size <B>] [--preload]\n"
+           "       [--timeout <ms>] [--retries <N>] [--tcp] [--psk <file>]\n"
+           "usage: %s --crypto-bench\n", prog, prog);
+    error("Incorrect Input");
+}
+
+/* Function: error() - To print error message
+ * in parameters:
+ *   msg - message to be printed
+ *
+ * return:
+ *   void
+ */
+void error(char *msg)
+{
+  printf("\nERROR:%s\n",msg);
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,456 @@
+/* kv_crypto.c
+ *
+ * ChaCha20-Poly1305, see kv_crypto.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "kv_crypto.h"
+
+typedef uint32_t kv_vec __attribute__((vector_size(16)));
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define QUARTER(a, b, c, d) \
+    a += b; d ^= a; d = ROTL(d, 16); \
+    c += d; b ^= c; b = ROTL(b, 12); \
+    a += b; d ^= a; d = ROTL(d, 8);  \
+    c += d; b ^= c; b = ROTL(b, 7);
+
+/* keystream block wanted by a message: counter 0 is its Poly1305 key*/
+struct kv_crypto_job{
+    const unsigned char *key;
+    const unsigned char *nonce;
+    uint32_t counter;
+    unsigned char *dst;
+    size_t len;
+    int xor;                            /* 0: copy the keystream*/
+};
+
+static inline uint32_t kv_crypto_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t kv_crypto_le64(const unsigned char *p)
+{
+    return (uint64_t)kv_crypto_le32(p) | (uint64_t)kv_crypto_le32(p + 4) << 32;
+}
+
+static inline void kv_crypto_put_le32(unsigned char *p, uint32_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &v, 4);
+#else
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+#endif
+}
+
+static inline void kv_crypto_put_le64(unsigned char *p, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+/* Function: kv_crypto_init_state() - To fill a ChaCha20 input block*/
+static void kv_crypto_init_state(uint32_t s[16], const unsigned char *key, uint32_t counter,
+                                 const unsigned char *nonce)
+{
+    int i;
+
+    s[0] = 0x61707865;
+    s[1] = 0x3320646e;
+    s[2] = 0x79622d32;
+    s[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+        s[4 + i] = kv_crypto_le32(key + 4 * i);
+    s[12] = counter;
+    for (i = 0; i < 3; i++)
+        s[13 + i] = kv_crypto_le32(nonce + 4 * i);
+}
+
+/* Function: kv_crypto_run() - To compute the keystream of up to 4 jobs
+ *   Lane i of every vector is the block of job i, unused lanes repeat
+ *   job 0 and are dropped.
+ * in parameters:
+ *   jobs - blocks to compute and where they go
+ *   num - number of jobs, 1..KV_CRYPTO_LANES
+ *
+ * return:
+ *   void
+ */
+static void kv_crypto_run(const struct kv_crypto_job *jobs, int num)
+{
+    uint32_t in[KV_CRYPTO_LANES][16];
+    uint32_t out[16][KV_CRYPTO_LANES];
+    unsigned char block[64];
+    uint64_t ks;
+    uint64_t d;
+    kv_vec x[16];
+    kv_vec s[16];
+    size_t k;
+    int lane;
+    int w;
+    int i;
+
+    for (lane = 0; lane < KV_CRYPTO_LANES; lane++)
+    {
+        const struct kv_crypto_job *job = &jobs[lane < num ? lane : 0];
+
+        kv_crypto_init_state(in[lane], job->key, job->counter, job->nonce);
+    }
+    for (w = 0; w < 16; w++)
+    {
+        s[w] = (kv_vec){ in[0][w], in[1][w], in[2][w], in[3][w] };
+        x[w] = s[w];
+    }
+
+    for (i = 0; i < 10; i++)
+    {
+        QUARTER(x[0], x[4], x[8],  x[12]);
+        QUARTER(x[1], x[5], x[9],  x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8],  x[13]);
+        QUARTER(x[3], x[4], x[9],  x[14]);
+    }
+    for (w = 0; w < 16; w++)
+    {
+        x[w] += s[w];
+        memcpy(out[w], &x[w], sizeof(x[w]));
+    }
+
+    for (lane = 0; lane < num; lane++)
+    {
+        for (w = 0; w < 16; w++)
+            kv_crypto_put_le32(block + 4 * w, out[w][lane]);
+        if (!jobs[lane].xor)
+        {
+            memcpy(jobs[lane].dst, block, jobs[lane].len);
+            continue;
+        }
+        /* 8 bytes at a time, the tail of a message byte by byte*/
+        for (k = 0; k + 8 <= jobs[lane].len; k += 8)
+        {
+            memcpy(&d, jobs[lane].dst + k, 8);
+            memcpy(&ks, block + k, 8);
+            d ^= ks;
+            memcpy(jobs[lane].dst + k, &d, 8);
+        }
+        for (; k < jobs[lane].len; k++)
+            jobs[lane].dst[k] ^= block[k];
+    }
+}
+
+/* Function: kv_crypto_queue() - To add one block to the pending jobs
+ *   The jobs run as soon as all lanes are taken.
+ */
+static void kv_crypto_queue(struct kv_crypto_job *jobs, int *num, const unsigned char *key,
+                            const unsigned char *nonce, uint32_t counter, unsigned char *dst,
+                            size_t len, int xor)
+{
+    struct kv_crypto_job *job = &jobs[(*num)++];
+
+    job->key = key;
+    job->nonce = nonce;
+    job->counter = counter;
+    job->dst = dst;
+    job->len = len;
+    job->xor = xor;
+    if (*num == KV_CRYPTO_LANES)
+    {
+        kv_crypto_run(jobs, *num);
+        *num = 0;
+    }
+}
+
+/* Function: kv_crypto_keystream() - To derive Poly1305 keys and/or
+ *   encrypt the data of a batch, blocks of all messages share lanes
+ * in parameters:
+ *   ops - messages
+ *   num - number of messages
+ *   otk - derive the Poly1305 key of every message
+ *   data - xor the data of every message (only the ok ones when
+ *          opening)
+ *
+ * return:
+ *   void
+ */
+static void kv_crypto_keystream(struct kv_crypto_op *ops, int num, int otk, int data)
+{
+    struct kv_crypto_job jobs[KV_CRYPTO_LANES];
+    int pending = 0;
+    uint32_t counter;
+    size_t off;
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        if (otk)
+            kv_crypto_queue(jobs, &pending, ops[i].key, ops[i].nonce, 0, ops[i].otk, 32, 0);
+        if (!data || !ops[i].ok)
+            continue;
+        for (off = 0, counter = 1; off < ops[i].len; off += 64, counter++)
+        {
+            kv_crypto_queue(jobs, &pending, ops[i].key, ops[i].nonce, counter, ops[i].data + off,
+                            ops[i].len - off < 64 ? ops[i].len - off : 64, 1);
+        }
+    }
+    if (pending > 0)
+        kv_crypto_run(jobs, pending);
+}
+
+/* Poly1305 over 44/44/42 bit limbs, products in 128 bits*/
+struct kv_poly{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+};
+
+#define M44 0xfffffffffffULL
+#define M42 0x3ffffffffffULL
+
+static void kv_poly_init(struct kv_poly *p, const unsigned char key[32])
+{
+    uint64_t t0 = kv_crypto_le64(key);
+    uint64_t t1 = kv_crypto_le64(key + 8);
+
+    /* clamped r*/
+    p->r[0] = t0 & 0xffc0fffffffULL;
+    p->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    p->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    p->h[0] = p->h[1] = p->h[2] = 0;
+    p->pad[0] = kv_crypto_le64(key + 16);
+    p->pad[1] = kv_crypto_le64(key + 24);
+}
+
+/* Function: kv_poly_blocks() - To absorb whole 16 byte blocks, a
+ *   shorter tail is zero padded as the AEAD construction wants
+ */
+static void kv_poly_blocks(struct kv_poly *p, const unsigned char *m, size_t len)
+{
+    unsigned char last[16];
+    uint64_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+    unsigned __int128 d0, d1, d2;
+    uint64_t t0, t1, c;
+
+    while (len > 0)
+    {
+        if (len < 16)
+        {
+            memset(last, 0, sizeof(last));
+            memcpy(last, m, len);
+            m = last;
+            len = 16;
+        }
+        t0 = kv_crypto_le64(m);
+        t1 = kv_crypto_le64(m + 8);
+        h0 += t0 & M44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & M44;
+        h2 += ((t1 >> 24) & M42) | (1ULL << 40);
+
+        d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+        d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+        d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+        c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & M44;
+        d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & M44;
+        d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & M42;
+        h0 += c * 5; c = h0 >> 44; h0 &= M44;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+    p->h[0] = h0;
+    p->h[1] = h1;
+    p->h[2] = h2;
+}
+
+static void kv_poly_finish(struct kv_poly *p, unsigned char tag[16])
+{
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+    uint64_t g0, g1, g2, c;
+
+    /* fully carry h*/
+    c = h1 >> 44; h1 &= M44;
+    h2 += c; c = h2 >> 42; h2 &= M42;
+    h0 += c * 5; c = h0 >> 44; h0 &= M44;
+    h1 += c; c = h1 >> 44; h1 &= M44;
+    h2 += c; c = h2 >> 42; h2 &= M42;
+    h0 += c * 5; c = h0 >> 44; h0 &= M44;
+    h1 += c;
+
+    /* h - p, kept when it does not borrow*/
+    g0 = h0 + 5; c = g0 >> 44; g0 &= M44;
+    g1 = h1 + c; c = g1 >> 44; g1 &= M44;
+    g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+
+    /* h + s mod 2^128*/
+    h0 += p->pad[0] & M44; c = h0 >> 44; h0 &= M44;
+    h1 += (((p->pad[0] >> 44) | (p->pad[1] << 20)) & M44) + c; c = h1 >> 44; h1 &= M44;
+    h2 += ((p->pad[1] >> 24) & M42) + c; h2 &= M42;
+
+    kv_crypto_put_le64(tag, h0 | (h1 << 44));
+    kv_crypto_put_le64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+/* Function: kv_crypto_tag() - To compute the RFC 8439 AEAD tag
+ *   over aad and ciphertext of a message
+ */
+static void kv_crypto_tag(const struct kv_crypto_op *op, unsigned char tag[16])
+{
+    struct kv_poly p;
+    unsigned char lens[16];
+
+    kv_poly_init(&p, op->otk);
+    kv_poly_blocks(&p, op->aad, op->aad_len);
+    kv_poly_blocks(&p, op->data, op->len);
+    kv_crypto_put_le64(lens, op->aad_len);
+    kv_crypto_put_le64(lens + 8, op->len);
+    kv_poly_blocks(&p, lens, 16);
+    kv_poly_finish(&p, tag);
+}
+
+/* Function: kv_crypto_derive() - To derive a session key (HChaCha20)
+ * in parameters:
+ *   key - set to the session key
+ *   psk - pre-shared key
+ *   salt - salt chosen by the client
+ *
+ * return:
+ *   void
+ */
+void kv_crypto_derive(unsigned char key[KV_CRYPTO_KEY], const unsigned char psk[KV_CRYPTO_KEY],
+                      const unsigned char salt[KV_CRYPTO_SALT])
+{
+    uint32_t s[16];
+    uint32_t out[8];
+    int i;
+
+    kv_crypto_init_state(s, psk, kv_crypto_le32(salt), salt + 4);
+    for (i = 0; i < 10; i++)
+    {
+        QUARTER(s[0], s[4], s[8],  s[12]);
+        QUARTER(s[1], s[5], s[9],  s[13]);
+        QUARTER(s[2], s[6], s[10], s[14]);
+        QUARTER(s[3], s[7], s[11], s[15]);
+        QUARTER(s[0], s[5], s[10], s[15]);
+        QUARTER(s[1], s[6], s[11], s[12]);
+        QUARTER(s[2], s[7], s[8],  s[13]);
+        QUARTER(s[3], s[4], s[9],  s[14]);
+    }
+    memcpy(out, s, 16);
+    memcpy(out + 4, s + 12, 16);
+    for (i = 0; i < 8; i++)
+    {
+        key[4 * i]     = (unsigned char)out[i];
+        key[4 * i + 1] = (unsigned char)(out[i] >> 8);
+        key[4 * i + 2] = (unsigned char)(out[i] >> 16);
+        key[4 * i + 3] = (unsigned char)(out[i] >> 24);
+    }
+}
+
+/* Function: kv_crypto_seal_batch() - To encrypt messages in place
+ * in parameters:
+ *   ops - messages, each with KV_CRYPTO_TAG bytes of room after data
+ *         for the tag
+ *   num - number of messages
+ *
+ * return:
+ *   void
+ */
+void kv_crypto_seal_batch(struct kv_crypto_op *ops, int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++)
+        ops[i].ok = 1;
+    kv_crypto_keystream(ops, num, 1, 1);
+    for (i = 0; i < num; i++)
+        kv_crypto_tag(&ops[i], ops[i].data + ops[i].len);
+}
+
+/* Function: kv_crypto_open_batch() - To check and decrypt messages in place
+ *   A message whose tag does not match is left as it was.
+ * in parameters:
+ *   ops - messages, tag after data; ok set to 1 for an authentic one
+ *   num - number of messages
+ *
+ * return:
+ *   number of authentic messages
+ */
+int kv_crypto_open_batch(struct kv_crypto_op *ops, int num)
+{
+    unsigned char tag[KV_CRYPTO_TAG];
+    unsigned char diff;
+    int good = 0;
+    int i;
+    int k;
+
+    kv_crypto_keystream(ops, num, 1, 0);
+    for (i = 0; i < num; i++)
+    {
+        kv_crypto_tag(&ops[i], tag);
+        /* constant time compare*/
+        diff = 0;
+        for (k = 0; k < KV_CRYPTO_TAG; k++)
+            diff |= tag[k] ^ ops[i].data[ops[i].len + k];
+        ops[i].ok = (diff == 0);
+        good += ops[i].ok;
+    }
+    kv_crypto_keystream(ops, num, 0, 1);
+    return good;
+}
+
+/* Function: kv_crypto_load_psk() - To read a pre-shared key file
+ * in parameters:
+ *   path - file with the key as 64 hex digits, white space ignored
+ *   psk - set to the key
+ *
+ * return:
+ *   0, -1 when the file cannot be read or holds no 32 byte key
+ */
+int kv_crypto_load_psk(const char *path, unsigned char psk[KV_CRYPTO_KEY])
+{
+    FILE *in = fopen(path, "r");
+    int digits = 0;
+    int ch;
+    int v;
+
+    if (NULL == in)
+        return -1;
+    memset(psk, 0, KV_CRYPTO_KEY);
+    while ((ch = fgetc(in)) != EOF)
+    {
+        if (isspace(ch))
+            continue;
+        if (!isxdigit(ch) || digits == 2 * KV_CRYPTO_KEY)
+        {
+            digits = -1;
+            break;
+        }
+        v = isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10;
+        psk[digits / 2] |= v << (digits % 2 ? 0 : 4);
+        digits++;
+    }
+    fclose(in);
+    return digits == 2 * KV_CRYPTO_KEY ? 0 : -1;
+}
@@ -0,0 +1,50 @@
+/* kv_crypto.h
+ *
+ * ChaCha20-Poly1305 (RFC 8439) for the sealed datagrams of
+ * Common/kv_proto.h, shared by UDP_Client.c and UDP_Server.c
+ * - No library needed. ChaCha20 runs 4 blocks side by side in GCC
+ *   vector types, SSE2/NEON without any target flag; the blocks may
+ *   belong to different messages, so a batch of short datagrams
+ *   fills the lanes as well as one long one
+ * - Session keys are HChaCha20(psk, salt): the client picks a random
+ *   16 byte salt once, every datagram carries it, and both sides
+ *   derive the same key without a handshake
+ * - A kv_crypto_op seals or opens one message in place; a batch of
+ *   them is the unit of work, one datagram is a batch of 1
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_CRYPTO_H
+#define KV_CRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KV_CRYPTO_KEY   32
+#define KV_CRYPTO_NONCE 12
+#define KV_CRYPTO_TAG   16
+#define KV_CRYPTO_SALT  16
+
+/* blocks computed together*/
+#define KV_CRYPTO_LANES 4
+
+struct kv_crypto_op{
+    const unsigned char *key;
+    unsigned char nonce[KV_CRYPTO_NONCE];
+    const unsigned char *aad;
+    size_t aad_len;
+    unsigned char *data;                /* plaintext or ciphertext, tag follows*/
+    size_t len;                         /* without the tag*/
+    int ok;                             /* set by kv_crypto_open_batch()*/
+    unsigned char otk[32];              /* Poly1305 key of the message*/
+};
+
+void kv_crypto_derive(unsigned char key[KV_CRYPTO_KEY], const unsigned char psk[KV_CRYPTO_KEY],
+                      const unsigned char salt[KV_CRYPTO_SALT]);
+void kv_crypto_seal_batch(struct kv_crypto_op *ops, int num);
+int kv_crypto_open_batch(struct kv_crypto_op *ops, int num);
+int kv_crypto_load_psk(const char *path, unsigned char psk[KV_CRYPTO_KEY]);
+
+#endif /* KV_CRYPTO_H */
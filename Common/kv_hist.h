@@ -0,0 +1,116 @@
+/* kv_hist.h
+ *
+ * Log-linear latency histogram shared by the Server stats and kvbench
+ * - Values below 2 * KV_HIST_SUB are exact, above that every power of
+ *   2 is split into KV_HIST_SUB buckets, about 3% relative error
+ * - Single writer: kv_hist_record() is only called by the thread
+ *   owning the histogram, other threads may read it at any time with
+ *   kv_hist_merge(), counters are never torn
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_HIST_H
+#define KV_HIST_H
+
+#include <stdint.h>
+
+#define KV_HIST_SUB_BITS 5
+#define KV_HIST_SUB (1 << KV_HIST_SUB_BITS)
+#define KV_HIST_BUCKETS ((64 - KV_HIST_SUB_BITS + 1) * KV_HIST_SUB)
+
+struct kv_hist{
+    uint64_t counts[KV_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+/* single writer increment, readers on other threads see whole values*/
+#define KV_HIST_ADD(field, v) \
+    __atomic_store_n(&(field), (field) + (v), __ATOMIC_RELAXED)
+
+/* Function: kv_hist_index() - To map a value to its bucket
+ * in parameters:
+ *   v - value, usually ns
+ *
+ * return:
+ *   bucket index
+ */
+static inline int kv_hist_index(uint64_t v)
+{
+    int msb;
+
+    if (v < 2 * KV_HIST_SUB)
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - KV_HIST_SUB_BITS) * KV_HIST_SUB + (int)(v >> (msb - KV_HIST_SUB_BITS));
+}
+
+/* Function: kv_hist_value() - To get the lowest value of a bucket
+ * in parameters:
+ *   idx - bucket index
+ *
+ * return:
+ *   value
+ */
+static inline uint64_t kv_hist_value(int idx)
+{
+    int shift;
+
+    if (idx < 2 * KV_HIST_SUB)
+        return idx;
+    shift = idx / KV_HIST_SUB - 1;
+    return (uint64_t)(idx - shift * KV_HIST_SUB) << shift;
+}
+
+static inline void kv_hist_record(struct kv_hist *h, uint64_t v)
+{
+    KV_HIST_ADD(h->counts[kv_hist_index(v)], 1);
+    KV_HIST_ADD(h->total, 1);
+    KV_HIST_ADD(h->sum, v);
+    if (v > h->max)
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+static inline void kv_hist_merge(struct kv_hist *dst, const struct kv_hist *src)
+{
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    int i;
+
+    for (i = 0; i < KV_HIST_BUCKETS; i++)
+        dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    dst->total += __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+/* Function: kv_hist_percentile() - To read a percentile
+ * in parameters:
+ *   h - histogram
+ *   pct - percentile, 0..100
+ *
+ * return:
+ *   lowest value of the bucket holding the percentile
+ */
+static inline uint64_t kv_hist_percentile(const struct kv_hist *h, double pct)
+{
+    double exact = h->total * pct / 100.0;
+    uint64_t want = (uint64_t)exact;
+    uint64_t seen = 0;
+    int i;
+
+    if (want < exact || want == 0)
+        want++;
+    for (i = 0; i < KV_HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= want)
+            return kv_hist_value(i);
+    }
+    return h->max;
+}
+
+#endif /* KV_HIST_H */
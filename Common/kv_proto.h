@@ -0,0 +1,333 @@
+/* kv_proto.h
+ *
+ * Binary wire protocol shared by UDP_Client.c and UDP_Server.c
+ *
+ * Every datagram starts with an 8 byte header, multi-byte fields are
+ * in network byte order:
+ *
+ *   0      magic   KV_PROTO_MAGIC, never a printable character so the
+ *                  Server tells binary from "--set key value" text by
+ *                  the first byte
+ *   1      version KV_PROTO_VERSION
+ *   2      opcode  KV_OP_*
+ *   3      status  KV_ST_* in replies, 0 in requests
+ *   4..7   request id, echoed in the reply
+ *
+ * Request body
+ *   SET            u16 key_len, key, u32 value_len, value [, u32 ttl]
+ *   GET, DEL       u16 key_len, key
+ *   FIN            empty
+ *   MSET           u16 count, count x (u16 key_len, key, u32 value_len, value)
+ *   MGET, MDEL     u16 count, count x (u16 key_len, key)
+ *   PUT            u16 key_len, key, u32 value_len, value [, u32 ttl]
+ *   CAS            u16 key_len, key, u32 value_len, value, u64 version
+ *                  [, u32 ttl]
+ *   INCR, DECR     u16 key_len, key, u64 delta
+ *   APPEND         u16 key_len, key, u32 value_len, value
+ *   GETS           u16 key_len, key
+ *   GETRANGE       u16 key_len, key, u32 offset, u32 length
+ *   PUTCHUNK       u32 upload_id, u16 key_len, key, u32 value_len,
+ *                  u32 offset, u32 length, length bytes [, u32 ttl]
+ *   SCAN           u8 flags, u16 count, u16 from_len, from, u16 to_len, to
+ *   PREFIX         u8 flags, u16 count, u16 prefix_len, prefix,
+ *                  u16 after_len, after
+ *   No request takes bytes past its last field, SET, MSET, PUT, CAS and
+ *   PUTCHUNK take no empty key; either is KV_ST_BADREQ
+ *
+ * Reply body
+ *   GET            u32 value_len, value when status is KV_ST_SUCCESS
+ *   GETS           u32 value_len, value, u64 version on success
+ *   GET, GETS      u32 value_len, u64 version with KV_ST_NOSPACE, the
+ *                  value does not fit one datagram
+ *   GETRANGE       u64 version, u32 value_len, u32 length, length
+ *                  bytes from offset on success
+ *   PUTCHUNK       u32 bytes received [, u64 version once complete]
+ *   SCAN, PREFIX   u8 more, u16 count, count x (u16 key_len, key)
+ *   PUT, CAS,      u64 version of the new value on success
+ *   APPEND
+ *   INCR, DECR     u64 new value on success
+ *   MSET, MDEL     u16 count, count x (u8 status)
+ *   MGET           u16 count, count x (u8 status [, u32 value_len, value])
+ *   others         empty
+ *
+ * Keys and values are length prefixed, so they may hold spaces and
+ * binary bytes. A ttl is in seconds, the key never expires without it
+ * or when it is 0. SET never replaces a key (KV_ST_EXISTS), PUT does.
+ * CAS replaces the value only while the key still has the version GETS
+ * returned, KV_ST_EXISTS when it changed and KV_ST_NOEXIST when it is
+ * gone. INCR and DECR need a decimal value, KV_ST_FAIL otherwise.
+ *
+ * Values bigger than one datagram move in chunks of at most
+ * KV_PROTO_CHUNK bytes. A reader gets KV_ST_NOSPACE with the length
+ * from GET and then asks for the value in ranges, starting over when
+ * the version changes between two ranges. A writer sends PUTCHUNKs
+ * in order under one upload id, each one acknowledged before the
+ * next; the last one stores the value as a PUT would.
+ *
+ * SCAN lists the keys from <= key < to in byte order, PREFIX the keys
+ * starting with prefix, at most count of them per reply (KV_ST_FAIL
+ * when the Server keeps no ordered index). With more set the client
+ * asks again with KV_SCAN_AFTER and the last key it got, as from for
+ * SCAN and as after for PREFIX. KV_SCAN_OPEN drops the upper bound of
+ * SCAN, an empty from starts at the first key.
+ *
+ * Over TCP every request and every reply, text or binary, is preceded
+ * by its length as a u32 (KV_PROTO_FRAME_LEN bytes, not counted) and
+ * is otherwise the datagram it would be over UDP, at most
+ * KV_PROTO_MAX_DATAGRAM bytes. Replies come in request order.
+ *
+ * A text command may start with "#<id> ", a decimal u32 request id
+ * that the reply then starts with too. Over UDP a client resends a
+ * request it got no reply for under the same request id, binary or
+ * text. The Server answers a resent SET, DEL, MSET, MDEL, PUT, CAS,
+ * INCR, DECR, APPEND or PUTCHUNK with the reply it kept from the first
+ * time instead of running it again; other requests are simply run
+ * again.
+ *
+ * A Server started with --psk only takes sealed requests and seals its
+ * replies (ChaCha20-Poly1305, Common/kv_crypto.h). A sealed datagram
+ * wraps a whole datagram of either framing:
+ *
+ *   0       magic   KV_PROTO_SEALED
+ *   1..16   salt    u64 unix time in ms the client picked it, then
+ *                   8 random bytes; the session key is
+ *                   HChaCha20(psk, salt)
+ *   17..24  counter u64, 1 for the first request of a session and one
+ *                   more for every request sent, resends included
+ *   25..    the datagram encrypted, then a 16 byte tag
+ *
+ * The nonce is a u32 direction (0 request, 1 reply) and the counter,
+ * the first KV_PROTO_SEAL_HDR bytes are authenticated with the
+ * datagram. A reply has the salt of its request and a counter the
+ * Server takes for it, never used for another reply. The Server takes
+ * a counter of a session once and within KV_PROTO_REPLAY_WINDOW of the
+ * highest one seen, whichever worker or transport it arrives on, so a
+ * datagram cannot be replayed. A salt opens a session only while it is
+ * young and newer than the Server (Server/kv_session.h): a client picks
+ * a new one when it has to resend. Inside, a datagram is at most
+ * KV_PROTO_MAX_PAYLOAD bytes, sealed or not.
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_PROTO_H
+#define KV_PROTO_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define KV_PROTO_MAGIC   0xB5
+#define KV_PROTO_VERSION 1
+#define KV_PROTO_HDR_LEN 8
+
+/* Largest UDP payload over IPv4*/
+#define KV_PROTO_MAX_DATAGRAM 65507
+
+#define KV_PROTO_SEALED  0xB6
+#define KV_PROTO_SEAL_HDR 25
+/* header and tag of a sealed datagram*/
+#define KV_PROTO_SEAL_OVERHEAD (KV_PROTO_SEAL_HDR + 16)
+/* largest request or reply, leaves room to seal it*/
+#define KV_PROTO_MAX_PAYLOAD (KV_PROTO_MAX_DATAGRAM - KV_PROTO_SEAL_OVERHEAD)
+/* counters accepted below the highest one of a session*/
+#define KV_PROTO_REPLAY_WINDOW 64
+/* length prefix of a request or reply on a TCP connection*/
+#define KV_PROTO_FRAME_LEN 4
+/* longest "#<id> " prefix of a text request or reply*/
+#define KV_PROTO_TEXT_ID_MAX 12
+/* value bytes per GETRANGE or PUTCHUNK, leaves room for header and key*/
+#define KV_PROTO_CHUNK 65000
+
+/* opcodes*/
+#define KV_OP_SET    1
+#define KV_OP_GET    2
+#define KV_OP_DEL    3
+#define KV_OP_FIN    4
+#define KV_OP_MSET   5
+#define KV_OP_MGET   6
+#define KV_OP_MDEL   7
+#define KV_OP_PUT    8
+#define KV_OP_CAS    9
+#define KV_OP_INCR   10
+#define KV_OP_DECR   11
+#define KV_OP_APPEND 12
+#define KV_OP_GETS   13
+#define KV_OP_GETRANGE 14
+#define KV_OP_PUTCHUNK 15
+#define KV_OP_SCAN   16
+#define KV_OP_PREFIX 17
+
+/* SCAN and PREFIX flags*/
+#define KV_SCAN_AFTER 0x1   /* resume past the given key*/
+#define KV_SCAN_OPEN  0x2   /* SCAN has no upper bound, to is ignored*/
+
+/* reply status codes*/
+#define KV_ST_SUCCESS 0
+#define KV_ST_EXISTS  1
+#define KV_ST_NOEXIST 2
+#define KV_ST_MAXLMT  3
+#define KV_ST_FAIL    4
+#define KV_ST_NOSPACE 5
+#define KV_ST_BADREQ  6
+/* client side only, never sent: no reply after all retransmits*/
+#define KV_ST_TIMEOUT 7
+/* update sent to a read replica, send it to the primary*/
+#define KV_ST_READONLY 8
+
+/* read position in a received datagram, never moves past end*/
+struct kv_proto_cursor{
+    const unsigned char *p;
+    const unsigned char *end;
+    int error;
+};
+
+static inline const char *kv_proto_status_str(int status)
+{
+    switch (status)
+    {
+        case KV_ST_SUCCESS: return "SUCCESS";
+        case KV_ST_EXISTS:  return "EXISTS";
+        case KV_ST_NOEXIST: return "NOEXIST";
+        case KV_ST_MAXLMT:  return "MAXLMT";
+        case KV_ST_FAIL:    return "FAIL";
+        case KV_ST_NOSPACE: return "NOSPACE";
+        case KV_ST_TIMEOUT: return "TIMEOUT";
+        case KV_ST_READONLY: return "READONLY";
+        default:            return "BADREQ";
+    }
+}
+
+/* time a salt was picked, unix ms*/
+static inline uint64_t kv_proto_salt_time(const unsigned char *salt)
+{
+    uint64_t t = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        t = t << 8 | salt[i];
+    return t;
+}
+
+static inline unsigned char *kv_proto_put_u16(unsigned char *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+    return p + 2;
+}
+
+static inline unsigned char *kv_proto_put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+static inline unsigned char *kv_proto_put_u64(unsigned char *p, uint64_t v)
+{
+    p = kv_proto_put_u32(p, v >> 32);
+    return kv_proto_put_u32(p, v);
+}
+
+static inline unsigned char *kv_proto_put_bytes(unsigned char *p, const void *src, size_t len)
+{
+    memcpy(p, src, len);
+    return p + len;
+}
+
+/* Function: kv_proto_put_header() - To write the 8 byte header
+ * in parameters:
+ *   p - start of the datagram
+ *   opcode - KV_OP_*
+ *   status - KV_ST_* for replies, 0 for requests
+ *   req_id - request id
+ *
+ * return:
+ *   pointer right after the header
+ */
+static inline unsigned char *kv_proto_put_header(unsigned char *p, int opcode,
+                                                 int status, uint32_t req_id)
+{
+    p[0] = KV_PROTO_MAGIC;
+    p[1] = KV_PROTO_VERSION;
+    p[2] = opcode;
+    p[3] = status;
+    return kv_proto_put_u32(p + 4, req_id);
+}
+
+static inline void kv_proto_cursor_init(struct kv_proto_cursor *c, const void *buf, size_t len)
+{
+    c->p = buf;
+    c->end = c->p + len;
+    c->error = 0;
+}
+
+static inline int kv_proto_check(struct kv_proto_cursor *c, size_t len)
+{
+    if (c->error || (size_t)(c->end - c->p) < len)
+    {
+        c->error = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* a request must end where its last field does, extra bytes are an error*/
+static inline void kv_proto_expect_end(struct kv_proto_cursor *c)
+{
+    if (c->p != c->end)
+        c->error = 1;
+}
+
+static inline uint8_t kv_proto_get_u8(struct kv_proto_cursor *c)
+{
+    if (!kv_proto_check(c, 1))
+        return 0;
+    return *c->p++;
+}
+
+static inline uint16_t kv_proto_get_u16(struct kv_proto_cursor *c)
+{
+    uint16_t v;
+
+    if (!kv_proto_check(c, 2))
+        return 0;
+    v = (uint16_t)(c->p[0] << 8 | c->p[1]);
+    c->p += 2;
+    return v;
+}
+
+static inline uint32_t kv_proto_get_u32(struct kv_proto_cursor *c)
+{
+    uint32_t v;
+
+    if (!kv_proto_check(c, 4))
+        return 0;
+    v = (uint32_t)c->p[0] << 24 | (uint32_t)c->p[1] << 16 |
+        (uint32_t)c->p[2] << 8 | c->p[3];
+    c->p += 4;
+    return v;
+}
+
+static inline uint64_t kv_proto_get_u64(struct kv_proto_cursor *c)
+{
+    uint64_t hi = kv_proto_get_u32(c);
+
+    return hi << 32 | kv_proto_get_u32(c);
+}
+
+/* returns a pointer into the datagram, no copy*/
+static inline const char *kv_proto_get_bytes(struct kv_proto_cursor *c, size_t len)
+{
+    const char *v;
+
+    if (!kv_proto_check(c, len))
+        return NULL;
+    v = (const char *)c->p;
+    c->p += len;
+    return v;
+}
+
+#endif /* KV_PROTO_H */
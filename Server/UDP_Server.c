@@ -2,38 +2,124 @@
  * 
  * Implementation of Server Client UDP communication
  * - Server receives key and value from Client
- *   Stores it in temporary buffer
- *   --set <key> <value>
+ *   Stores it in temporary buffer, dropped after <ttl> seconds if given
+ *   --set <key> <value> [<ttl>]
  * - Client retrieves the value when it sends the key
  *   --get <key>
  * - Client Deletes entry based on key supplied
  *   --del <key>
+ * - Read-modify-write commands, one datagram each
+ *   --put <key> <value> [<ttl>]            set or overwrite
+ *   --cas <key> <value> <version> [<ttl>]  overwrite if unchanged
+ *   --incr <key> <delta>, --decr <key> <delta>
+ *   --append <key> <value>
+ *   --gets <key>                           value and version for --cas
+ * - Multi-key commands, one packed reply line per key
+ *   --mset <key> <value> [<key> <value> ...]
+ *   --mget <key> [<key> ...]
+ *   --mdel <key> [<key> ...]
+ * - Same commands in the binary framing of Common/kv_proto.h,
+ *   detected per datagram by its first byte
+ * - Values go up to KV_MAX_VALUE. A get is sent straight from the
+ *   pinned item with scatter/gather iovecs; a value bigger than one datagram
+ *   is read with binary GETRANGE and written with binary PUTCHUNK
+ * - With --snapshot <file> the store is reloaded from the file at
+ *   startup and written back on --fin, on SIGUSR1 and every
+ *   --snapshot-interval seconds
+ * - With --aof <file> every set and del is logged before or shortly
+ *   after it is acknowledged (--aof-fsync) and the log is replayed at
+ *   startup instead of the snapshot
+ * - Logging is asynchronous and leveled (kv_log.h), --loglevel sets
+ *   the level at startup and, as a text command, at runtime
+ *   --loglevel error|warn|info|debug
+ * - Per-op counters, service time histograms, memory and batch usage
+ *   are returned by the text command
+ *   --stats
+ * - --max-keys and --max-memory bound the store, a full store answers
+ *   MAXLMT unless --eviction clock drops unreferenced keys instead
+ * - With --index ordered keys are also kept in order, listed a page
+ *   at a time by
+ *   --scan <from> <to> [<count> [<after>]]
+ *   --prefix <prefix> [<count> [<after>]]
+ * - Datagrams go through a pluggable I/O backend (kv_io.h), --io
+ *   blocking uses recvmmsg/sendmmsg, --io uring a per worker io_uring
+ *   with multishot receive into a provided buffer ring
+ * - With --tcp <port> the same commands are also served over TCP,
+ *   each one framed by its length (kv_tcp.h); a connection may
+ *   pipeline requests and gets the replies in order
+ * - A UDP request resent by the client under the same request id gets
+ *   the reply kept from its first run (kv_dedup.h) when it changes
+ *   the store, --dedup <N> replies kept per worker, 0 turns it off
+ * - With --psk <file> requests and replies are sealed with
+ *   ChaCha20-Poly1305 under per client session keys; one replay
+ *   window per client is shared by all workers (kv_session.h), and
+ *   a worker opens and seals the datagrams of a batch together
+ * - With --repl-listen <port> sets and dels are streamed to read
+ *   replicas started with --replica-of <ip>:<port> (kv_repl.h); a
+ *   replica serves reads and answers READONLY to updates
+ * - Key lookups probe a group of slots at once with the widest of
+ *   AVX2, SSE2 or plain 64-bit words the CPU runs (kv_probe.h),
+ *   --probe auto|scalar|sse2|avx2 forces one
  *
  * Author: Kapil
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h> 
 #include <stdlib.h> 
 #include <unistd.h> 
 #include <string.h> 
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h> 
+#include <sys/uio.h>
 #include <sys/socket.h> 
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
 
-#define MAXINPUT 1024 
+#include "kv_store.h"
+#include "kv_snapshot.h"
+#include "kv_aof.h"
+#include "kv_log.h"
+#include "kv_stats.h"
+#include "kv_upload.h"
+#include "kv_io.h"
+#include "kv_tcp.h"
+#include "kv_dedup.h"
+#include "kv_session.h"
+#include "kv_repl.h"
+#include "kv_parse.h"
+#include "kv_probe.h"
+#include "../Common/kv_crypto.h"
+#include "../Common/kv_proto.h"
+
+/* Largest reply, bound for packed multi-key replies; sealed it still
+   fits one datagram*/
+#define MAXREPLY KV_PROTO_MAX_PAYLOAD
+/* text replies leave room for a "#<id> " prefix*/
+#define MAXTEXTREPLY (MAXREPLY - KV_PROTO_TEXT_ID_MAX)
+/* socket buffers, room for a batch of full size datagrams*/
+#define SOCK_BUF_SIZE (4 * 1024 * 1024)
 #define ONEMILLION 1000000
 
-/* splitting the string based on " " token*/
-#define STRING_SPLIT(buffer,key, split_str) split_str = strtok(&buffer[6]," ");\
-                                            strncpy(key,split_str,strlen(split_str));\
-                                            key[strlen(split_str)]='\0';
+/* Max number of worker threads for --threads*/
+#define MAX_THREADS 256
+/* Lock stripes per worker thread*/
+#define SHARDS_PER_THREAD 4
+
+/* Interval of the expiry thread, the timing wheels tick in seconds*/
+#define EXPIRE_TICK_MS 100
 
-/* return status codes*/
-#define FAILURE -1
-#define ENTRY_EXIST 1
-#define SUCCESS 0
+/* Datagrams taken from the I/O backend at once, --batch*/
+#define DEFAULT_BATCH 32
+#define MAX_BATCH 1024
+
+/* Keys per --scan/--prefix page, default and max; a full page of the
+   longest keys still about fits one datagram*/
+#define SCAN_PAGE 100
+#define SCAN_MAX_PAGE 256
 
 #define IPADDR 1
 #define PORTNUM 2
@@ -41,51 +127,328 @@
 #define MIN_PORTNO 1
 #define MAX_PORTNO 65535
 
-/* linked list for storing key-value pair*/
-struct node{
-    char *key;
-    char *value;
-    struct node *next;
+/* value sent from a pinned store item, the reply buffer holds what
+   goes before it (split bytes) and after it*/
+struct reply_value{
+    const struct kv_item *item;     /* NULL when the reply is all in the buffer*/
+    uint32_t offset;                /* first value byte sent*/
+    uint32_t length;                /* value bytes sent*/
+    int split;
+};
+
+/* --psk: how to seal the reply of a request, taken from the request*/
+struct seal_ctx{
+    int ok;                         /* authentic and not a replay*/
+    unsigned char key[KV_CRYPTO_KEY];
+    unsigned char hdr[KV_PROTO_SEAL_HDR];
+};
+
+/* per worker thread context, each worker owns one socket: a UDP
+   socket, or a TCP listener for the workers of --tcp*/
+struct worker{
+    pthread_t tid;
+    int id;
+    int sockfd;
+    struct kv_store *store;
+    const char *io_name;            /* backend in use, set once it is up*/
+    struct kv_dedup dedup;          /* UDP workers only*/
+    /* written by this worker only, read by --stats*/
+    struct kv_stats stats;
+    /* TCP workers only: event loop, reply of the request in flight*/
+    struct kv_tcp_loop tcp;
+    char *reply;
+    struct reply_value value;
+    struct seal_ctx seal;
+    unsigned char *sealed;
 };
 
 /* Function prototypes */
-int find_entry(struct node **head, char *, int length, char *value);
-int add_entry(struct node** head, char* key, int key_len, char* value, int value_len); 
-int del_entry(struct node **head, char *key, int length);
-void del_all_entry(struct node **head);
 void error(char *msg);
 int validate_ip_addr(char *ip_addr);
+int open_server_socket(struct sockaddr_in *serv_addr, int reuseport);
+int dispatch_request(struct kv_store *store, const struct sockaddr_in *from, char *buffer,
+                     int length, char *reply, struct reply_value *rv, int *fin,
+                     struct kv_stats *stats, struct kv_dedup *dedup);
+int handle_request(struct kv_store *store, const struct kv_request *req, int parsed,
+                   char *reply, struct reply_value *rv, struct kv_stats *stats);
+int handle_multi_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                         struct kv_stats *stats);
+int handle_update_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                          struct reply_value *rv, struct kv_stats *stats);
+int handle_binary_request(struct kv_store *store, const struct sockaddr_in *from,
+                          const char *buffer, int length, char *reply,
+                          struct reply_value *rv, int *fin, struct kv_stats *stats);
+int handle_chunk_request(struct kv_store *store, const struct sockaddr_in *from,
+                         struct kv_proto_cursor *c, unsigned char **out);
+int handle_scan_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                        struct kv_stats *stats);
+int handle_binary_scan(struct kv_store *store, int opcode, struct kv_proto_cursor *c,
+                       unsigned char **out, unsigned char *out_end);
+static int scan_page(struct kv_store *store, const struct kv_scan_range *range, int count,
+                     struct kv_scan_key ***keys);
+static void prefix_range(struct kv_scan_range *range, const char *prefix, int len, char *end);
+int handle_stats(struct kv_store *store, char *reply);
+static int binary_status(int status, int missing);
+static int request_id(const char *buffer, int length, uint32_t *req_id);
+static int request_mutates(int opcode);
+static uint64_t now_ns(void);
+void *worker_main(void *arg);
+void *tcp_main(void *arg);
+static int tcp_request(void *arg, const struct sockaddr_in *from, char *req, int len,
+                       struct kv_io_reply *out);
+static void tcp_release(void *arg);
+static void tcp_commit(void *arg);
+static void reply_iov(struct kv_io_reply *out, char *reply, int reply_len,
+                      const struct reply_value *rv);
+static void open_sealed(struct kv_io_msg *msgs, int num, struct seal_ctx *seals,
+                        struct kv_crypto_op *ops, struct kv_stats *stats);
+static int seal_reply(const struct seal_ctx *seal, struct kv_io_reply *out, unsigned char *sealed,
+                      struct kv_crypto_op *op);
+static uint64_t seal_counter(const unsigned char *buf);
+void *expire_main(void *arg);
+void stop_workers(void);
+void print_batch_stats(void);
+void usage(char *prog);
+size_t parse_size(const char *str);
+static int parse_addr(const char *str, struct sockaddr_in *addr);
+static int readonly_reply(const char *buffer, int id_len, int opcode, uint32_t req_id,
+                          char *reply);
+
+/* set once --fin is received, read by all workers*/
+static int server_stop;
+static struct worker *workers;
+static int num_workers = 1;
+/* --tcp, as many event loops as UDP workers*/
+static struct worker *tcp_workers;
+static int num_tcp_workers;
+static int batch_size = DEFAULT_BATCH;
+static int io_backend = KV_IO_BLOCKING;
+static int dedup_entries = KV_DEDUP_DEFAULT;
+/* --psk, requests must be sealed*/
+static int sealed;
+static unsigned char psk[KV_CRYPTO_KEY];
+/* one replay window per client whichever worker its datagrams reach*/
+static struct kv_sessions sessions;
+static uint64_t server_start_ns;
 
 /** Functions **/
 
 /* main function*/
 int main(int argc, char **argv) 
 { 
-    int sockfd; 
     int portno;
-    int num_bytes;
-    int key_len;
-    int value_len;
-    int status = FAILURE;
-    int entry_count = 0;
     int count = 1;
-    char buffer[MAXINPUT]; 
-    char *ip_addr;
-    char *port_num;
-    char key[257];
-    char value[257];
+    int i;
+    char *ip_addr = NULL;
+    char *port_num = NULL;
     char *split_str;
-    char msg[]="SUCCESS";
-    struct node* head = NULL;
+    struct kv_store store;
+    struct kv_slab_stats slab_stats;
     struct sockaddr_in serv_addr;
-    struct sockaddr_in cli_addr; 
-    unsigned int len;
+    char *snapshot_path = NULL;
+    unsigned int snapshot_interval = 0;
+    char *aof_path = NULL;
+    int aof_policy = KV_AOF_INTERVAL;
+    unsigned int aof_interval = 1000;
+    size_t max_keys = ONEMILLION;
+    size_t max_memory = 0;
+    int evict = KV_EVICT_NONE;
+    int ordered = 0;
+    int probe = KV_PROBE_AUTO;
+    int tcp_port = 0;
+    int repl_port = 0;
+    char *replica_of = NULL;
+    struct sockaddr_in repl_addr;
+    size_t repl_backlog = KV_REPL_BACKLOG_DEFAULT;
+    struct kv_tcp_handler tcp_handler = { tcp_request, tcp_release, tcp_commit, NULL };
+    long loaded;
+    uint64_t start_ns;
+    pthread_t expire_tid;
+    sigset_t sigusr1;
 
     /*validate input parameters*/
-    if (argc != 2) 
+    if (argc < 2 || argc % 2 != 0) 
+    {
+        usage(argv[0]);
+    }
+
+    for (i = 2; i < argc; i += 2)
+    {
+        if (strncmp(argv[i],"--threads",9)==0)
+        {
+            num_workers = atoi(argv[i+1]);
+            if (num_workers < 1 || num_workers > MAX_THREADS)
+            {
+                error("--threads must be between 1 and 256");
+            }
+        }
+        else if (strncmp(argv[i],"--batch",7)==0)
+        {
+            batch_size = atoi(argv[i+1]);
+            if (batch_size < 1 || batch_size > MAX_BATCH)
+            {
+                error("--batch must be between 1 and 1024");
+            }
+        }
+        else if (strcmp(argv[i],"--tcp")==0)
+        {
+            tcp_port = atoi(argv[i+1]);
+            if (tcp_port < MIN_PORTNO || tcp_port > MAX_PORTNO)
+            {
+                error("--tcp port number invalid");
+            }
+        }
+        else if (strcmp(argv[i],"--repl-listen")==0)
+        {
+            repl_port = atoi(argv[i+1]);
+            if (repl_port < MIN_PORTNO || repl_port > MAX_PORTNO)
+            {
+                error("--repl-listen port number invalid");
+            }
+        }
+        else if (strcmp(argv[i],"--replica-of")==0)
+        {
+            replica_of = argv[i+1];
+            if (parse_addr(replica_of, &repl_addr) != SUCCESS)
+            {
+                error("--replica-of must be <ipaddress>:<port>");
+            }
+        }
+        else if (strcmp(argv[i],"--repl-backlog")==0)
+        {
+            repl_backlog = parse_size(argv[i+1]);
+            if (repl_backlog < KV_REPL_BACKLOG_MIN)
+            {
+                error("--repl-backlog must be at least 4M");
+            }
+        }
+        else if (strcmp(argv[i],"--dedup")==0)
+        {
+            dedup_entries = atoi(argv[i+1]);
+            if (dedup_entries < 0)
+            {
+                error("--dedup must be 0 or more");
+            }
+        }
+        else if (strcmp(argv[i],"--psk")==0)
+        {
+            if (kv_crypto_load_psk(argv[i+1], psk) != 0)
+            {
+                error("--psk file must hold a 32 byte key as 64 hex digits");
+            }
+            sealed = 1;
+        }
+        else if (strcmp(argv[i],"--io")==0)
+        {
+            io_backend = kv_io_parse_backend(argv[i+1]);
+            if (io_backend < 0)
+            {
+                error("--io must be blocking or uring");
+            }
+        }
+        else if (strcmp(argv[i],"--snapshot-interval")==0)
+        {
+            snapshot_interval = atoi(argv[i+1]);
+        }
+        else if (strcmp(argv[i],"--snapshot")==0)
+        {
+            snapshot_path = argv[i+1];
+        }
+        else if (strcmp(argv[i],"--loglevel")==0)
+        {
+            if (kv_log_parse_level(argv[i+1]) < 0)
+            {
+                error("--loglevel must be error, warn, info or debug");
+            }
+            kv_log_set_level(kv_log_parse_level(argv[i+1]));
+        }
+        else if (strcmp(argv[i],"--max-keys")==0)
+        {
+            max_keys = parse_size(argv[i+1]);
+            if (max_keys < 1)
+            {
+                error("--max-keys must be at least 1");
+            }
+        }
+        else if (strcmp(argv[i],"--max-memory")==0)
+        {
+            max_memory = parse_size(argv[i+1]);
+            if (max_memory < KV_SLAB_PAGE_SIZE)
+            {
+                error("--max-memory must be at least 1M");
+            }
+        }
+        else if (strcmp(argv[i],"--eviction")==0)
+        {
+            if (strcmp(argv[i+1],"clock")==0)
+            {
+                evict = KV_EVICT_CLOCK;
+            }
+            else if (strcmp(argv[i+1],"none")==0)
+            {
+                evict = KV_EVICT_NONE;
+            }
+            else
+            {
+                error("--eviction must be none or clock");
+            }
+        }
+        else if (strcmp(argv[i],"--index")==0)
+        {
+            if (strcmp(argv[i+1],"ordered")==0)
+            {
+                ordered = 1;
+            }
+            else if (strcmp(argv[i+1],"none")!=0)
+            {
+                error("--index must be none or ordered");
+            }
+        }
+        else if (strcmp(argv[i],"--probe")==0)
+        {
+            probe = kv_probe_parse(argv[i+1]);
+            if (probe < 0)
+            {
+                error("--probe must be auto, scalar, sse2 or avx2");
+            }
+        }
+        else if (strcmp(argv[i],"--aof")==0)
+        {
+            aof_path = argv[i+1];
+        }
+        else if (strcmp(argv[i],"--aof-fsync")==0)
+        {
+            if (strcmp(argv[i+1],"always")==0)
+            {
+                aof_policy = KV_AOF_ALWAYS;
+            }
+            else if (strcmp(argv[i+1],"os")==0)
+            {
+                aof_policy = KV_AOF_OS;
+            }
+            else
+            {
+                aof_policy = KV_AOF_INTERVAL;
+                aof_interval = atoi(argv[i+1]);
+                if (aof_interval < 1)
+                {
+                    error("--aof-fsync must be always, os or a number of ms");
+                }
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (snapshot_interval > 0 && NULL == snapshot_path)
+    {
+        error("--snapshot-interval needs --snapshot");
+    }
+    if (repl_port > 0 && replica_of != NULL)
     {
-        printf("usage: %s <ipaddress>:<port>\n", argv[0]);
-        error("Incorrect Input");
+        error("--repl-listen and --replica-of exclude each other");
     }
 
     /*Separating ipaddr and portno from <ipaddr>:<portno> format*/    
@@ -133,373 +496,2105 @@ int main(int argc, char **argv)
         }
     }
 
-    printf("\nPort number:%d, ipaddr:%s",portno, ip_addr);
+    /* SIGUSR1 is taken by the snapshot thread alone: blocked before
+       the first thread, every thread inherits the mask*/
+    if (snapshot_path != NULL)
+    {
+        sigemptyset(&sigusr1);
+        sigaddset(&sigusr1, SIGUSR1);
+        if (pthread_sigmask(SIG_BLOCK, &sigusr1, NULL) != 0)
+        {
+            error("Blocking SIGUSR1 failed");
+        }
+    }
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) 
+    if (kv_log_start(stdout) != SUCCESS)
     {
-        error("Opening socket");
+        error("Log thread creation failed");
+    }
+    KV_LOG(KV_LOG_INFO, "Port number:%d, ipaddr:%s", portno, ip_addr);
+
+    /* single worker keeps one shard, more workers get lock stripes*/
+    if (kv_store_init(&store, num_workers > 1 ? num_workers * SHARDS_PER_THREAD : 1,
+                      max_keys) != SUCCESS)
+    {
+        error("Store allocation failed");
+    }
+    kv_store_set_limits(&store, max_memory, evict);
+    if (kv_store_set_probe(&store, probe) != SUCCESS)
+    {
+        error("--probe names a version this CPU cannot run");
+    }
+    KV_LOG(KV_LOG_INFO, "Key lookup: %s", kv_probe_name(store.probe_impl));
+    /* before loading, loaded keys are indexed too*/
+    kv_store_set_ordered(&store, ordered);
+
+    /* the log holds every acknowledged mutation, the snapshot may be older*/
+    server_start_ns = start_ns = now_ns();
+    if (aof_path != NULL)
+    {
+        loaded = kv_aof_replay(&store, aof_path);
+        if (loaded < 0)
+        {
+            error("Append-only log is corrupt");
+        }
+        KV_LOG(KV_LOG_INFO, "Replayed %ld records from %s in %.1f ms", loaded, aof_path,
+               (now_ns() - start_ns) / 1e6);
+    }
+    else if (snapshot_path != NULL)
+    {
+        loaded = kv_snapshot_load(&store, snapshot_path);
+        if (loaded < 0)
+        {
+            error("Snapshot file is corrupt");
+        }
+        KV_LOG(KV_LOG_INFO, "Loaded %ld keys from %s in %.1f ms", loaded, snapshot_path,
+               (now_ns() - start_ns) / 1e6);
+    }
+
+    if (aof_path != NULL &&
+        kv_aof_open(&store, aof_path, aof_policy, aof_interval) != SUCCESS)
+    {
+        error("Opening append-only log failed");
+    }
+
+    /* after the log's journal hook is in place, replicas get what is logged*/
+    if (repl_port > 0)
+    {
+        memset(&repl_addr, 0, sizeof(repl_addr));
+        repl_addr.sin_family = AF_INET;
+        repl_addr.sin_addr.s_addr = inet_addr(ip_addr);
+        repl_addr.sin_port = htons(repl_port);
+        if (kv_repl_primary_start(&store, &repl_addr, repl_backlog) != SUCCESS)
+        {
+            error("Replication listen failed");
+        }
+        KV_LOG(KV_LOG_INFO, "Replication port number:%d", repl_port);
+    }
+    else if (replica_of != NULL &&
+             kv_repl_replica_start(&store, &repl_addr) != SUCCESS)
+    {
+        error("Replication thread creation failed");
+    }
+
+    if (snapshot_path != NULL)
+    {
+        if (kv_snapshot_start(&store, snapshot_path, snapshot_interval) != SUCCESS)
+        {
+            error("Snapshot thread creation failed");
+        }
     }
 
     memset(&serv_addr, 0, sizeof(serv_addr)); 
-    memset(&cli_addr, 0, sizeof(cli_addr)); 
 
     /* server IP config */
     serv_addr.sin_family = AF_INET; /* IPv4 */ 
     serv_addr.sin_addr.s_addr = inet_addr(ip_addr); 
     serv_addr.sin_port = htons(portno); 
-    
-    /* Bind the socket with the server address*/ 
-    if ( bind(sockfd, (const struct sockaddr *)&serv_addr, 
-                       sizeof(serv_addr)) < 0 ) 
-    { 
-        error("Bind failed"); 
-    } 
-    
-    len = sizeof(cli_addr);
 
-    /* Server receives commands set,get,del from Client */
-    do
+    if (sealed && kv_sessions_init(&sessions, psk) != SUCCESS)
     {
-        num_bytes = recvfrom(sockfd, (char *)buffer, MAXINPUT, 
-                    MSG_WAITALL, ( struct sockaddr *) &cli_addr, 
-                    &len); 
-        buffer[num_bytes] = '\0';
+        error("Session table allocation failed");
+    }
 
-        printf("\nClient UDP message received:%s\n", buffer); 
-        
-        /* Processing --set command from Client*/
-        if (strncmp(buffer,"--set",5)==0)
-        {
-            if (entry_count < ONEMILLION)
-            {
-                STRING_SPLIT(buffer,key, split_str);
-                
-                while (split_str != NULL)
-                {
-                    strncpy(value,split_str,strlen(split_str));
-                    value[strlen(split_str)]='\0';
-                    split_str = strtok (NULL, " ");
-                }
-                key_len = strlen(key);
-                value_len = strlen(value);
-                
-                /* Check if key exists in db before adding it*/
-                if (SUCCESS == find_entry(&head, key, key_len, value))
-                    status = ENTRY_EXIST;
-                else
-                    status = add_entry(&head, key, key_len, value, value_len);
-                
-                /* Adding appropriate status message for Client*/
-                if (status == FAILURE)
-                {
-                    printf("\nCommand --set FAILED");
-                    strcpy(msg,"FAIL");
-                }
-                else if (status == ENTRY_EXIST)
-                {
-                    printf("\nEntry in Server exists, --set Ignored");    
-                    strcpy(msg,"EXISTS");
-                }
-                else
-                {
-                    strcpy(msg,"SUCCESS");
-                    entry_count++;
-                }
-            }
-            else
-            {
-                strcpy(msg,"MAXLMT");
-                printf("\nMax limit reached for --set");
-            }
+    /* all sockets are bound before any worker runs, so a bind error
+       is reported at startup*/
+    workers = calloc(num_workers, sizeof(struct worker));
+    if (NULL == workers)
+    {
+        error("Worker allocation failed");
+    }
+    for (i = 0; i < num_workers; i++)
+    {
+        workers[i].id = i;
+        workers[i].store = &store;
+        workers[i].sockfd = open_server_socket(&serv_addr, num_workers > 1);
+    }
 
-            sendto(sockfd, (const char *)msg, strlen(msg), 
-                    MSG_CONFIRM, (const struct sockaddr *) &cli_addr, len);                
+    /* TCP loops share the store and the dispatcher with the UDP workers*/
+    if (tcp_port > 0)
+    {
+        num_tcp_workers = num_workers;
+        tcp_workers = calloc(num_tcp_workers, sizeof(struct worker));
+        if (NULL == tcp_workers)
+        {
+            error("Worker allocation failed");
         }
-        /* Processing --get command from Client*/
-        else if (strncmp(buffer,"--get",5)==0)
+        serv_addr.sin_port = htons(tcp_port);
+        for (i = 0; i < num_tcp_workers; i++)
         {
-            STRING_SPLIT(buffer,key, split_str);
-            
-            key_len = strlen(key);
-            status = find_entry(&head, key, key_len, value);    
-            if (status == FAILURE)
+            tcp_workers[i].id = i;
+            tcp_workers[i].store = &store;
+            tcp_workers[i].reply = malloc(MAXREPLY);
+            tcp_workers[i].sealed = malloc(KV_PROTO_MAX_DATAGRAM);
+            tcp_workers[i].sockfd = kv_tcp_listen(&serv_addr, num_tcp_workers > 1);
+            tcp_handler.arg = &tcp_workers[i];
+            if (NULL == tcp_workers[i].reply || NULL == tcp_workers[i].sealed ||
+                tcp_workers[i].sockfd < 0 ||
+                kv_tcp_init(&tcp_workers[i].tcp, tcp_workers[i].sockfd, &tcp_handler,
+                            &tcp_workers[i].stats) != SUCCESS)
             {
-                strcpy(value,"Key not found : ");
-                strcat(value, key);
+                error("TCP listen failed");
             }
-            sendto(sockfd, (const char *)value, strlen(value), 
-                    MSG_CONFIRM, (const struct sockaddr *) &cli_addr, len);            
         }
-        /* Processing --del command from Client*/
-        else if (strncmp(buffer,"--del",5)==0)
+        KV_LOG(KV_LOG_INFO, "TCP port number:%d", tcp_port);
+    }
+
+    for (i = 0; i < num_workers; i++)
+    {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0)
         {
-            STRING_SPLIT(buffer,key, split_str);
-            
-            key_len = strlen(key);
-            status = del_entry(&head, key, key_len);        
-            if (status == FAILURE)
-            {
-                strcpy(msg,"NOEXIST");
-                printf("\nEntry does not exists");
-            }
-            else
-            {
-                strcpy(msg,"SUCCESS");
-                entry_count--;
-            }
-            sendto(sockfd, (const char *)msg, strlen(msg), 
-                    MSG_CONFIRM, (const struct sockaddr *) &cli_addr, len);                
+            error("Worker thread creation failed");
         }
-        else if (strncmp(buffer,"--fin",5)==0)
+    }
+    for (i = 0; i < num_tcp_workers; i++)
+    {
+        if (pthread_create(&tcp_workers[i].tid, NULL, tcp_main, &tcp_workers[i]) != 0)
         {
-            strcpy(msg,"FIN");
-            sendto(sockfd, (const char *)msg, strlen(msg), 
-                    MSG_CONFIRM, (const struct sockaddr *) &cli_addr, len);                
+            error("Worker thread creation failed");
+        }
+    }
+    if (pthread_create(&expire_tid, NULL, expire_main, &store) != 0)
+    {
+        error("Expiry thread creation failed");
+    }
+
+    for (i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+        close(workers[i].sockfd);
+    }
+    for (i = 0; i < num_tcp_workers; i++)
+    {
+        pthread_join(tcp_workers[i].tid, NULL);
+        kv_tcp_free(&tcp_workers[i].tcp);
+        close(tcp_workers[i].sockfd);
+        free(tcp_workers[i].reply);
+        free(tcp_workers[i].sealed);
+    }
+    if (sealed)
+        kv_sessions_free(&sessions);
+    /* its deletes are logged, stop it before the log is closed*/
+    pthread_join(expire_tid, NULL);
 
-            /* Code execution should not reach here because validation 
-                is in place for cmd types*/
-            printf("FIN received");
+    /* restores the log's journal hook*/
+    kv_repl_stop();
+    kv_aof_close();
+    if (snapshot_path != NULL)
+    {
+        kv_snapshot_stop();
+        if (kv_snapshot_save(&store, snapshot_path) != SUCCESS)
+        {
+            KV_LOG(KV_LOG_ERROR, "Writing snapshot %s failed", snapshot_path);
         }
+    }
 
-    }while(strncmp(buffer,"--fin",5)!=0);
-    
-    del_all_entry(&head);
+    print_batch_stats();
+    kv_store_slab_stats(&store, &slab_stats);
+    kv_slab_print_stats(&slab_stats, stdout);
+    kv_upload_clear();
+    del_all_entry(&store);
+    kv_log_stop();
+    free(workers);
+    free(tcp_workers);
     free(ip_addr);
     free(port_num);
-    close(sockfd);
 
     return 0;
 } 
 
-/* Function: validate_ip_addr() - To validate IP addr 
- * in parameters: 
- *   ip_addr_in - IP addr to be validated
+/* Function: open_server_socket() - To create and bind a UDP socket
+ * in parameters:
+ *   serv_addr - address to bind to
+ *   reuseport - set SO_REUSEPORT so every worker binds the same port
  *
  * return:
- *   status of validation
+ *   socket fd, exits on failure
  */
-
-int validate_ip_addr(char *ip_addr_in)
+int open_server_socket(struct sockaddr_in *serv_addr, int reuseport)
 {
-    char *split_str;
-    int count = 0;
-    int temp_ip=0;
-    int status = 0;
-    char *ip_addr;
-
-    ip_addr = (char*)malloc(strlen(ip_addr_in)+1);
-    strncpy(ip_addr,ip_addr_in,strlen(ip_addr_in)+1);
-
-   /*Separating ipaddr based on <num>.<num>.<num>.<num> format*/    
-    split_str = strtok(ip_addr,".");
+    int sockfd;
+    int on = 1;
+    int buf_size = SOCK_BUF_SIZE;
 
-    while (split_str != NULL)
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) 
     {
-        status = FAILURE;
-
-        /* Only 3 dots in IP addr*/
-        if(count > 3)
-            break;
-
-        temp_ip = atoi(split_str);
-
-        if(temp_ip>=0 && temp_ip < 256)
-        {
-            status = SUCCESS;
-        }
-
-        split_str = strtok (NULL, ".");
-        count++;
- 
+        error("Opening socket");
     }
 
-    if (count < 4)
-        status = FAILURE;
+    /* kernel spreads datagrams over the sockets by source address hash*/
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        error("SO_REUSEPORT failed");
+    }
 
-    free(ip_addr);
-    return status;
-}
+    /* best effort, the kernel caps both at net.core.[rw]mem_max*/
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
 
+    /* Bind the socket with the server address*/ 
+    if ( bind(sockfd, (const struct sockaddr *)serv_addr, 
+                       sizeof(*serv_addr)) < 0 ) 
+    { 
+        error("Bind failed"); 
+    } 
 
-/* Function: error() - To print error message 
- * in parameters: 
- *   msg - message to be printed
- *
- * return:
- *   void
- */
-void error(char *msg) 
-{
-  printf("\nERROR:%s\n",msg);
-  exit(EXIT_FAILURE);
+    return sockfd;
 }
 
-/* Function: find_entry() - To find the if a key-value pair exists 
- * in parameters: 
- *   head - head of the linked list
- *   key - key value to be found in db
- *   length - length of the key
- *   value - value of the key
+/* Function: worker_main() - Request loop of one worker thread
+ * in parameters:
+ *   arg - struct worker of this thread
  *
  * return:
- *   status - status of the operation
+ *   NULL
  */
-int find_entry(struct node **head, char *key, int length, char *value)
+void *worker_main(void *arg)
 {
-  struct node *temp = *head;
-  int status = FAILURE;
-  
-  while(temp != NULL)
-  {
-    /* Check string length also to avoid sub-string match*/
-    if(strncmp(temp->key, key, length) == 0 && strlen(temp->key) == length)
+    struct worker *w = arg;
+    struct kv_io io;
+    struct kv_io_msg *msgs;
+    struct kv_io_reply *out;
+    struct reply_value *values;
+    struct seal_ctx *seals = NULL;
+    struct kv_crypto_op *ops = NULL;
+    unsigned char *sealed_replies = NULL;
+    char *replies;
+    char *reply;
+    int num_msgs;
+    int num_replies;
+    int reply_len;
+    int fin;
+    int i;
+
+    msgs = calloc(batch_size, sizeof(struct kv_io_msg));
+    out = calloc(batch_size, sizeof(struct kv_io_reply));
+    values = calloc(batch_size, sizeof(struct reply_value));
+    replies = malloc((size_t)batch_size * MAXREPLY);
+    if (!msgs || !out || !values || !replies ||
+        kv_dedup_init(&w->dedup, dedup_entries) != SUCCESS)
+    {
+        error("Worker buffer allocation failed");
+    }
+    if (sealed)
+    {
+        seals = calloc(batch_size, sizeof(struct seal_ctx));
+        ops = calloc(batch_size, sizeof(struct kv_crypto_op));
+        sealed_replies = malloc((size_t)batch_size * KV_PROTO_MAX_DATAGRAM);
+        if (!seals || !ops || !sealed_replies)
+        {
+            error("Worker buffer allocation failed");
+        }
+    }
+    /* created by the thread that submits to it*/
+    if (kv_io_open(&io, io_backend, w->sockfd, batch_size, &w->stats.io_syscalls) != SUCCESS)
+    {
+        error("Worker I/O setup failed");
+    }
+    __atomic_store_n(&w->io_name, io.ops->name, __ATOMIC_RELEASE);
+
+    /* Server receives commands set,get,del from Client */
+    while (!__atomic_load_n(&server_stop, __ATOMIC_ACQUIRE))
+    {
+        num_msgs = kv_io_recv(&io, msgs);
+        if (num_msgs <= 0)
+        {
+            /* woken by stop_workers(), a timeout or a transient error*/
+            continue;
+        }
+
+        kv_stats_batch(&w->stats, num_msgs);
+
+        /* the batch is decrypted at once, forged and replayed datagrams
+           are dropped without reply*/
+        if (sealed)
+            open_sealed(msgs, num_msgs, seals, ops, &w->stats);
+
+        /* whole batch runs against the store before any reply is sent*/
+        num_replies = 0;
+        fin = 0;
+        for (i = 0; i < num_msgs; i++)
+        {
+            reply = replies + (size_t)num_replies * MAXREPLY;
+            values[num_replies].item = NULL;
+            if (msgs[i].len < 0)
+                continue;
+
+            reply_len = dispatch_request(w->store, msgs[i].addr, msgs[i].buf, msgs[i].len,
+                                         reply, &values[num_replies], &fin, &w->stats,
+                                         &w->dedup);
+            if (reply_len < 0)
+                continue;
+
+            reply_iov(&out[num_replies], reply, reply_len, &values[num_replies]);
+            out[num_replies].addr = msgs[i].addr;
+            if (sealed)
+            {
+                seal_reply(&seals[i], &out[num_replies],
+                           sealed_replies + (size_t)num_replies * KV_PROTO_MAX_DATAGRAM,
+                           &ops[num_replies]);
+            }
+            num_replies++;
+        }
+        if (sealed)
+            kv_crypto_seal_batch(ops, num_replies);
+
+        /* with --aof-fsync always the batch's mutations must be on
+           disk before they are acknowledged*/
+        kv_aof_commit();
+        kv_repl_commit();
+
+        kv_io_send(&io, out, num_replies);
+
+        /* the kernel has copied the values, their items may go*/
+        for (i = 0; i < num_replies; i++)
+        {
+            if (values[i].item != NULL)
+                release_entry(w->store, values[i].item);
+        }
+
+        if (fin)
+        {
+            stop_workers();
+        }
+    }
+
+    kv_io_close(&io);
+    kv_dedup_free(&w->dedup);
+    if (sealed)
+    {
+        free(seals);
+        free(ops);
+        free(sealed_replies);
+    }
+    free(msgs);
+    free(out);
+    free(values);
+    free(replies);
+    return NULL;
+}
+
+/* Function: reply_iov() - To point a reply at its bytes
+ *   A value read from the store goes out from the item itself.
+ * in parameters:
+ *   out - reply to fill, address left to the caller
+ *   reply - reply buffer
+ *   reply_len - bytes in reply
+ *   rv - value filled in by dispatch_request()
+ *
+ * return:
+ *   void
+ */
+static void reply_iov(struct kv_io_reply *out, char *reply, int reply_len,
+                      const struct reply_value *rv)
+{
+    if (rv->item != NULL)
+    {
+        out->iov[0].iov_base = reply;
+        out->iov[0].iov_len = rv->split;
+        out->iov[1].iov_base = (char *)ITEM_VALUE(rv->item) + rv->offset;
+        out->iov[1].iov_len = rv->length;
+        out->iov[2].iov_base = reply + rv->split;
+        out->iov[2].iov_len = reply_len - rv->split;
+        out->iovcnt = 3;
+    }
+    else
+    {
+        out->iov[0].iov_base = reply;
+        out->iov[0].iov_len = reply_len;
+        out->iovcnt = 1;
+    }
+}
+
+/* Function: open_sealed() - To open the sealed datagrams of a batch
+ *   All of them are decrypted together. A datagram that is not sealed,
+ *   not authentic or a replay is dropped (len -1); the others are
+ *   decrypted in place and msgs then point at the datagram inside.
+ *   Sessions are looked up and opened only once the datagram proved
+ *   authentic.
+ * in parameters:
+ *   msgs - received datagrams
+ *   num - number of datagrams
+ *   seals - set to how the reply of each datagram is sealed
+ *   ops - scratch of num crypto ops
+ *   stats - stats of the worker, counts the dropped datagrams
+ *
+ * return:
+ *   void
+ */
+static void open_sealed(struct kv_io_msg *msgs, int num, struct seal_ctx *seals,
+                        struct kv_crypto_op *ops, struct kv_stats *stats)
+{
+    struct kv_crypto_op *op;
+    unsigned char *buf;
+    uint64_t now = kv_session_clock();
+    int map[MAX_BATCH];
+    int num_ops = 0;
+    int i;
+    int k;
+
+    for (i = 0; i < num; i++)
+    {
+        buf = (unsigned char *)msgs[i].buf;
+        seals[i].ok = 0;
+        if (msgs[i].len <= KV_PROTO_SEAL_OVERHEAD || buf[0] != KV_PROTO_SEALED)
+            continue;
+        if (!kv_session_fresh(&sessions, buf + 1, seal_counter(buf), now))
+            continue;
+
+        kv_session_key(&sessions, buf + 1, seals[i].key);
+        memcpy(seals[i].hdr, buf, KV_PROTO_SEAL_HDR);
+        op = &ops[num_ops];
+        op->key = seals[i].key;
+        memset(op->nonce, 0, 4);
+        memcpy(op->nonce + 4, buf + 17, 8);
+        op->aad = buf;
+        op->aad_len = KV_PROTO_SEAL_HDR;
+        op->data = buf + KV_PROTO_SEAL_HDR;
+        op->len = msgs[i].len - KV_PROTO_SEAL_OVERHEAD;
+        map[num_ops++] = i;
+    }
+
+    kv_crypto_open_batch(ops, num_ops);
+
+    for (k = 0; k < num_ops; k++)
+    {
+        i = map[k];
+        buf = (unsigned char *)msgs[i].buf;
+        /* only an authentic counter moves the window, and only once
+           across all workers*/
+        if (!ops[k].ok || kv_session_take(&sessions, buf + 1, seal_counter(buf), now) != SUCCESS)
+            continue;
+        seals[i].ok = 1;
+        msgs[i].buf += KV_PROTO_SEAL_HDR;
+        msgs[i].len -= KV_PROTO_SEAL_OVERHEAD;
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        if (!seals[i].ok)
+        {
+            msgs[i].len = -1;
+            KV_HIST_ADD(stats->seal_rejects, 1);
+        }
+    }
+}
+
+/* Function: seal_reply() - To lay out the sealed datagram of a reply
+ *   The reply, pinned value included, is copied after the salt of its
+ *   request and a reply counter of its own, so no two replies share a
+ *   nonce; kv_crypto_seal_batch() then encrypts it in place.
+ * in parameters:
+ *   seal - taken from the request
+ *   out - reply, set to the sealed datagram
+ *   sealed - buffer of KV_PROTO_MAX_DATAGRAM bytes
+ *   op - set up to seal the datagram
+ *
+ * return:
+ *   length of the sealed datagram
+ */
+static int seal_reply(const struct seal_ctx *seal, struct kv_io_reply *out, unsigned char *sealed,
+                      struct kv_crypto_op *op)
+{
+    size_t len = 0;
+    int i;
+
+    memcpy(sealed, seal->hdr, 17);
+    kv_proto_put_u64(sealed + 17, kv_session_reply_counter(&sessions));
+    for (i = 0; i < out->iovcnt; i++)
+    {
+        memcpy(sealed + KV_PROTO_SEAL_HDR + len, out->iov[i].iov_base, out->iov[i].iov_len);
+        len += out->iov[i].iov_len;
+    }
+
+    op->key = seal->key;
+    memset(op->nonce, 0, 4);
+    op->nonce[3] = 1;
+    memcpy(op->nonce + 4, sealed + 17, 8);
+    op->aad = sealed;
+    op->aad_len = KV_PROTO_SEAL_HDR;
+    op->data = sealed + KV_PROTO_SEAL_HDR;
+    op->len = len;
+
+    out->iov[0].iov_base = sealed;
+    out->iov[0].iov_len = KV_PROTO_SEAL_OVERHEAD + len;
+    out->iovcnt = 1;
+    return (int)out->iov[0].iov_len;
+}
+
+/* Function: seal_counter() - To read the counter of a sealed datagram*/
+static uint64_t seal_counter(const unsigned char *buf)
+{
+    uint64_t counter = 0;
+    int i;
+
+    for (i = 17; i < KV_PROTO_SEAL_HDR; i++)
+        counter = counter << 8 | buf[i];
+    return counter;
+}
+/* Function: tcp_main() - Event loop of one TCP worker thread
+ * in parameters:
+ *   arg - struct worker of this thread, loop set up by main()
+ *
+ * return:
+ *   NULL
+ */
+void *tcp_main(void *arg)
+{
+    struct worker *w = arg;
+
+    kv_tcp_run(&w->tcp);
+    return NULL;
+}
+
+/* Function: tcp_request() - To run one request read from a TCP connection
+ *   kv_tcp_handler request callback; the reply is copied by the loop
+ *   before tcp_release() unpins its value.
+ * in parameters:
+ *   arg - struct worker of the loop
+ *   from - client address
+ *   req - request
+ *   len - request length
+ *   out - set to the reply bytes
+ *
+ * return:
+ *   0, -1 if nothing is to be sent, -2 to close a connection whose
+ *   request does not open under --psk
+ */
+static int tcp_request(void *arg, const struct sockaddr_in *from, char *req, int len,
+                       struct kv_io_reply *out)
+{
+    struct worker *w = arg;
+    struct kv_io_msg msg = { req, len, from };
+    struct kv_crypto_op op;
+    int reply_len;
+    int fin = 0;
+
+    w->value.item = NULL;
+    if (sealed)
+    {
+        /* a stream loses nothing, a frame that does not open is not
+           from a client with the key*/
+        open_sealed(&msg, 1, &w->seal, &op, &w->stats);
+        if (msg.len < 0)
+            return -2;
+    }
+    reply_len = dispatch_request(w->store, from, msg.buf, msg.len, w->reply, &w->value, &fin,
+                                 &w->stats, NULL);
+    if (fin)
+    {
+        /* the loop still writes this reply before it stops*/
+        stop_workers();
+    }
+    if (reply_len < 0)
+        return -1;
+
+    reply_iov(out, w->reply, reply_len, &w->value);
+    out->addr = from;
+    if (sealed)
+    {
+        seal_reply(&w->seal, out, w->sealed, &op);
+        kv_crypto_seal_batch(&op, 1);
+    }
+    return 0;
+}
+
+static void tcp_release(void *arg)
+{
+    struct worker *w = arg;
+
+    if (w->value.item != NULL)
+        release_entry(w->store, w->value.item);
+    w->value.item = NULL;
+}
+
+static void tcp_commit(void *arg)
+{
+    (void)arg;
+    kv_aof_commit();
+    kv_repl_commit();
+}
+
+/* Function: expire_main() - Expiry thread
+ *   Drives the store clock and the timing wheels, keys nobody reads
+ *   again are dropped within a second of their expiry.
+ * in parameters:
+ *   arg - key-value store
+ *
+ * return:
+ *   NULL
+ */
+void *expire_main(void *arg)
+{
+    struct kv_store *store = arg;
+    struct timespec tick = { 0, EXPIRE_TICK_MS * 1000000L };
+    size_t dropped;
+
+    while (!__atomic_load_n(&server_stop, __ATOMIC_ACQUIRE))
+    {
+        dropped = kv_store_expire(store, (uint32_t)time(NULL));
+        if (dropped > 0)
+        {
+            KV_LOG(KV_LOG_DEBUG, "Expired %zu keys", dropped);
+            kv_repl_commit();
+        }
+        nanosleep(&tick, NULL);
+    }
+    return NULL;
+}
+
+/* Function: stop_workers() - To make every worker leave its loop
+ * in parameters:
+ *   none
+ *
+ * return:
+ *   void
+ */
+void stop_workers(void)
+{
+    int i;
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_RELEASE);
+
+    /* shutdown wakes up workers waiting for datagrams*/
+    for (i = 0; i < num_workers; i++)
+    {
+        shutdown(workers[i].sockfd, SHUT_RD);
+    }
+    for (i = 0; i < num_tcp_workers; i++)
+    {
+        kv_tcp_stop(&tcp_workers[i].tcp);
+    }
+}
+
+/* Function: print_batch_stats() - To print achieved batch sizes and syscalls
+ * in parameters:
+ *   none
+ *
+ * return:
+ *   void
+ */
+void print_batch_stats(void)
+{
+    struct worker *w;
+    int i;
+    int b;
+
+    for (i = 0; i < num_workers; i++)
+    {
+        w = &workers[i];
+        printf("\nworker %d: %s I/O, %llu batches, %llu datagrams, avg batch %.2f, %llu syscalls\n"
+               "batch size histogram:",
+               w->id, w->io_name ? w->io_name : "no", (unsigned long long)w->stats.recv_calls,
+               (unsigned long long)w->stats.recv_msgs,
+               w->stats.recv_calls ? (double)w->stats.recv_msgs / w->stats.recv_calls : 0.0,
+               (unsigned long long)w->stats.io_syscalls);
+        for (b = 0; b < KV_STAT_BATCH_BUCKETS; b++)
+        {
+            if (w->stats.batch_hist[b] != 0)
+                printf(" [%d-%d]:%llu", 1 << b, (2 << b) - 1,
+                       (unsigned long long)w->stats.batch_hist[b]);
+        }
+    }
+    for (i = 0; i < num_tcp_workers; i++)
+    {
+        w = &tcp_workers[i];
+        printf("\ntcp worker %d: %llu connections, %llu syscalls", w->id,
+               (unsigned long long)w->stats.tcp_accepted,
+               (unsigned long long)w->stats.io_syscalls);
+    }
+    printf("\n");
+}
+
+/* Function: parse_size() - To read a count with an optional K, M or G suffix
+ * in parameters:
+ *   str - number, e.g. "512M"
+ *
+ * return:
+ *   value, 0 if str is not a number
+ */
+size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if (end == str)
+        return 0;
+    switch (*end)
+    {
+        case 'K': case 'k': value <<= 10; end++; break;
+        case 'M': case 'm': value <<= 20; end++; break;
+        case 'G': case 'g': value <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? (size_t)value : 0;
+}
+
+/* Function: parse_addr() - To read an <ipaddress>:<port> argument
+ * in parameters:
+ *   str - argument
+ *   addr - set to the address
+ *
+ * return:
+ *   status of the operation
+ */
+static int parse_addr(const char *str, struct sockaddr_in *addr)
+{
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strchr(str, ':');
+    int port;
+
+    if (NULL == colon || colon - str >= INET_ADDRSTRLEN)
+        return FAILURE;
+    memcpy(ip, str, colon - str);
+    ip[colon - str] = '\0';
+    port = atoi(colon + 1);
+    if (port < MIN_PORTNO || port > MAX_PORTNO || validate_ip_addr(ip) != 0)
+        return FAILURE;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = inet_addr(ip);
+    addr->sin_port = htons(port);
+    return SUCCESS;
+}
+
+/* Function: usage() - To print command line format and exit
+ * in parameters:
+ *   prog - program name
+ *
+ * return:
+ *   void
+ */
+void usage(char *prog)
+{
+    printf("usage: %s <ipaddress>:<port> [--threads <N>] [--batch <N>]\n"
+           "       [--snapshot <file>] [--snapshot-interval <seconds>]\n"
+           "       [--aof <file>] [--aof-fsync always|os|<ms>]\n"
+           "       [--max-keys <N>] [--max-memory <bytes>[K|M|G]] [--eviction none|clock]\n"
+           "       [--index none|ordered] [--io blocking|uring] [--tcp <port>]\n"
+           "       [--dedup <N>] [--psk <file>] [--loglevel error|warn|info|debug]\n"
+           "       [--probe auto|scalar|sse2|avx2]\n"
+           "       [--repl-listen <port> [--repl-backlog <bytes>] | --replica-of <ipaddress>:<port>]\n",
+           prog);
+    error("Incorrect Input");
+}
+
+/* Function: dispatch_request() - To run one datagram in either framing
+ * in parameters:
+ *   store - key-value store
+ *   from - client address
+ *   buffer - datagram
+ *   length - datagram length
+ *   reply - buffer of MAXREPLY bytes for the response
+ *   rv - set when the reply carries a value pinned in the store, the
+ *        caller sends it between the reply bytes and releases it
+ *   fin - set to 1 when the request is a FIN
+ *   stats - stats of the calling worker
+ *   dedup - replies of requests already run for UDP clients, NULL
+ *           over TCP where requests are never resent
+ *
+ * return:
+ *   length of reply in the buffer, -1 if nothing is to be sent
+ */
+int dispatch_request(struct kv_store *store, const struct sockaddr_in *from, char *buffer,
+                     int length, char *reply, struct reply_value *rv, int *fin,
+                     struct kv_stats *stats, struct kv_dedup *dedup)
+{
+    struct kv_op_stats *op;
+    struct kv_request req;
+    uint64_t start = now_ns();
+    uint32_t req_id = 0;
+    int id_len;
+    int text_len = 0;
+    int parsed = KV_PARSE_UNKNOWN;
+    int opcode = 0;
+    int once;
+    int reply_len;
+
+    /* set by the handler through kv_stats_status()*/
+    stats->cur_op = 0;
+    if (length <= 0)
+        return -1;
+
+    id_len = request_id(buffer, length, &req_id);
+    if ((unsigned char)buffer[0] == KV_PROTO_MAGIC)
+    {
+        if (length >= KV_PROTO_HDR_LEN)
+            opcode = (unsigned char)buffer[2];
+    }
+    else
+    {
+        /* no "#<id> " prefix, as over TCP*/
+        if (id_len > 0)
+            text_len = id_len;
+        KV_LOG(KV_LOG_DEBUG, "Client UDP message received:%.*s", length - text_len,
+               buffer + text_len);
+        parsed = kv_parse_request(buffer + text_len, length - text_len, &req);
+        opcode = req.opcode;
+    }
+
+    if (kv_repl_role() == KV_REPL_REPLICA)
+    {
+        /* updates go to the primary, not counted as run*/
+        reply_len = readonly_reply(buffer, id_len, opcode, req_id, reply);
+        if (reply_len >= 0)
+            return reply_len;
+    }
+    once = (dedup != NULL && id_len >= 0 && request_mutates(opcode));
+    if (once)
+    {
+        /* a resent request already run is answered as the first time*/
+        reply_len = kv_dedup_find(dedup, from, req_id, start, reply);
+        if (reply_len >= 0)
+        {
+            KV_HIST_ADD(stats->dedup_hits, 1);
+            return reply_len;
+        }
+    }
+
+    /* text commands always start with '-' (after the "#<id> " prefix),
+       binary ones with the magic*/
+    if ((unsigned char)buffer[0] == KV_PROTO_MAGIC)
+    {
+        reply_len = handle_binary_request(store, from, buffer, length, reply, rv, fin, stats);
+    }
+    else
+    {
+        /* the reply starts with the same prefix*/
+        memcpy(reply, buffer, text_len);
+        if (opcode == KV_OP_FIN && parsed == KV_PARSE_OK)
+        {
+            *fin = 1;
+        }
+        reply_len = handle_request(store, &req, parsed, reply + text_len, rv, stats);
+        if (reply_len >= 0 && text_len > 0)
+        {
+            reply_len += text_len;
+            if (rv->item != NULL)
+                rv->split += text_len;
+        }
+    }
+
+    /* replies with a pinned value are never of a mutation*/
+    if (once && reply_len >= 0 && rv->item == NULL)
+    {
+        kv_dedup_add(dedup, from, req_id, start, reply, reply_len);
+    }
+
+    if (stats->cur_op != 0)
+    {
+        op = &stats->ops[stats->cur_op - 1];
+        KV_HIST_ADD(op->requests, 1);
+        kv_hist_record(&op->service, now_ns() - start);
+    }
+    return reply_len;
+}
+
+/* Function: request_id() - To read the request id of a request
+ * in parameters:
+ *   buffer - request
+ *   length - request length, at least 1
+ *   req_id - set to the request id
+ *
+ * return:
+ *   length of the "#<id> " prefix of a text request, 0 for a binary
+ *   request, -1 when the request has no id
+ */
+static int request_id(const char *buffer, int length, uint32_t *req_id)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    uint64_t id = 0;
+    int i;
+
+    if (p[0] == KV_PROTO_MAGIC)
+    {
+        if (length < KV_PROTO_HDR_LEN)
+            return -1;
+        *req_id = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+        return 0;
+    }
+    if (p[0] != '#')
+        return -1;
+
+    for (i = 1; i < KV_PROTO_TEXT_ID_MAX && i < length && p[i] >= '0' && p[i] <= '9'; i++)
+        id = id * 10 + (p[i] - '0');
+    if (i == 1 || i == length || p[i] != ' ' || id > UINT32_MAX)
+        return -1;
+    *req_id = (uint32_t)id;
+    return i + 1;
+}
+
+/* Function: request_mutates() - To tell a request that changes the store
+ *   Running such a request twice is not the same as running it once,
+ *   its reply is kept for a resend.
+ * in parameters:
+ *   opcode - KV_OP_* of the request, binary or text
+ *
+ * return:
+ *   1 when the request changes the store, 0 otherwise
+ */
+static int request_mutates(int opcode)
+{
+    switch (opcode)
+    {
+        case KV_OP_SET: case KV_OP_DEL: case KV_OP_MSET: case KV_OP_MDEL:
+        case KV_OP_PUT: case KV_OP_CAS: case KV_OP_INCR: case KV_OP_DECR:
+        case KV_OP_APPEND: case KV_OP_PUTCHUNK:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Function: readonly_reply() - To turn down an update on a replica
+ * in parameters:
+ *   buffer - request
+ *   id_len - as returned by request_id()
+ *   opcode - KV_OP_* of the request
+ *   req_id - request id
+ *   reply - buffer for the response
+ *
+ * return:
+ *   length of the READONLY reply, -1 when the request is no update
+ */
+static int readonly_reply(const char *buffer, int id_len, int opcode, uint32_t req_id,
+                          char *reply)
+{
+    if ((unsigned char)buffer[0] == KV_PROTO_MAGIC)
+    {
+        if (id_len < 0 || !request_mutates(opcode))
+            return -1;
+        return (char *)kv_proto_put_header((unsigned char *)reply, opcode,
+                                           KV_ST_READONLY, req_id) - reply;
+    }
+    if (id_len < 0)
+        id_len = 0;
+    if (!request_mutates(opcode))
+        return -1;
+    memcpy(reply, buffer, id_len);
+    memcpy(reply + id_len, "READONLY", 8);
+    return id_len + 8;
+}
+
+/* Function: now_ns() - To read the monotonic clock
+ *
+ * return:
+ *   time in ns
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Function: handle_stats() - To build the --stats reply
+ * in parameters:
+ *   store - key-value store
+ *   reply - buffer of MAXREPLY bytes for the response
+ *
+ * return:
+ *   length of reply
+ */
+int handle_stats(struct kv_store *store, char *reply)
+{
+    struct kv_stats *total = calloc(1, sizeof(*total));
+    const char *io_name = NULL;
+    const char *name;
+    int reply_len;
+    int i;
+
+    if (NULL == total)
+    {
+        strcpy(reply,"FAIL");
+        return strlen(reply);
+    }
+
+    for (i = 0; i < num_workers; i++)
+    {
+        kv_stats_merge(total, &workers[i].stats);
+        /* workers whose io_uring failed fell back to blocking*/
+        name = __atomic_load_n(&workers[i].io_name, __ATOMIC_ACQUIRE);
+        if (name != NULL && io_name != NULL && strcmp(name, io_name) != 0)
+            io_name = "mixed";
+        else if (name != NULL && NULL == io_name)
+            io_name = name;
+    }
+    for (i = 0; i < num_tcp_workers; i++)
+    {
+        kv_stats_merge(total, &tcp_workers[i].stats);
+    }
+    reply_len = kv_stats_format(total, store, num_workers, io_name ? io_name : "none",
+                                now_ns() - server_start_ns, reply, MAXTEXTREPLY);
+    free(total);
+    return reply_len;
+}
+
+/* Function: handle_request() - To execute one text command
+ * in parameters:
+ *   store - key-value store
+ *   req - command from Client, as parsed by kv_parse_request()
+ *   parsed - what kv_parse_request() returned
+ *   reply - buffer of MAXREPLY bytes for the response
+ *   rv - set when a --get value is sent from the store
+ *
+ * return:
+ *   length of reply, -1 if nothing is to be sent
+ */
+int handle_request(struct kv_store *store, const struct kv_request *req, int parsed,
+                   char *reply, struct reply_value *rv, struct kv_stats *stats)
+{
+    const struct kv_view *key = &req->args[0];
+    int status = FAILURE;
+    const struct kv_item *item;
+    char level[16];
+    uint64_t ttl = 0;
+
+    if (parsed == KV_PARSE_UNKNOWN)
+    {
+        return -1;
+    }
+    if (parsed == KV_PARSE_BADREQ)
+    {
+        if (req->opcode < KV_PARSE_STATS)
+            kv_stats_status(stats, req->opcode, KV_ST_BADREQ);
+        strcpy(reply,"FAIL");
+        return strlen(reply);
+    }
+
+    switch (req->opcode)
+    {
+        case KV_OP_MSET:
+        case KV_OP_MGET:
+        case KV_OP_MDEL:
+            return handle_multi_request(store, req, reply, stats);
+
+        case KV_OP_PUT:
+        case KV_OP_CAS:
+        case KV_OP_INCR:
+        case KV_OP_DECR:
+        case KV_OP_APPEND:
+        case KV_OP_GETS:
+            return handle_update_request(store, req, reply, rv, stats);
+
+        case KV_OP_SCAN:
+        case KV_OP_PREFIX:
+            return handle_scan_request(store, req, reply, stats);
+    }
+
+    /* Processing --set command from Client*/
+    if (req->opcode == KV_OP_SET)
+    {
+        /* "<key> <value> [<ttl>]", the token after the value is the ttl*/
+        if (req->num_args > 2 && (kv_parse_u64(&req->args[2], &ttl) != SUCCESS || ttl > KV_MAX_TTL))
+        {
+            kv_stats_status(stats, KV_OP_SET, KV_ST_BADREQ);
+            strcpy(reply,"FAIL");
+            return strlen(reply);
+        }
+
+        /* add_entry checks if key exists in db before adding it*/
+        status = add_entry(store, key->ptr, key->len, req->args[1].ptr, req->args[1].len, ttl);
+        kv_stats_status(stats, KV_OP_SET, binary_status(status, KV_ST_FAIL));
+
+        /* Adding appropriate status message for Client*/
+        if (status == FAILURE)
+        {
+            KV_LOG(KV_LOG_DEBUG, "Command --set FAILED");
+            strcpy(reply,"FAIL");
+        }
+        else if (status == ENTRY_EXIST)
+        {
+            KV_LOG(KV_LOG_DEBUG, "Entry in Server exists, --set Ignored");
+            strcpy(reply,"EXISTS");
+        }
+        else if (status == ENTRY_MAXLMT)
+        {
+            strcpy(reply,"MAXLMT");
+            KV_LOG(KV_LOG_WARN, "Max limit reached for --set");
+        }
+        else
+        {
+            strcpy(reply,"SUCCESS");
+        }
+    }
+    /* Processing --get command from Client*/
+    else if (req->opcode == KV_OP_GET)
+    {
+        status = find_entry(store, key->ptr, key->len, &item);
+        kv_stats_status(stats, KV_OP_GET, binary_status(status, KV_ST_NOEXIST));
+        if (status == FAILURE)
+        {
+            return sprintf(reply, "Key not found : %.*s", (int)key->len, key->ptr);
+        }
+        else if (item->value_len > MAXTEXTREPLY)
+        {
+            release_entry(store, item);
+            strcpy(reply,"NOSPACE");
+        }
+        else
+        {
+            /* the reply is the value alone, sent from the item*/
+            rv->item = item;
+            rv->offset = 0;
+            rv->length = item->value_len;
+            rv->split = 0;
+            return 0;
+        }
+    }
+    /* Processing --del command from Client*/
+    else if (req->opcode == KV_OP_DEL)
+    {
+        status = del_entry(store, key->ptr, key->len);
+        kv_stats_status(stats, KV_OP_DEL, binary_status(status, KV_ST_NOEXIST));
+        if (status == FAILURE)
+        {
+            strcpy(reply,"NOEXIST");
+            KV_LOG(KV_LOG_DEBUG, "Entry does not exists");
+        }
+        else
+        {
+            strcpy(reply,"SUCCESS");
+        }
+    }
+    else if (req->opcode == KV_OP_FIN)
+    {
+        strcpy(reply,"FIN");
+        kv_stats_status(stats, KV_OP_FIN, KV_ST_SUCCESS);
+        KV_LOG(KV_LOG_INFO, "FIN received");
+    }
+    /* Processing --stats command from Client*/
+    else if (req->opcode == KV_PARSE_STATS)
+    {
+        return handle_stats(store, reply);
+    }
+    /* Processing --loglevel command from Client*/
+    else
+    {
+        /* the level names are short, a longer one is no level*/
+        status = FAILURE;
+        if (key->len < sizeof(level))
+        {
+            memcpy(level, key->ptr, key->len);
+            level[key->len] = '\0';
+            status = kv_log_parse_level(level);
+        }
+        if (status < 0)
+        {
+            strcpy(reply,"FAIL");
+        }
+        else
+        {
+            kv_log_set_level(status);
+            strcpy(reply,"SUCCESS");
+            KV_LOG(KV_LOG_INFO, "Log level set to %s", kv_log_level_name(status));
+        }
+    }
+
+    return strlen(reply);
+}
+
+/* Function: validate_ip_addr() - To validate IP addr 
+ * in parameters: 
+ *   ip_addr_in - IP addr to be validated
+ *
+ * return:
+ *   status of validation
+ */
+
+int validate_ip_addr(char *ip_addr_in)
+{
+    char *split_str;
+    int count = 0;
+    int temp_ip=0;
+    int status = 0;
+    char *ip_addr;
+
+    ip_addr = (char*)malloc(strlen(ip_addr_in)+1);
+    strncpy(ip_addr,ip_addr_in,strlen(ip_addr_in)+1);
+
+   /*Separating ipaddr based on <num>.<num>.<num>.<num> format*/    
+    split_str = strtok(ip_addr,".");
+
+    while (split_str != NULL)
     {
-       printf("\nEntry in db exists for the queried key, Found value:%s",temp->value);
-       strcpy(value, temp->value);
-       status = SUCCESS;
-       break;
+        status = FAILURE;
+
+        /* Only 3 dots in IP addr*/
+        if(count > 3)
+            break;
+
+        temp_ip = atoi(split_str);
+
+        if(temp_ip>=0 && temp_ip < 256)
+        {
+            status = SUCCESS;
+        }
+
+        split_str = strtok (NULL, ".");
+        count++;
+ 
     }
-    temp = temp->next;
-  }
 
-  return status;
+    if (count < 4)
+        status = FAILURE;
+
+    free(ip_addr);
+    return status;
 }
 
-/* 
- * Function: add_entry() - To add a key-value pair exists 
+
+/* Function: error() - To print error message 
  * in parameters: 
- *   head - head of the linked list
- *   key - key value to be found in db
- *   key_len - length of the key
- *   value - value of the key to be added
- *   value_len - length of value
+ *   msg - message to be printed
  *
  * return:
- *   status - status of the operation
+ *   void
  */
+void error(char *msg) 
+{
+  kv_log_stop();
+  printf("\nERROR:%s\n",msg);
+  exit(EXIT_FAILURE);
+}
 
-int add_entry(struct node** head, char* key, int key_len, char* value, int value_len) 
-{ 
-    struct node* new_node = (struct node*) malloc(sizeof(struct node)); 
-  
-    if (NULL == new_node)
-        return FAILURE;
+/* Function: handle_update_request() - To execute a read-modify-write command
+ *   --put <key> <value> [<ttl>]             set, replacing any value
+ *   --cas <key> <value> <version> [<ttl>]   put only while unchanged
+ *   --incr <key> <delta>, --decr <key> <delta>
+ *   --append <key> <value>
+ *   --gets <key>                            value and its version
+ * in parameters:
+ *   store - key-value store
+ *   req - command from Client, its arguments counted by kv_parse
+ *   reply - buffer of MAXREPLY bytes for the response
+ *   rv - set when a --gets value is sent from the store
+ *   stats - stats of the calling worker
+ *
+ * Reply is "<value> <version>" for --gets, the new number for --incr
+ * and --decr, otherwise SUCCESS | EXISTS | NOEXIST | MAXLMT | FAIL.
+ *
+ * return:
+ *   length of reply
+ */
+int handle_update_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                          struct reply_value *rv, struct kv_stats *stats)
+{
+    const struct kv_item *item;
+    const struct kv_view *key = &req->args[0];
+    const struct kv_view *arg = &req->args[1];
+    const struct kv_view *ttl_arg;
+    uint64_t number = 0;
+    uint64_t ttl = 0;
+    uint64_t result;
+    int opcode = req->opcode;
+    int status;
 
-    new_node = (struct node*) malloc(sizeof(struct node));
-    new_node->key = malloc((key_len+1)*sizeof(char));
-    new_node->value = malloc((value_len+1)*sizeof(char));
-    
-    strncpy(new_node->key, key, key_len);
-    key[key_len] = '\0';
-    strncpy(new_node->value, value, value_len);
-    value[value_len] ='\0';
+    switch (opcode)
+    {
+        case KV_OP_PUT:
+        case KV_OP_CAS:
+            if (opcode == KV_OP_CAS)
+            {
+                if (kv_parse_u64(&req->args[2], &number) != SUCCESS || number == 0)
+                {
+                    status = FAILURE;
+                    break;
+                }
+            }
+            /* the ttl is the token after the value or the version*/
+            ttl_arg = &req->args[opcode == KV_OP_CAS ? 3 : 2];
+            if (req->num_args > (opcode == KV_OP_CAS ? 3 : 2) &&
+                (kv_parse_u64(ttl_arg, &ttl) != SUCCESS || ttl > KV_MAX_TTL))
+            {
+                status = FAILURE;
+                break;
+            }
+            status = put_entry(store, key->ptr, key->len, arg->ptr, arg->len, ttl, number, NULL);
+        break;
 
-  
-    printf("\nset value success: added new key:%s and new value:%s\n", new_node->key,new_node->value);
+        case KV_OP_INCR:
+        case KV_OP_DECR:
+            if (kv_parse_u64(arg, &number) != SUCCESS)
+            {
+                status = FAILURE;
+                break;
+            }
+            status = incr_entry(store, key->ptr, key->len, number, opcode == KV_OP_DECR, &result);
+            if (status == SUCCESS)
+            {
+                kv_stats_status(stats, opcode, KV_ST_SUCCESS);
+                return sprintf(reply, "%llu", (unsigned long long)result);
+            }
+        break;
 
-    if (*head == NULL) 
-    { 
-       *head = new_node; 
-        new_node->next = NULL; 
+        case KV_OP_APPEND:
+            status = append_entry(store, key->ptr, key->len, arg->ptr, arg->len, NULL);
+        break;
 
-       return SUCCESS; 
-    }   
-    /* add new node at head*/   
-    new_node->next = *head; 
-    *head = new_node; 
+        default:
+            status = find_entry(store, key->ptr, key->len, &item);
+            kv_stats_status(stats, opcode, binary_status(status, KV_ST_NOEXIST));
+            if (status != SUCCESS)
+                return sprintf(reply, "Key not found : %.*s", (int)key->len, key->ptr);
+            if (item->value_len > MAXTEXTREPLY - 21)
+            {
+                release_entry(store, item);
+                strcpy(reply,"NOSPACE");
+                return strlen(reply);
+            }
+            /* value from the item, the version follows it*/
+            rv->item = item;
+            rv->offset = 0;
+            rv->length = item->value_len;
+            rv->split = 0;
+            return sprintf(reply, " %llu", (unsigned long long)item->version);
+    }
 
-    return SUCCESS;
-} 
+    status = binary_status(status, KV_ST_FAIL);
+    kv_stats_status(stats, opcode, status);
+    strcpy(reply, kv_proto_status_str(status));
+    return strlen(reply);
+}
 
-/* 
- * Function: del_entry() - To find the if a key-value pair exists 
- * in parameters: 
- *   head - head of the linked list
- *   key - key value to be found in db
- *   length - length of the key
+/* Function: handle_multi_request() - To execute --mset, --mget or --mdel
+ * in parameters:
+ *   store - key-value store
+ *   req - command from Client, its keys counted by kv_parse
+ *   reply - buffer of MAXREPLY bytes for the response
+ *
+ * Reply has one line per key, in request order:
+ *   --mset, --mdel : SUCCESS | EXISTS | MAXLMT | NOEXIST | FAIL
+ *   --mget         : SUCCESS <value> | NOEXIST | NOSPACE | FAIL
+ * NOSPACE is sent when the value does not fit in one reply datagram,
+ * FAIL when it holds a NUL or a newline, which a line cannot carry
+ * (a binary SET may store either; --get or binary MGET returns it).
  *
  * return:
- *   status - status of the operation
+ *   length of reply
  */
-
-int del_entry(struct node **head, char *key, int length)
+int handle_multi_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                         struct kv_stats *stats)
 {
-  struct node *temp = *head;
-  struct node *prev = NULL;
+    int reply_len = 0;
+    int status;
+    int keys_left;
+    const struct kv_item *item;
+    struct kv_view list = req->list;
+    struct kv_view key;
+    struct kv_view set_value;
+    const char *status_str;
+
+    /* keys were counted by the parser, --mget keeps room for the
+       status lines of those left*/
+    keys_left = (req->opcode == KV_OP_MSET) ? req->num_args / 2 : req->num_args;
 
-  while(temp != NULL)
-  {
-    /* Check string length also to avoid sub-string match*/
-    if(strncmp(temp->key, key, length) == 0 && strlen(temp->key) == length)
+    while (kv_parse_next(&list, &key))
     {
-        if (prev == NULL && temp->next == NULL)
+        keys_left--;
+
+        if (req->opcode == KV_OP_MSET)
         {
-            /* Only one node case*/
-            head = NULL;
-            printf("\nDelete operation success, key removed:%s",temp->key);
-            free(temp->key);
-            free(temp->value);
-            free(temp);
-            return SUCCESS;
+            /* the parser saw an even number of tokens*/
+            kv_parse_next(&list, &set_value);
+            status = add_entry(store, key.ptr, key.len, set_value.ptr, set_value.len, 0);
+            kv_stats_status(stats, KV_OP_MSET, binary_status(status, KV_ST_FAIL));
+            if (status == ENTRY_EXIST)
+                status_str = "EXISTS";
+            else if (status == ENTRY_MAXLMT)
+                status_str = "MAXLMT";
+            else if (status == FAILURE)
+                status_str = "FAIL";
+            else
+                status_str = "SUCCESS";
         }
-        else if(prev == NULL && temp->next != NULL)
-        { 
-            /*If the node is the head*/
-            *head = temp->next;
-            printf("\nDelete operation success, key removed:%s",temp->key);
-            free(temp->key);
-            free(temp->value);
-            free(temp);
-            return SUCCESS;
+        else if (req->opcode == KV_OP_MDEL)
+        {
+            status = del_entry(store, key.ptr, key.len);
+            kv_stats_status(stats, KV_OP_MDEL, binary_status(status, KV_ST_NOEXIST));
+            status_str = (status == FAILURE) ? "NOEXIST" : "SUCCESS";
         }
         else
         {
-            prev->next = temp->next;
-            printf("\nDelete operation success, key removed:%s",temp->key);
-            free(temp->key);
-            free(temp->value);
-            free(temp);
-            return SUCCESS;
+            status = find_entry(store, key.ptr, key.len, &item);
+            kv_stats_status(stats, KV_OP_MGET, binary_status(status, KV_ST_NOEXIST));
+            /* "SUCCESS <value>\n" plus at most "NOSPACE\n" per key left*/
+            if (status == FAILURE)
+            {
+                status_str = "NOEXIST";
+            }
+            else if (memchr(ITEM_VALUE(item), '\0', item->value_len) != NULL ||
+                     memchr(ITEM_VALUE(item), '\n', item->value_len) != NULL)
+            {
+                status_str = "FAIL";
+            }
+            else if ((size_t)reply_len + 9 + item->value_len + keys_left * 8 > MAXTEXTREPLY)
+            {
+                status_str = "NOSPACE";
+            }
+            else
+            {
+                /* packed with other values, copied once into the reply*/
+                status_str = NULL;
+                memcpy(reply + reply_len, "SUCCESS ", 8);
+                memcpy(reply + reply_len + 8, ITEM_VALUE(item), item->value_len);
+                reply_len += 8 + item->value_len;
+                reply[reply_len++] = '\n';
+            }
+            if (status == SUCCESS)
+                release_entry(store, item);
         }
+
+        if (status_str != NULL)
+            reply_len += sprintf(reply + reply_len, "%s\n", status_str);
     }
-    prev = temp;
-    temp = temp->next;
-  }
-  return FAILURE;
+
+    return reply_len;
 }
 
-/* 
- * Function: del_all_entry() - Free all allocated mem to avoid memleak 
- * in parameters: 
- *   head - head of the linked list
+/* Function: handle_chunk_request() - To take one PUTCHUNK of a big value
+ *   The chunk is staged in kv_upload, the one completing the value
+ *   stores it with put semantics.
+ * in parameters:
+ *   store - key-value store
+ *   from - client address
+ *   c - cursor on the request body
+ *   out - reply body position, moved past what is written
+ *
+ * return:
+ *   KV_ST_* status of the request
+ */
+int handle_chunk_request(struct kv_store *store, const struct sockaddr_in *from,
+                         struct kv_proto_cursor *c, unsigned char **out)
+{
+    struct kv_upload *done;
+    const char *key;
+    const char *data;
+    uint32_t upload_id;
+    uint32_t total;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t ttl;
+    uint32_t received = 0;
+    uint64_t version = 0;
+    int key_len;
+    int status;
+
+    upload_id = kv_proto_get_u32(c);
+    key_len = kv_proto_get_u16(c);
+    key = kv_proto_get_bytes(c, key_len);
+    total = kv_proto_get_u32(c);
+    offset = kv_proto_get_u32(c);
+    len = kv_proto_get_u32(c);
+    data = kv_proto_get_bytes(c, len);
+    ttl = (c->p < c->end) ? kv_proto_get_u32(c) : 0;
+    kv_proto_expect_end(c);
+    if (c->error || key_len == 0 || ttl > KV_MAX_TTL)
+        return KV_ST_BADREQ;
+
+    status = kv_upload_chunk(from, upload_id, key, key_len, total, offset, data, len, ttl,
+                             &received, &done);
+    if (status != SUCCESS)
+        return status == ENTRY_MAXLMT ? KV_ST_MAXLMT : KV_ST_BADREQ;
+
+    *out = kv_proto_put_u32(*out, received);
+    if (done != NULL)
+    {
+        status = put_entry(store, done->key, done->key_len, done->value, done->total,
+                           done->ttl, 0, &version);
+        kv_upload_free(done);
+        if (status != SUCCESS)
+            return binary_status(status, KV_ST_FAIL);
+        *out = kv_proto_put_u64(*out, version);
+    }
+    return KV_ST_SUCCESS;
+}
+
+/* Function: scan_page() - To read one page of an ordered scan
+ * in parameters:
+ *   store - key-value store
+ *   range - keys to list
+ *   count - page size, 1 to SCAN_MAX_PAGE
+ *   keys - set to the keys found, in order, released with free()
+ *
+ * return:
+ *   number of keys, count + 1 when the range goes on past the page;
+ *   FAILURE when the store keeps no index
+ */
+static int scan_page(struct kv_store *store, const struct kv_scan_range *range, int count,
+                     struct kv_scan_key ***keys)
+{
+    struct kv_scan_key **page;
+    struct kv_scan_key *bufs;
+    int n;
+    int i;
+
+    /* one key more than asked for tells if another page follows*/
+    page = malloc((count + 1) * (sizeof(*page) + sizeof(*bufs)));
+    if (NULL == page)
+        return FAILURE;
+    bufs = (struct kv_scan_key *)(page + count + 1);
+    for (i = 0; i <= count; i++)
+        page[i] = &bufs[i];
+
+    n = kv_store_scan(store, range, page, count + 1);
+    if (n < 0)
+    {
+        free(page);
+        return FAILURE;
+    }
+    *keys = page;
+    return n;
+}
+
+/* Function: prefix_range() - To turn a prefix into the range of its keys
+ *   The range ends at the prefix with its last byte below 0xff
+ *   incremented, the first key past all keys holding the prefix.
+ * in parameters:
+ *   range - set to the range
+ *   prefix - key prefix
+ *   len - length of prefix
+ *   end - buffer of KV_MAX_KEY bytes for the end of the range
  *
  * return:
  *   void
  */
-void del_all_entry(struct node **head)
+static void prefix_range(struct kv_scan_range *range, const char *prefix, int len, char *end)
 {
-  struct node *temp = *head;
+    range->from = prefix;
+    range->from_len = len;
+    range->after = 0;
+    range->to = NULL;
+    range->to_len = 0;
 
-  while(temp != NULL)
-  {
-    if (temp->next == NULL)
+    while (len > 0 && (unsigned char)prefix[len - 1] == 0xff)
+        len--;
+    if (len > 0)
     {
-        /* Only one node case*/
-        printf("\nDelete operation success, key freed:%s",temp->key);
-        free(temp->key);
-        free(temp->value);
-        free(temp);
-        break;
+        memcpy(end, prefix, len);
+        end[len - 1]++;
+        range->to = end;
+        range->to_len = len;
+    }
+}
+
+/* Function: handle_scan_request() - To execute --scan or --prefix
+ *   --scan <from> <to> [<count> [<after>]]   keys from <= key < to
+ *   --prefix <prefix> [<count> [<after>]]    keys starting with prefix
+ *   Up to count keys (SCAN_PAGE when not given) are listed; <after>
+ *   is the last key of the previous page.
+ * in parameters:
+ *   store - key-value store
+ *   req - command from Client, as parsed by kv_parse
+ *   reply - buffer of MAXREPLY bytes for the response
+ *
+ * Reply has one key per line, then END when the range is done or
+ * MORE when the next page is to be asked for. FAIL when the request
+ * is malformed or the Server runs without --index ordered.
+ *
+ * return:
+ *   length of reply
+ */
+int handle_scan_request(struct kv_store *store, const struct kv_request *req, char *reply,
+                        struct kv_stats *stats)
+{
+    struct kv_scan_range range;
+    struct kv_scan_key **keys;
+    char end[KV_MAX_KEY];
+    const struct kv_view *first = &req->args[0];
+    const struct kv_view *to = &req->args[1];
+    const struct kv_view *after;
+    uint64_t asked = SCAN_PAGE;
+    int count;
+    int opcode = req->opcode;
+    int next;
+    int reply_len = 0;
+    int more;
+    int n;
+    int i;
+
+    /* <count> and <after> follow <from> <to>, or <prefix>*/
+    next = (opcode == KV_OP_SCAN) ? 2 : 1;
+    after = (req->num_args > next + 1) ? &req->args[next + 1] : NULL;
+    if (req->num_args > next && (kv_parse_u64(&req->args[next], &asked) != SUCCESS || asked < 1))
+    {
+        kv_stats_status(stats, opcode, KV_ST_BADREQ);
+        strcpy(reply,"FAIL");
+        return strlen(reply);
+    }
+    /* bounded, from here on the page size is an int like n*/
+    count = (asked > SCAN_MAX_PAGE) ? SCAN_MAX_PAGE : (int)asked;
+
+    if (opcode == KV_OP_SCAN)
+    {
+        range.from = first->ptr;
+        range.from_len = first->len;
+        range.after = 0;
+        range.to = to->ptr;
+        range.to_len = to->len;
+    }
+    else
+    {
+        prefix_range(&range, first->ptr, first->len, end);
+    }
+    /* resume past the cursor, never before the start of the range*/
+    if (after != NULL &&
+        kv_index_compare(after->ptr, after->len, range.from, range.from_len) >= 0)
+    {
+        range.from = after->ptr;
+        range.from_len = after->len;
+        range.after = 1;
+    }
+
+    n = scan_page(store, &range, count, &keys);
+    if (n < 0)
+    {
+        kv_stats_status(stats, opcode, KV_ST_FAIL);
+        strcpy(reply,"FAIL");
+        return strlen(reply);
+    }
+
+    more = (n > count);
+    if (more)
+        n = count;
+    for (i = 0; i < n; i++)
+    {
+        /* the page ends early when the datagram is full*/
+        if (reply_len + keys[i]->len + 1 + 4 > MAXTEXTREPLY)
+        {
+            more = 1;
+            break;
+        }
+        memcpy(reply + reply_len, keys[i]->key, keys[i]->len);
+        reply_len += keys[i]->len;
+        reply[reply_len++] = '\n';
+    }
+    free(keys);
+
+    kv_stats_status(stats, opcode, KV_ST_SUCCESS);
+    strcpy(reply + reply_len, more ? "MORE" : "END");
+    return reply_len + strlen(reply + reply_len);
+}
+
+/* Function: handle_binary_scan() - To execute a binary SCAN or PREFIX
+ * in parameters:
+ *   store - key-value store
+ *   opcode - KV_OP_SCAN or KV_OP_PREFIX
+ *   c - cursor on the request body
+ *   out - reply body position, moved past what is written
+ *   out_end - end of the reply buffer
+ *
+ * return:
+ *   KV_ST_* status of the request
+ */
+int handle_binary_scan(struct kv_store *store, int opcode, struct kv_proto_cursor *c,
+                       unsigned char **out, unsigned char *out_end)
+{
+    struct kv_scan_range range;
+    struct kv_scan_key **keys;
+    char end[KV_MAX_KEY];
+    const char *first;
+    const char *second;
+    unsigned char *head;
+    int flags;
+    int count;
+    int first_len;
+    int second_len;
+    int more;
+    int n;
+    int i;
+
+    flags = kv_proto_get_u8(c);
+    count = kv_proto_get_u16(c);
+    first_len = kv_proto_get_u16(c);
+    first = kv_proto_get_bytes(c, first_len);
+    second_len = kv_proto_get_u16(c);
+    second = kv_proto_get_bytes(c, second_len);
+    kv_proto_expect_end(c);
+    if (c->error || count < 1 || first_len > KV_MAX_KEY)
+        return KV_ST_BADREQ;
+    if (count > SCAN_MAX_PAGE)
+        count = SCAN_MAX_PAGE;
+
+    if (opcode == KV_OP_SCAN)
+    {
+        range.from = first;
+        range.from_len = first_len;
+        range.after = flags & KV_SCAN_AFTER;
+        range.to = (flags & KV_SCAN_OPEN) ? NULL : second;
+        range.to_len = second_len;
     }
     else
     {
-        *head = temp->next;
-        printf("\nDelete operation success, key freed:%s",temp->key);
-        free(temp->key);
-        free(temp->value);
-        free(temp);
+        prefix_range(&range, first, first_len, end);
+        if ((flags & KV_SCAN_AFTER) &&
+            kv_index_compare(second, second_len, range.from, range.from_len) >= 0)
+        {
+            range.from = second;
+            range.from_len = second_len;
+            range.after = 1;
+        }
+    }
+
+    n = scan_page(store, &range, count, &keys);
+    if (n < 0)
+        return KV_ST_FAIL;
+
+    more = (n > count);
+    if (more)
+        n = count;
+    /* more flag and key count are filled in once the page is built*/
+    head = *out;
+    *out += 3;
+    for (i = 0; i < n; i++)
+    {
+        if (*out + 2 + keys[i]->len > out_end)
+        {
+            more = 1;
+            break;
+        }
+        *out = kv_proto_put_u16(*out, keys[i]->len);
+        *out = kv_proto_put_bytes(*out, keys[i]->key, keys[i]->len);
+    }
+    free(keys);
+
+    head[0] = more;
+    kv_proto_put_u16(head + 1, i);
+    return KV_ST_SUCCESS;
+}
+
+/* Function: binary_status() - To map a store status to a KV_ST_* code
+ * in parameters:
+ *   status - return value of a store entry function
+ *   missing - code to use for FAILURE
+ *
+ * return:
+ *   KV_ST_* status code
+ */
+static int binary_status(int status, int missing)
+{
+    switch (status)
+    {
+        case SUCCESS:      return KV_ST_SUCCESS;
+        case ENTRY_EXIST:  return KV_ST_EXISTS;
+        case ENTRY_MAXLMT: return KV_ST_MAXLMT;
+        case ENTRY_NOEXIST: return KV_ST_NOEXIST;
+        default:           return missing;
+    }
+}
+
+/* Function: handle_binary_request() - To execute one binary request
+ * in parameters:
+ *   store - key-value store
+ *   from - client address, names chunked uploads
+ *   buffer - datagram starting with the kv_proto header
+ *   length - datagram length
+ *   reply - buffer of MAXREPLY bytes for the response
+ *   rv - set when a GET, GETS or GETRANGE value is sent from the store
+ *   fin - set to 1 when the request is a FIN
+ *
+ * return:
+ *   length of reply, -1 if nothing is to be sent
+ */
+int handle_binary_request(struct kv_store *store, const struct sockaddr_in *from,
+                          const char *buffer, int length, char *reply,
+                          struct reply_value *rv, int *fin, struct kv_stats *stats)
+{
+    struct kv_proto_cursor c;
+    unsigned char *out = (unsigned char *)reply + KV_PROTO_HDR_LEN;
+    unsigned char *reply_end = (unsigned char *)reply + MAXREPLY;
+    const struct kv_item *item;
+    const char *key;
+    const char *value;
+    unsigned char *key_status;
+    int version;
+    int opcode;
+    int status = KV_ST_SUCCESS;
+    int key_len;
+    int value_len;
+    int count;
+    int i;
+    uint32_t req_id;
+    uint32_t ttl;
+    uint32_t offset;
+    uint64_t item_version;
+    uint64_t number;
+
+    if (length < KV_PROTO_HDR_LEN)
+        return -1;
+
+    kv_proto_cursor_init(&c, buffer, length);
+    kv_proto_get_u8(&c);
+    version = kv_proto_get_u8(&c);
+    opcode = kv_proto_get_u8(&c);
+    kv_proto_get_u8(&c);
+    req_id = kv_proto_get_u32(&c);
+
+    KV_LOG(KV_LOG_DEBUG, "Client binary message received: opcode %d, request id %u", opcode, req_id);
+
+    if (version != KV_PROTO_VERSION)
+    {
+        kv_proto_put_header((unsigned char *)reply, opcode, KV_ST_BADREQ, req_id);
+        return KV_PROTO_HDR_LEN;
+    }
+
+    switch (opcode)
+    {
+        case KV_OP_SET:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            value_len = kv_proto_get_u32(&c);
+            value = kv_proto_get_bytes(&c, value_len);
+            /* optional trailing ttl, nothing after it*/
+            ttl = (c.p < c.end) ? kv_proto_get_u32(&c) : 0;
+            kv_proto_expect_end(&c);
+            if (c.error || key_len == 0 || ttl > KV_MAX_TTL)
+                status = KV_ST_BADREQ;
+            else
+                status = binary_status(add_entry(store, key, key_len, value, value_len, ttl),
+                                       KV_ST_FAIL);
+        break;
+
+        case KV_OP_GET:
+        case KV_OP_GETS:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            kv_proto_expect_end(&c);
+            if (c.error)
+            {
+                status = KV_ST_BADREQ;
+            }
+            else if (find_entry(store, key, key_len, &item) != SUCCESS)
+            {
+                status = KV_ST_NOEXIST;
+            }
+            else if (out + 4 + item->value_len + 8 > reply_end)
+            {
+                /* too big for one datagram, the client reads ranges*/
+                out = kv_proto_put_u32(out, item->value_len);
+                out = kv_proto_put_u64(out, item->version);
+                release_entry(store, item);
+                kv_stats_status(stats, opcode, KV_ST_NOSPACE);
+                kv_proto_put_header((unsigned char *)reply, opcode, KV_ST_NOSPACE, req_id);
+                return out - (unsigned char *)reply;
+            }
+            else
+            {
+                out = kv_proto_put_u32(out, item->value_len);
+                rv->item = item;
+                rv->offset = 0;
+                rv->length = item->value_len;
+                rv->split = out - (unsigned char *)reply;
+                if (opcode == KV_OP_GETS)
+                    out = kv_proto_put_u64(out, item->version);
+            }
+        break;
+
+        case KV_OP_GETRANGE:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            offset = kv_proto_get_u32(&c);
+            value_len = kv_proto_get_u32(&c);
+            kv_proto_expect_end(&c);
+            if (c.error)
+            {
+                status = KV_ST_BADREQ;
+            }
+            else if (find_entry(store, key, key_len, &item) != SUCCESS)
+            {
+                status = KV_ST_NOEXIST;
+            }
+            else if (offset > item->value_len)
+            {
+                release_entry(store, item);
+                status = KV_ST_BADREQ;
+            }
+            else
+            {
+                /* at most what is left and what fits one datagram*/
+                if ((uint32_t)value_len > item->value_len - offset)
+                    value_len = item->value_len - offset;
+                if (value_len > KV_PROTO_CHUNK)
+                    value_len = KV_PROTO_CHUNK;
+                out = kv_proto_put_u64(out, item->version);
+                out = kv_proto_put_u32(out, item->value_len);
+                out = kv_proto_put_u32(out, value_len);
+                rv->item = item;
+                rv->offset = offset;
+                rv->length = value_len;
+                rv->split = out - (unsigned char *)reply;
+            }
+        break;
+
+        case KV_OP_PUTCHUNK:
+            status = handle_chunk_request(store, from, &c, &out);
+        break;
+
+        case KV_OP_SCAN:
+        case KV_OP_PREFIX:
+            status = handle_binary_scan(store, opcode, &c, &out, reply_end);
+        break;
+
+        case KV_OP_PUT:
+        case KV_OP_CAS:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            value_len = kv_proto_get_u32(&c);
+            value = kv_proto_get_bytes(&c, value_len);
+            item_version = (opcode == KV_OP_CAS) ? kv_proto_get_u64(&c) : 0;
+            ttl = (c.p < c.end) ? kv_proto_get_u32(&c) : 0;
+            kv_proto_expect_end(&c);
+            /* version 0 is never handed out, as cas it would mean any*/
+            if (c.error || key_len == 0 || ttl > KV_MAX_TTL ||
+                (opcode == KV_OP_CAS && item_version == 0))
+            {
+                status = KV_ST_BADREQ;
+                break;
+            }
+            status = binary_status(put_entry(store, key, key_len, value, value_len, ttl,
+                                             item_version, &item_version), KV_ST_FAIL);
+            if (status == KV_ST_SUCCESS)
+                out = kv_proto_put_u64(out, item_version);
+        break;
+
+        case KV_OP_INCR:
+        case KV_OP_DECR:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            number = kv_proto_get_u64(&c);
+            kv_proto_expect_end(&c);
+            if (c.error)
+            {
+                status = KV_ST_BADREQ;
+                break;
+            }
+            status = binary_status(incr_entry(store, key, key_len, number,
+                                              opcode == KV_OP_DECR, &number), KV_ST_FAIL);
+            if (status == KV_ST_SUCCESS)
+                out = kv_proto_put_u64(out, number);
+        break;
+
+        case KV_OP_APPEND:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            value_len = kv_proto_get_u32(&c);
+            value = kv_proto_get_bytes(&c, value_len);
+            kv_proto_expect_end(&c);
+            if (c.error)
+            {
+                status = KV_ST_BADREQ;
+                break;
+            }
+            status = binary_status(append_entry(store, key, key_len, value, value_len,
+                                                &item_version), KV_ST_FAIL);
+            if (status == KV_ST_SUCCESS)
+                out = kv_proto_put_u64(out, item_version);
+        break;
+
+        case KV_OP_DEL:
+            key_len = kv_proto_get_u16(&c);
+            key = kv_proto_get_bytes(&c, key_len);
+            kv_proto_expect_end(&c);
+            if (c.error)
+                status = KV_ST_BADREQ;
+            else
+                status = binary_status(del_entry(store, key, key_len), KV_ST_NOEXIST);
+        break;
+
+        case KV_OP_FIN:
+            kv_proto_expect_end(&c);
+            if (c.error)
+                status = KV_ST_BADREQ;
+            else
+                *fin = 1;
+        break;
+
+        case KV_OP_MSET:
+        case KV_OP_MGET:
+        case KV_OP_MDEL:
+            count = kv_proto_get_u16(&c);
+
+            /* validate the whole request first, a malformed datagram
+               must not be applied half way*/
+            for (i = 0; i < count; i++)
+            {
+                key_len = kv_proto_get_u16(&c);
+                kv_proto_get_bytes(&c, key_len);
+                if (opcode == KV_OP_MSET)
+                {
+                    /* like SET, no empty key*/
+                    if (key_len == 0)
+                        c.error = 1;
+                    kv_proto_get_bytes(&c, kv_proto_get_u32(&c));
+                }
+            }
+            kv_proto_expect_end(&c);
+            if (c.error)
+            {
+                status = KV_ST_BADREQ;
+                break;
+            }
+
+            kv_proto_cursor_init(&c, buffer + KV_PROTO_HDR_LEN + 2,
+                                 length - KV_PROTO_HDR_LEN - 2);
+            out = kv_proto_put_u16(out, count);
+            for (i = 0; i < count; i++)
+            {
+                key_len = kv_proto_get_u16(&c);
+                key = kv_proto_get_bytes(&c, key_len);
+                key_status = out;
+
+                if (opcode == KV_OP_MSET)
+                {
+                    value_len = kv_proto_get_u32(&c);
+                    value = kv_proto_get_bytes(&c, value_len);
+                    *out++ = binary_status(add_entry(store, key, key_len, value, value_len, 0),
+                                           KV_ST_FAIL);
+                }
+                else if (opcode == KV_OP_MDEL)
+                {
+                    *out++ = binary_status(del_entry(store, key, key_len), KV_ST_NOEXIST);
+                }
+                else if (find_entry(store, key, key_len, &item) != SUCCESS)
+                {
+                    *out++ = KV_ST_NOEXIST;
+                }
+                else
+                {
+                    /* status + length + value, keep one byte per key left*/
+                    if (out + 5 + item->value_len + (count - i - 1) > reply_end)
+                    {
+                        *out++ = KV_ST_NOSPACE;
+                    }
+                    else
+                    {
+                        /* packed with other values, copied once into the reply*/
+                        *out++ = KV_ST_SUCCESS;
+                        out = kv_proto_put_u32(out, item->value_len);
+                        out = kv_proto_put_bytes(out, ITEM_VALUE(item), item->value_len);
+                    }
+                    release_entry(store, item);
+                }
+                kv_stats_status(stats, opcode, *key_status);
+            }
+        break;
+
+        default:
+            status = KV_ST_BADREQ;
+        break;
     }
-    temp = temp->next;
-  }
+
+    /* multi-key ops were counted per key above*/
+    if ((opcode >= KV_OP_SET && opcode <= KV_OP_FIN) || (opcode >= KV_OP_PUT && opcode <= KV_OP_PREFIX))
+        kv_stats_status(stats, opcode, status);
+    else if (opcode >= KV_OP_MSET && opcode <= KV_OP_MDEL && status != KV_ST_SUCCESS)
+        kv_stats_status(stats, opcode, status);
+
+    if (status != KV_ST_SUCCESS)
+        out = (unsigned char *)reply + KV_PROTO_HDR_LEN;
+    kv_proto_put_header((unsigned char *)reply, opcode, status, req_id);
+    return out - (unsigned char *)reply;
 }
@@ -0,0 +1,608 @@
+/* kv_aof.c
+ *
+ * Append-only log, see kv_aof.h
+ *
+ * Lock order: shard lock, then aof_lock. Appends run from the store
+ * journal hook with the shard lock held, so the flusher never takes
+ * a shard lock while it holds aof_lock.
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "kv_aof.h"
+#include "kv_log.h"
+#include "../Common/kv_proto.h"
+
+#define KV_AOF_PATH_MAX 4096
+
+/* poll interval for a running rewrite child under the always policy*/
+#define KV_AOF_CHILD_POLL_MS 10
+
+/* growable byte buffer*/
+struct kv_aof_buf{
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+/* child side of a rewrite*/
+struct kv_aof_writer{
+    int fd;
+    unsigned char *buf;
+    size_t len;
+    int error;
+};
+
+static pthread_mutex_t aof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aof_flush_cond;      /* wakes the flusher*/
+static pthread_cond_t aof_durable_cond;    /* wakes committing workers*/
+static pthread_t aof_thread;
+static int aof_running;
+static int aof_stop;
+
+static struct kv_store *aof_store;
+static char aof_path[KV_AOF_PATH_MAX];
+static char aof_tmp_path[KV_AOF_PATH_MAX];
+static int aof_fd = -1;
+static int aof_policy;
+static unsigned int aof_interval_ms;
+
+/* appenders fill pending, the flusher writes out the swapped buffer*/
+static struct kv_aof_buf aof_pending;
+static struct kv_aof_buf aof_writing;
+static uint64_t aof_appended_seq;
+static uint64_t aof_durable_seq;
+
+/* log size now and right after the last rewrite, flusher only*/
+static size_t aof_size;
+static size_t aof_base_size;
+
+/* mutations since the rewrite child forked*/
+static int aof_rewriting;
+static pid_t aof_child;
+static struct kv_aof_buf aof_rewrite_buf;
+
+/* last record appended by this worker thread*/
+static __thread uint64_t aof_last_seq;
+
+static int kv_aof_reserve(struct kv_aof_buf *buf, size_t len)
+{
+    unsigned char *data;
+    size_t cap = buf->cap ? buf->cap : 4096;
+
+    if (buf->len + len <= buf->cap)
+        return SUCCESS;
+    while (cap < buf->len + len)
+        cap *= 2;
+    data = realloc(buf->data, cap);
+    if (NULL == data)
+        return FAILURE;
+    buf->data = data;
+    buf->cap = cap;
+    return SUCCESS;
+}
+
+/* bytes of one record, a set with expiry becomes KV_AOF_SETEX*/
+size_t kv_aof_record_len(int op, int key_len, int value_len, uint32_t expire)
+{
+    if (op == KV_MUT_DEL)
+        return 1 + 2 + key_len;
+    return 1 + 2 + key_len + 4 + value_len + (expire != 0 ? 4 : 0);
+}
+
+/* writes one record at p, returns the byte after it*/
+unsigned char *kv_aof_encode(unsigned char *p, int op, const char *key, int key_len,
+                             const char *value, int value_len, uint32_t expire)
+{
+    *p++ = (op == KV_MUT_SET && expire != 0) ? KV_AOF_SETEX : op;
+    p = kv_proto_put_u16(p, key_len);
+    p = kv_proto_put_bytes(p, key, key_len);
+    if (op == KV_MUT_SET)
+    {
+        p = kv_proto_put_u32(p, value_len);
+        p = kv_proto_put_bytes(p, value, value_len);
+        if (expire != 0)
+            p = kv_proto_put_u32(p, expire);
+    }
+    return p;
+}
+
+static int kv_aof_write_all(int fd, const unsigned char *p, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FAILURE;
+        }
+        p += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+static void kv_aof_sync_dir(const char *path)
+{
+    char dir[KV_AOF_PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    size_t len;
+    int fd;
+
+    if (NULL == slash)
+    {
+        dir[0] = '.';
+        len = 1;
+    }
+    else
+    {
+        len = slash == path ? 1 : (size_t)(slash - path);
+        memcpy(dir, path, len);
+    }
+    dir[len] = '\0';
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+/* Function: kv_aof_append() - Store journal hook, logs one mutation
+ *   Runs with the shard lock of key held.
+ */
+static void kv_aof_append(void *arg, int op, const char *key, int key_len,
+                          const char *value, int value_len, uint32_t expire)
+{
+    size_t len = kv_aof_record_len(op, key_len, value_len, expire);
+
+    (void)arg;
+    pthread_mutex_lock(&aof_lock);
+    if (kv_aof_reserve(&aof_pending, len) != SUCCESS)
+    {
+        pthread_mutex_unlock(&aof_lock);
+        KV_LOG(KV_LOG_ERROR, "aof: out of memory, mutation not logged");
+        return;
+    }
+    kv_aof_encode(aof_pending.data + aof_pending.len, op, key, key_len, value, value_len, expire);
+    aof_pending.len += len;
+
+    /* a failed copy only loses the rewrite, checked when it ends*/
+    if (aof_rewriting)
+    {
+        if (kv_aof_reserve(&aof_rewrite_buf, len) == SUCCESS)
+        {
+            kv_aof_encode(aof_rewrite_buf.data + aof_rewrite_buf.len, op,
+                          key, key_len, value, value_len, expire);
+            aof_rewrite_buf.len += len;
+        }
+        else
+        {
+            aof_rewriting = -1;
+        }
+    }
+
+    aof_last_seq = ++aof_appended_seq;
+    if (aof_policy == KV_AOF_ALWAYS)
+        pthread_cond_signal(&aof_flush_cond);
+    pthread_mutex_unlock(&aof_lock);
+}
+
+/* Function: kv_aof_commit() - To wait until this thread's mutations are durable
+ *   Returns at once unless the policy is always and the calling
+ *   worker logged something since its previous commit.
+ */
+void kv_aof_commit(void)
+{
+    if (aof_last_seq == 0)
+        return;
+
+    if (aof_policy == KV_AOF_ALWAYS)
+    {
+        pthread_mutex_lock(&aof_lock);
+        while (aof_durable_seq < aof_last_seq)
+            pthread_cond_wait(&aof_durable_cond, &aof_lock);
+        pthread_mutex_unlock(&aof_lock);
+    }
+    aof_last_seq = 0;
+}
+
+/* kv_store_for_each() callback of the rewrite child*/
+static void kv_aof_record(void *arg, const struct kv_item *item)
+{
+    struct kv_aof_writer *w = arg;
+    unsigned char *p;
+
+    if (w->len + kv_aof_record_len(KV_MUT_SET, item->key_len, item->value_len, item->expire) >
+        KV_AOF_BUF_SIZE)
+    {
+        if (kv_aof_write_all(w->fd, w->buf, w->len) != SUCCESS)
+            w->error = 1;
+        w->len = 0;
+    }
+
+    p = kv_aof_encode(w->buf + w->len, KV_MUT_SET, ITEM_KEY(item), item->key_len,
+                      ITEM_VALUE(item), item->value_len, item->expire);
+    w->len = p - w->buf;
+}
+
+/* Function: kv_aof_write_store() - To write the store as a fresh log
+ *   Runs in the forked child, only async-signal-safe calls.
+ */
+static int kv_aof_write_store(struct kv_store *store, const char *path, unsigned char *buf)
+{
+    struct kv_aof_writer w;
+
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0)
+        return FAILURE;
+
+    memcpy(w.buf, KV_AOF_MAGIC, KV_AOF_MAGIC_LEN);
+    w.len = KV_AOF_MAGIC_LEN;
+    kv_store_for_each(store, kv_aof_record, &w);
+    if (kv_aof_write_all(w.fd, w.buf, w.len) != SUCCESS)
+        w.error = 1;
+    if (fsync(w.fd) != 0)
+        w.error = 1;
+    close(w.fd);
+    return w.error ? FAILURE : SUCCESS;
+}
+
+/* Function: kv_aof_rewrite_start() - To fork the rewrite child
+ *   Called by the flusher without aof_lock held.
+ */
+static void kv_aof_rewrite_start(void)
+{
+    unsigned char *buf = malloc(KV_AOF_BUF_SIZE);
+    pid_t pid;
+
+    if (NULL == buf)
+        return;
+
+    /* with every shard locked no mutation is half applied: each one
+       is either in the child's store or in aof_rewrite_buf*/
+    kv_store_lock_all(aof_store);
+    pthread_mutex_lock(&aof_lock);
+    aof_rewriting = 1;
+    aof_rewrite_buf.len = 0;
+    pthread_mutex_unlock(&aof_lock);
+
+    pid = fork();
+    if (pid == 0)
+        _exit(kv_aof_write_store(aof_store, aof_tmp_path, buf) == SUCCESS ? 0 : 1);
+
+    if (pid < 0)
+    {
+        pthread_mutex_lock(&aof_lock);
+        aof_rewriting = 0;
+        pthread_mutex_unlock(&aof_lock);
+        KV_LOG(KV_LOG_ERROR, "aof: rewrite fork failed");
+    }
+    kv_store_unlock_all(aof_store);
+
+    free(buf);
+    aof_child = pid > 0 ? pid : 0;
+}
+
+/* Function: kv_aof_rewrite_finish() - To switch over to the rewritten log
+ *   Called by the flusher with aof_lock held, appenders wait until
+ *   the mutations logged during the rewrite are in the new file.
+ * in parameters:
+ *   ok - child wrote the new log
+ */
+static void kv_aof_rewrite_finish(int ok)
+{
+    struct stat st;
+    int fd = -1;
+
+    if (ok && aof_rewriting == 1)
+        fd = open(aof_tmp_path, O_WRONLY | O_APPEND);
+
+    if (fd < 0 ||
+        kv_aof_write_all(fd, aof_rewrite_buf.data, aof_rewrite_buf.len) != SUCCESS ||
+        fdatasync(fd) != 0 || fstat(fd, &st) != 0 ||
+        rename(aof_tmp_path, aof_path) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        unlink(aof_tmp_path);
+        KV_LOG(KV_LOG_ERROR, "aof: rewrite of %s failed", aof_path);
+    }
+    else
+    {
+        kv_aof_sync_dir(aof_path);
+        close(aof_fd);
+        aof_fd = fd;
+        aof_size = aof_base_size = st.st_size;
+
+        /* everything still pending was copied to the rewrite buffer*/
+        aof_pending.len = 0;
+        aof_durable_seq = aof_appended_seq;
+        pthread_cond_broadcast(&aof_durable_cond);
+    }
+
+    aof_rewriting = 0;
+    aof_child = 0;
+    free(aof_rewrite_buf.data);
+    memset(&aof_rewrite_buf, 0, sizeof(aof_rewrite_buf));
+}
+
+/* Function: kv_aof_main() - Flusher thread
+ *   Writes out the pending buffer, fsyncs it as the policy says and
+ *   wakes the workers waiting on it. Also drives log rewrites.
+ */
+static void *kv_aof_main(void *arg)
+{
+    struct kv_aof_buf tmp;
+    struct timespec deadline;
+    uint64_t seq;
+    unsigned int wait_ms;
+    int stopping = 0;
+    int status;
+    int error;
+    pid_t pid;
+
+    (void)arg;
+    pthread_mutex_lock(&aof_lock);
+    while (!stopping)
+    {
+        if (aof_policy == KV_AOF_ALWAYS)
+            wait_ms = aof_child ? KV_AOF_CHILD_POLL_MS : 0;
+        else
+            wait_ms = aof_policy == KV_AOF_OS ? KV_AOF_FLUSH_MS : aof_interval_ms;
+
+        if (wait_ms == 0)
+        {
+            while (aof_pending.len == 0 && !aof_stop)
+                pthread_cond_wait(&aof_flush_cond, &aof_lock);
+        }
+        else if (!aof_stop)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wait_ms / 1000;
+            deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&aof_flush_cond, &aof_lock, &deadline);
+        }
+        stopping = aof_stop;
+
+        /* swap, appenders keep going into the other buffer*/
+        tmp = aof_writing;
+        aof_writing = aof_pending;
+        aof_pending = tmp;
+        aof_pending.len = 0;
+        seq = aof_appended_seq;
+        pthread_mutex_unlock(&aof_lock);
+
+        error = 0;
+        if (aof_writing.len > 0)
+        {
+            if (kv_aof_write_all(aof_fd, aof_writing.data, aof_writing.len) != SUCCESS)
+                error = 1;
+            else if (aof_policy != KV_AOF_OS && fdatasync(aof_fd) != 0)
+                error = 1;
+            aof_size += aof_writing.len;
+            aof_writing.len = 0;
+        }
+        if (error)
+            KV_LOG(KV_LOG_ERROR, "aof: writing %s failed: %s", aof_path, strerror(errno));
+
+        if (aof_child == 0 && !stopping && aof_size >= KV_AOF_REWRITE_MIN &&
+            aof_size >= 2 * aof_base_size)
+            kv_aof_rewrite_start();
+
+        pthread_mutex_lock(&aof_lock);
+        /* a failed write is reported, not retried: waiting workers
+           would otherwise hang on a full disk*/
+        aof_durable_seq = seq;
+        pthread_cond_broadcast(&aof_durable_cond);
+
+        if (aof_child != 0)
+        {
+            pid = waitpid(aof_child, &status, stopping ? 0 : WNOHANG);
+            if (pid == aof_child)
+                kv_aof_rewrite_finish(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+    }
+    pthread_mutex_unlock(&aof_lock);
+    return NULL;
+}
+
+/* Function: kv_aof_replay() - To apply a log to the store at startup
+ * in parameters:
+ *   store - key-value store, no worker running and no journal set
+ *   path - log file
+ *
+ * return:
+ *   number of records applied, 0 when there is no log yet,
+ *   FAILURE when the file is not a log
+ */
+long kv_aof_replay(struct kv_store *store, const char *path)
+{
+    struct kv_proto_cursor c;
+    struct stat st;
+    const unsigned char *good;
+    const char *key, *value = NULL;
+    unsigned char *map;
+    uint16_t key_len;
+    uint32_t value_len = 0;
+    uint32_t expire;
+    long applied = 0;
+    int op;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : FAILURE;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return FAILURE;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return FAILURE;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    kv_proto_cursor_init(&c, map, st.st_size);
+    key = kv_proto_get_bytes(&c, KV_AOF_MAGIC_LEN);
+    if (NULL == key || memcmp(key, KV_AOF_MAGIC, KV_AOF_MAGIC_LEN) != 0)
+    {
+        munmap(map, st.st_size);
+        close(fd);
+        return FAILURE;
+    }
+
+    good = c.p;
+    while (c.p < c.end)
+    {
+        op = kv_proto_get_u8(&c);
+        key_len = kv_proto_get_u16(&c);
+        key = kv_proto_get_bytes(&c, key_len);
+        expire = 0;
+        if (op == KV_MUT_SET || op == KV_AOF_SETEX)
+        {
+            value_len = kv_proto_get_u32(&c);
+            value = kv_proto_get_bytes(&c, value_len);
+        }
+        if (op == KV_AOF_SETEX)
+            expire = kv_proto_get_u32(&c);
+        if (c.error || (op != KV_MUT_SET && op != KV_MUT_DEL && op != KV_AOF_SETEX))
+            break;
+
+        /* log order per key is apply order, a later set replaces*/
+        if (op != KV_MUT_DEL)
+            kv_store_apply(store, key, key_len, value, value_len, expire);
+        else
+            del_entry(store, key, key_len);
+        applied++;
+        good = c.p;
+    }
+
+    if (good != c.end)
+    {
+        KV_LOG(KV_LOG_WARN, "aof: %s has a torn tail, cut at byte %ld",
+               path, (long)(good - map));
+        if (ftruncate(fd, good - map) != 0)
+            applied = FAILURE;
+    }
+
+    munmap(map, st.st_size);
+    close(fd);
+    return applied;
+}
+
+/* Function: kv_aof_open() - To start logging the mutations of store
+ *   Call after kv_aof_replay() and before any worker is created. The
+ *   flusher thread inherits the signal mask of the caller, block
+ *   SIGUSR1 first when snapshots are on.
+ * in parameters:
+ *   store - key-value store
+ *   path - log file, created if missing
+ *   policy - KV_AOF_ALWAYS, KV_AOF_INTERVAL or KV_AOF_OS
+ *   interval_ms - fsync interval of KV_AOF_INTERVAL
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_aof_open(struct kv_store *store, const char *path, int policy, unsigned int interval_ms)
+{
+    pthread_condattr_t attr;
+    off_t size;
+
+    if (strlen(path) + sizeof(".rewrite") > sizeof(aof_tmp_path))
+        return FAILURE;
+    strcpy(aof_path, path);
+    strcpy(aof_tmp_path, path);
+    strcat(aof_tmp_path, ".rewrite");
+
+    aof_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (aof_fd < 0)
+        return FAILURE;
+    size = lseek(aof_fd, 0, SEEK_END);
+    if (size == 0)
+    {
+        if (kv_aof_write_all(aof_fd, (const unsigned char *)KV_AOF_MAGIC,
+                             KV_AOF_MAGIC_LEN) != SUCCESS || fsync(aof_fd) != 0)
+            return FAILURE;
+        size = KV_AOF_MAGIC_LEN;
+    }
+    aof_size = aof_base_size = size;
+
+    aof_store = store;
+    aof_policy = policy;
+    aof_interval_ms = interval_ms > 0 ? interval_ms : 1;
+    aof_stop = 0;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&aof_flush_cond, &attr);
+    pthread_cond_init(&aof_durable_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    kv_store_set_journal(store, kv_aof_append, NULL);
+    if (pthread_create(&aof_thread, NULL, kv_aof_main, NULL) != 0)
+    {
+        kv_store_set_journal(store, NULL, NULL);
+        return FAILURE;
+    }
+    aof_running = 1;
+    return SUCCESS;
+}
+
+/* Function: kv_aof_close() - To flush, fsync and close the log
+ *   No worker may be running. Waits for a rewrite in progress.
+ */
+void kv_aof_close(void)
+{
+    if (!aof_running)
+        return;
+
+    pthread_mutex_lock(&aof_lock);
+    aof_stop = 1;
+    pthread_cond_signal(&aof_flush_cond);
+    pthread_mutex_unlock(&aof_lock);
+    pthread_join(aof_thread, NULL);
+    aof_running = 0;
+
+    fsync(aof_fd);
+    close(aof_fd);
+    aof_fd = -1;
+    kv_store_set_journal(aof_store, NULL, NULL);
+    free(aof_pending.data);
+    free(aof_writing.data);
+    memset(&aof_pending, 0, sizeof(aof_pending));
+    memset(&aof_writing, 0, sizeof(aof_writing));
+}
@@ -0,0 +1,68 @@
+/* kv_aof.h
+ *
+ * Append-only log of store mutations
+ * - Every applied set and del is appended to an in-memory buffer from
+ *   the store journal hook, one flusher thread writes the buffer out
+ *   and fsyncs it, so one fsync covers every mutation that arrived
+ *   since the previous one (group commit)
+ * - Fsync policies
+ *     always   a worker sends no reply before its mutations are on
+ *              disk, all workers waiting share one fsync
+ *     <N> ms   the flusher writes and fsyncs every N ms, at most N ms
+ *              of acknowledged mutations are lost in a crash
+ *     os       the flusher writes every KV_AOF_FLUSH_MS and leaves
+ *              fsync to the kernel
+ * - When the log has doubled since the last rewrite, a forked child
+ *   writes the current store as set records to "<path>.rewrite".
+ *   Mutations arriving meanwhile are kept aside and appended before
+ *   the new log is renamed over the old one.
+ *
+ * File layout, multi-byte fields in network byte order:
+ *
+ *   header   "KVAOF001"
+ *   records  u8 KV_MUT_SET, u16 key_len, key, u32 value_len, value
+ *            u8 KV_MUT_DEL, u16 key_len, key
+ *            u8 KV_AOF_SETEX, u16 key_len, key, u32 value_len, value,
+ *               u32 expire (unix seconds), a set of a key with a TTL
+ *
+ * A torn record at the end of the file is cut off at replay.
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_AOF_H
+#define KV_AOF_H
+
+#include "kv_store.h"
+
+#define KV_AOF_MAGIC     "KVAOF001"
+#define KV_AOF_MAGIC_LEN 8
+
+/* record type of a set with expiry, next to KV_MUT_SET and KV_MUT_DEL*/
+#define KV_AOF_SETEX 3
+
+/* fsync policies*/
+#define KV_AOF_ALWAYS   0
+#define KV_AOF_INTERVAL 1
+#define KV_AOF_OS       2
+
+/* write interval of the os policy*/
+#define KV_AOF_FLUSH_MS 100
+
+/* smallest log that is worth a rewrite*/
+#define KV_AOF_REWRITE_MIN (16 * 1024 * 1024)
+
+/* child write buffer, allocated before fork, holds the largest record*/
+#define KV_AOF_BUF_SIZE (2 * 1024 * 1024)
+
+/* record encoding, shared with the replication stream of kv_repl.h*/
+size_t kv_aof_record_len(int op, int key_len, int value_len, uint32_t expire);
+unsigned char *kv_aof_encode(unsigned char *p, int op, const char *key, int key_len,
+                             const char *value, int value_len, uint32_t expire);
+long kv_aof_replay(struct kv_store *store, const char *path);
+int kv_aof_open(struct kv_store *store, const char *path, int policy, unsigned int interval_ms);
+void kv_aof_commit(void);
+void kv_aof_close(void);
+
+#endif /* KV_AOF_H */
@@ -0,0 +1,144 @@
+/* kv_dedup.c
+ *
+ * Reply cache of retransmitted requests, see kv_dedup.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kv_dedup.h"
+#include "kv_store.h"
+
+/* Function: kv_dedup_set() - To find the set of a request*/
+static struct kv_dedup_entry *kv_dedup_set(struct kv_dedup *dedup, uint32_t ip, uint16_t port,
+                                           uint32_t req_id)
+{
+    uint64_t h = ((uint64_t)ip << 32 | (uint64_t)port << 16) ^ req_id;
+
+    h *= 0x9E3779B97F4A7C15ULL;
+    return &dedup->entries[((h >> 32) & dedup->set_mask) * KV_DEDUP_WAYS];
+}
+
+/* Function: kv_dedup_init() - To set up the cache of one worker
+ * in parameters:
+ *   dedup - cache
+ *   entries - replies kept, rounded up to a power of 2; 0 turns the
+ *             cache off
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_dedup_init(struct kv_dedup *dedup, int entries)
+{
+    uint32_t sets = 1;
+
+    memset(dedup, 0, sizeof(*dedup));
+    if (entries <= 0)
+        return SUCCESS;
+
+    while (sets * KV_DEDUP_WAYS < (uint32_t)entries)
+        sets <<= 1;
+    dedup->entries = calloc((size_t)sets * KV_DEDUP_WAYS, sizeof(struct kv_dedup_entry));
+    if (dedup->entries == NULL)
+        return FAILURE;
+    dedup->set_mask = sets - 1;
+    return SUCCESS;
+}
+
+/* Function: kv_dedup_find() - To look up the reply of a request
+ * in parameters:
+ *   dedup - cache
+ *   addr - client address
+ *   req_id - request id
+ *   now - current time in ns
+ *   reply - buffer the kept reply is copied to
+ *
+ * return:
+ *   length of the reply, -1 when the request was not seen
+ */
+int kv_dedup_find(struct kv_dedup *dedup, const struct sockaddr_in *addr, uint32_t req_id,
+                  uint64_t now, char *reply)
+{
+    struct kv_dedup_entry *set;
+    struct kv_dedup_entry *e;
+    int i;
+
+    if (dedup->entries == NULL)
+        return -1;
+
+    set = kv_dedup_set(dedup, addr->sin_addr.s_addr, addr->sin_port, req_id);
+    for (i = 0; i < KV_DEDUP_WAYS; i++)
+    {
+        e = &set[i];
+        if (e->time_ns == 0 || e->req_id != req_id || e->ip != addr->sin_addr.s_addr ||
+            e->port != addr->sin_port)
+            continue;
+        if (now - e->time_ns > KV_DEDUP_MAX_AGE * 1000000000ULL)
+            return -1;
+        memcpy(reply, e->data != NULL ? e->data : e->inline_data, e->len);
+        return (int)e->len;
+    }
+    return -1;
+}
+
+/* Function: kv_dedup_add() - To keep the reply of a request
+ *   Called once the request ran, so a retransmit of it in the same
+ *   batch already finds the reply.
+ * in parameters:
+ *   dedup - cache
+ *   addr - client address
+ *   req_id - request id
+ *   now - current time in ns
+ *   reply - reply bytes
+ *   len - length of reply
+ *
+ * return:
+ *   void
+ */
+void kv_dedup_add(struct kv_dedup *dedup, const struct sockaddr_in *addr, uint32_t req_id,
+                  uint64_t now, const char *reply, int len)
+{
+    struct kv_dedup_entry *set;
+    struct kv_dedup_entry *e;
+    char *data = NULL;
+    int i;
+
+    if (dedup->entries == NULL || len < 0)
+        return;
+    if (len > KV_DEDUP_INLINE && (data = malloc(len)) == NULL)
+        return;
+
+    /* oldest entry of the set, an empty one is oldest of all*/
+    set = kv_dedup_set(dedup, addr->sin_addr.s_addr, addr->sin_port, req_id);
+    e = &set[0];
+    for (i = 1; i < KV_DEDUP_WAYS && e->time_ns != 0; i++)
+    {
+        if (set[i].time_ns < e->time_ns)
+            e = &set[i];
+    }
+
+    free(e->data);
+    e->time_ns = now;
+    e->ip = addr->sin_addr.s_addr;
+    e->port = addr->sin_port;
+    e->req_id = req_id;
+    e->len = len;
+    e->data = data;
+    memcpy(data != NULL ? data : e->inline_data, reply, len);
+}
+
+/* Function: kv_dedup_free() - To release the cache of a worker*/
+void kv_dedup_free(struct kv_dedup *dedup)
+{
+    uint32_t i;
+
+    if (dedup->entries == NULL)
+        return;
+    for (i = 0; i < (dedup->set_mask + 1) * KV_DEDUP_WAYS; i++)
+        free(dedup->entries[i].data);
+    free(dedup->entries);
+    dedup->entries = NULL;
+}
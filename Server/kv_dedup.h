@@ -0,0 +1,61 @@
+/* kv_dedup.h
+ *
+ * Replies of recent requests that change the store, for exactly once
+ * effects over UDP
+ * - A client that gets no reply sends the same request again with the
+ *   same request id. Running a del, append or incr twice would change
+ *   the store twice or report the wrong result, so the first reply is
+ *   kept and sent again instead
+ * - Entries are keyed by (client address, request id), the request id
+ *   of the binary header or of a "#<id> " text prefix
+ * - One cache per UDP worker; SO_REUSEPORT hands all datagrams of one
+ *   client socket to the same worker, so there is no lock
+ * - A set associative table of KV_DEDUP_WAYS entries per set, a new
+ *   reply takes the oldest entry of its set. Entries older than
+ *   KV_DEDUP_MAX_AGE are ignored, well past any client's retransmits;
+ *   the table size bounds how many requests back a retransmit is
+ *   still recognized
+ * - Short replies are kept in the entry, longer ones (multi-key) in a
+ *   copy of their own
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_DEDUP_H
+#define KV_DEDUP_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* entries per worker unless --dedup is given, 0 turns the cache off*/
+#define KV_DEDUP_DEFAULT 65536
+#define KV_DEDUP_WAYS 4
+/* reply bytes kept in the entry itself*/
+#define KV_DEDUP_INLINE 32
+/* seconds a reply is kept at most*/
+#define KV_DEDUP_MAX_AGE 30
+
+struct kv_dedup_entry{
+    uint64_t time_ns;                   /* when added, 0 for an empty entry*/
+    uint32_t ip;
+    uint16_t port;
+    uint32_t req_id;
+    uint32_t len;
+    char *data;                         /* NULL when the reply is inline*/
+    char inline_data[KV_DEDUP_INLINE];
+};
+
+struct kv_dedup{
+    struct kv_dedup_entry *entries;     /* NULL when turned off*/
+    uint32_t set_mask;
+};
+
+int kv_dedup_init(struct kv_dedup *dedup, int entries);
+int kv_dedup_find(struct kv_dedup *dedup, const struct sockaddr_in *addr, uint32_t req_id,
+                  uint64_t now, char *reply);
+void kv_dedup_add(struct kv_dedup *dedup, const struct sockaddr_in *addr, uint32_t req_id,
+                  uint64_t now, const char *reply, int len);
+void kv_dedup_free(struct kv_dedup *dedup);
+
+#endif /* KV_DEDUP_H */
@@ -0,0 +1,94 @@
+/* kv_hash.h
+ *
+ * Non-cryptographic 64-bit hash used to index the key-value store.
+ * wyhash-style multiply-mix: 16 bytes are consumed per round and the
+ * tail is folded with two overlapping loads, so short keys hash in a
+ * handful of instructions without a byte loop.
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_HASH_H
+#define KV_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define KV_HASH_SEED 0xa0761d6478bd642fULL
+#define KV_HASH_P1   0xe7037ed1a0b428dbULL
+#define KV_HASH_P2   0x8ebc6af09c88c6e3ULL
+
+/* 64x64->128 multiply folded back to 64 bits*/
+static inline uint64_t kv_hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t kv_hash_read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t kv_hash_read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Function: kv_hash() - To hash a key of given length
+ * in parameters:
+ *   key - key bytes, need not be NUL terminated
+ *   len - length of the key
+ *
+ * return:
+ *   64-bit hash of the key
+ */
+static inline uint64_t kv_hash(const char *key, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t seed = KV_HASH_SEED ^ kv_hash_mix(len ^ KV_HASH_P1, KV_HASH_P2);
+    uint64_t a;
+    uint64_t b;
+    size_t left = len;
+
+    while (left > 16)
+    {
+        seed = kv_hash_mix(kv_hash_read64(p) ^ KV_HASH_P1,
+                           kv_hash_read64(p + 8) ^ seed);
+        p += 16;
+        left -= 16;
+    }
+
+    if (left >= 8)
+    {
+        a = kv_hash_read64(p);
+        b = kv_hash_read64(p + left - 8);
+    }
+    else if (left >= 4)
+    {
+        a = kv_hash_read32(p);
+        b = kv_hash_read32(p + left - 4);
+    }
+    else if (left > 0)
+    {
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[left >> 1] << 8) | p[left - 1];
+        b = 0;
+    }
+    else
+    {
+        a = 0;
+        b = 0;
+    }
+
+    return kv_hash_mix(KV_HASH_P1 ^ len, kv_hash_mix(a ^ KV_HASH_P1, b ^ seed));
+}
+
+#endif /* KV_HASH_H */
@@ -0,0 +1,646 @@
+/* kv_index.c
+ *
+ * B+-tree ordered index of a store shard, see kv_index.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kv_index.h"
+#include "kv_store.h"
+
+struct kv_index_node{
+    int leaf;
+    int count;          /* items of a leaf, children of an inner node*/
+    /* first 8 key bytes, big endian; one entry more than the fanout
+       holds the overflow just before a split*/
+    uint64_t prefix[KV_INDEX_FANOUT + 1];
+};
+
+struct kv_index_leaf{
+    struct kv_index_node node;
+    struct kv_item *item[KV_INDEX_FANOUT + 1];
+    struct kv_index_leaf *next;     /* next leaf in key order*/
+};
+
+/* key[i] separates child[i - 1] from child[i], key[0] is unused*/
+struct kv_index_inner{
+    struct kv_index_node node;
+    struct kv_index_node *child[KV_INDEX_FANOUT + 1];
+    uint16_t len[KV_INDEX_FANOUT + 1];
+    char key[KV_INDEX_FANOUT + 1][KV_MAX_KEY];
+};
+
+/* key looked up, its prefix worked out once per operation*/
+struct kv_index_probe{
+    const char *key;
+    int len;
+    uint64_t prefix;
+};
+
+#define LEAF(n)  ((struct kv_index_leaf *)(n))
+#define INNER(n) ((struct kv_index_inner *)(n))
+
+static uint64_t kv_index_prefix(const char *key, int len)
+{
+    uint64_t prefix = 0;
+    int i;
+
+    /* zero padded: byte order of the prefixes is the key order, ties
+       are settled on the whole key*/
+    for (i = 0; i < 8; i++)
+        prefix = prefix << 8 | (i < len ? (unsigned char)key[i] : 0);
+    return prefix;
+}
+
+static void kv_probe_init(struct kv_index_probe *p, const char *key, int len)
+{
+    p->key = key;
+    p->len = len;
+    p->prefix = kv_index_prefix(key, len);
+}
+
+/* Function: kv_index_compare() - To order two keys
+ *   Bytewise, a key sorts before the longer keys it is a prefix of.
+ * in parameters:
+ *   a, a_len - first key
+ *   b, b_len - second key
+ *
+ * return:
+ *   < 0, 0 or > 0 as a sorts before, equal to or after b
+ */
+int kv_index_compare(const char *a, int a_len, const char *b, int b_len)
+{
+    int r = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    if (r != 0)
+        return r;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static int kv_probe_compare(const struct kv_index_probe *p, uint64_t prefix, const char *key, int len)
+{
+    if (p->prefix != prefix)
+        return p->prefix < prefix ? -1 : 1;
+    return kv_index_compare(p->key, p->len, key, len);
+}
+
+/* Function: kv_leaf_search() - To find where a key is or would go in a leaf
+ * in parameters:
+ *   leaf - leaf node
+ *   p - key
+ *   after - skip an item equal to the key
+ *
+ * return:
+ *   position of the first item at or, with after, past the key
+ */
+static int kv_leaf_search(const struct kv_index_leaf *leaf, const struct kv_index_probe *p, int after)
+{
+    int lo = 0;
+    int hi = leaf->node.count;
+    int mid;
+    int r;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        r = kv_probe_compare(p, leaf->node.prefix[mid], ITEM_KEY(leaf->item[mid]),
+                             leaf->item[mid]->key_len);
+        if (r > 0 || (after && r == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Function: kv_inner_search() - To pick the child whose range holds a key
+ *
+ * return:
+ *   child index, the last one whose separator is not above the key
+ */
+static int kv_inner_search(const struct kv_index_inner *inner, const struct kv_index_probe *p)
+{
+    int lo = 1;
+    int hi = inner->node.count;
+    int mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (kv_probe_compare(p, inner->node.prefix[mid], inner->key[mid], inner->len[mid]) >= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+static void kv_inner_set_key(struct kv_index_inner *inner, int i, const char *key, int len,
+                             uint64_t prefix)
+{
+    memcpy(inner->key[i], key, len);
+    inner->len[i] = len;
+    inner->node.prefix[i] = prefix;
+}
+
+/* Function: kv_inner_move() - To move children with their separators
+ *   Entries from..count-1 move to from+shift, shift is 1 or -1.
+ */
+static void kv_inner_move(struct kv_index_inner *inner, int from, int shift)
+{
+    int n = inner->node.count - from;
+
+    memmove(&inner->child[from + shift], &inner->child[from], n * sizeof(inner->child[0]));
+    memmove(&inner->len[from + shift], &inner->len[from], n * sizeof(inner->len[0]));
+    memmove(&inner->node.prefix[from + shift], &inner->node.prefix[from],
+            n * sizeof(inner->node.prefix[0]));
+    memmove(inner->key[from + shift], inner->key[from], n * sizeof(inner->key[0]));
+}
+
+/* Function: kv_leaf_move() - To move items, see kv_inner_move()*/
+static void kv_leaf_move(struct kv_index_leaf *leaf, int from, int shift)
+{
+    int n = leaf->node.count - from;
+
+    memmove(&leaf->item[from + shift], &leaf->item[from], n * sizeof(leaf->item[0]));
+    memmove(&leaf->node.prefix[from + shift], &leaf->node.prefix[from],
+            n * sizeof(leaf->node.prefix[0]));
+}
+
+/* Function: kv_index_reserve() - To allocate the nodes an insert may split into
+ *   One leaf and one inner node per level: a split may climb every
+ *   level and add a root above them.
+ *
+ * return:
+ *   status - FAILURE when out of memory, the tree is unchanged
+ */
+static int kv_index_reserve(struct kv_index *index)
+{
+    struct kv_index_inner *inner;
+
+    if (NULL == index->spare_leaf)
+    {
+        index->spare_leaf = malloc(sizeof(struct kv_index_leaf));
+        if (NULL == index->spare_leaf)
+            return FAILURE;
+    }
+    while (index->nspare_inner < index->height)
+    {
+        inner = malloc(sizeof(struct kv_index_inner));
+        if (NULL == inner)
+            return FAILURE;
+        /* spare list linked through the first child*/
+        inner->child[0] = (struct kv_index_node *)index->spare_inner;
+        index->spare_inner = inner;
+        index->nspare_inner++;
+    }
+    return SUCCESS;
+}
+
+static struct kv_index_leaf *kv_take_leaf(struct kv_index *index)
+{
+    struct kv_index_leaf *leaf = index->spare_leaf;
+
+    index->spare_leaf = NULL;
+    leaf->node.leaf = 1;
+    leaf->node.count = 0;
+    leaf->next = NULL;
+    return leaf;
+}
+
+static struct kv_index_inner *kv_take_inner(struct kv_index *index)
+{
+    struct kv_index_inner *inner = index->spare_inner;
+
+    index->spare_inner = (struct kv_index_inner *)inner->child[0];
+    index->nspare_inner--;
+    inner->node.leaf = 0;
+    inner->node.count = 0;
+    return inner;
+}
+
+/* Function: kv_node_insert() - To add an item below a node
+ * in parameters:
+ *   index - index, spare nodes reserved
+ *   node - subtree root
+ *   p - key of item
+ *   item - item to be added, its key not in the index
+ *   sep - set to the lowest key of the new node on a split
+ *
+ * return:
+ *   new right sibling of node when it split, NULL otherwise
+ */
+static struct kv_index_node *kv_node_insert(struct kv_index *index, struct kv_index_node *node,
+                                            const struct kv_index_probe *p, struct kv_item *item,
+                                            struct kv_index_probe *sep)
+{
+    struct kv_index_leaf *leaf;
+    struct kv_index_leaf *right_leaf;
+    struct kv_index_inner *inner;
+    struct kv_index_inner *right;
+    struct kv_index_node *split;
+    int half;
+    int i;
+
+    if (node->leaf)
+    {
+        leaf = LEAF(node);
+        i = kv_leaf_search(leaf, p, 0);
+        kv_leaf_move(leaf, i, 1);
+        leaf->item[i] = item;
+        node->prefix[i] = p->prefix;
+        if (++node->count <= KV_INDEX_FANOUT)
+            return NULL;
+
+        /* upper half moves to a new leaf linked after this one*/
+        half = node->count / 2;
+        right_leaf = kv_take_leaf(index);
+        right_leaf->node.count = node->count - half;
+        memcpy(right_leaf->item, &leaf->item[half], right_leaf->node.count * sizeof(leaf->item[0]));
+        memcpy(right_leaf->node.prefix, &node->prefix[half],
+               right_leaf->node.count * sizeof(node->prefix[0]));
+        node->count = half;
+        right_leaf->next = leaf->next;
+        leaf->next = right_leaf;
+
+        sep->key = ITEM_KEY(right_leaf->item[0]);
+        sep->len = right_leaf->item[0]->key_len;
+        sep->prefix = right_leaf->node.prefix[0];
+        return &right_leaf->node;
+    }
+
+    inner = INNER(node);
+    i = kv_inner_search(inner, p);
+    split = kv_node_insert(index, inner->child[i], p, item, sep);
+    if (NULL == split)
+        return NULL;
+
+    /* the new node goes right of the child that split*/
+    i++;
+    kv_inner_move(inner, i, 1);
+    inner->child[i] = split;
+    kv_inner_set_key(inner, i, sep->key, sep->len, sep->prefix);
+    if (++node->count <= KV_INDEX_FANOUT)
+        return NULL;
+
+    /* upper half moves to a new node, the separator in front of it
+       goes up to the parent; it stays readable in right->key[0]*/
+    half = node->count / 2;
+    right = kv_take_inner(index);
+    right->node.count = node->count - half;
+    memcpy(right->child, &inner->child[half], right->node.count * sizeof(inner->child[0]));
+    memcpy(right->len, &inner->len[half], right->node.count * sizeof(inner->len[0]));
+    memcpy(right->node.prefix, &node->prefix[half], right->node.count * sizeof(node->prefix[0]));
+    memcpy(right->key, inner->key[half], right->node.count * sizeof(inner->key[0]));
+    node->count = half;
+
+    sep->key = right->key[0];
+    sep->len = right->len[0];
+    sep->prefix = right->node.prefix[0];
+    return &right->node;
+}
+
+/* Function: kv_index_init() - To initialise an empty index
+ *
+ * return:
+ *   void
+ */
+void kv_index_init(struct kv_index *index)
+{
+    memset(index, 0, sizeof(*index));
+}
+
+/* Function: kv_index_insert() - To add the key of an item
+ * in parameters:
+ *   index - index
+ *   item - item whose key is not in the index yet
+ *
+ * return:
+ *   status - FAILURE when out of memory, the index is unchanged
+ */
+int kv_index_insert(struct kv_index *index, struct kv_item *item)
+{
+    struct kv_index_probe p;
+    struct kv_index_probe sep;
+    struct kv_index_node *split;
+    struct kv_index_inner *root;
+
+    if (kv_index_reserve(index) != SUCCESS)
+        return FAILURE;
+
+    if (NULL == index->root)
+    {
+        index->root = &kv_take_leaf(index)->node;
+        index->height = 1;
+    }
+
+    kv_probe_init(&p, ITEM_KEY(item), item->key_len);
+    split = kv_node_insert(index, index->root, &p, item, &sep);
+    if (split != NULL)
+    {
+        /* the tree only grows at the top, every leaf stays as deep*/
+        root = kv_take_inner(index);
+        root->node.count = 2;
+        root->child[0] = index->root;
+        root->child[1] = split;
+        kv_inner_set_key(root, 1, sep.key, sep.len, sep.prefix);
+        index->root = &root->node;
+        index->height++;
+    }
+    index->count++;
+    return SUCCESS;
+}
+
+/* Function: kv_borrow_left() - To move the last entry of child i-1 to child i*/
+static void kv_borrow_left(struct kv_index_inner *parent, int i)
+{
+    struct kv_index_node *left = parent->child[i - 1];
+    struct kv_index_node *node = parent->child[i];
+    struct kv_index_leaf *leaf;
+    struct kv_index_inner *inner;
+
+    left->count--;
+    if (node->leaf)
+    {
+        leaf = LEAF(node);
+        kv_leaf_move(leaf, 0, 1);
+        leaf->item[0] = LEAF(left)->item[left->count];
+        node->prefix[0] = left->prefix[left->count];
+        node->count++;
+        kv_inner_set_key(parent, i, ITEM_KEY(leaf->item[0]), leaf->item[0]->key_len,
+                         node->prefix[0]);
+        return;
+    }
+
+    /* rotate through the parent: its separator comes down in front of
+       the moved child, the left node's last separator goes up*/
+    inner = INNER(node);
+    kv_inner_move(inner, 0, 1);
+    node->count++;
+    inner->child[0] = INNER(left)->child[left->count];
+    kv_inner_set_key(inner, 1, parent->key[i], parent->len[i], parent->node.prefix[i]);
+    kv_inner_set_key(parent, i, INNER(left)->key[left->count], INNER(left)->len[left->count],
+                     left->prefix[left->count]);
+}
+
+/* Function: kv_borrow_right() - To move the first entry of child i+1 to child i*/
+static void kv_borrow_right(struct kv_index_inner *parent, int i)
+{
+    struct kv_index_node *node = parent->child[i];
+    struct kv_index_node *right = parent->child[i + 1];
+    struct kv_index_leaf *leaf;
+    struct kv_index_inner *inner;
+
+    if (node->leaf)
+    {
+        leaf = LEAF(right);
+        LEAF(node)->item[node->count] = leaf->item[0];
+        node->prefix[node->count] = right->prefix[0];
+        node->count++;
+        kv_leaf_move(leaf, 1, -1);
+        right->count--;
+        kv_inner_set_key(parent, i + 1, ITEM_KEY(leaf->item[0]), leaf->item[0]->key_len,
+                         right->prefix[0]);
+        return;
+    }
+
+    inner = INNER(right);
+    INNER(node)->child[node->count] = inner->child[0];
+    kv_inner_set_key(INNER(node), node->count, parent->key[i + 1], parent->len[i + 1],
+                     parent->node.prefix[i + 1]);
+    node->count++;
+    kv_inner_set_key(parent, i + 1, inner->key[1], inner->len[1], right->prefix[1]);
+    kv_inner_move(inner, 1, -1);
+    right->count--;
+}
+
+/* Function: kv_merge() - To fold child i+1 into child i and free it*/
+static void kv_merge(struct kv_index_inner *parent, int i)
+{
+    struct kv_index_node *node = parent->child[i];
+    struct kv_index_node *right = parent->child[i + 1];
+    struct kv_index_inner *inner;
+
+    if (node->leaf)
+    {
+        memcpy(&LEAF(node)->item[node->count], LEAF(right)->item,
+               right->count * sizeof(LEAF(node)->item[0]));
+        memcpy(&node->prefix[node->count], right->prefix, right->count * sizeof(node->prefix[0]));
+        LEAF(node)->next = LEAF(right)->next;
+    }
+    else
+    {
+        /* the parent separator comes down between the two halves*/
+        inner = INNER(node);
+        memcpy(&inner->child[node->count], INNER(right)->child,
+               right->count * sizeof(inner->child[0]));
+        memcpy(&inner->len[node->count], INNER(right)->len, right->count * sizeof(inner->len[0]));
+        memcpy(&node->prefix[node->count], right->prefix, right->count * sizeof(node->prefix[0]));
+        memcpy(inner->key[node->count], INNER(right)->key, right->count * sizeof(inner->key[0]));
+        kv_inner_set_key(inner, node->count, parent->key[i + 1], parent->len[i + 1],
+                         parent->node.prefix[i + 1]);
+    }
+    node->count += right->count;
+    free(right);
+
+    kv_inner_move(parent, i + 2, -1);
+    parent->node.count--;
+}
+
+/* Function: kv_node_delete() - To remove a key below a node
+ *   A child left with fewer than KV_INDEX_MIN entries borrows one
+ *   from a sibling or is merged with it on the way back up.
+ *
+ * return:
+ *   status - FAILURE when the key is not in the subtree
+ */
+static int kv_node_delete(struct kv_index_node *node, const struct kv_index_probe *p)
+{
+    struct kv_index_leaf *leaf;
+    struct kv_index_inner *inner;
+    int i;
+
+    if (node->leaf)
+    {
+        leaf = LEAF(node);
+        i = kv_leaf_search(leaf, p, 0);
+        if (i == node->count ||
+            kv_probe_compare(p, node->prefix[i], ITEM_KEY(leaf->item[i]), leaf->item[i]->key_len) != 0)
+            return FAILURE;
+        kv_leaf_move(leaf, i + 1, -1);
+        node->count--;
+        return SUCCESS;
+    }
+
+    inner = INNER(node);
+    i = kv_inner_search(inner, p);
+    if (kv_node_delete(inner->child[i], p) != SUCCESS)
+        return FAILURE;
+    if (inner->child[i]->count >= KV_INDEX_MIN)
+        return SUCCESS;
+
+    if (i > 0 && inner->child[i - 1]->count > KV_INDEX_MIN)
+        kv_borrow_left(inner, i);
+    else if (i + 1 < node->count && inner->child[i + 1]->count > KV_INDEX_MIN)
+        kv_borrow_right(inner, i);
+    else if (i > 0)
+        kv_merge(inner, i - 1);
+    else if (node->count > 1)
+        kv_merge(inner, 0);
+    return SUCCESS;
+}
+
+/* Function: kv_index_delete() - To remove a key
+ * in parameters:
+ *   index - index
+ *   key - key to be removed
+ *   key_len - length of key
+ *
+ * return:
+ *   status - FAILURE when the key is not in the index
+ */
+int kv_index_delete(struct kv_index *index, const char *key, int key_len)
+{
+    struct kv_index_probe p;
+    struct kv_index_node *root = index->root;
+
+    if (NULL == root)
+        return FAILURE;
+
+    kv_probe_init(&p, key, key_len);
+    if (kv_node_delete(root, &p) != SUCCESS)
+        return FAILURE;
+    index->count--;
+
+    /* a merge below the root takes one child a time, at most one
+       level goes per delete*/
+    if (!root->leaf && root->count == 1)
+    {
+        index->root = INNER(root)->child[0];
+        index->height--;
+        free(root);
+    }
+    else if (root->leaf && root->count == 0)
+    {
+        index->root = NULL;
+        index->height = 0;
+        free(root);
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_index_move() - To repoint a key at the item that replaced it
+ *   Called while the old item is still readable.
+ * in parameters:
+ *   index - index
+ *   item - new item, same key as the one it replaces
+ *
+ * return:
+ *   status - FAILURE when the key is not in the index
+ */
+int kv_index_move(struct kv_index *index, struct kv_item *item)
+{
+    struct kv_index_probe p;
+    struct kv_index_node *node = index->root;
+    struct kv_index_leaf *leaf;
+    int i;
+
+    if (NULL == node)
+        return FAILURE;
+
+    kv_probe_init(&p, ITEM_KEY(item), item->key_len);
+    while (!node->leaf)
+        node = INNER(node)->child[kv_inner_search(INNER(node), &p)];
+
+    leaf = LEAF(node);
+    i = kv_leaf_search(leaf, &p, 0);
+    if (i == node->count ||
+        kv_probe_compare(&p, node->prefix[i], ITEM_KEY(leaf->item[i]), leaf->item[i]->key_len) != 0)
+        return FAILURE;
+    leaf->item[i] = item;
+    return SUCCESS;
+}
+
+/* Function: kv_index_seek() - To position an iterator in key order
+ * in parameters:
+ *   index - index
+ *   key - key to start at, any byte string
+ *   key_len - length of key
+ *   after - start past key itself, used to resume after a cursor
+ *   iter - set to the position, read with kv_index_next()
+ *
+ * return:
+ *   void
+ */
+void kv_index_seek(struct kv_index *index, const char *key, int key_len, int after,
+                   struct kv_index_iter *iter)
+{
+    struct kv_index_probe p;
+    struct kv_index_node *node = index->root;
+
+    iter->leaf = NULL;
+    iter->pos = 0;
+    if (NULL == node)
+        return;
+
+    kv_probe_init(&p, key, key_len);
+    while (!node->leaf)
+        node = INNER(node)->child[kv_inner_search(INNER(node), &p)];
+    iter->leaf = LEAF(node);
+    iter->pos = kv_leaf_search(iter->leaf, &p, after);
+}
+
+/* Function: kv_index_next() - To step an iterator
+ *   Valid while the shard lock stays held since kv_index_seek().
+ *
+ * return:
+ *   next item in key order, NULL past the last one
+ */
+struct kv_item *kv_index_next(struct kv_index_iter *iter)
+{
+    while (iter->leaf != NULL && iter->pos >= iter->leaf->node.count)
+    {
+        iter->leaf = iter->leaf->next;
+        iter->pos = 0;
+    }
+    if (NULL == iter->leaf)
+        return NULL;
+    return iter->leaf->item[iter->pos++];
+}
+
+static void kv_node_free(struct kv_index_node *node)
+{
+    int i;
+
+    if (!node->leaf)
+    {
+        for (i = 0; i < node->count; i++)
+            kv_node_free(INNER(node)->child[i]);
+    }
+    free(node);
+}
+
+/* Function: kv_index_free() - To release all nodes, the items stay
+ *
+ * return:
+ *   void
+ */
+void kv_index_free(struct kv_index *index)
+{
+    struct kv_index_inner *inner;
+
+    if (index->root != NULL)
+        kv_node_free(index->root);
+    free(index->spare_leaf);
+    while (index->spare_inner != NULL)
+    {
+        inner = index->spare_inner;
+        index->spare_inner = (struct kv_index_inner *)inner->child[0];
+        free(inner);
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,65 @@
+/* kv_index.h
+ *
+ * Ordered index of the keys of one store shard, backs range scans
+ * - B+-tree: inner nodes hold separator keys, leaves hold the items in
+ *   key order and are linked, so a range is one descent and then a
+ *   walk along the leaves
+ * - Every node keeps the first 8 bytes of its keys inline, a binary
+ *   search inside a node mostly compares those and only touches the
+ *   key bytes on a tie
+ * - Leaves point at the items, keys are not copied; an item moved to
+ *   another chunk is repointed with kv_index_move(). Separators are
+ *   copied into the inner node as they outlive the key they came from
+ * - Nodes a split may need are allocated before the tree is touched,
+ *   so an insert either fails cleanly or succeeds; a delete never
+ *   allocates
+ * - Not thread safe, every store shard owns one index under its lock
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_INDEX_H
+#define KV_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* items per leaf and children per inner node*/
+#define KV_INDEX_FANOUT 32
+/* fewer entries than this and a node borrows from or merges with a
+   sibling, low enough that a node just split is not rebalanced at
+   once*/
+#define KV_INDEX_MIN (KV_INDEX_FANOUT / 4)
+
+struct kv_item;
+struct kv_index_node;
+struct kv_index_leaf;
+struct kv_index_inner;
+
+struct kv_index{
+    struct kv_index_node *root;         /* NULL while empty*/
+    struct kv_index_leaf *spare_leaf;   /* kept for the next split*/
+    struct kv_index_inner *spare_inner; /* list, one per level*/
+    int nspare_inner;
+    int height;                         /* levels, 1 when the root is a leaf*/
+    size_t count;
+};
+
+/* position in the leaves, see kv_index_seek()*/
+struct kv_index_iter{
+    struct kv_index_leaf *leaf;
+    int pos;
+};
+
+void kv_index_init(struct kv_index *index);
+void kv_index_free(struct kv_index *index);
+int kv_index_insert(struct kv_index *index, struct kv_item *item);
+int kv_index_delete(struct kv_index *index, const char *key, int key_len);
+int kv_index_move(struct kv_index *index, struct kv_item *item);
+void kv_index_seek(struct kv_index *index, const char *key, int key_len, int after,
+                   struct kv_index_iter *iter);
+struct kv_item *kv_index_next(struct kv_index_iter *iter);
+int kv_index_compare(const char *a, int a_len, const char *b, int b_len);
+
+#endif /* KV_INDEX_H */
@@ -0,0 +1,191 @@
+/* kv_io.c
+ *
+ * Backend selection and the blocking backend, see kv_io.h
+ *
+ * The blocking backend is the request loop's original socket code:
+ * recvmmsg(MSG_WAITFORONE) blocks for one datagram and takes whatever
+ * else is queued, sendmmsg sends the replies, retried while partial.
+ *
+ * Author: Kapil
+ *
+ */
+
+#define _GNU_SOURCE     /* recvmmsg, sendmmsg*/
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "kv_io.h"
+#include "kv_log.h"
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+#include "../Common/kv_hist.h"
+
+/* the largest datagram*/
+#define KV_IO_BUF_SIZE KV_PROTO_MAX_DATAGRAM
+
+struct kv_io_blocking{
+    struct mmsghdr *in_msgs;
+    struct mmsghdr *out_msgs;
+    struct iovec *in_iov;
+    struct sockaddr_in *addrs;
+    char *buffers;
+};
+
+/* Function: kv_io_open() - To set up the backend of one worker socket
+ *   A backend that cannot be set up is replaced by the blocking one.
+ * in parameters:
+ *   io - backend handle to fill
+ *   backend - KV_IO_BLOCKING or KV_IO_URING
+ *   sockfd - bound UDP socket of the worker
+ *   batch - most datagrams taken per kv_io_recv()
+ *   syscalls - counter the backend adds its syscalls to
+ *
+ * return:
+ *   status - SUCCESS or FAILURE when not even blocking I/O can be set up
+ */
+int kv_io_open(struct kv_io *io, int backend, int sockfd, int batch, uint64_t *syscalls)
+{
+    memset(io, 0, sizeof(*io));
+    io->sockfd = sockfd;
+    io->batch = batch;
+    io->syscalls = syscalls;
+
+    if (KV_IO_URING == backend)
+    {
+        io->ops = &kv_io_uring_ops;
+        if (io->ops->open(io) == SUCCESS)
+            return SUCCESS;
+        KV_LOG(KV_LOG_WARN, "io_uring setup failed, using blocking I/O");
+    }
+
+    io->ops = &kv_io_blocking_ops;
+    return io->ops->open(io);
+}
+
+/* Function: kv_io_close() - To release the backend
+ *   The socket stays open, it belongs to the caller.
+ */
+void kv_io_close(struct kv_io *io)
+{
+    if (io->ops != NULL)
+        io->ops->close(io);
+    io->ops = NULL;
+}
+
+/* Function: kv_io_parse_backend() - To map an --io name to a backend
+ * in parameters:
+ *   name - "blocking" or "uring"
+ *
+ * return:
+ *   KV_IO_*, -1 for an unknown name
+ */
+int kv_io_parse_backend(const char *name)
+{
+    if (strcmp(name, kv_io_blocking_ops.name) == 0)
+        return KV_IO_BLOCKING;
+    if (strcmp(name, kv_io_uring_ops.name) == 0)
+        return KV_IO_URING;
+    return -1;
+}
+
+static void kv_io_blocking_close(struct kv_io *io)
+{
+    struct kv_io_blocking *b = io->priv;
+
+    if (NULL == b)
+        return;
+    free(b->in_msgs);
+    free(b->out_msgs);
+    free(b->in_iov);
+    free(b->addrs);
+    free(b->buffers);
+    free(b);
+    io->priv = NULL;
+}
+
+static int kv_io_blocking_open(struct kv_io *io)
+{
+    struct kv_io_blocking *b = calloc(1, sizeof(*b));
+
+    io->priv = b;
+    if (NULL == b)
+        return FAILURE;
+    b->in_msgs = calloc(io->batch, sizeof(struct mmsghdr));
+    b->out_msgs = calloc(io->batch, sizeof(struct mmsghdr));
+    b->in_iov = calloc(io->batch, sizeof(struct iovec));
+    b->addrs = calloc(io->batch, sizeof(struct sockaddr_in));
+    b->buffers = malloc((size_t)io->batch * KV_IO_BUF_SIZE);
+    if (!b->in_msgs || !b->out_msgs || !b->in_iov || !b->addrs || !b->buffers)
+    {
+        kv_io_blocking_close(io);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int kv_io_blocking_recv(struct kv_io *io, struct kv_io_msg *msgs)
+{
+    struct kv_io_blocking *b = io->priv;
+    int num_msgs;
+    int i;
+
+    for (i = 0; i < io->batch; i++)
+    {
+        b->in_iov[i].iov_base = b->buffers + (size_t)i * KV_IO_BUF_SIZE;
+        b->in_iov[i].iov_len = KV_IO_BUF_SIZE;
+        b->in_msgs[i].msg_hdr.msg_iov = &b->in_iov[i];
+        b->in_msgs[i].msg_hdr.msg_iovlen = 1;
+        b->in_msgs[i].msg_hdr.msg_name = &b->addrs[i];
+        b->in_msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+    }
+
+    /* block for the first datagram, then take whatever is queued*/
+    KV_HIST_ADD(*io->syscalls, 1);
+    num_msgs = recvmmsg(io->sockfd, b->in_msgs, io->batch, MSG_WAITFORONE, NULL);
+    if (num_msgs <= 0)
+        return 0;
+
+    for (i = 0; i < num_msgs; i++)
+    {
+        msgs[i].buf = b->in_iov[i].iov_base;
+        msgs[i].len = b->in_msgs[i].msg_len;
+        msgs[i].addr = &b->addrs[i];
+    }
+    return num_msgs;
+}
+
+static int kv_io_blocking_send(struct kv_io *io, const struct kv_io_reply *replies, int num)
+{
+    struct kv_io_blocking *b = io->priv;
+    int num_sent = 0;
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        memset(&b->out_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        b->out_msgs[i].msg_hdr.msg_iov = (struct iovec *)replies[i].iov;
+        b->out_msgs[i].msg_hdr.msg_iovlen = replies[i].iovcnt;
+        b->out_msgs[i].msg_hdr.msg_name = (struct sockaddr_in *)replies[i].addr;
+        b->out_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    /* all replies of the batch in one syscall, retried if partial*/
+    while (num_sent < num)
+    {
+        KV_HIST_ADD(*io->syscalls, 1);
+        i = sendmmsg(io->sockfd, b->out_msgs + num_sent, num - num_sent, MSG_CONFIRM);
+        if (i <= 0)
+            break;
+        num_sent += i;
+    }
+    return num_sent;
+}
+
+const struct kv_io_ops kv_io_blocking_ops = {
+    .name = "blocking",
+    .open = kv_io_blocking_open,
+    .recv = kv_io_blocking_recv,
+    .send = kv_io_blocking_send,
+    .close = kv_io_blocking_close,
+};
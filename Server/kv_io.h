@@ -0,0 +1,92 @@
+/* kv_io.h
+ *
+ * Datagram I/O backends under the worker request loop
+ * - A worker asks its backend for a batch of received datagrams, runs
+ *   them against the store and hands back the batch of replies; a
+ *   reply is up to KV_IO_IOVS pieces so a value goes out from its
+ *   pinned item
+ * - blocking: recvmmsg waiting for the first datagram and sendmmsg,
+ *   two syscalls a batch
+ * - uring: one io_uring per worker. A multishot RECVMSG fills buffers
+ *   of a registered buffer ring for as long as datagrams come, the
+ *   replies of a batch are SENDMSG entries submitted together; a batch
+ *   that finds its datagrams already completed needs one syscall
+ * - The backend is picked at startup with --io, a worker whose
+ *   io_uring cannot be set up falls back to blocking
+ * - kv_io_send() returns once the kernel no longer reads the replies,
+ *   the caller may then release the pinned values
+ * - Every backend counts the syscalls it makes, shown by --stats to
+ *   compare backends under the same load
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_IO_H
+#define KV_IO_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#define KV_IO_BLOCKING 0
+#define KV_IO_URING    1
+
+/* head, pinned value, tail*/
+#define KV_IO_IOVS 3
+
+/* received datagram, valid until the next kv_io_recv()*/
+struct kv_io_msg{
+    char *buf;                          /* len bytes, not NUL terminated*/
+    int len;
+    const struct sockaddr_in *addr;
+};
+
+struct kv_io_reply{
+    const struct sockaddr_in *addr;
+    struct iovec iov[KV_IO_IOVS];
+    int iovcnt;
+};
+
+struct kv_io;
+
+struct kv_io_ops{
+    const char *name;
+    int (*open)(struct kv_io *io);
+    int (*recv)(struct kv_io *io, struct kv_io_msg *msgs);
+    int (*send)(struct kv_io *io, const struct kv_io_reply *replies, int num);
+    void (*close)(struct kv_io *io);
+};
+
+struct kv_io{
+    const struct kv_io_ops *ops;
+    int sockfd;
+    int batch;                          /* most datagrams per kv_io_recv()*/
+    uint64_t *syscalls;                 /* counter of the owning worker*/
+    void *priv;                         /* backend state*/
+};
+
+int kv_io_open(struct kv_io *io, int backend, int sockfd, int batch, uint64_t *syscalls);
+void kv_io_close(struct kv_io *io);
+int kv_io_parse_backend(const char *name);
+
+/* Function: kv_io_recv() - To wait for the next batch of datagrams
+ *   Returns 0 when woken without one, the caller checks for shutdown.
+ */
+static inline int kv_io_recv(struct kv_io *io, struct kv_io_msg *msgs)
+{
+    return io->ops->recv(io, msgs);
+}
+
+/* Function: kv_io_send() - To send a batch of replies
+ *   Returns the number of replies sent.
+ */
+static inline int kv_io_send(struct kv_io *io, const struct kv_io_reply *replies, int num)
+{
+    return io->ops->send(io, replies, num);
+}
+
+extern const struct kv_io_ops kv_io_blocking_ops;
+extern const struct kv_io_ops kv_io_uring_ops;
+
+#endif /* KV_IO_H */
@@ -0,0 +1,548 @@
+/* kv_io_uring.c
+ *
+ * io_uring backend, see kv_io.h
+ *
+ * The rings are driven through the raw syscalls and their mmap'ed
+ * memory, the tree does not depend on liburing.
+ *
+ * One multishot RECVMSG stays armed on the worker socket. Every
+ * datagram completes into a buffer the kernel takes from the provided
+ * buffer ring: an io_uring_recvmsg_out header, the client address and
+ * the payload. The buffers of a batch go back to the ring when the
+ * worker asks for the next batch, after their replies (which point at
+ * the client addresses in them) are sent. The receive stops when the
+ * ring runs dry or on an error and is armed again then.
+ *
+ * The completion ring is shared, so receive completions posted while
+ * the worker waits for its sends are stashed for the next batch.
+ *
+ * Author: Kapil
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "kv_io.h"
+#include "kv_log.h"
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+#include "../Common/kv_hist.h"
+
+/* user_data of the requests*/
+#define KV_URING_RECV   1
+#define KV_URING_SEND   2
+#define KV_URING_CANCEL 3
+/* the one buffer group of a ring*/
+#define KV_URING_BGID   0
+/* longest wait for datagrams before the worker looks for shutdown*/
+#define KV_URING_WAIT_MS 100
+/* tries to cancel the receive at close*/
+#define KV_URING_CANCEL_TRIES 10
+
+/* receive completion kept for the next batch*/
+struct kv_uring_recv{
+    int32_t res;
+    uint16_t bid;
+};
+
+struct kv_uring{
+    int fd;
+    unsigned features;
+    unsigned sq_entries;
+    /* submission ring*/
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned sq_local_tail;             /* entries filled, published on enter*/
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    /* completion ring, may share the mapping of the submission ring*/
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* provided buffers*/
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint16_t br_tail;
+    int br_registered;
+    char *bufs;
+    size_t buf_size;
+    unsigned nbufs;                     /* power of 2*/
+    uint16_t *held;                     /* buffers of the current batch*/
+    unsigned nheld;
+    struct kv_uring_recv *stash;        /* nbufs entries*/
+    unsigned stash_head;
+    unsigned stash_tail;
+    struct msghdr recv_hdr;
+    struct msghdr *send_hdrs;           /* batch entries*/
+    int armed;                          /* receive in flight*/
+    int sends;                          /* send completions outstanding*/
+    int sends_failed;
+};
+
+static unsigned kv_uring_pow2(unsigned n)
+{
+    unsigned p = 1;
+
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+/* Function: kv_uring_enter() - To submit queued entries and wait
+ * in parameters:
+ *   io - backend handle
+ *   min_complete - completions to wait for, 0 to only submit
+ *   wait_ms - give up waiting after this long, 0 for no limit
+ *
+ * return:
+ *   entries submitted or -errno
+ */
+static int kv_uring_enter(struct kv_io *io, unsigned min_complete, int wait_ms)
+{
+    struct kv_uring *u = io->priv;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = 0;
+    unsigned submit;
+    void *argp = NULL;
+    size_t argsz = 0;
+    long ret;
+
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    submit = u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (min_complete > 0)
+        flags |= IORING_ENTER_GETEVENTS;
+    if (wait_ms > 0 && (u->features & IORING_FEAT_EXT_ARG))
+    {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = wait_ms / 1000;
+        ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    KV_HIST_ADD(*io->syscalls, 1);
+    ret = syscall(__NR_io_uring_enter, u->fd, submit, min_complete, flags, argp, argsz);
+    return ret < 0 ? -errno : (int)ret;
+}
+
+/* Function: kv_uring_sqe() - To take a free submission entry
+ *   NULL when the ring is full of entries not yet submitted.
+ */
+static struct io_uring_sqe *kv_uring_sqe(struct kv_uring *u)
+{
+    struct io_uring_sqe *sqe;
+
+    if (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+        return NULL;
+    sqe = &u->sqes[u->sq_local_tail & *u->sq_mask];
+    u->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* Function: kv_uring_reap() - To take every completion posted so far
+ *   Receives are stashed for kv_uring_recv(), sends counted off.
+ */
+static void kv_uring_reap(struct kv_uring *u)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+    struct kv_uring_recv *r;
+
+    for (; head != tail; head++)
+    {
+        cqe = &u->cqes[head & *u->cq_mask];
+        switch (cqe->user_data)
+        {
+            case KV_URING_RECV:
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    u->armed = 0;
+                /* every buffer is either stashed or held, never more
+                   than nbufs of them*/
+                if (cqe->flags & IORING_CQE_F_BUFFER)
+                {
+                    r = &u->stash[u->stash_tail++ & (u->nbufs - 1)];
+                    r->res = cqe->res;
+                    r->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                }
+                else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+                {
+                    KV_LOG(KV_LOG_DEBUG, "io_uring receive failed: %s", strerror(-cqe->res));
+                }
+            break;
+
+            case KV_URING_SEND:
+                u->sends--;
+                if (cqe->res < 0)
+                    u->sends_failed++;
+            break;
+
+            default:
+            break;
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Function: kv_uring_give() - To hand a buffer back to the kernel
+ *   Published with the next kv_uring_publish().
+ */
+static void kv_uring_give(struct kv_uring *u, uint16_t bid)
+{
+    struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * u->buf_size);
+    buf->len = u->buf_size;
+    buf->bid = bid;
+    u->br_tail++;
+}
+
+static void kv_uring_publish(struct kv_uring *u)
+{
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* Function: kv_uring_arm() - To queue the multishot receive*/
+static void kv_uring_arm(struct kv_io *io)
+{
+    struct kv_uring *u = io->priv;
+    struct io_uring_sqe *sqe = kv_uring_sqe(u);
+
+    if (NULL == sqe)
+        return;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = io->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = KV_URING_BGID;
+    sqe->user_data = KV_URING_RECV;
+    u->armed = 1;
+}
+
+/* Function: kv_uring_map() - To map the rings of a new io_uring
+ * in parameters:
+ *   u - state, fd set
+ *   p - parameters returned by io_uring_setup
+ *
+ * return:
+ *   status - SUCCESS or FAILURE
+ */
+static int kv_uring_map(struct kv_uring *u, const struct io_uring_params *p)
+{
+    unsigned i;
+
+    u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = 0;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == u->sq_ring)
+    {
+        u->sq_ring = NULL;
+        return FAILURE;
+    }
+    u->cq_ring = u->sq_ring;
+    if (u->cq_ring_size > 0)
+    {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == u->cq_ring)
+        {
+            u->cq_ring = NULL;
+            return FAILURE;
+        }
+    }
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == u->sqes)
+    {
+        u->sqes = NULL;
+        return FAILURE;
+    }
+
+    u->sq_entries = p->sq_entries;
+    u->sq_head = (unsigned *)((char *)u->sq_ring + p->sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_ring + p->sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ring + p->sq_off.ring_mask);
+    u->sq_local_tail = *u->sq_tail;
+    /* slot i always holds entry i*/
+    for (i = 0; i < p->sq_entries; i++)
+        ((unsigned *)((char *)u->sq_ring + p->sq_off.array))[i] = i;
+
+    u->cq_head = (unsigned *)((char *)u->cq_ring + p->cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ring + p->cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ring + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p->cq_off.cqes);
+    return SUCCESS;
+}
+
+/* Function: kv_uring_setup() - To create the io_uring of a worker
+ *   Completions are run only when the worker enters the kernel, which
+ *   saves interrupting it; older kernels without that get a plain ring.
+ */
+static int kv_uring_setup(struct kv_uring *u, unsigned entries, unsigned cq_entries)
+{
+    static const unsigned tries[] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_CQSIZE,
+    };
+    struct io_uring_params p;
+    unsigned t;
+
+    for (t = 0; t < sizeof(tries) / sizeof(tries[0]); t++)
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = tries[t];
+        p.cq_entries = cq_entries;
+        u->fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (u->fd >= 0)
+            break;
+    }
+    if (u->fd < 0)
+        return FAILURE;
+
+    u->features = p.features;
+    return kv_uring_map(u, &p);
+}
+
+static void kv_uring_close(struct kv_io *io)
+{
+    struct kv_uring *u = io->priv;
+    struct io_uring_buf_reg reg;
+    struct io_uring_sqe *sqe;
+    int tries;
+
+    if (NULL == u)
+        return;
+
+    /* the kernel must be done writing into the buffers before they go*/
+    if (u->fd >= 0 && u->armed && u->sqes != NULL)
+    {
+        sqe = kv_uring_sqe(u);
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = KV_URING_RECV;
+            sqe->user_data = KV_URING_CANCEL;
+        }
+        for (tries = 0; u->armed && tries < KV_URING_CANCEL_TRIES; tries++)
+        {
+            kv_uring_enter(io, 1, KV_URING_WAIT_MS);
+            kv_uring_reap(u);
+        }
+    }
+    if (u->br_registered)
+    {
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = KV_URING_BGID;
+        syscall(__NR_io_uring_register, u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if (u->fd >= 0)
+        close(u->fd);
+
+    if (u->sqes != NULL)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring != NULL)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->br != NULL)
+        munmap(u->br, u->br_size);
+    if (u->bufs != NULL)
+        munmap(u->bufs, u->nbufs * u->buf_size);
+    free(u->held);
+    free(u->stash);
+    free(u->send_hdrs);
+    free(u);
+    io->priv = NULL;
+}
+
+static int kv_uring_open(struct kv_io *io)
+{
+    struct kv_uring *u = calloc(1, sizeof(*u));
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    io->priv = u;
+    if (NULL == u)
+        return FAILURE;
+    u->fd = -1;
+
+    /* twice the batch, a batch is held while the next one arrives*/
+    u->nbufs = kv_uring_pow2(2 * io->batch);
+    /* header, client address and datagram*/
+    u->buf_size = (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+                   KV_PROTO_MAX_DATAGRAM + 63) & ~(size_t)63;
+    u->held = calloc(u->nbufs, sizeof(uint16_t));
+    u->stash = calloc(u->nbufs, sizeof(struct kv_uring_recv));
+    u->send_hdrs = calloc(io->batch, sizeof(struct msghdr));
+    if (!u->held || !u->stash || !u->send_hdrs)
+        goto fail;
+
+    /* the sends of a batch, the receive and a cancel; completions for
+       every buffer on top*/
+    if (kv_uring_setup(u, io->batch + 2, u->nbufs + 2 * kv_uring_pow2(io->batch + 2)) != SUCCESS)
+        goto fail;
+
+    u->br_size = u->nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = mmap(NULL, u->nbufs * u->buf_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == u->br || MAP_FAILED == u->bufs)
+    {
+        u->br = MAP_FAILED == u->br ? NULL : u->br;
+        u->bufs = MAP_FAILED == u->bufs ? NULL : u->bufs;
+        goto fail;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = u->nbufs;
+    reg.bgid = KV_URING_BGID;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto fail;
+    u->br_registered = 1;
+    for (i = 0; i < u->nbufs; i++)
+        kv_uring_give(u, i);
+    kv_uring_publish(u);
+
+    /* only the address is wanted with the payload*/
+    u->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    u->recv_hdr.msg_controllen = 0;
+    return SUCCESS;
+
+fail:
+    KV_LOG(KV_LOG_DEBUG, "io_uring setup: %s", strerror(errno));
+    kv_uring_close(io);
+    return FAILURE;
+}
+
+static int kv_uring_recv(struct kv_io *io, struct kv_io_msg *msgs)
+{
+    struct kv_uring *u = io->priv;
+    struct io_uring_recvmsg_out *out;
+    struct kv_uring_recv *r;
+    char *buf;
+    unsigned i;
+    int num_msgs = 0;
+
+    /* the previous batch is sent, its buffers may be refilled*/
+    for (i = 0; i < u->nheld; i++)
+        kv_uring_give(u, u->held[i]);
+    if (u->nheld > 0)
+        kv_uring_publish(u);
+    u->nheld = 0;
+
+    if (!u->armed)
+        kv_uring_arm(io);
+
+    kv_uring_reap(u);
+    if (u->stash_head == u->stash_tail)
+    {
+        kv_uring_enter(io, 1, KV_URING_WAIT_MS);
+        kv_uring_reap(u);
+    }
+    else if (u->sq_local_tail != *u->sq_tail)
+    {
+        /* the receive was armed again, datagrams are already waiting*/
+        kv_uring_enter(io, 0, 0);
+    }
+
+    while (num_msgs < io->batch && u->stash_head != u->stash_tail)
+    {
+        r = &u->stash[u->stash_head++ & (u->nbufs - 1)];
+        buf = u->bufs + (size_t)r->bid * u->buf_size;
+        u->held[u->nheld++] = r->bid;
+
+        out = (struct io_uring_recvmsg_out *)buf;
+        if (r->res < (int32_t)(sizeof(*out) + u->recv_hdr.msg_namelen) ||
+            (out->flags & MSG_TRUNC) || out->namelen > u->recv_hdr.msg_namelen)
+            continue;
+
+        msgs[num_msgs].addr = (const struct sockaddr_in *)(out + 1);
+        msgs[num_msgs].buf = buf + sizeof(*out) + u->recv_hdr.msg_namelen;
+        msgs[num_msgs].len = out->payloadlen;
+        num_msgs++;
+    }
+    return num_msgs;
+}
+
+static int kv_uring_send(struct kv_io *io, const struct kv_io_reply *replies, int num)
+{
+    struct kv_uring *u = io->priv;
+    struct io_uring_sqe *sqe;
+    struct msghdr *hdr;
+    int queued;
+    int ret;
+
+    for (queued = 0; queued < num; queued++)
+    {
+        sqe = kv_uring_sqe(u);
+        if (NULL == sqe)
+            break;
+        hdr = &u->send_hdrs[queued];
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = (struct sockaddr_in *)replies[queued].addr;
+        hdr->msg_namelen = sizeof(struct sockaddr_in);
+        hdr->msg_iov = (struct iovec *)replies[queued].iov;
+        hdr->msg_iovlen = replies[queued].iovcnt;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = io->sockfd;
+        sqe->addr = (uint64_t)(uintptr_t)hdr;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_CONFIRM;
+        sqe->user_data = KV_URING_SEND;
+        u->sends++;
+    }
+
+    /* the values are read by the kernel until their send completes,
+       the caller releases them after we return*/
+    u->sends_failed = 0;
+    while (u->sends > 0)
+    {
+        ret = kv_uring_enter(io, u->sends, 0);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+        {
+            KV_LOG(KV_LOG_ERROR, "io_uring send failed: %s", strerror(-ret));
+            break;
+        }
+        kv_uring_reap(u);
+    }
+    return queued - u->sends_failed;
+}
+
+const struct kv_io_ops kv_io_uring_ops = {
+    .name = "uring",
+    .open = kv_uring_open,
+    .recv = kv_uring_recv,
+    .send = kv_uring_send,
+    .close = kv_uring_close,
+};
@@ -0,0 +1,214 @@
+/* kv_log.c
+ *
+ * Asynchronous logger, see kv_log.h
+ *
+ * The ring is a bounded multi-producer queue: every entry carries a
+ * sequence number telling whether it is free for the producer that
+ * claimed position pos (seq == pos) or filled for the consumer
+ * (seq == pos + 1). Producers claim positions with a CAS on
+ * log_head, the single consumer owns log_tail.
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kv_log.h"
+#include "kv_store.h"
+
+struct kv_log_entry{
+    size_t seq;
+    int level;
+    struct timespec ts;
+    char msg[KV_LOG_MSG_MAX];
+};
+
+int kv_log_level = KV_LOG_DEFAULT;
+
+static const char *log_level_names[] = { "error", "warn", "info", "debug" };
+
+static struct kv_log_entry log_ring[KV_LOG_RING_SIZE];
+static size_t log_head __attribute__((aligned(64)));    /* next position to claim*/
+static size_t log_tail __attribute__((aligned(64)));    /* next position to drain*/
+static size_t log_dropped;
+static int log_init_done;
+
+static FILE *log_out;
+static pthread_t log_thread;
+static int log_running;
+static int log_stop;
+
+static void kv_log_init_ring(void)
+{
+    size_t i;
+
+    for (i = 0; i < KV_LOG_RING_SIZE; i++)
+        log_ring[i].seq = i;
+    log_init_done = 1;
+}
+
+/* Function: kv_log_write() - To queue one message, never blocks
+ * in parameters:
+ *   level - KV_LOG_*
+ *   fmt - printf format, longer messages are truncated
+ *
+ * return:
+ *   void
+ */
+void kv_log_write(int level, const char *fmt, ...)
+{
+    struct kv_log_entry *e;
+    size_t pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    size_t seq;
+    va_list ap;
+
+    if (!log_init_done)
+        return;
+
+    while (1)
+    {
+        e = &log_ring[pos & (KV_LOG_RING_SIZE - 1)];
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos)
+        {
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((long)(seq - pos) < 0)
+        {
+            /* consumer is a whole ring behind*/
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    e->level = level;
+    clock_gettime(CLOCK_REALTIME, &e->ts);
+    va_start(ap, fmt);
+    vsnprintf(e->msg, sizeof(e->msg), fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Function: kv_log_drain() - To write out every filled entry
+ *
+ * return:
+ *   number of entries written
+ */
+static int kv_log_drain(void)
+{
+    struct kv_log_entry *e;
+    struct tm tm;
+    char stamp[32];
+    size_t dropped;
+    int n = 0;
+
+    while (1)
+    {
+        e = &log_ring[log_tail & (KV_LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+            break;
+
+        localtime_r(&e->ts.tv_sec, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf(log_out, "%s.%03ld %-5s %s\n", stamp, e->ts.tv_nsec / 1000000,
+                kv_log_level_name(e->level), e->msg);
+
+        /* hand the entry back to producers one lap ahead*/
+        __atomic_store_n(&e->seq, log_tail + KV_LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_tail++;
+        n++;
+    }
+
+    dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0)
+        fprintf(log_out, "%zu log messages dropped, ring full\n", dropped);
+    if (n > 0 || dropped > 0)
+        fflush(log_out);
+    return n;
+}
+
+static void *kv_log_main(void *arg)
+{
+    struct timespec idle = { 0, KV_LOG_IDLE_MS * 1000000L };
+
+    (void)arg;
+    while (!__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+    {
+        if (kv_log_drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+    kv_log_drain();
+    return NULL;
+}
+
+/* Function: kv_log_parse_level() - To map a level name to KV_LOG_*
+ *
+ * return:
+ *   level, FAILURE for an unknown name
+ */
+int kv_log_parse_level(const char *name)
+{
+    int i;
+
+    for (i = KV_LOG_ERROR; i <= KV_LOG_DEBUG; i++)
+    {
+        if (strcmp(name, log_level_names[i]) == 0)
+            return i;
+    }
+    return FAILURE;
+}
+
+const char *kv_log_level_name(int level)
+{
+    if (level < KV_LOG_ERROR || level > KV_LOG_DEBUG)
+        return "?";
+    return log_level_names[level];
+}
+
+void kv_log_set_level(int level)
+{
+    __atomic_store_n(&kv_log_level, level, __ATOMIC_RELAXED);
+}
+
+/* Function: kv_log_start() - To start the drain thread
+ *   Call before any other thread is created.
+ * in parameters:
+ *   out - stream the messages are written to
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_log_start(FILE *out)
+{
+    kv_log_init_ring();
+    log_out = out;
+    log_stop = 0;
+    if (pthread_create(&log_thread, NULL, kv_log_main, NULL) != 0)
+        return FAILURE;
+    log_running = 1;
+    return SUCCESS;
+}
+
+/* Function: kv_log_stop() - To write out what is queued and stop the thread
+ */
+void kv_log_stop(void)
+{
+    if (!log_running)
+        return;
+    __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    log_running = 0;
+}
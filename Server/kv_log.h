@@ -0,0 +1,52 @@
+/* kv_log.h
+ *
+ * Leveled asynchronous logging for the Server
+ * - KV_LOG() tests the level before formatting anything, a message
+ *   above the current level costs one relaxed load
+ * - Messages are formatted into a fixed size lock-free ring shared by
+ *   all threads, a full ring drops the message instead of blocking
+ *   the worker
+ * - One background thread drains the ring to the log stream
+ * - The level is changed at runtime with the "--loglevel <level>"
+ *   text command or kv_log_set_level()
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_LOG_H
+#define KV_LOG_H
+
+#include <stdio.h>
+
+#define KV_LOG_ERROR 0
+#define KV_LOG_WARN  1
+#define KV_LOG_INFO  2
+#define KV_LOG_DEBUG 3
+
+/* errors and warnings only unless asked for more*/
+#define KV_LOG_DEFAULT KV_LOG_WARN
+
+/* ring entries, power of 2, and longest message kept*/
+#define KV_LOG_RING_SIZE 4096
+#define KV_LOG_MSG_MAX   232
+
+/* drain interval when the ring is empty*/
+#define KV_LOG_IDLE_MS 10
+
+extern int kv_log_level;
+
+#define KV_LOG(level, ...)                                                  \
+    do {                                                                    \
+        if ((level) <= __atomic_load_n(&kv_log_level, __ATOMIC_RELAXED))    \
+            kv_log_write((level), __VA_ARGS__);                             \
+    } while (0)
+
+void kv_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int kv_log_parse_level(const char *name);
+const char *kv_log_level_name(int level);
+void kv_log_set_level(int level);
+int kv_log_start(FILE *out);
+void kv_log_stop(void);
+
+#endif /* KV_LOG_H */
@@ -0,0 +1,195 @@
+/* kv_parse.c
+ *
+ * Parser of the text commands, see kv_parse.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "kv_parse.h"
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+
+/* the first token after the command is a key*/
+#define KV_PARSE_KEY   0x1
+/* ... which may be empty, the start of a --scan or --prefix*/
+#define KV_PARSE_EMPTY 0x2
+/* the tokens after the command come in key value pairs*/
+#define KV_PARSE_PAIRS 0x4
+
+struct kv_parse_cmd{
+    const char *name;
+    size_t name_len;
+    int opcode;
+    int min_args;
+    int max_args;
+    int flags;
+};
+
+#define KV_PARSE_CMD(name, opcode, min, max, flags) { name, sizeof(name) - 1, opcode, min, max, flags }
+
+static const struct kv_parse_cmd kv_parse_cmds[] = {
+    KV_PARSE_CMD("--set",      KV_OP_SET,         2, 3,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--get",      KV_OP_GET,         1, 1,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--del",      KV_OP_DEL,         1, 1,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--fin",      KV_OP_FIN,         0, 1,       0),
+    KV_PARSE_CMD("--mset",     KV_OP_MSET,        2, INT_MAX, KV_PARSE_PAIRS),
+    KV_PARSE_CMD("--mget",     KV_OP_MGET,        1, INT_MAX, 0),
+    KV_PARSE_CMD("--mdel",     KV_OP_MDEL,        1, INT_MAX, 0),
+    KV_PARSE_CMD("--put",      KV_OP_PUT,         2, 3,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--cas",      KV_OP_CAS,         3, 4,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--incr",     KV_OP_INCR,        2, 2,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--decr",     KV_OP_DECR,        2, 2,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--append",   KV_OP_APPEND,      2, 2,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--gets",     KV_OP_GETS,        1, 1,       KV_PARSE_KEY),
+    KV_PARSE_CMD("--scan",     KV_OP_SCAN,        2, 4,       KV_PARSE_KEY | KV_PARSE_EMPTY),
+    KV_PARSE_CMD("--prefix",   KV_OP_PREFIX,      1, 3,       KV_PARSE_KEY | KV_PARSE_EMPTY),
+    KV_PARSE_CMD("--stats",    KV_PARSE_STATS,    0, 0,       0),
+    KV_PARSE_CMD("--loglevel", KV_PARSE_LOGLEVEL, 1, 1,       0),
+};
+
+/* Function: kv_parse_find() - To look up the command token*/
+static const struct kv_parse_cmd *kv_parse_find(const char *name, size_t len)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(kv_parse_cmds) / sizeof(kv_parse_cmds[0]); i++)
+    {
+        if (kv_parse_cmds[i].name_len == len && memcmp(kv_parse_cmds[i].name, name, len) == 0)
+            return &kv_parse_cmds[i];
+    }
+    return NULL;
+}
+
+/* Function: kv_parse_request() - To parse one text command
+ * in parameters:
+ *   buf - request, after any "#<id> " prefix
+ *   len - length of buf
+ *   req - set to the command and views into buf
+ *
+ * return:
+ *   KV_PARSE_OK, KV_PARSE_UNKNOWN when buf is no text command, or
+ *   KV_PARSE_BADREQ when it is malformed; req->opcode is set for
+ *   every known command
+ */
+int kv_parse_request(const char *buf, size_t len, struct kv_request *req)
+{
+    const struct kv_parse_cmd *cmd;
+    const char *end = buf + len;
+    const char *p = buf;
+    const char *token;
+    size_t token_len;
+
+    memset(req, 0, sizeof(*req));
+
+    while (p < end && *p != ' ' && *p != '\0')
+        p++;
+    cmd = kv_parse_find(buf, p - buf);
+    if (NULL == cmd)
+        return KV_PARSE_UNKNOWN;
+    req->opcode = cmd->opcode;
+    if (len > KV_PROTO_MAX_PAYLOAD)
+        return KV_PARSE_BADREQ;
+
+    req->list.ptr = (p < end) ? p + 1 : end;
+    req->list.len = end - req->list.ptr;
+
+    /* p is at the space before the next token, or at the end*/
+    while (p < end)
+    {
+        if (*p == '\0')
+            return KV_PARSE_BADREQ;
+        token = ++p;
+        while (p < end && *p != ' ')
+        {
+            if (*p == '\0')
+                return KV_PARSE_BADREQ;
+            p++;
+        }
+        token_len = p - token;
+
+        if (req->num_args == cmd->max_args)
+            return KV_PARSE_BADREQ;
+        if (0 == req->num_args && (cmd->flags & KV_PARSE_KEY))
+        {
+            if (token_len > KV_MAX_KEY || (0 == token_len && !(cmd->flags & KV_PARSE_EMPTY)))
+                return KV_PARSE_BADREQ;
+        }
+        else if (0 == token_len)
+        {
+            return KV_PARSE_BADREQ;
+        }
+        if (req->num_args < KV_PARSE_MAX_ARGS)
+        {
+            req->args[req->num_args].ptr = token;
+            req->args[req->num_args].len = token_len;
+        }
+        req->num_args++;
+    }
+
+    if (req->num_args < cmd->min_args || ((cmd->flags & KV_PARSE_PAIRS) && (req->num_args & 1)))
+        return KV_PARSE_BADREQ;
+    return KV_PARSE_OK;
+}
+
+/* Function: kv_parse_next() - To take the next token of a list
+ * in parameters:
+ *   list - tokens left, moved past the one taken
+ *   token - set to the token
+ *
+ * return:
+ *   1 when a token was taken, 0 at the end of the list
+ */
+int kv_parse_next(struct kv_view *list, struct kv_view *token)
+{
+    const char *space;
+
+    if (0 == list->len)
+        return 0;
+    token->ptr = list->ptr;
+    space = memchr(list->ptr, ' ', list->len);
+    if (NULL == space)
+    {
+        token->len = list->len;
+        list->ptr += list->len;
+        list->len = 0;
+    }
+    else
+    {
+        token->len = space - list->ptr;
+        list->len -= token->len + 1;
+        list->ptr = space + 1;
+    }
+    return 1;
+}
+
+/* Function: kv_parse_u64() - To read a decimal number token
+ * in parameters:
+ *   token - digits only, no sign
+ *   value - set to the number
+ *
+ * return:
+ *   status of the operation, FAILURE for an empty token, another
+ *   character or a number past UINT64_MAX
+ */
+int kv_parse_u64(const struct kv_view *token, uint64_t *value)
+{
+    uint64_t number = 0;
+    size_t i;
+    unsigned int digit;
+
+    if (0 == token->len)
+        return FAILURE;
+    for (i = 0; i < token->len; i++)
+    {
+        digit = (unsigned char)token->ptr[i] - '0';
+        if (digit > 9 || number > (UINT64_MAX - digit) / 10)
+            return FAILURE;
+        number = number * 10 + digit;
+    }
+    *value = number;
+    return SUCCESS;
+}
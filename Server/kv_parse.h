@@ -0,0 +1,59 @@
+/* kv_parse.h
+ *
+ * Parser of the text commands, "--set <key> <value> [<ttl>]" and the
+ * others the Client sends without --binary
+ * - One pass over the request. The command becomes a KV_OP_* and its
+ *   key and arguments views (pointer and length) into the request;
+ *   nothing is copied, the request is not written to and need not be
+ *   NUL terminated
+ * - Tokens are separated by exactly one space. An unknown command is
+ *   KV_PARSE_UNKNOWN and gets no reply. A known one with a token too
+ *   many or too few, an empty token, a key longer than KV_MAX_KEY, a
+ *   NUL byte or more than KV_PROTO_MAX_PAYLOAD bytes is
+ *   KV_PARSE_BADREQ
+ * - The keys (and values) of --mset, --mget and --mdel are counted in
+ *   the pass and then taken one by one with kv_parse_next(); their
+ *   length is left to the store, so each key still gets its own
+ *   status line
+ * - No state outside the arguments, unlike strtok, so the workers and
+ *   TCP threads parse at the same time
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_PARSE_H
+#define KV_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KV_PARSE_OK       0
+#define KV_PARSE_UNKNOWN -1
+#define KV_PARSE_BADREQ  -2
+
+/* text commands that have no KV_OP_*, never counted in kv_stats*/
+#define KV_PARSE_STATS    32
+#define KV_PARSE_LOGLEVEL 33
+
+/* tokens after the command kept in args, --cas has the most*/
+#define KV_PARSE_MAX_ARGS 4
+
+/* bytes of a request, not NUL terminated*/
+struct kv_view{
+    const char *ptr;
+    size_t len;
+};
+
+struct kv_request{
+    int opcode;                             /* KV_OP_* or KV_PARSE_*, 0 when unknown*/
+    int num_args;                           /* tokens after the command*/
+    struct kv_view args[KV_PARSE_MAX_ARGS]; /* the first of them, args[0] is the key*/
+    struct kv_view list;                    /* all of them, keys of --m* for kv_parse_next()*/
+};
+
+int kv_parse_request(const char *buf, size_t len, struct kv_request *req);
+int kv_parse_next(struct kv_view *list, struct kv_view *token);
+int kv_parse_u64(const struct kv_view *token, uint64_t *value);
+
+#endif /* KV_PARSE_H */
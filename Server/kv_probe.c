@@ -0,0 +1,315 @@
+/* kv_probe.c
+ *
+ * Key lookup with control byte groups, see kv_probe.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <string.h>
+
+#include "kv_probe.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KV_PROBE_X86 1
+#endif
+
+static inline uint64_t kv_probe_read64(const void *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    /* byte i of the group at bits 8i..8i+7*/
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t kv_probe_read32(const void *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Function: kv_key_eq_short() - To compare two keys of under 16 bytes
+ *   Two overlapping loads cover the key, no byte loop.
+ */
+static inline int kv_key_eq_short(const char *a, const char *b, size_t len)
+{
+    uint64_t x;
+
+    if (len >= 8)
+    {
+        x = (kv_probe_read64(a) ^ kv_probe_read64(b)) |
+            (kv_probe_read64(a + len - 8) ^ kv_probe_read64(b + len - 8));
+        return x == 0;
+    }
+    if (len >= 4)
+    {
+        x = (kv_probe_read32(a) ^ kv_probe_read32(b)) |
+            (kv_probe_read32(a + len - 4) ^ kv_probe_read32(b + len - 4));
+        return x == 0;
+    }
+    if (len == 0)
+        return 1;
+    /* 1 to 3 bytes: first, middle and last*/
+    return a[0] == b[0] && a[len / 2] == b[len / 2] && a[len - 1] == b[len - 1];
+}
+
+/* Function: kv_probe_scalar() - Lookup with 8 control bytes in a uint64
+ * in parameters:
+ *   table - table to be probed
+ *   hash - hash of the key
+ *   key - key to be found
+ *   length - length of the key
+ *
+ * return:
+ *   slot holding the key or NULL
+ */
+static struct kv_slot *kv_probe_scalar(const struct kv_table *table, uint64_t hash,
+                                       const char *key, size_t length)
+{
+    const uint64_t lsbs = 0x0101010101010101ULL;
+    const uint64_t msbs = 0x8080808080808080ULL;
+    uint64_t tags = lsbs * KV_CTRL_TAG(hash);
+    uint64_t group;
+    uint64_t match;
+    uint64_t empty;
+    uint64_t x;
+    struct kv_slot *slot;
+    size_t idx;
+
+    if (NULL == table->slots)
+        return NULL;
+
+    idx = hash & table->mask;
+    while (1)
+    {
+        group = kv_probe_read64(table->ctrl + idx);
+        /* high bit of each byte equal to the tag, seldom of one that is
+           not; the hash check below sorts those out*/
+        x = group ^ tags;
+        match = (x - lsbs) & ~x & msbs;
+        /* KV_CTRL_EMPTY is the only byte with bit 7 set and bit 1 clear*/
+        empty = group & ~(group << 6) & msbs;
+        if (empty)
+            match &= (empty & -empty) - 1;
+
+        while (match)
+        {
+            slot = &table->slots[(idx + (__builtin_ctzll(match) >> 3)) & table->mask];
+            if (slot->hash == hash && slot->key_len == length &&
+                memcmp(ITEM_KEY(slot->item), key, length) == 0)
+                return slot;
+            match &= match - 1;
+        }
+        if (empty)
+            return NULL;
+        idx = (idx + 8) & table->mask;
+    }
+}
+
+#ifdef KV_PROBE_X86
+
+/* Function: kv_key_eq_sse2() - To compare two keys of the same length*/
+__attribute__((target("sse2")))
+static inline int kv_key_eq_sse2(const char *a, const char *b, size_t len)
+{
+    __m128i x;
+    __m128i y;
+    size_t i;
+
+    if (len < 16)
+        return kv_key_eq_short(a, b, len);
+    for (i = 0; i + 16 < len; i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *)(a + i));
+        y = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+            return 0;
+    }
+    /* last 16 bytes, overlapping the loop's*/
+    x = _mm_loadu_si128((const __m128i *)(a + len - 16));
+    y = _mm_loadu_si128((const __m128i *)(b + len - 16));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF;
+}
+
+/* Function: kv_probe_sse2() - Lookup with groups of 16 control bytes*/
+__attribute__((target("sse2")))
+static struct kv_slot *kv_probe_sse2(const struct kv_table *table, uint64_t hash,
+                                     const char *key, size_t length)
+{
+    __m128i tags = _mm_set1_epi8((char)KV_CTRL_TAG(hash));
+    __m128i empties = _mm_set1_epi8((char)KV_CTRL_EMPTY);
+    __m128i group;
+    uint32_t match;
+    uint32_t empty;
+    struct kv_slot *slot;
+    size_t idx;
+
+    if (NULL == table->slots)
+        return NULL;
+
+    idx = hash & table->mask;
+    while (1)
+    {
+        group = _mm_loadu_si128((const __m128i *)(table->ctrl + idx));
+        match = _mm_movemask_epi8(_mm_cmpeq_epi8(group, tags));
+        empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group, empties));
+        if (empty)
+            match &= (empty & -empty) - 1;
+
+        while (match)
+        {
+            slot = &table->slots[(idx + __builtin_ctz(match)) & table->mask];
+            if (slot->hash == hash && slot->key_len == length &&
+                kv_key_eq_sse2(ITEM_KEY(slot->item), key, length))
+                return slot;
+            match &= match - 1;
+        }
+        if (empty)
+            return NULL;
+        idx = (idx + 16) & table->mask;
+    }
+}
+
+/* Function: kv_key_eq_avx2() - To compare two keys of the same length*/
+__attribute__((target("avx2")))
+static inline int kv_key_eq_avx2(const char *a, const char *b, size_t len)
+{
+    __m256i x;
+    __m256i y;
+    size_t i;
+
+    if (len < 32)
+        return kv_key_eq_sse2(a, b, len);
+    for (i = 0; i + 32 < len; i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *)(a + i));
+        y = _mm256_loadu_si256((const __m256i *)(b + i));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu)
+            return 0;
+    }
+    x = _mm256_loadu_si256((const __m256i *)(a + len - 32));
+    y = _mm256_loadu_si256((const __m256i *)(b + len - 32));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) == 0xFFFFFFFFu;
+}
+
+/* Function: kv_probe_avx2() - Lookup with groups of 32 control bytes*/
+__attribute__((target("avx2")))
+static struct kv_slot *kv_probe_avx2(const struct kv_table *table, uint64_t hash,
+                                     const char *key, size_t length)
+{
+    __m256i tags = _mm256_set1_epi8((char)KV_CTRL_TAG(hash));
+    __m256i empties = _mm256_set1_epi8((char)KV_CTRL_EMPTY);
+    __m256i group;
+    uint32_t match;
+    uint32_t empty;
+    struct kv_slot *slot;
+    size_t idx;
+
+    if (NULL == table->slots)
+        return NULL;
+
+    idx = hash & table->mask;
+    while (1)
+    {
+        group = _mm256_loadu_si256((const __m256i *)(table->ctrl + idx));
+        match = _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, tags));
+        empty = _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, empties));
+        if (empty)
+            match &= (empty & -empty) - 1;
+
+        while (match)
+        {
+            slot = &table->slots[(idx + __builtin_ctz(match)) & table->mask];
+            if (slot->hash == hash && slot->key_len == length &&
+                kv_key_eq_avx2(ITEM_KEY(slot->item), key, length))
+                return slot;
+            match &= match - 1;
+        }
+        if (empty)
+            return NULL;
+        idx = (idx + 32) & table->mask;
+    }
+}
+
+#endif /* KV_PROBE_X86 */
+
+/* Function: kv_probe_best() - To find the widest version the CPU runs
+ *
+ * return:
+ *   KV_PROBE_AVX2, KV_PROBE_SSE2 or KV_PROBE_SCALAR
+ */
+int kv_probe_best(void)
+{
+#ifdef KV_PROBE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return KV_PROBE_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return KV_PROBE_SSE2;
+#endif
+    return KV_PROBE_SCALAR;
+}
+
+/* Function: kv_probe_select() - To get the lookup of a version
+ * in parameters:
+ *   probe - KV_PROBE_*, KV_PROBE_AUTO for kv_probe_best()
+ *
+ * return:
+ *   lookup function, NULL when the CPU does not run that version
+ */
+kv_probe_fn kv_probe_select(int probe)
+{
+    int best = kv_probe_best();
+
+    if (probe == KV_PROBE_AUTO)
+        probe = best;
+    if (probe > best)
+        return NULL;
+
+    switch (probe)
+    {
+#ifdef KV_PROBE_X86
+        case KV_PROBE_AVX2:
+            return kv_probe_avx2;
+        case KV_PROBE_SSE2:
+            return kv_probe_sse2;
+#endif
+        case KV_PROBE_SCALAR:
+            return kv_probe_scalar;
+        default:
+            return NULL;
+    }
+}
+
+static const char *kv_probe_names[] = { "auto", "scalar", "sse2", "avx2" };
+
+const char *kv_probe_name(int probe)
+{
+    if (probe < KV_PROBE_AUTO || probe > KV_PROBE_AVX2)
+        return "?";
+    return kv_probe_names[probe];
+}
+
+/* Function: kv_probe_parse() - To map a --probe name to KV_PROBE_*
+ *
+ * return:
+ *   version, FAILURE for an unknown name
+ */
+int kv_probe_parse(const char *name)
+{
+    int i;
+
+    for (i = KV_PROBE_AUTO; i <= KV_PROBE_AVX2; i++)
+    {
+        if (strcmp(name, kv_probe_names[i]) == 0)
+            return i;
+    }
+    return FAILURE;
+}
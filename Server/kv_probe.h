@@ -0,0 +1,67 @@
+/* kv_probe.h
+ *
+ * Key lookup in one hash table of kv_store.h, Swiss table style
+ * - Next to its slots a table keeps one control byte per slot:
+ *   KV_CTRL_EMPTY for a slot never used, KV_CTRL_DELETED for a
+ *   tombstone, or else the 7-bit tag of the key's hash, from bits the
+ *   shard and the slot index do not use
+ * - A lookup loads the control bytes of a group of slots at once,
+ *   starting at the key's home slot, and compares them all with the
+ *   tag: 32 with AVX2, 16 with SSE2, 8 in a uint64 otherwise. Only the
+ *   slots whose tag matches are read, and an empty byte in the group
+ *   ends the probe. Probing stays linear, a group just moves that many
+ *   slots at a time, so the tables are the same for every version
+ * - The first KV_CTRL_CLONE control bytes are repeated after the last
+ *   one, so a group starting near the end of the table needs no wrap
+ * - A slot whose tag, hash and length match has its key compared with
+ *   overlapping loads of 8, 16 or 32 bytes, never past either key
+ * - The version is picked once by the CPU (KV_PROBE_AUTO), the others
+ *   stay available for --probe and Test/kv_probe_bench.c
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_PROBE_H
+#define KV_PROBE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kv_store.h"
+
+#define KV_CTRL_EMPTY   0x80
+#define KV_CTRL_DELETED 0xFE
+/* widest group, control bytes repeated after the table*/
+#define KV_CTRL_CLONE   32
+/* tag of a live slot, the top 7 bits of the hash*/
+#define KV_CTRL_TAG(hash) ((uint8_t)((hash) >> 57))
+
+/* lookup versions*/
+#define KV_PROBE_AUTO   0
+#define KV_PROBE_SCALAR 1
+#define KV_PROBE_SSE2   2
+#define KV_PROBE_AVX2   3
+
+/* Function: kv_ctrl_set() - To set the control byte of a slot
+ * in parameters:
+ *   table - table of the slot
+ *   idx - index of the slot
+ *   ctrl - KV_CTRL_EMPTY, KV_CTRL_DELETED or KV_CTRL_TAG() of its hash
+ *
+ * return:
+ *   void
+ */
+static inline void kv_ctrl_set(struct kv_table *table, size_t idx, uint8_t ctrl)
+{
+    table->ctrl[idx] = ctrl;
+    if (idx < KV_CTRL_CLONE)
+        table->ctrl[table->mask + 1 + idx] = ctrl;
+}
+
+int kv_probe_best(void);
+kv_probe_fn kv_probe_select(int probe);
+const char *kv_probe_name(int probe);
+int kv_probe_parse(const char *name);
+
+#endif /* KV_PROBE_H */
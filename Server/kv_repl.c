@@ -0,0 +1,873 @@
+/* kv_repl.c
+ *
+ * Replication, see kv_repl.h
+ *
+ * Lock order: shard lock, then repl_lock, as with aof_lock. The ring
+ * is written with repl_lock held and sent from without it; once a send
+ * returns the offset is checked again, and a replica whose bytes were
+ * overwritten meanwhile is dropped, it copies again.
+ *
+ * Author: Kapil
+ *
+ */
+
+#define _GNU_SOURCE     /* accept4*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "kv_repl.h"
+#include "kv_aof.h"
+#include "kv_tcp.h"
+#include "kv_log.h"
+#include "../Common/kv_proto.h"
+
+/* poll interval of the primary while a copy child runs*/
+#define KV_REPL_CHILD_POLL_MS 10
+/* replica read buffer, grows up to the largest record*/
+#define KV_REPL_READ_BUF (64 * 1024)
+#define KV_REPL_RECORD_MAX (1 + 2 + KV_MAX_KEY + 4 + KV_MAX_VALUE + 4)
+#define KV_REPL_ACK_LEN 9
+
+/* replica connection states, the replica side goes through the same*/
+#define KV_PEER_HELLO  0    /* primary: waiting for the magic*/
+#define KV_PEER_COPY   1    /* a child is writing the store*/
+#define KV_PEER_STREAM 2    /* sent from the ring*/
+
+/* replica as seen by the primary*/
+struct kv_repl_peer{
+    int fd;
+    int state;
+    pid_t child;                /* writing the copy*/
+    uint64_t offset;            /* next ring byte to send*/
+    uint64_t acked;             /* applied by the replica*/
+    unsigned char in[KV_REPL_MAGIC_LEN + KV_REPL_ACK_LEN];
+    int in_len;
+};
+
+/* child side of a copy*/
+struct kv_repl_writer{
+    int fd;
+    unsigned char *buf;
+    size_t len;
+    int error;
+};
+
+static pthread_mutex_t repl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t repl_thread;
+static int repl_role;
+static int repl_stop;
+static struct kv_store *repl_store;
+
+/* journal hook installed before this one, the append-only log's*/
+static kv_journal_fn repl_next_journal;
+static void *repl_next_arg;
+
+/* primary*/
+static unsigned char *repl_ring;
+static size_t repl_ring_size;
+static uint64_t repl_offset;
+static int repl_listen_fd = -1;
+static int repl_wake_fd = -1;
+static int repl_wake_pending;
+static struct kv_repl_peer repl_peers[KV_REPL_MAX_REPLICAS];
+static int repl_num_peers;
+
+/* set by the journal hook, cleared by kv_repl_commit()*/
+static __thread int repl_appended;
+
+/* replica*/
+static struct sockaddr_in repl_primary;
+
+/* read by kv_repl_status(), written by the replication thread*/
+static int repl_replicas;
+static int repl_link_up;
+static uint64_t repl_applied;
+static uint64_t repl_lag_bytes;
+static uint64_t repl_syncs;
+static uint64_t repl_ping_ms;           /* primary clock of the last heartbeat*/
+static uint64_t repl_ping_delay_ms;     /* how late it was applied*/
+
+/* wall clock in ms, heartbeats compare the two hosts' clocks*/
+static uint64_t kv_repl_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int kv_repl_send_all(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FAILURE;
+        }
+        p += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_repl_put() - To append bytes to the ring, repl_lock held*/
+static void kv_repl_put(const void *src, size_t len)
+{
+    size_t pos = repl_offset % repl_ring_size;
+    size_t first = len < repl_ring_size - pos ? len : repl_ring_size - pos;
+
+    memcpy(repl_ring + pos, src, first);
+    memcpy(repl_ring, (const unsigned char *)src + first, len - first);
+    repl_offset += len;
+}
+
+/* Function: kv_repl_append() - Store journal hook, queues one mutation
+ *   Runs with the shard lock of key held, after the hook it replaced.
+ *   The record is laid out as kv_aof_encode() does, the value copied
+ *   straight into the ring.
+ */
+static void kv_repl_append(void *arg, int op, const char *key, int key_len,
+                           const char *value, int value_len, uint32_t expire)
+{
+    unsigned char head[1 + 2 + KV_MAX_KEY + 4];
+    unsigned char tail[4];
+    unsigned char *p;
+
+    (void)arg;
+    if (repl_next_journal != NULL)
+        repl_next_journal(repl_next_arg, op, key, key_len, value, value_len, expire);
+
+    head[0] = (op == KV_MUT_SET && expire != 0) ? KV_AOF_SETEX : op;
+    p = kv_proto_put_u16(head + 1, key_len);
+    p = kv_proto_put_bytes(p, key, key_len);
+    if (op == KV_MUT_SET)
+        p = kv_proto_put_u32(p, value_len);
+
+    pthread_mutex_lock(&repl_lock);
+    kv_repl_put(head, p - head);
+    if (op == KV_MUT_SET)
+    {
+        kv_repl_put(value, value_len);
+        if (expire != 0)
+        {
+            kv_proto_put_u32(tail, expire);
+            kv_repl_put(tail, sizeof(tail));
+        }
+    }
+    pthread_mutex_unlock(&repl_lock);
+    repl_appended = 1;
+}
+
+/* Function: kv_repl_commit() - To wake the sender after a batch
+ *   Called by a worker after each batch, next to kv_aof_commit(). One
+ *   wakeup covers every mutation queued until the sender runs.
+ */
+void kv_repl_commit(void)
+{
+    uint64_t one = 1;
+
+    if (!repl_appended)
+        return;
+    repl_appended = 0;
+    if (__atomic_exchange_n(&repl_wake_pending, 1, __ATOMIC_ACQ_REL) == 0 &&
+        write(repl_wake_fd, &one, sizeof(one)) < 0)
+        KV_LOG(KV_LOG_DEBUG, "repl: wakeup failed");
+}
+
+/* kv_store_for_each() callback of the copy child*/
+static void kv_repl_record(void *arg, const struct kv_item *item)
+{
+    struct kv_repl_writer *w = arg;
+
+    if (w->error)
+        return;
+    if (w->len + kv_aof_record_len(KV_MUT_SET, item->key_len, item->value_len, item->expire) >
+        KV_AOF_BUF_SIZE)
+    {
+        if (kv_repl_send_all(w->fd, w->buf, w->len) != SUCCESS)
+            w->error = 1;
+        w->len = 0;
+    }
+    w->len = kv_aof_encode(w->buf + w->len, KV_MUT_SET, ITEM_KEY(item), item->key_len,
+                           ITEM_VALUE(item), item->value_len, item->expire) - w->buf;
+}
+
+/* Function: kv_repl_write_store() - To write the store to a replica
+ *   Runs in the forked child, only async-signal-safe calls. The
+ *   socket is blocking meanwhile, the primary leaves it alone until
+ *   the child is done.
+ * in parameters:
+ *   fd - replica socket
+ *   buf - KV_AOF_BUF_SIZE bytes allocated before the fork
+ *   offset - ring offset the copy is taken at
+ *
+ * return:
+ *   status of the operation
+ */
+static int kv_repl_write_store(int fd, unsigned char *buf, uint64_t offset)
+{
+    struct kv_repl_writer w = { fd, buf, 0, 0 };
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    memcpy(buf, KV_REPL_MAGIC, KV_REPL_MAGIC_LEN);
+    w.len = KV_REPL_MAGIC_LEN;
+    kv_store_for_each(repl_store, kv_repl_record, &w);
+    if (w.len + 1 + 8 > KV_AOF_BUF_SIZE)
+    {
+        if (kv_repl_send_all(fd, w.buf, w.len) != SUCCESS)
+            w.error = 1;
+        w.len = 0;
+    }
+    w.buf[w.len] = KV_REPL_SYNC;
+    w.len = kv_proto_put_u64(w.buf + w.len + 1, offset) - w.buf;
+    if (!w.error && kv_repl_send_all(fd, w.buf, w.len) != SUCCESS)
+        w.error = 1;
+    return w.error ? FAILURE : SUCCESS;
+}
+
+/* Function: kv_repl_copy() - To fork the child copying the store to a replica*/
+static int kv_repl_copy(struct kv_repl_peer *peer)
+{
+    unsigned char *buf = malloc(KV_AOF_BUF_SIZE);
+    pid_t pid;
+
+    if (NULL == buf)
+        return FAILURE;
+
+    /* with every shard locked no mutation is half applied: each one
+       is either in the child's store or in the ring past the offset*/
+    kv_store_lock_all(repl_store);
+    pthread_mutex_lock(&repl_lock);
+    peer->offset = peer->acked = repl_offset;
+    pthread_mutex_unlock(&repl_lock);
+
+    pid = fork();
+    if (pid == 0)
+        _exit(kv_repl_write_store(peer->fd, buf, peer->offset) == SUCCESS ? 0 : 1);
+    kv_store_unlock_all(repl_store);
+    free(buf);
+
+    if (pid < 0)
+    {
+        KV_LOG(KV_LOG_ERROR, "repl: fork failed");
+        return FAILURE;
+    }
+    peer->child = pid;
+    peer->state = KV_PEER_COPY;
+    __atomic_add_fetch(&repl_syncs, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/* Function: kv_repl_copied() - To switch a replica to the ring once its copy is written*/
+static int kv_repl_copied(struct kv_repl_peer *peer)
+{
+    int status;
+    pid_t pid;
+
+    pid = waitpid(peer->child, &status, WNOHANG);
+    if (pid == 0)
+        return SUCCESS;
+    peer->child = 0;
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return FAILURE;
+
+    fcntl(peer->fd, F_SETFL, fcntl(peer->fd, F_GETFL) | O_NONBLOCK);
+    peer->state = KV_PEER_STREAM;
+    return SUCCESS;
+}
+
+/* Function: kv_repl_read() - To read the hello or the acknowledgements of a replica*/
+static int kv_repl_read(struct kv_repl_peer *peer)
+{
+    struct kv_proto_cursor c;
+    ssize_t n;
+    int used;
+
+    n = recv(peer->fd, peer->in + peer->in_len, sizeof(peer->in) - peer->in_len, MSG_DONTWAIT);
+    if (0 == n)
+        return FAILURE;
+    if (n < 0)
+        return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? SUCCESS : FAILURE;
+    peer->in_len += n;
+
+    if (peer->state == KV_PEER_HELLO)
+    {
+        if (peer->in_len < KV_REPL_MAGIC_LEN)
+            return SUCCESS;
+        if (memcmp(peer->in, KV_REPL_MAGIC, KV_REPL_MAGIC_LEN) != 0)
+            return FAILURE;
+        /* a replica sends nothing more before its copy is complete*/
+        peer->in_len = 0;
+        return kv_repl_copy(peer);
+    }
+
+    for (used = 0; peer->in_len - used >= KV_REPL_ACK_LEN; used += KV_REPL_ACK_LEN)
+    {
+        if (peer->in[used] != KV_REPL_ACK)
+            return FAILURE;
+        kv_proto_cursor_init(&c, peer->in + used + 1, 8);
+        peer->acked = kv_proto_get_u64(&c);
+    }
+    memmove(peer->in, peer->in + used, peer->in_len - used);
+    peer->in_len -= used;
+    return SUCCESS;
+}
+
+/* Function: kv_repl_send() - To send a replica the ring bytes it lacks
+ * return:
+ *   SUCCESS, FAILURE when the replica has to be dropped
+ */
+static int kv_repl_send(struct kv_repl_peer *peer)
+{
+    uint64_t end;
+    size_t pos;
+    size_t len;
+    ssize_t n;
+    int lost;
+
+    while (1)
+    {
+        pthread_mutex_lock(&repl_lock);
+        end = repl_offset;
+        pthread_mutex_unlock(&repl_lock);
+        if (end - peer->offset > repl_ring_size)
+        {
+            KV_LOG(KV_LOG_WARN, "repl: replica fell more than --repl-backlog behind");
+            return FAILURE;
+        }
+        if (end == peer->offset)
+            return SUCCESS;
+
+        pos = peer->offset % repl_ring_size;
+        len = end - peer->offset;
+        if (len > repl_ring_size - pos)
+            len = repl_ring_size - pos;
+        n = send(peer->fd, repl_ring + pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+            return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? SUCCESS : FAILURE;
+
+        /* appenders may have overwritten what was just sent*/
+        pthread_mutex_lock(&repl_lock);
+        lost = (repl_offset - peer->offset > repl_ring_size);
+        pthread_mutex_unlock(&repl_lock);
+        if (lost)
+        {
+            KV_LOG(KV_LOG_WARN, "repl: replica fell more than --repl-backlog behind");
+            return FAILURE;
+        }
+        peer->offset += n;
+        if ((size_t)n < len)
+            return SUCCESS;
+    }
+}
+
+static void kv_repl_drop(int i)
+{
+    struct kv_repl_peer *peer = &repl_peers[i];
+
+    if (peer->child > 0)
+    {
+        kill(peer->child, SIGKILL);
+        waitpid(peer->child, NULL, 0);
+    }
+    close(peer->fd);
+    repl_peers[i] = repl_peers[--repl_num_peers];
+}
+
+static void kv_repl_accept(void)
+{
+    struct kv_repl_peer *peer;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+    int fd;
+
+    fd = accept4(repl_listen_fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (repl_num_peers == KV_REPL_MAX_REPLICAS)
+    {
+        KV_LOG(KV_LOG_WARN, "repl: more than %d replicas, %s refused", KV_REPL_MAX_REPLICAS,
+               inet_ntoa(addr.sin_addr));
+        close(fd);
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    peer = &repl_peers[repl_num_peers++];
+    memset(peer, 0, sizeof(*peer));
+    peer->fd = fd;
+    peer->state = KV_PEER_HELLO;
+    KV_LOG(KV_LOG_INFO, "repl: replica %s:%d connected", inet_ntoa(addr.sin_addr),
+           ntohs(addr.sin_port));
+}
+
+/* Function: kv_repl_primary_main() - Primary replication thread
+ *   Accepts replicas, forks their copies, sends the ring and appends
+ *   a heartbeat every KV_REPL_PING_MS.
+ */
+static void *kv_repl_primary_main(void *arg)
+{
+    struct pollfd fds[2 + KV_REPL_MAX_REPLICAS];
+    struct kv_repl_peer *peer;
+    unsigned char ping[1 + 8];
+    uint64_t last_ping = 0;
+    uint64_t wake;
+    uint64_t end;
+    uint64_t lag;
+    uint64_t now;
+    int streaming;
+    int copying;
+    int status;
+    int i;
+
+    (void)arg;
+    while (!__atomic_load_n(&repl_stop, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&repl_lock);
+        end = repl_offset;
+        pthread_mutex_unlock(&repl_lock);
+
+        fds[0].fd = repl_listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = repl_wake_fd;
+        fds[1].events = POLLIN;
+        copying = 0;
+        for (i = 0; i < repl_num_peers; i++)
+        {
+            peer = &repl_peers[i];
+            fds[2 + i].fd = peer->state == KV_PEER_COPY ? -1 : peer->fd;
+            fds[2 + i].events = POLLIN;
+            if (peer->state == KV_PEER_STREAM && peer->offset != end)
+                fds[2 + i].events |= POLLOUT;
+            fds[2 + i].revents = 0;
+            copying |= (peer->state == KV_PEER_COPY);
+        }
+        if (poll(fds, 2 + repl_num_peers, copying ? KV_REPL_CHILD_POLL_MS : KV_REPL_PING_MS) < 0)
+            continue;
+
+        if (fds[1].revents & POLLIN)
+        {
+            /* cleared first: a worker's wakeup that comes meanwhile
+               finds its mutations sent below*/
+            __atomic_store_n(&repl_wake_pending, 0, __ATOMIC_RELEASE);
+            if (read(repl_wake_fd, &wake, sizeof(wake)) < 0)
+                KV_LOG(KV_LOG_DEBUG, "repl: reading wakeup failed");
+        }
+
+        now = kv_repl_now_ms();
+        if (now - last_ping >= KV_REPL_PING_MS)
+        {
+            ping[0] = KV_REPL_PING;
+            kv_proto_put_u64(ping + 1, now);
+            pthread_mutex_lock(&repl_lock);
+            kv_repl_put(ping, sizeof(ping));
+            pthread_mutex_unlock(&repl_lock);
+            last_ping = now;
+        }
+
+        /* backwards: a dropped replica is replaced by the last one,
+           which is done already*/
+        streaming = 0;
+        lag = 0;
+        for (i = repl_num_peers - 1; i >= 0; i--)
+        {
+            peer = &repl_peers[i];
+            status = SUCCESS;
+            if (peer->state == KV_PEER_COPY)
+                status = kv_repl_copied(peer);
+            else if (fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR))
+                status = kv_repl_read(peer);
+            if (status == SUCCESS && peer->state == KV_PEER_STREAM)
+                status = kv_repl_send(peer);
+            if (status != SUCCESS)
+            {
+                KV_LOG(KV_LOG_INFO, "repl: replica dropped");
+                kv_repl_drop(i);
+                continue;
+            }
+            if (peer->state == KV_PEER_STREAM)
+            {
+                streaming++;
+                if (end - peer->acked > lag)
+                    lag = end - peer->acked;
+            }
+        }
+        __atomic_store_n(&repl_replicas, streaming, __ATOMIC_RELAXED);
+        __atomic_store_n(&repl_lag_bytes, lag, __ATOMIC_RELAXED);
+
+        if (fds[0].revents & POLLIN)
+            kv_repl_accept();
+    }
+    return NULL;
+}
+
+/* Function: kv_repl_apply() - To apply the complete records of a buffer
+ * in parameters:
+ *   buf - stream bytes read from the primary
+ *   len - length of buf
+ *   state - KV_PEER_HELLO before the magic, KV_PEER_COPY until the
+ *           SYNC record, KV_PEER_STREAM after
+ *   ack - set when a heartbeat was applied
+ *
+ * return:
+ *   bytes applied, a partial record is left; FAILURE when buf is not
+ *   a replication stream
+ */
+static long kv_repl_apply(const unsigned char *buf, size_t len, int *state, int *ack)
+{
+    struct kv_proto_cursor c;
+    const unsigned char *start;
+    const char *key;
+    const char *value = NULL;
+    uint16_t key_len;
+    uint32_t value_len = 0;
+    uint32_t expire;
+    uint64_t arg;
+    uint64_t now;
+    size_t used = 0;
+    size_t dropped;
+    int op;
+
+    if (*state == KV_PEER_HELLO)
+    {
+        if (len < KV_REPL_MAGIC_LEN)
+            return 0;
+        if (memcmp(buf, KV_REPL_MAGIC, KV_REPL_MAGIC_LEN) != 0)
+            return FAILURE;
+        /* keys deleted on the primary while the link was down go too*/
+        dropped = kv_store_clear(repl_store);
+        KV_LOG(KV_LOG_INFO, "repl: copying the store of the primary, %zu keys dropped", dropped);
+        *state = KV_PEER_COPY;
+        used = KV_REPL_MAGIC_LEN;
+    }
+
+    kv_proto_cursor_init(&c, buf + used, len - used);
+    while (c.p < c.end)
+    {
+        start = c.p;
+        op = kv_proto_get_u8(&c);
+        if (op == KV_REPL_SYNC || op == KV_REPL_PING)
+        {
+            arg = kv_proto_get_u64(&c);
+            if (c.error)
+                break;
+            if (op == KV_REPL_SYNC)
+            {
+                if (*state != KV_PEER_COPY)
+                    return FAILURE;
+                *state = KV_PEER_STREAM;
+                __atomic_store_n(&repl_applied, arg, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&repl_syncs, 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&repl_link_up, 1, __ATOMIC_RELAXED);
+                KV_LOG(KV_LOG_INFO, "repl: in sync with the primary at offset %llu",
+                       (unsigned long long)arg);
+            }
+            else
+            {
+                now = kv_repl_now_ms();
+                __atomic_store_n(&repl_ping_delay_ms, now > arg ? now - arg : 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&repl_ping_ms, arg, __ATOMIC_RELAXED);
+                *ack = 1;
+            }
+        }
+        else if (op == KV_MUT_SET || op == KV_AOF_SETEX || op == KV_MUT_DEL)
+        {
+            key_len = kv_proto_get_u16(&c);
+            if (!c.error && key_len > KV_MAX_KEY)
+                return FAILURE;
+            key = kv_proto_get_bytes(&c, key_len);
+            expire = 0;
+            if (op != KV_MUT_DEL)
+            {
+                value_len = kv_proto_get_u32(&c);
+                if (!c.error && value_len > KV_MAX_VALUE)
+                    return FAILURE;
+                value = kv_proto_get_bytes(&c, value_len);
+            }
+            if (op == KV_AOF_SETEX)
+                expire = kv_proto_get_u32(&c);
+            if (c.error)
+                break;
+
+            if (op == KV_MUT_DEL)
+                del_entry(repl_store, key, key_len);
+            else if (kv_store_apply(repl_store, key, key_len, value, value_len, expire) != SUCCESS)
+                KV_LOG(KV_LOG_DEBUG, "repl: set of %.*s not applied", key_len, key);
+        }
+        else
+        {
+            return FAILURE;
+        }
+
+        if (*state == KV_PEER_STREAM && op != KV_REPL_SYNC)
+            __atomic_add_fetch(&repl_applied, c.p - start, __ATOMIC_RELAXED);
+        used = c.p - buf;
+    }
+    return used;
+}
+
+/* Function: kv_repl_stopped() - To wait before connecting again
+ * return:
+ *   1 once kv_repl_stop() was called
+ */
+static int kv_repl_stopped(int wait_ms)
+{
+    while (wait_ms > 0 && !__atomic_load_n(&repl_stop, __ATOMIC_ACQUIRE))
+    {
+        poll(NULL, 0, KV_REPL_PING_MS);
+        wait_ms -= KV_REPL_PING_MS;
+    }
+    return __atomic_load_n(&repl_stop, __ATOMIC_ACQUIRE);
+}
+
+/* Function: kv_repl_replica_main() - Replica replication thread
+ *   Connects to the primary, applies its stream and acknowledges
+ *   every heartbeat; starts over when the link drops.
+ */
+static void *kv_repl_replica_main(void *arg)
+{
+    struct timeval timeout = { KV_REPL_RETRY_MS / 1000, 0 };
+    struct pollfd pfd;
+    unsigned char ack[KV_REPL_ACK_LEN];
+    unsigned char *buf;
+    unsigned char *grown;
+    size_t cap = KV_REPL_READ_BUF;
+    size_t len;
+    ssize_t n;
+    long used;
+    int want_ack;
+    int state;
+    int one = 1;
+    int fd;
+
+    (void)arg;
+    buf = malloc(cap);
+    if (NULL == buf)
+    {
+        KV_LOG(KV_LOG_ERROR, "repl: out of memory, not replicating");
+        return NULL;
+    }
+
+    while (!kv_repl_stopped(0))
+    {
+        /* the send timeout bounds connect() as well*/
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0 ||
+            connect(fd, (const struct sockaddr *)&repl_primary, sizeof(repl_primary)) < 0 ||
+            kv_repl_send_all(fd, KV_REPL_MAGIC, KV_REPL_MAGIC_LEN) != SUCCESS)
+        {
+            if (fd >= 0)
+                close(fd);
+            kv_repl_stopped(KV_REPL_RETRY_MS);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        KV_LOG(KV_LOG_INFO, "repl: connected to the primary %s:%d",
+               inet_ntoa(repl_primary.sin_addr), ntohs(repl_primary.sin_port));
+
+        state = KV_PEER_HELLO;
+        len = 0;
+        while (!kv_repl_stopped(0))
+        {
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, KV_REPL_PING_MS) <= 0)
+                continue;
+            n = recv(fd, buf + len, cap - len, 0);
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n <= 0)
+                break;
+            len += n;
+
+            want_ack = 0;
+            used = kv_repl_apply(buf, len, &state, &want_ack);
+            if (used < 0)
+            {
+                KV_LOG(KV_LOG_ERROR, "repl: the primary sent a bad stream");
+                break;
+            }
+            memmove(buf, buf + used, len - used);
+            len -= used;
+
+            /* a record longer than the buffer*/
+            if (len == cap)
+            {
+                grown = cap < KV_REPL_RECORD_MAX ? realloc(buf, cap * 2) : NULL;
+                if (NULL == grown)
+                    break;
+                buf = grown;
+                cap *= 2;
+            }
+
+            if (want_ack)
+            {
+                ack[0] = KV_REPL_ACK;
+                kv_proto_put_u64(ack + 1, __atomic_load_n(&repl_applied, __ATOMIC_RELAXED));
+                if (kv_repl_send_all(fd, ack, sizeof(ack)) != SUCCESS)
+                    break;
+            }
+        }
+        close(fd);
+        __atomic_store_n(&repl_link_up, 0, __ATOMIC_RELAXED);
+        if (!kv_repl_stopped(0))
+            KV_LOG(KV_LOG_WARN, "repl: link to the primary lost, connecting again");
+    }
+    free(buf);
+    return NULL;
+}
+
+/* Function: kv_repl_primary_start() - To start serving replicas
+ *   Call after kv_aof_open() and before any worker is created.
+ * in parameters:
+ *   store - key-value store
+ *   addr - address replicas connect to
+ *   backlog - ring size in bytes, at least KV_REPL_BACKLOG_MIN
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_repl_primary_start(struct kv_store *store, const struct sockaddr_in *addr, size_t backlog)
+{
+    repl_ring = malloc(backlog);
+    repl_listen_fd = kv_tcp_listen(addr, 0);
+    repl_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (NULL == repl_ring || repl_listen_fd < 0 || repl_wake_fd < 0)
+        return FAILURE;
+    repl_ring_size = backlog;
+    repl_store = store;
+    repl_role = KV_REPL_PRIMARY;
+
+    repl_next_journal = store->journal;
+    repl_next_arg = store->journal_arg;
+    kv_store_set_journal(store, kv_repl_append, NULL);
+    if (pthread_create(&repl_thread, NULL, kv_repl_primary_main, NULL) != 0)
+    {
+        kv_store_set_journal(store, repl_next_journal, repl_next_arg);
+        repl_role = KV_REPL_NONE;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_repl_replica_start() - To start following a primary
+ * in parameters:
+ *   store - key-value store, emptied once the primary answers
+ *   primary - replication address of the primary
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_repl_replica_start(struct kv_store *store, const struct sockaddr_in *primary)
+{
+    repl_store = store;
+    repl_primary = *primary;
+    repl_role = KV_REPL_REPLICA;
+    if (pthread_create(&repl_thread, NULL, kv_repl_replica_main, NULL) != 0)
+    {
+        repl_role = KV_REPL_NONE;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_repl_role() - To tell whether updates are served
+ *
+ * return:
+ *   KV_REPL_NONE, KV_REPL_PRIMARY or KV_REPL_REPLICA
+ */
+int kv_repl_role(void)
+{
+    return repl_role;
+}
+
+/* Function: kv_repl_status() - To report the replication state for --stats
+ * in parameters:
+ *   status - filled in
+ *
+ * return:
+ *   void
+ */
+void kv_repl_status(struct kv_repl_status *status)
+{
+    uint64_t now;
+    uint64_t ping;
+    uint64_t stale;
+
+    memset(status, 0, sizeof(*status));
+    status->role = repl_role;
+    status->syncs = __atomic_load_n(&repl_syncs, __ATOMIC_RELAXED);
+    if (repl_role == KV_REPL_PRIMARY)
+    {
+        pthread_mutex_lock(&repl_lock);
+        status->offset = repl_offset;
+        pthread_mutex_unlock(&repl_lock);
+        status->replicas = __atomic_load_n(&repl_replicas, __ATOMIC_RELAXED);
+        status->lag_bytes = __atomic_load_n(&repl_lag_bytes, __ATOMIC_RELAXED);
+    }
+    else if (repl_role == KV_REPL_REPLICA)
+    {
+        status->link_up = __atomic_load_n(&repl_link_up, __ATOMIC_RELAXED);
+        status->offset = __atomic_load_n(&repl_applied, __ATOMIC_RELAXED);
+        /* the data is as old as the last heartbeat was late, or older
+           once the next heartbeat is overdue*/
+        status->lag_ms = __atomic_load_n(&repl_ping_delay_ms, __ATOMIC_RELAXED);
+        ping = __atomic_load_n(&repl_ping_ms, __ATOMIC_RELAXED);
+        now = kv_repl_now_ms();
+        if (ping != 0 && now > ping + KV_REPL_PING_MS)
+        {
+            stale = now - ping - KV_REPL_PING_MS;
+            if (stale > status->lag_ms)
+                status->lag_ms = stale;
+        }
+    }
+}
+
+/* Function: kv_repl_stop() - To stop replicating
+ *   No worker may be running.
+ */
+void kv_repl_stop(void)
+{
+    uint64_t one = 1;
+
+    if (repl_role == KV_REPL_NONE)
+        return;
+
+    __atomic_store_n(&repl_stop, 1, __ATOMIC_RELEASE);
+    if (repl_wake_fd >= 0 && write(repl_wake_fd, &one, sizeof(one)) < 0)
+        KV_LOG(KV_LOG_DEBUG, "repl: wakeup failed");
+    pthread_join(repl_thread, NULL);
+
+    if (repl_role == KV_REPL_PRIMARY)
+    {
+        while (repl_num_peers > 0)
+            kv_repl_drop(repl_num_peers - 1);
+        close(repl_listen_fd);
+        close(repl_wake_fd);
+        repl_listen_fd = repl_wake_fd = -1;
+        kv_store_set_journal(repl_store, repl_next_journal, repl_next_arg);
+        free(repl_ring);
+        repl_ring = NULL;
+    }
+    repl_role = KV_REPL_NONE;
+}
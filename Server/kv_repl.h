@@ -0,0 +1,90 @@
+/* kv_repl.h
+ *
+ * Primary/replica replication of the store
+ * - A primary (--repl-listen <port>) keeps every applied set and del
+ *   in a ring of --repl-backlog bytes, appended from the store journal
+ *   hook after the append-only log's. One thread serves all replicas
+ *   over TCP from the ring, each at its own offset
+ * - A replica that connects first gets a full copy: with every shard
+ *   locked the primary notes the ring offset and forks, the child
+ *   writes the store to the replica and ends with that offset, and
+ *   the stream continues from the ring at that offset. A replica that
+ *   falls more than the ring behind is dropped and copies again
+ * - A replica (--replica-of <ip>:<port>) applies the stream in order
+ *   through the store, serves gets and answers READONLY to updates.
+ *   When the link drops it reconnects, empties its store and copies
+ *   again
+ * - Every KV_REPL_PING_MS the primary sends its wall clock time, the
+ *   replica answers with the offset it has applied. --stats shows how
+ *   many bytes the slowest replica is behind on the primary, and how
+ *   old the data is in ms on the replica
+ *
+ * Stream, multi-byte fields in network byte order:
+ *
+ *   replica -> primary   "KVREPL01", then u8 KV_REPL_ACK, u64 offset
+ *                        per heartbeat
+ *   primary -> replica   "KVREPL01", the store as set records of
+ *                        kv_aof.h, u8 KV_REPL_SYNC, u64 offset, then
+ *                        set and del records of kv_aof.h and
+ *                        u8 KV_REPL_PING, u64 unix time in ms
+ *
+ * An offset counts the stream bytes the primary has appended since it
+ * started. A replica is at the SYNC offset plus the bytes it applied
+ * after the SYNC record.
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_REPL_H
+#define KV_REPL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "kv_store.h"
+
+#define KV_REPL_MAGIC     "KVREPL01"
+#define KV_REPL_MAGIC_LEN 8
+
+/* stream record types, next to KV_MUT_SET, KV_MUT_DEL and KV_AOF_SETEX*/
+#define KV_REPL_SYNC 4
+#define KV_REPL_PING 5
+#define KV_REPL_ACK  6
+
+/* ring size unless --repl-backlog is given, and the least accepted:
+   a record of the largest value must fit with room to spare*/
+#define KV_REPL_BACKLOG_DEFAULT (16 * 1024 * 1024)
+#define KV_REPL_BACKLOG_MIN (4 * 1024 * 1024)
+
+#define KV_REPL_MAX_REPLICAS 16
+/* heartbeat interval, also how often a replica acknowledges*/
+#define KV_REPL_PING_MS 100
+/* wait between connection attempts of a replica*/
+#define KV_REPL_RETRY_MS 1000
+
+/* roles*/
+#define KV_REPL_NONE    0
+#define KV_REPL_PRIMARY 1
+#define KV_REPL_REPLICA 2
+
+/* reported by kv_repl_status()*/
+struct kv_repl_status{
+    int role;
+    int replicas;           /* primary: replicas streaming*/
+    int link_up;            /* replica: synced with the primary*/
+    uint64_t offset;        /* primary: appended, replica: applied*/
+    uint64_t lag_bytes;     /* primary: slowest replica behind offset*/
+    uint64_t lag_ms;        /* replica: age of the data applied*/
+    uint64_t syncs;         /* full copies sent or taken*/
+};
+
+int kv_repl_primary_start(struct kv_store *store, const struct sockaddr_in *addr, size_t backlog);
+int kv_repl_replica_start(struct kv_store *store, const struct sockaddr_in *primary);
+void kv_repl_commit(void);
+int kv_repl_role(void);
+void kv_repl_status(struct kv_repl_status *status);
+void kv_repl_stop(void);
+
+#endif /* KV_REPL_H */
@@ -0,0 +1,271 @@
+/* kv_session.c
+ *
+ * Session replay windows, see kv_session.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kv_session.h"
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+
+/* Function: kv_sessions_init() - To set up the sessions of the Server
+ * in parameters:
+ *   sessions - table
+ *   psk - pre-shared key the session keys derive from
+ *
+ * return:
+ *   status of the operation
+ */
+int kv_sessions_init(struct kv_sessions *sessions, const unsigned char psk[KV_CRYPTO_KEY])
+{
+    struct timespec ts;
+    int i;
+
+    sessions->table = calloc(KV_SESSION_ENTRIES, sizeof(struct kv_session));
+    sessions->floor = calloc(KV_SESSION_ENTRIES / KV_SESSION_WAYS, sizeof(uint64_t));
+    if (NULL == sessions->table || NULL == sessions->floor)
+        return FAILURE;
+    sessions->set_mask = KV_SESSION_ENTRIES / KV_SESSION_WAYS - 1;
+    sessions->start_ms = kv_session_clock();
+    /* a reply nonce is never used twice under a key: the counter goes
+       on from the wall clock in ns, past any a previous run reached*/
+    clock_gettime(CLOCK_REALTIME, &ts);
+    sessions->reply_counter = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    for (i = 0; i < KV_SESSION_LOCKS; i++)
+        pthread_mutex_init(&sessions->locks[i], NULL);
+    memcpy(sessions->psk, psk, KV_CRYPTO_KEY);
+    return SUCCESS;
+}
+
+/* Function: kv_session_clock() - To read the wall clock salts are dated by
+ *
+ * return:
+ *   unix time in ms
+ */
+uint64_t kv_session_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: kv_session_key() - To derive the key of a salt
+ * in parameters:
+ *   sessions - table
+ *   salt - salt of a sealed datagram
+ *   key - set to the session key
+ *
+ * return:
+ *   void
+ */
+void kv_session_key(const struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                    unsigned char key[KV_CRYPTO_KEY])
+{
+    kv_crypto_derive(key, sessions->psk, salt);
+}
+
+/* Function: kv_session_set() - To find the set of a salt and lock it*/
+static struct kv_session *kv_session_set(struct kv_sessions *sessions,
+                                         const unsigned char salt[KV_CRYPTO_SALT],
+                                         pthread_mutex_t **lock)
+{
+    uint64_t h;
+    uint32_t set;
+
+    /* the random half of the salt, the time half is shared by many*/
+    memcpy(&h, salt + 8, sizeof(h));
+    set = (h * 0x9E3779B97F4A7C15ULL) >> 32 & sessions->set_mask;
+    *lock = &sessions->locks[set % KV_SESSION_LOCKS];
+    pthread_mutex_lock(*lock);
+    return &sessions->table[(size_t)set * KV_SESSION_WAYS];
+}
+
+/* Function: kv_session_find() - To find the session of a salt in its set*/
+static struct kv_session *kv_session_find(struct kv_session *set,
+                                          const unsigned char salt[KV_CRYPTO_SALT])
+{
+    int i;
+
+    for (i = 0; i < KV_SESSION_WAYS; i++)
+    {
+        if (set[i].last_ms != 0 && memcmp(set[i].salt, salt, KV_CRYPTO_SALT)==0)
+            return &set[i];
+    }
+    return NULL;
+}
+
+/* Function: kv_session_floor() - To find the floor of a locked set*/
+static uint64_t *kv_session_floor(struct kv_sessions *sessions, const struct kv_session *set)
+{
+    return &sessions->floor[(set - sessions->table) / KV_SESSION_WAYS];
+}
+
+/* Function: kv_session_admit() - To tell whether a salt may open a session
+ *   in a set whose floor is floor*/
+static int kv_session_admit(const struct kv_sessions *sessions, uint64_t floor,
+                            const unsigned char salt[KV_CRYPTO_SALT], uint64_t now)
+{
+    uint64_t born = kv_proto_salt_time(salt);
+
+    return born >= sessions->start_ms && born > floor && born + KV_SESSION_MAX_AGE > now &&
+           born < now + KV_SESSION_MAX_AGE;
+}
+
+/* Function: kv_session_counter_fresh() - To tell whether a counter may be taken*/
+static int kv_session_counter_fresh(const struct kv_session *session, uint64_t counter)
+{
+    uint64_t behind;
+
+    if (counter == 0)
+        return 0;
+    if (counter > session->top)
+        return 1;
+    behind = session->top - counter;
+    return behind < KV_PROTO_REPLAY_WINDOW && !(session->window >> behind & 1);
+}
+
+/* Function: kv_session_fresh() - To tell whether a datagram may be taken
+ *   Checked before a datagram is decrypted, so a replay costs no
+ *   crypto; kv_session_take() decides. Opens no session.
+ * in parameters:
+ *   sessions - table
+ *   salt - salt of the datagram
+ *   counter - counter of the datagram
+ *   now - kv_session_clock()
+ *
+ * return:
+ *   1 when the counter was not taken and is within the window of the
+ *   session, or the salt may open a session
+ */
+int kv_session_fresh(struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                     uint64_t counter, uint64_t now)
+{
+    struct kv_session *set;
+    struct kv_session *session;
+    pthread_mutex_t *lock;
+    int fresh;
+
+    set = kv_session_set(sessions, salt, &lock);
+    session = kv_session_find(set, salt);
+    if (session != NULL)
+        fresh = kv_session_counter_fresh(session, counter);
+    else
+        fresh = counter != 0 &&
+                kv_session_admit(sessions, *kv_session_floor(sessions, set), salt, now);
+    pthread_mutex_unlock(lock);
+    return fresh;
+}
+
+/* Function: kv_session_take() - To take the counter of an authentic datagram
+ *   Opens the session of a new salt, in place of the session of its
+ *   set idle the longest among those whose salt opens none any more,
+ *   or else among all of them, raising the floor of the set.
+ * in parameters:
+ *   sessions - table
+ *   salt - salt of the datagram
+ *   counter - counter of the datagram
+ *   now - kv_session_clock()
+ *
+ * return:
+ *   SUCCESS, FAILURE when it was taken already (a replay, maybe on
+ *   another worker), has fallen out of the window, or no session can
+ *   be opened for the salt
+ */
+int kv_session_take(struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                    uint64_t counter, uint64_t now)
+{
+    struct kv_session *set;
+    struct kv_session *s;
+    struct kv_session *live = NULL;
+    pthread_mutex_t *lock;
+    uint64_t *floor;
+    uint64_t born;
+    uint64_t shift;
+    int i;
+
+    set = kv_session_set(sessions, salt, &lock);
+    floor = kv_session_floor(sessions, set);
+    s = kv_session_find(set, salt);
+    if (NULL == s && kv_session_admit(sessions, *floor, salt, now))
+    {
+        for (i = 0; i < KV_SESSION_WAYS; i++)
+        {
+            /* a salt that may still open a session goes last*/
+            if (set[i].last_ms != 0 && kv_session_admit(sessions, *floor, set[i].salt, now))
+            {
+                if (NULL == live || set[i].last_ms < live->last_ms)
+                    live = &set[i];
+                continue;
+            }
+            if (NULL == s || set[i].last_ms < s->last_ms)
+                s = &set[i];
+        }
+        if (NULL == s)
+        {
+            /* its window goes with it: the salt and every one picked
+               before it must not open a session here again*/
+            s = live;
+            born = kv_proto_salt_time(s->salt);
+            if (born > *floor)
+                *floor = born;
+        }
+        memset(s, 0, sizeof(*s));
+        memcpy(s->salt, salt, KV_CRYPTO_SALT);
+    }
+    if (NULL == s || !kv_session_counter_fresh(s, counter))
+    {
+        pthread_mutex_unlock(lock);
+        return FAILURE;
+    }
+
+    if (counter > s->top)
+    {
+        shift = counter - s->top;
+        s->window = shift >= KV_PROTO_REPLAY_WINDOW ? 0 : s->window << shift;
+        s->top = counter;
+    }
+    s->window |= 1ULL << (s->top - counter);
+    s->last_ms = now;
+    pthread_mutex_unlock(lock);
+    return SUCCESS;
+}
+
+/* Function: kv_session_reply_counter() - To take the nonce counter of a reply
+ *   Replies are sealed under a counter of their own, never the one of
+ *   their request: two replies never share a nonce, whatever requests
+ *   were answered twice.
+ * in parameters:
+ *   sessions - table
+ *
+ * return:
+ *   counter, unique for the Server
+ */
+uint64_t kv_session_reply_counter(struct kv_sessions *sessions)
+{
+    return __atomic_add_fetch(&sessions->reply_counter, 1, __ATOMIC_RELAXED);
+}
+
+/* Function: kv_sessions_free() - To release the sessions*/
+void kv_sessions_free(struct kv_sessions *sessions)
+{
+    int i;
+
+    if (sessions->table != NULL)
+    {
+        memset(sessions->table, 0, KV_SESSION_ENTRIES * sizeof(struct kv_session));
+        for (i = 0; i < KV_SESSION_LOCKS; i++)
+            pthread_mutex_destroy(&sessions->locks[i]);
+    }
+    free(sessions->table);
+    free(sessions->floor);
+    sessions->table = NULL;
+    sessions->floor = NULL;
+    memset(sessions->psk, 0, KV_CRYPTO_KEY);
+}
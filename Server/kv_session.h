@@ -0,0 +1,71 @@
+/* kv_session.h
+ *
+ * Replay windows of the clients under --psk
+ * - A session is named by the salt of its sealed datagrams. Its key is
+ *   derived again for every datagram, the table holds no key
+ * - Every session keeps a replay window: the highest counter taken
+ *   and a bitmap of the KV_PROTO_REPLAY_WINDOW counters below it.
+ *   A session is opened and a counter taken only after the datagram
+ *   proved authentic, so a forged datagram touches no window
+ * - One table for the Server, shared by the UDP workers and the TCP
+ *   threads, so a datagram resent from another port, to another
+ *   worker or over TCP meets the same window. It is set associative,
+ *   a lock per KV_SESSION_LOCKS-th of the sets
+ * - The salt starts with the time the client picked it
+ *   (Common/kv_proto.h). A salt picked before the Server started or
+ *   more than KV_SESSION_MAX_AGE ago opens no session. A new salt
+ *   takes the place of such a session first; when a set holds none,
+ *   the session idle the longest goes and the set's floor rises to
+ *   the time of its salt. A salt picked no later than the floor opens
+ *   no session in that set, so a session dropped from the table can
+ *   never be opened again with its window reset
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_SESSION_H
+#define KV_SESSION_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../Common/kv_crypto.h"
+
+/* sessions of the Server*/
+#define KV_SESSION_ENTRIES 65536
+#define KV_SESSION_WAYS 4
+#define KV_SESSION_LOCKS 256
+
+/* ms after which a salt opens no new session*/
+#define KV_SESSION_MAX_AGE (10 * 60 * 1000)
+
+struct kv_session{
+    uint64_t last_ms;                   /* last datagram, 0 for an unused entry*/
+    uint64_t top;                       /* highest counter taken*/
+    uint64_t window;                    /* bit i: counter top - i taken*/
+    unsigned char salt[KV_CRYPTO_SALT];
+};
+
+struct kv_sessions{
+    struct kv_session *table;
+    uint32_t set_mask;
+    uint64_t start_ms;                  /* older salts open no session*/
+    uint64_t *floor;                    /* per set, salts born no later open none*/
+    uint64_t reply_counter;             /* last nonce counter of a reply*/
+    pthread_mutex_t locks[KV_SESSION_LOCKS];
+    unsigned char psk[KV_CRYPTO_KEY];
+};
+
+int kv_sessions_init(struct kv_sessions *sessions, const unsigned char psk[KV_CRYPTO_KEY]);
+uint64_t kv_session_clock(void);
+void kv_session_key(const struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                    unsigned char key[KV_CRYPTO_KEY]);
+int kv_session_fresh(struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                     uint64_t counter, uint64_t now);
+int kv_session_take(struct kv_sessions *sessions, const unsigned char salt[KV_CRYPTO_SALT],
+                    uint64_t counter, uint64_t now);
+uint64_t kv_session_reply_counter(struct kv_sessions *sessions);
+void kv_sessions_free(struct kv_sessions *sessions);
+
+#endif /* KV_SESSION_H */
@@ -0,0 +1,257 @@
+/* kv_slab.c
+ *
+ * Size-class slab allocator, see kv_slab.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kv_slab.h"
+#include "kv_store.h"
+
+/* Growth factor between two consecutive chunk sizes, in percent*/
+#define KV_SLAB_FACTOR 125
+
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/* bytes before the first chunk of a page*/
+#define KV_SLAB_PAGE_HEADER ALIGN_UP(sizeof(struct kv_slab_page), KV_SLAB_ALIGN)
+
+/* Function: kv_slab_page_size() - To size the pages of a class
+ *   Small chunks share KV_SLAB_PAGE_SIZE pages, a large chunk gets a
+ *   page of a few chunks only.
+ */
+static size_t kv_slab_page_size(size_t size)
+{
+    size_t chunks = (KV_SLAB_PAGE_SIZE - KV_SLAB_PAGE_HEADER) / size;
+
+    if (size < KV_SLAB_LARGE_CHUNK)
+        return KV_SLAB_PAGE_SIZE;
+    if (chunks > KV_SLAB_LARGE_PAGE_CHUNKS)
+        chunks = KV_SLAB_LARGE_PAGE_CHUNKS;
+    return KV_SLAB_PAGE_HEADER + chunks * size;
+}
+
+/* Function: kv_slab_init() - To set up the size classes
+ * in parameters:
+ *   slab - allocator to be initialised
+ *   max_size - largest allocation that will be requested
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_slab_init(struct kv_slab *slab, size_t max_size)
+{
+    size_t size = KV_SLAB_MIN_CHUNK;
+    size_t nidx;
+    size_t i;
+    int c = 0;
+
+    memset(slab, 0, sizeof(*slab));
+    max_size = ALIGN_UP(max_size, KV_SLAB_ALIGN);
+    if (max_size > KV_SLAB_PAGE_SIZE - KV_SLAB_PAGE_HEADER)
+        return FAILURE;
+
+    while (size < max_size && c < KV_SLAB_MAX_CLASSES - 1)
+    {
+        slab->classes[c++].size = size;
+        size = ALIGN_UP(size * KV_SLAB_FACTOR / 100, KV_SLAB_ALIGN);
+    }
+    slab->classes[c++].size = max_size;
+    slab->nclasses = c;
+    for (c = 0; c < slab->nclasses; c++)
+        slab->classes[c].page_size = kv_slab_page_size(slab->classes[c].size);
+    slab->max_size = max_size;
+
+    /* direct lookup table so alloc/free never search the classes*/
+    nidx = max_size / KV_SLAB_ALIGN + 1;
+    slab->class_of = malloc(nidx);
+    if (NULL == slab->class_of)
+        return FAILURE;
+
+    c = 0;
+    for (i = 0; i < nidx; i++)
+    {
+        while (slab->classes[c].size < i * KV_SLAB_ALIGN)
+            c++;
+        slab->class_of[i] = c;
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_slab_alloc() - To allocate a chunk for size bytes
+ * in parameters:
+ *   slab - allocator
+ *   size - number of bytes needed
+ *
+ * return:
+ *   chunk pointer or NULL
+ */
+void *kv_slab_alloc(struct kv_slab *slab, size_t size)
+{
+    struct kv_slab_class *cls;
+    struct kv_slab_chunk *chunk;
+    struct kv_slab_page *page;
+    char *ptr;
+
+    if (size == 0 || size > slab->max_size)
+        return NULL;
+
+    cls = &slab->classes[slab->class_of[(size + KV_SLAB_ALIGN - 1) / KV_SLAB_ALIGN]];
+
+    if (cls->free_list != NULL)
+    {
+        chunk = cls->free_list;
+        cls->free_list = chunk->next;
+        cls->free_chunks--;
+        ptr = (char *)chunk;
+    }
+    else
+    {
+        if (cls->bump + cls->size > cls->bump_end || cls->bump == NULL)
+        {
+            page = malloc(cls->page_size);
+            if (NULL == page)
+                return NULL;
+            page->next = cls->pages;
+            cls->pages = page;
+            cls->npages++;
+            cls->bump = (char *)page + KV_SLAB_PAGE_HEADER;
+            cls->bump_end = (char *)page + cls->page_size;
+        }
+        ptr = cls->bump;
+        cls->bump += cls->size;
+    }
+
+    cls->used_chunks++;
+    cls->requested_bytes += size;
+    return ptr;
+}
+
+/* Function: kv_slab_chunk_size() - To get the memory an allocation takes
+ * in parameters:
+ *   slab - allocator
+ *   size - number of bytes to be allocated
+ *
+ * return:
+ *   chunk size of the class serving size
+ */
+size_t kv_slab_chunk_size(struct kv_slab *slab, size_t size)
+{
+    return slab->classes[slab->class_of[(size + KV_SLAB_ALIGN - 1) / KV_SLAB_ALIGN]].size;
+}
+
+/* Function: kv_slab_free() - To return a chunk to its class free list
+ * in parameters:
+ *   slab - allocator
+ *   ptr - chunk returned by kv_slab_alloc()
+ *   size - size passed to kv_slab_alloc()
+ *
+ * return:
+ *   void
+ */
+void kv_slab_free(struct kv_slab *slab, void *ptr, size_t size)
+{
+    struct kv_slab_class *cls;
+    struct kv_slab_chunk *chunk = ptr;
+
+    if (NULL == ptr)
+        return;
+
+    cls = &slab->classes[slab->class_of[(size + KV_SLAB_ALIGN - 1) / KV_SLAB_ALIGN]];
+    chunk->next = cls->free_list;
+    cls->free_list = chunk;
+    cls->free_chunks++;
+    cls->used_chunks--;
+    cls->requested_bytes -= size;
+}
+
+/* Function: kv_slab_get_stats() - To add per class usage into stats
+ * in parameters:
+ *   slab - allocator
+ *   stats - counters to add to, zeroed by the caller
+ *
+ * return:
+ *   void
+ */
+void kv_slab_get_stats(struct kv_slab *slab, struct kv_slab_stats *stats)
+{
+    struct kv_slab_class *cls;
+    struct kv_slab_class_stats *out;
+    int c;
+
+    stats->nclasses = slab->nclasses;
+    for (c = 0; c < slab->nclasses; c++)
+    {
+        cls = &slab->classes[c];
+        out = &stats->classes[c];
+        out->size = cls->size;
+        out->page_size = cls->page_size;
+        out->npages += cls->npages;
+        out->used_chunks += cls->used_chunks;
+        out->free_chunks += cls->free_chunks;
+        out->requested_bytes += cls->requested_bytes;
+    }
+}
+
+/* Function: kv_slab_print_stats() - To print per class usage
+ * in parameters:
+ *   stats - counters from kv_slab_get_stats()
+ *   out - stream to print to
+ *
+ * return:
+ *   void
+ */
+void kv_slab_print_stats(struct kv_slab_stats *stats, FILE *out)
+{
+    struct kv_slab_class_stats *cls;
+    size_t total_page_bytes = 0;
+    size_t total_used = 0;
+    size_t total_requested = 0;
+    int c;
+
+    fprintf(out, "\nslab class  chunk    page  pages   used_chunks   free_chunks  requested_bytes");
+    for (c = 0; c < stats->nclasses; c++)
+    {
+        cls = &stats->classes[c];
+        if (cls->npages == 0)
+            continue;
+        fprintf(out, "\n%10d %6zu %7zu %6zu %13zu %13zu %16zu", c, cls->size,
+                cls->page_size, cls->npages, cls->used_chunks, cls->free_chunks,
+                cls->requested_bytes);
+        total_page_bytes += cls->npages * cls->page_size;
+        total_used += cls->used_chunks * cls->size;
+        total_requested += cls->requested_bytes;
+    }
+    fprintf(out, "\nslab total: %zu bytes in pages, %zu bytes in used chunks, %zu bytes requested\n",
+            total_page_bytes, total_used, total_requested);
+}
+
+/* Function: kv_slab_destroy() - To release all pages to the system
+ * in parameters:
+ *   slab - allocator
+ *
+ * return:
+ *   void
+ */
+void kv_slab_destroy(struct kv_slab *slab)
+{
+    struct kv_slab_page *page;
+    int c;
+
+    for (c = 0; c < slab->nclasses; c++)
+    {
+        while (slab->classes[c].pages != NULL)
+        {
+            page = slab->classes[c].pages;
+            slab->classes[c].pages = page->next;
+            free(page);
+        }
+    }
+    free(slab->class_of);
+    memset(slab, 0, sizeof(*slab));
+}
@@ -0,0 +1,88 @@
+/* kv_slab.h
+ *
+ * Size-class slab allocator for the key-value store items
+ * - Memory is taken from the system in fixed size pages and carved
+ *   into equal chunks, one chunk size per class
+ * - Class sizes grow geometrically up to the largest item the
+ *   store can hold (key + value limits)
+ * - Freed chunks go back on the free list of their class and are
+ *   reused before a new page is carved, so set/del churn does not
+ *   grow the heap
+ * - Classes of KV_SLAB_LARGE_CHUNK bytes and up take pages of at most
+ *   KV_SLAB_LARGE_PAGE_CHUNKS chunks, so one large value does not
+ *   hold a whole KV_SLAB_PAGE_SIZE page of its class in every shard
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_SLAB_H
+#define KV_SLAB_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define KV_SLAB_PAGE_SIZE   (1024 * 1024)
+#define KV_SLAB_MIN_CHUNK   32
+#define KV_SLAB_ALIGN       16
+#define KV_SLAB_MAX_CLASSES 64
+
+/* chunks of a large class page*/
+#define KV_SLAB_LARGE_CHUNK       (16 * 1024)
+#define KV_SLAB_LARGE_PAGE_CHUNKS 2
+
+/* page list header, chunks follow it*/
+struct kv_slab_page{
+    struct kv_slab_page *next;
+};
+
+/* free chunks are linked through their first bytes*/
+struct kv_slab_chunk{
+    struct kv_slab_chunk *next;
+};
+
+struct kv_slab_class{
+    size_t size;                    /* chunk size*/
+    size_t page_size;               /* bytes taken from the system per page*/
+    struct kv_slab_chunk *free_list;
+    char *bump;                     /* uncarved part of newest page*/
+    char *bump_end;
+    struct kv_slab_page *pages;
+    size_t npages;
+    size_t used_chunks;
+    size_t free_chunks;
+    size_t requested_bytes;         /* bytes asked for by live chunks*/
+};
+
+/* usage counters of one class, summed over slabs by kv_slab_get_stats()*/
+struct kv_slab_class_stats{
+    size_t size;
+    size_t page_size;
+    size_t npages;
+    size_t used_chunks;
+    size_t free_chunks;
+    size_t requested_bytes;
+};
+
+struct kv_slab_stats{
+    int nclasses;
+    struct kv_slab_class_stats classes[KV_SLAB_MAX_CLASSES];
+};
+
+struct kv_slab{
+    struct kv_slab_class classes[KV_SLAB_MAX_CLASSES];
+    int nclasses;
+    size_t max_size;
+    unsigned char *class_of;        /* (size + ALIGN - 1) / ALIGN -> class*/
+};
+
+/* Function prototypes */
+int kv_slab_init(struct kv_slab *slab, size_t max_size);
+void *kv_slab_alloc(struct kv_slab *slab, size_t size);
+void kv_slab_free(struct kv_slab *slab, void *ptr, size_t size);
+size_t kv_slab_chunk_size(struct kv_slab *slab, size_t size);
+void kv_slab_get_stats(struct kv_slab *slab, struct kv_slab_stats *stats);
+void kv_slab_print_stats(struct kv_slab_stats *stats, FILE *out);
+void kv_slab_destroy(struct kv_slab *slab);
+
+#endif /* KV_SLAB_H */
@@ -0,0 +1,381 @@
+/* kv_snapshot.c
+ *
+ * Snapshot save and reload, see kv_snapshot.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "kv_snapshot.h"
+#include "kv_log.h"
+#include "../Common/kv_proto.h"
+
+#define KV_SNAP_PATH_MAX 4096
+
+/* state of one snapshot being written*/
+struct kv_snap_writer{
+    int fd;
+    unsigned char *buf;
+    size_t len;
+    uint64_t count;
+    int error;
+};
+
+/* background snapshot thread*/
+static pthread_t snap_thread;
+static int snap_running;
+static int snap_stop;
+static struct kv_store *snap_store;
+static const char *snap_path;
+static unsigned int snap_interval;
+
+/* write() until done, only async-signal-safe calls: runs in the
+   forked child*/
+static int kv_snap_write_all(int fd, const unsigned char *p, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FAILURE;
+        }
+        p += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+static void kv_snap_flush(struct kv_snap_writer *w)
+{
+    if (!w->error && kv_snap_write_all(w->fd, w->buf, w->len) != SUCCESS)
+        w->error = 1;
+    w->len = 0;
+}
+
+/* kv_store_for_each() callback, appends one record*/
+static void kv_snap_record(void *arg, const struct kv_item *item)
+{
+    struct kv_snap_writer *w = arg;
+    unsigned char *p;
+
+    if (w->len + 2 + item->key_len + 4 + item->value_len + 4 > KV_SNAP_BUF_SIZE)
+        kv_snap_flush(w);
+
+    p = w->buf + w->len;
+    p = kv_proto_put_u16(p, item->key_len);
+    p = kv_proto_put_bytes(p, ITEM_KEY(item), item->key_len);
+    p = kv_proto_put_u32(p, item->value_len);
+    p = kv_proto_put_bytes(p, ITEM_VALUE(item), item->value_len);
+    p = kv_proto_put_u32(p, item->expire);
+    w->len = p - w->buf;
+    w->count++;
+}
+
+/* fsync the directory holding path so the rename itself is durable*/
+static void kv_snap_sync_dir(const char *path)
+{
+    char dir[KV_SNAP_PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    size_t len;
+    int fd;
+
+    if (NULL == slash)
+    {
+        dir[0] = '.';
+        len = 1;
+    }
+    else
+    {
+        len = slash == path ? 1 : (size_t)(slash - path);
+        memcpy(dir, path, len);
+    }
+    dir[len] = '\0';
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+/* Function: kv_snap_write() - To write the store to path
+ * in parameters:
+ *   store - key-value store, not changing while this runs
+ *   path - snapshot file
+ *   buf - KV_SNAP_BUF_SIZE bytes, allocated by the caller so the
+ *         forked child never calls malloc
+ *
+ * return:
+ *   status - status of the operation
+ */
+static int kv_snap_write(struct kv_store *store, const char *path, unsigned char *buf)
+{
+    char tmp[KV_SNAP_PATH_MAX];
+    struct kv_snap_writer w;
+    unsigned char *p;
+    size_t len = strlen(path);
+
+    if (len + sizeof(".tmp") > sizeof(tmp))
+        return FAILURE;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0)
+        return FAILURE;
+
+    /* count is patched once the records are written*/
+    w.len = KV_SNAP_HDR_LEN;
+    kv_store_for_each(store, kv_snap_record, &w);
+
+    if (w.len + KV_SNAP_HDR_LEN > KV_SNAP_BUF_SIZE)
+        kv_snap_flush(&w);
+    p = kv_proto_put_bytes(w.buf + w.len, KV_SNAP_TRAILER, KV_SNAP_MAGIC_LEN);
+    p = kv_proto_put_u64(p, w.count);
+    w.len = p - w.buf;
+    kv_snap_flush(&w);
+
+    p = kv_proto_put_bytes(w.buf, KV_SNAP_MAGIC, KV_SNAP_MAGIC_LEN);
+    kv_proto_put_u64(p, w.count);
+    if (pwrite(w.fd, w.buf, KV_SNAP_HDR_LEN, 0) != KV_SNAP_HDR_LEN)
+        w.error = 1;
+
+    if (fsync(w.fd) != 0)
+        w.error = 1;
+    close(w.fd);
+
+    if (w.error || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return FAILURE;
+    }
+    kv_snap_sync_dir(path);
+    return SUCCESS;
+}
+
+/* Function: kv_snapshot_save() - To write a snapshot in the calling thread
+ * in parameters:
+ *   store - key-value store, no worker may be running
+ *   path - snapshot file
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_snapshot_save(struct kv_store *store, const char *path)
+{
+    unsigned char *buf = malloc(KV_SNAP_BUF_SIZE);
+    int status;
+
+    if (NULL == buf)
+        return FAILURE;
+    status = kv_snap_write(store, path, buf);
+    free(buf);
+    return status;
+}
+
+/* Function: kv_snapshot_save_bg() - To write a snapshot from a forked child
+ * in parameters:
+ *   store - key-value store, workers may be running
+ *   path - snapshot file
+ *
+ * return:
+ *   pid of the child, FAILURE if it could not be started
+ */
+int kv_snapshot_save_bg(struct kv_store *store, const char *path)
+{
+    unsigned char *buf = malloc(KV_SNAP_BUF_SIZE);
+    pid_t pid;
+
+    if (NULL == buf)
+        return FAILURE;
+
+    /* no shard is mid-update at the fork, the child sees a
+       consistent store and the workers only wait for fork() itself*/
+    kv_store_lock_all(store);
+    pid = fork();
+    if (pid == 0)
+        _exit(kv_snap_write(store, path, buf) == SUCCESS ? 0 : 1);
+    kv_store_unlock_all(store);
+
+    free(buf);
+    return pid < 0 ? FAILURE : pid;
+}
+
+/* Function: kv_snapshot_load() - To load a snapshot into an empty store
+ * in parameters:
+ *   store - key-value store
+ *   path - snapshot file
+ *
+ * return:
+ *   number of entries loaded, 0 when there is no snapshot yet,
+ *   FAILURE when the file is truncated or not a snapshot
+ */
+long kv_snapshot_load(struct kv_store *store, const char *path)
+{
+    struct kv_proto_cursor c, t;
+    struct stat st;
+    const char *magic, *key, *value;
+    unsigned char *map;
+    uint64_t count, i;
+    uint16_t key_len;
+    uint32_t value_len;
+    uint32_t expire = 0;
+    long loaded = 0;
+    int has_expire;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : FAILURE;
+    if (fstat(fd, &st) != 0 || st.st_size < 2 * KV_SNAP_HDR_LEN)
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return FAILURE;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* header and trailer must agree, a short write is caught here*/
+    kv_proto_cursor_init(&c, map, st.st_size - KV_SNAP_HDR_LEN);
+    kv_proto_cursor_init(&t, map + st.st_size - KV_SNAP_HDR_LEN, KV_SNAP_HDR_LEN);
+    magic = kv_proto_get_bytes(&c, KV_SNAP_MAGIC_LEN);
+    count = kv_proto_get_u64(&c);
+    has_expire = memcmp(magic, KV_SNAP_MAGIC, KV_SNAP_MAGIC_LEN) == 0;
+    if ((!has_expire && memcmp(magic, KV_SNAP_MAGIC_V1, KV_SNAP_MAGIC_LEN) != 0) ||
+        memcmp(kv_proto_get_bytes(&t, KV_SNAP_MAGIC_LEN), KV_SNAP_TRAILER, KV_SNAP_MAGIC_LEN) != 0 ||
+        kv_proto_get_u64(&t) != count)
+    {
+        munmap(map, st.st_size);
+        return FAILURE;
+    }
+
+    kv_store_reserve(store, count);
+    for (i = 0; i < count; i++)
+    {
+        key_len = kv_proto_get_u16(&c);
+        key = kv_proto_get_bytes(&c, key_len);
+        value_len = kv_proto_get_u32(&c);
+        value = kv_proto_get_bytes(&c, value_len);
+        if (has_expire)
+            expire = kv_proto_get_u32(&c);
+        if (c.error)
+            break;
+        if (kv_store_load(store, key, key_len, value, value_len, expire) == SUCCESS)
+            loaded++;
+    }
+
+    munmap(map, st.st_size);
+    return c.error ? FAILURE : loaded;
+}
+
+/* Function: kv_snapshot_main() - Background snapshot thread
+ *   Waits for SIGUSR1 or the interval to expire, forks a snapshot
+ *   child and reaps it. Triggers arriving while a child runs stay
+ *   pending and start one more snapshot afterwards.
+ */
+static void *kv_snapshot_main(void *arg)
+{
+    struct timespec timeout, *tp = NULL;
+    sigset_t set;
+    pid_t pid;
+    int status;
+
+    (void)arg;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (snap_interval > 0)
+    {
+        timeout.tv_sec = snap_interval;
+        timeout.tv_nsec = 0;
+        tp = &timeout;
+    }
+
+    while (1)
+    {
+        if (sigtimedwait(&set, NULL, tp) < 0 && errno != EAGAIN)
+            continue;
+        if (__atomic_load_n(&snap_stop, __ATOMIC_ACQUIRE))
+            break;
+
+        pid = kv_snapshot_save_bg(snap_store, snap_path);
+        if (pid < 0)
+        {
+            KV_LOG(KV_LOG_ERROR, "snapshot: fork failed");
+            continue;
+        }
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            KV_LOG(KV_LOG_ERROR, "snapshot: writing %s failed", snap_path);
+    }
+    return NULL;
+}
+
+/* Function: kv_snapshot_start() - To start the background snapshot thread
+ *   SIGUSR1 must be blocked in every thread so that only this one takes
+ *   it: the caller blocks it before creating its first thread, the log,
+ *   log flusher and replication threads included. The calling thread
+ *   is blocked again here, which cannot reach threads already running.
+ * in parameters:
+ *   store - key-value store
+ *   path - snapshot file
+ *   interval_s - seconds between snapshots, 0 for SIGUSR1 only
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_snapshot_start(struct kv_store *store, const char *path, unsigned int interval_s)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        return FAILURE;
+
+    snap_store = store;
+    snap_path = path;
+    snap_interval = interval_s;
+    snap_stop = 0;
+    if (pthread_create(&snap_thread, NULL, kv_snapshot_main, NULL) != 0)
+        return FAILURE;
+    snap_running = 1;
+    return SUCCESS;
+}
+
+/* Function: kv_snapshot_stop() - To stop the snapshot thread
+ *   Returns once a background snapshot in progress has finished.
+ */
+void kv_snapshot_stop(void)
+{
+    if (!snap_running)
+        return;
+    __atomic_store_n(&snap_stop, 1, __ATOMIC_RELEASE);
+    pthread_kill(snap_thread, SIGUSR1);
+    pthread_join(snap_thread, NULL);
+    snap_running = 0;
+}
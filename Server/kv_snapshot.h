@@ -0,0 +1,47 @@
+/* kv_snapshot.h
+ *
+ * Snapshot persistence for the key-value store
+ * - A snapshot is a compact binary dump of every key-value pair,
+ *   written to "<path>.tmp", fsync'd and renamed over <path> so a
+ *   crash never leaves a half written snapshot behind
+ * - Background snapshots fork: the child writes its copy-on-write
+ *   view of the store while the workers keep serving
+ * - Startup reload maps the file and bulk loads it into pre-sized
+ *   tables, no rehash and no per-key lookup
+ *
+ * File layout, multi-byte fields in network byte order:
+ *
+ *   header   "KVSNAP02", u64 count
+ *   records  count x (u16 key_len, key, u32 value_len, value,
+ *                     u32 expire (unix seconds, 0 = never))
+ *   trailer  "KVSNAPND", u64 count
+ *
+ * "KVSNAP01" files, written before keys could expire, have no expire
+ * field and still load.
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_SNAPSHOT_H
+#define KV_SNAPSHOT_H
+
+#include "kv_store.h"
+
+#define KV_SNAP_MAGIC   "KVSNAP02"
+#define KV_SNAP_MAGIC_V1 "KVSNAP01"
+#define KV_SNAP_TRAILER "KVSNAPND"
+#define KV_SNAP_MAGIC_LEN 8
+#define KV_SNAP_HDR_LEN  (KV_SNAP_MAGIC_LEN + 8)
+
+/* write buffer, one write() per this many bytes of records; bigger
+   than the largest record so a record never straddles two buffers*/
+#define KV_SNAP_BUF_SIZE (2 * 1024 * 1024)
+
+int kv_snapshot_save(struct kv_store *store, const char *path);
+int kv_snapshot_save_bg(struct kv_store *store, const char *path);
+long kv_snapshot_load(struct kv_store *store, const char *path);
+int kv_snapshot_start(struct kv_store *store, const char *path, unsigned int interval_s);
+void kv_snapshot_stop(void);
+
+#endif /* KV_SNAPSHOT_H */
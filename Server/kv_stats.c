@@ -0,0 +1,241 @@
+/* kv_stats.c
+ *
+ * Runtime metrics, see kv_stats.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kv_stats.h"
+#include "kv_slab.h"
+#include "kv_repl.h"
+#include "kv_probe.h"
+
+static const char *stat_op_names[KV_STAT_OPS] = {
+    "set", "get", "del", "fin", "mset", "mget", "mdel",
+    "put", "cas", "incr", "decr", "append", "gets",
+    "getrange", "putchunk", "scan", "prefix"
+};
+
+/* reply under construction, never written past size*/
+struct kv_stats_out{
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void kv_stats_printf(struct kv_stats_out *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void kv_stats_printf(struct kv_stats_out *out, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (out->len >= out->size)
+        return;
+    va_start(ap, fmt);
+    n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        out->len += n;
+    if (out->len >= out->size)
+        out->len = out->size - 1;
+}
+
+/* Function: kv_stats_batch() - To count one batch taken from the I/O backend
+ * in parameters:
+ *   stats - stats of the calling worker
+ *   num_msgs - datagrams in the batch
+ *
+ * return:
+ *   void
+ */
+void kv_stats_batch(struct kv_stats *stats, int num_msgs)
+{
+    int bucket;
+
+    for (bucket = 0; (2 << bucket) <= num_msgs && bucket < KV_STAT_BATCH_BUCKETS - 1; bucket++)
+        ;
+    KV_HIST_ADD(stats->recv_calls, 1);
+    KV_HIST_ADD(stats->recv_msgs, num_msgs);
+    KV_HIST_ADD(stats->batch_hist[bucket], 1);
+}
+
+/* Function: kv_stats_merge() - To add a worker's stats to a total
+ * in parameters:
+ *   dst - total, owned by the caller
+ *   src - stats of a worker that may still be running
+ *
+ * return:
+ *   void
+ */
+void kv_stats_merge(struct kv_stats *dst, const struct kv_stats *src)
+{
+    int op;
+    int i;
+
+    for (op = 0; op < KV_STAT_OPS; op++)
+    {
+        dst->ops[op].requests += __atomic_load_n(&src->ops[op].requests, __ATOMIC_RELAXED);
+        for (i = 0; i < KV_STAT_STATUSES; i++)
+            dst->ops[op].status[i] += __atomic_load_n(&src->ops[op].status[i], __ATOMIC_RELAXED);
+        kv_hist_merge(&dst->ops[op].service, &src->ops[op].service);
+    }
+
+    dst->recv_calls += __atomic_load_n(&src->recv_calls, __ATOMIC_RELAXED);
+    dst->recv_msgs += __atomic_load_n(&src->recv_msgs, __ATOMIC_RELAXED);
+    for (i = 0; i < KV_STAT_BATCH_BUCKETS; i++)
+        dst->batch_hist[i] += __atomic_load_n(&src->batch_hist[i], __ATOMIC_RELAXED);
+    dst->io_syscalls += __atomic_load_n(&src->io_syscalls, __ATOMIC_RELAXED);
+    dst->tcp_accepted += __atomic_load_n(&src->tcp_accepted, __ATOMIC_RELAXED);
+    dst->tcp_closed += __atomic_load_n(&src->tcp_closed, __ATOMIC_RELAXED);
+    dst->dedup_hits += __atomic_load_n(&src->dedup_hits, __ATOMIC_RELAXED);
+    dst->seal_rejects += __atomic_load_n(&src->seal_rejects, __ATOMIC_RELAXED);
+}
+
+/* Function: kv_stats_format() - To render the stats reply
+ * in parameters:
+ *   total - merged stats of all workers
+ *   store - key-value store
+ *   threads - number of workers
+ *   io_backend - name of the workers' I/O backend
+ *   uptime_ns - time since startup
+ *   reply - output buffer
+ *   size - size of reply
+ *
+ * return:
+ *   length of the reply
+ */
+int kv_stats_format(const struct kv_stats *total, struct kv_store *store,
+                    int threads, const char *io_backend, uint64_t uptime_ns,
+                    char *reply, size_t size)
+{
+    struct kv_stats_out out = { reply, size, 0 };
+    struct kv_slab_stats slab;
+    const struct kv_op_stats *op;
+    const struct kv_hist *h;
+    struct kv_usage usage;
+    struct kv_repl_status repl;
+    size_t chunk_bytes = 0, page_bytes = 0, requested = 0;
+    int o, s, c, b;
+
+    kv_store_usage(store, &usage);
+    kv_store_slab_stats(store, &slab);
+    for (c = 0; c < slab.nclasses; c++)
+    {
+        page_bytes += slab.classes[c].npages * slab.classes[c].page_size;
+        chunk_bytes += slab.classes[c].used_chunks * slab.classes[c].size;
+        requested += slab.classes[c].requested_bytes;
+    }
+
+    kv_stats_printf(&out, "uptime_ms %llu\n", (unsigned long long)(uptime_ns / 1000000));
+    kv_stats_printf(&out, "threads %d\n", threads);
+    kv_stats_printf(&out, "io_backend %s\n", io_backend);
+    kv_stats_printf(&out, "key_probe %s\n", kv_probe_name(store->probe_impl));
+    kv_stats_printf(&out, "keys %zu\n", usage.keys);
+    kv_stats_printf(&out, "max_keys %zu\n", store->max_entries);
+    kv_stats_printf(&out, "bytes_stored %zu\n", usage.bytes);
+    kv_stats_printf(&out, "memory_bytes %zu\n", usage.memory);
+    kv_stats_printf(&out, "max_memory %zu\n", store->max_memory);
+    kv_stats_printf(&out, "eviction %s\n", store->evict == KV_EVICT_CLOCK ? "clock" : "none");
+    kv_stats_printf(&out, "evictions %llu\n", (unsigned long long)usage.evictions);
+    kv_stats_printf(&out, "expired %llu\n", (unsigned long long)usage.expired);
+    kv_stats_printf(&out, "slab_page_bytes %zu\n", page_bytes);
+    kv_stats_printf(&out, "slab_chunk_bytes %zu\n", chunk_bytes);
+    kv_stats_printf(&out, "slab_requested_bytes %zu\n", requested);
+
+    for (c = 0; c < slab.nclasses; c++)
+    {
+        if (slab.classes[c].npages == 0)
+            continue;
+        kv_stats_printf(&out, "slab_class_%d size=%zu page=%zu pages=%zu used=%zu free=%zu\n",
+                        c, slab.classes[c].size, slab.classes[c].page_size, slab.classes[c].npages,
+                        slab.classes[c].used_chunks, slab.classes[c].free_chunks);
+    }
+
+    kv_stats_printf(&out, "get_hits %llu\n",
+                    (unsigned long long)(total->ops[KV_OP_GET - 1].status[KV_ST_SUCCESS] +
+                                         total->ops[KV_OP_MGET - 1].status[KV_ST_SUCCESS] +
+                                         total->ops[KV_OP_GETS - 1].status[KV_ST_SUCCESS]));
+    kv_stats_printf(&out, "get_misses %llu\n",
+                    (unsigned long long)(total->ops[KV_OP_GET - 1].status[KV_ST_NOEXIST] +
+                                         total->ops[KV_OP_MGET - 1].status[KV_ST_NOEXIST] +
+                                         total->ops[KV_OP_GETS - 1].status[KV_ST_NOEXIST]));
+
+    kv_stats_printf(&out, "recv_calls %llu\n", (unsigned long long)total->recv_calls);
+    kv_stats_printf(&out, "recv_msgs %llu\n", (unsigned long long)total->recv_msgs);
+    kv_stats_printf(&out, "recv_batch");
+    for (b = 0; b < KV_STAT_BATCH_BUCKETS; b++)
+    {
+        if (total->batch_hist[b] != 0)
+            kv_stats_printf(&out, " %d-%d:%llu", 1 << b, (2 << b) - 1,
+                            (unsigned long long)total->batch_hist[b]);
+    }
+    kv_stats_printf(&out, "\n");
+    kv_stats_printf(&out, "io_syscalls %llu\n", (unsigned long long)total->io_syscalls);
+    kv_stats_printf(&out, "tcp_conns %llu\n",
+                    (unsigned long long)(total->tcp_accepted - total->tcp_closed));
+    kv_stats_printf(&out, "tcp_accepted %llu\n", (unsigned long long)total->tcp_accepted);
+    kv_stats_printf(&out, "dedup_hits %llu\n", (unsigned long long)total->dedup_hits);
+    kv_stats_printf(&out, "seal_rejects %llu\n", (unsigned long long)total->seal_rejects);
+
+    kv_repl_status(&repl);
+    kv_stats_printf(&out, "repl_role %s\n", repl.role == KV_REPL_PRIMARY ? "primary" :
+                    repl.role == KV_REPL_REPLICA ? "replica" : "none");
+    if (repl.role == KV_REPL_PRIMARY)
+    {
+        kv_stats_printf(&out, "repl_replicas %d\n", repl.replicas);
+        kv_stats_printf(&out, "repl_lag_bytes %llu\n", (unsigned long long)repl.lag_bytes);
+    }
+    else if (repl.role == KV_REPL_REPLICA)
+    {
+        kv_stats_printf(&out, "repl_link %s\n", repl.link_up ? "up" : "down");
+        kv_stats_printf(&out, "repl_lag_ms %llu\n", (unsigned long long)repl.lag_ms);
+    }
+    if (repl.role != KV_REPL_NONE)
+    {
+        kv_stats_printf(&out, "repl_offset %llu\n", (unsigned long long)repl.offset);
+        kv_stats_printf(&out, "repl_syncs %llu\n", (unsigned long long)repl.syncs);
+    }
+
+    for (o = 0; o < KV_STAT_OPS; o++)
+    {
+        op = &total->ops[o];
+        if (op->requests == 0)
+            continue;
+
+        kv_stats_printf(&out, "cmd_%s %llu\n", stat_op_names[o], (unsigned long long)op->requests);
+        for (s = 0; s < KV_STAT_STATUSES; s++)
+        {
+            if (op->status[s] != 0)
+                kv_stats_printf(&out, "%s_%s %llu\n", stat_op_names[o],
+                                kv_proto_status_str(s), (unsigned long long)op->status[s]);
+        }
+
+        h = &op->service;
+        kv_stats_printf(&out, "%s_service_ns mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+                        stat_op_names[o], (unsigned long long)(h->total ? h->sum / h->total : 0),
+                        (unsigned long long)kv_hist_percentile(h, 50),
+                        (unsigned long long)kv_hist_percentile(h, 90),
+                        (unsigned long long)kv_hist_percentile(h, 99),
+                        (unsigned long long)kv_hist_percentile(h, 99.9),
+                        (unsigned long long)h->max);
+
+        /* non-empty buckets only, "<lowest ns>:<count>"*/
+        kv_stats_printf(&out, "%s_service_hist", stat_op_names[o]);
+        for (b = 0; b < KV_HIST_BUCKETS; b++)
+        {
+            if (h->counts[b] != 0)
+                kv_stats_printf(&out, " %llu:%llu", (unsigned long long)kv_hist_value(b),
+                                (unsigned long long)h->counts[b]);
+        }
+        kv_stats_printf(&out, "\n");
+    }
+
+    return (int)out.len;
+}
@@ -0,0 +1,66 @@
+/* kv_stats.h
+ *
+ * Runtime metrics of the Server
+ * - Every worker owns one struct kv_stats and is the only writer, so
+ *   recording is a plain increment on a cache line no other thread
+ *   writes
+ * - The "--stats" command adds up all workers' counters, the store
+ *   size and the slab usage into one text reply, one "name value"
+ *   pair per line
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_STATS_H
+#define KV_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+#include "../Common/kv_hist.h"
+
+/* operations counted, index KV_OP_* - 1*/
+#define KV_STAT_OPS KV_OP_PREFIX
+/* outcomes counted, index KV_ST_*, a get SUCCESS is a hit, NOEXIST a miss*/
+#define KV_STAT_STATUSES (KV_ST_BADREQ + 1)
+/* receive batch size histogram, bucket b counts 2^b..2^(b+1)-1*/
+#define KV_STAT_BATCH_BUCKETS 11
+
+struct kv_op_stats{
+    uint64_t requests;
+    uint64_t status[KV_STAT_STATUSES];  /* per key for multi-key ops*/
+    struct kv_hist service;             /* ns from parse to reply built*/
+};
+
+struct kv_stats{
+    struct kv_op_stats ops[KV_STAT_OPS];
+    uint64_t recv_calls;
+    uint64_t recv_msgs;
+    uint64_t batch_hist[KV_STAT_BATCH_BUCKETS];
+    uint64_t io_syscalls;               /* added by the worker's I/O backend*/
+    uint64_t tcp_accepted;              /* TCP workers only*/
+    uint64_t tcp_closed;
+    uint64_t dedup_hits;                /* resent requests answered from kv_dedup*/
+    uint64_t seal_rejects;              /* --psk: forged, replayed or not sealed*/
+    int cur_op;                         /* op of the request in flight*/
+};
+
+/* Function: kv_stats_status() - To count one outcome of an op
+ *   Called by the owning worker only.
+ */
+static inline void kv_stats_status(struct kv_stats *stats, int opcode, int status)
+{
+    stats->cur_op = opcode;
+    KV_HIST_ADD(stats->ops[opcode - 1].status[status], 1);
+}
+
+void kv_stats_batch(struct kv_stats *stats, int num_msgs);
+void kv_stats_merge(struct kv_stats *dst, const struct kv_stats *src);
+int kv_stats_format(const struct kv_stats *total, struct kv_store *store,
+                    int threads, const char *io_backend, uint64_t uptime_ns,
+                    char *reply, size_t size);
+
+#endif /* KV_STATS_H */
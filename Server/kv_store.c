@@ -0,0 +1,1426 @@
+/* kv_store.c
+ *
+ * Open-addressing hash table backing the UDP Server key-value store.
+ * See kv_store.h for the layout.
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "kv_hash.h"
+#include "kv_store.h"
+#include "kv_probe.h"
+
+/* Number of old-table slots migrated on every store operation*/
+#define KV_REHASH_STEP 64
+
+/* marker for a deleted slot, keeps linear probe chains intact*/
+static struct kv_item kv_tombstone_mark;
+#define KV_TOMBSTONE (&kv_tombstone_mark)
+
+#define SLOT_LIVE(s) ((s)->item != NULL && (s)->item != KV_TOMBSTONE)
+
+/* item past its expiry time, kept until accessed or its timer fires*/
+#define ITEM_EXPIRED(store, it) \
+    ((it)->expire != 0 && (it)->expire <= __atomic_load_n(&(store)->clock, __ATOMIC_RELAXED))
+
+/* Function: kv_table_alloc() - To allocate an empty table
+ * in parameters:
+ *   table - table to be initialised
+ *   nslots - number of slots, power of 2
+ *
+ * return:
+ *   status - status of the operation
+ */
+static int kv_table_alloc(struct kv_table *table, size_t nslots)
+{
+    table->slots = calloc(nslots, sizeof(struct kv_slot));
+    if (NULL == table->slots)
+        return FAILURE;
+    /* a group read at the last slot runs into the cloned bytes*/
+    table->ctrl = malloc(nslots + KV_CTRL_CLONE);
+    if (NULL == table->ctrl)
+    {
+        free(table->slots);
+        table->slots = NULL;
+        return FAILURE;
+    }
+    memset(table->ctrl, KV_CTRL_EMPTY, nslots + KV_CTRL_CLONE);
+
+    table->mask = nslots - 1;
+    table->used = 0;
+    table->tombstones = 0;
+    return SUCCESS;
+}
+
+/* Function: kv_table_free() - To release the memory of a table
+ * in parameters:
+ *   table - table, left empty
+ *
+ * return:
+ *   void
+ */
+static void kv_table_free(struct kv_table *table)
+{
+    free(table->slots);
+    free(table->ctrl);
+    memset(table, 0, sizeof(*table));
+}
+
+/* Function: kv_table_find_expired() - To find an expired item by key hash
+ *   Timers keep no key, a live slot with the same hash whose item has
+ *   expired is dropped whichever key it holds.
+ * in parameters:
+ *   store - key-value store
+ *   table - table to be probed
+ *   hash - hash of the key
+ *
+ * return:
+ *   slot holding the expired item or NULL
+ */
+static struct kv_slot *kv_table_find_expired(struct kv_store *store, struct kv_table *table,
+                                             uint64_t hash)
+{
+    size_t idx;
+    struct kv_slot *slot;
+
+    if (NULL == table->slots)
+        return NULL;
+
+    idx = hash & table->mask;
+    while (1)
+    {
+        slot = &table->slots[idx];
+        if (slot->item == NULL)
+            return NULL;
+        if (slot->hash == hash && slot->item != KV_TOMBSTONE && ITEM_EXPIRED(store, slot->item))
+            return slot;
+        idx = (idx + 1) & table->mask;
+    }
+}
+
+/* Function: kv_table_place() - To put a slot known to be absent into table
+ * in parameters:
+ *   table - destination table
+ *   src - slot content to be copied
+ *
+ * return:
+ *   void
+ */
+static void kv_table_place(struct kv_table *table, const struct kv_slot *src)
+{
+    size_t idx = src->hash & table->mask;
+    struct kv_slot *slot;
+
+    while (1)
+    {
+        slot = &table->slots[idx];
+        if (slot->item == NULL || slot->item == KV_TOMBSTONE)
+            break;
+        idx = (idx + 1) & table->mask;
+    }
+
+    if (slot->item == KV_TOMBSTONE)
+        table->tombstones--;
+    *slot = *src;
+    kv_ctrl_set(table, idx, KV_CTRL_TAG(src->hash));
+    table->used++;
+}
+
+/* Function: kv_rehash_step() - To migrate slots from old to current table
+ * in parameters:
+ *   shard - store shard
+ *   steps - max number of old slots to visit
+ *
+ * return:
+ *   void
+ */
+static void kv_rehash_step(struct kv_shard *shard, size_t steps)
+{
+    struct kv_slot *slot;
+    size_t idx;
+
+    if (NULL == shard->old.slots)
+        return;
+
+    while (steps-- > 0 && shard->rehash_idx <= shard->old.mask)
+    {
+        idx = shard->rehash_idx++;
+        slot = &shard->old.slots[idx];
+        if (SLOT_LIVE(slot))
+        {
+            kv_table_place(&shard->cur, slot);
+            /* tombstone, not empty: unmigrated keys may probe through it*/
+            slot->item = KV_TOMBSTONE;
+            kv_ctrl_set(&shard->old, idx, KV_CTRL_DELETED);
+            shard->old.used--;
+        }
+    }
+
+    if (shard->rehash_idx > shard->old.mask)
+    {
+        kv_table_free(&shard->old);
+        shard->rehash_idx = 0;
+    }
+}
+
+/* Function: kv_maybe_grow() - To start a resize when load gets too high
+ * in parameters:
+ *   shard - store shard
+ *
+ * return:
+ *   status - FAILURE only if the table is full and cannot grow
+ */
+static int kv_maybe_grow(struct kv_shard *shard)
+{
+    struct kv_table *cur = &shard->cur;
+    size_t nslots = cur->mask + 1;
+    size_t occupied = cur->used + cur->tombstones + 1;
+    struct kv_table next;
+
+    /* max load factor 3/4, tombstones included*/
+    if (occupied * 4 <= nslots * 3)
+        return SUCCESS;
+
+    /* previous resize must be complete before starting a new one*/
+    kv_rehash_step(shard, (size_t)-1);
+    occupied = cur->used + cur->tombstones + 1;
+
+    while ((cur->used + 1) * 2 >= nslots)
+        nslots *= 2;
+
+    if (kv_table_alloc(&next, nslots) != SUCCESS)
+    {
+        /* keep going on the current table, at least one empty slot stays*/
+        return (occupied <= cur->mask) ? SUCCESS : FAILURE;
+    }
+
+    shard->old = *cur;
+    shard->cur = next;
+    shard->rehash_idx = 0;
+    return SUCCESS;
+}
+
+/* Function: kv_get_shard() - To pick the shard owning a key hash
+ * in parameters:
+ *   store - key-value store
+ *   hash - hash of the key
+ *
+ * return:
+ *   shard, locked
+ */
+static struct kv_shard *kv_get_shard(struct kv_store *store, uint64_t hash)
+{
+    /* top bits pick the shard, low bits index the table inside it*/
+    struct kv_shard *shard = &store->shards[(hash >> 40) & (store->nshards - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    return shard;
+}
+
+/* Function: kv_store_init() - To initialise an empty store
+ * in parameters:
+ *   store - key-value store
+ *   nshards - number of lock stripes, rounded up to a power of 2
+ *   max_entries - max number of keys in the store
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_store_init(struct kv_store *store, unsigned int nshards, size_t max_entries)
+{
+    struct kv_shard *shard;
+    unsigned int i;
+
+    memset(store, 0, sizeof(*store));
+    store->nshards = 1;
+    while (store->nshards < nshards)
+        store->nshards *= 2;
+    store->max_entries = max_entries;
+    store->clock = time(NULL);
+    store->probe_impl = kv_probe_best();
+    store->probe = kv_probe_select(store->probe_impl);
+
+    if (posix_memalign((void **)&store->shards, 64,
+                       store->nshards * sizeof(struct kv_shard)) != 0)
+        return FAILURE;
+    memset(store->shards, 0, store->nshards * sizeof(struct kv_shard));
+
+    for (i = 0; i < store->nshards; i++)
+    {
+        shard = &store->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        if (kv_slab_init(&shard->slab, ITEM_SIZE(KV_MAX_KEY, KV_MAX_VALUE)) != SUCCESS)
+            return FAILURE;
+        if (kv_table_alloc(&shard->cur, KV_INIT_SLOTS) != SUCCESS)
+            return FAILURE;
+        kv_wheel_init(&shard->wheel, store->clock);
+        kv_index_init(&shard->index);
+        /* tokens handed out before a restart never match again*/
+        shard->version = (uint64_t)store->clock << 32;
+    }
+    return SUCCESS;
+}
+
+static void kv_shard_remove(struct kv_store *store, struct kv_shard *shard,
+                            struct kv_table *table, struct kv_slot *slot);
+static void kv_shard_drop_expired(struct kv_store *store, struct kv_shard *shard,
+                                  struct kv_table *table, struct kv_slot *slot);
+
+/* Function: kv_shard_lookup() - To find a key in both table generations
+ *   An expired key is dropped on the way and reported as absent.
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked store shard
+ *   hash - hash of the key
+ *   key - key to be found
+ *   length - length of the key
+ *   table_out - table the slot belongs to, may be NULL
+ *
+ * return:
+ *   slot holding the key or NULL
+ */
+static struct kv_slot *kv_shard_lookup(struct kv_store *store, struct kv_shard *shard,
+                                       uint64_t hash, const char *key, size_t length,
+                                       struct kv_table **table_out)
+{
+    struct kv_table *table = &shard->cur;
+    struct kv_slot *slot;
+
+    kv_rehash_step(shard, KV_REHASH_STEP);
+
+    slot = store->probe(table, hash, key, length);
+    if (NULL == slot)
+    {
+        table = &shard->old;
+        slot = store->probe(table, hash, key, length);
+    }
+    if (slot != NULL && ITEM_EXPIRED(store, slot->item))
+    {
+        kv_shard_drop_expired(store, shard, table, slot);
+        slot = NULL;
+    }
+    if (table_out != NULL)
+        *table_out = table;
+    return slot;
+}
+
+/* Function: find_entry() - To find the if a key-value pair exists
+ *   The item is pinned rather than copied: it stays readable, value
+ *   and version unchanged, until release_entry() even if the key is
+ *   deleted or set again meanwhile.
+ * in parameters:
+ *   store - key-value store
+ *   key - key value to be found in db
+ *   length - length of the key
+ *   item - set to the pinned item
+ *
+ * return:
+ *   status - status of the operation
+ */
+int find_entry(struct kv_store *store, const char *key, int length, const struct kv_item **item)
+{
+    uint64_t hash = kv_hash(key, length);
+    struct kv_shard *shard = kv_get_shard(store, hash);
+    struct kv_slot *slot;
+    int status = FAILURE;
+
+    slot = kv_shard_lookup(store, shard, hash, key, length, NULL);
+    if (slot != NULL)
+    {
+        /* written only when it changes, a hot key's line stays clean*/
+        if (store->evict != KV_EVICT_NONE && !(slot->meta & KV_META_REF))
+            slot->meta |= KV_META_REF;
+        /* pinned under the lock, released without it*/
+        __atomic_add_fetch(&slot->item->refs, 1, __ATOMIC_RELAXED);
+        *item = slot->item;
+        status = SUCCESS;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/* Function: kv_item_free() - To give an item dropped from its table back
+ *   A pinned item only gets KV_ITEM_UNLINKED, the last release_entry()
+ *   frees it. Its chunk stays in the memory count until then.
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard the item belonged to
+ *   item - item no slot points to any more
+ *
+ * return:
+ *   void
+ */
+static void kv_item_free(struct kv_store *store, struct kv_shard *shard, struct kv_item *item)
+{
+    size_t size = ITEM_SIZE(item->key_len, item->value_len);
+
+    /* one atomic op decides who frees: no pin left here, or the
+       release that drops the last pin sees the flag*/
+    if (__atomic_load_n(&item->refs, __ATOMIC_RELAXED) != 0 &&
+        __atomic_fetch_or(&item->refs, KV_ITEM_UNLINKED, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    __atomic_sub_fetch(&store->memory, kv_slab_chunk_size(&shard->slab, size), __ATOMIC_RELAXED);
+    kv_slab_free(&shard->slab, item, size);
+}
+
+/* Function: release_entry() - To drop a pin taken by find_entry()
+ * in parameters:
+ *   store - key-value store
+ *   item - item returned by find_entry()
+ *
+ * return:
+ *   void
+ */
+void release_entry(struct kv_store *store, const struct kv_item *item)
+{
+    struct kv_item *it = (struct kv_item *)item;
+    struct kv_shard *shard;
+
+    if (__atomic_fetch_sub(&it->refs, 1, __ATOMIC_ACQ_REL) != (KV_ITEM_UNLINKED | 1))
+        return;
+
+    /* last pin of an item already dropped from the store, rare:
+       the shard is found again from the key*/
+    shard = kv_get_shard(store, kv_hash(ITEM_KEY(it), it->key_len));
+    it->refs = 0;
+    kv_item_free(store, shard, it);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* Function: kv_shard_remove() - To delete the item of a live slot
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard
+ *   table - table holding slot
+ *   slot - live slot
+ *
+ * return:
+ *   void
+ */
+static void kv_shard_remove(struct kv_store *store, struct kv_shard *shard,
+                            struct kv_table *table, struct kv_slot *slot)
+{
+    struct kv_item *item = slot->item;
+
+    __atomic_store_n(&shard->bytes, shard->bytes - item->key_len - item->value_len,
+                     __ATOMIC_RELAXED);
+    if (store->ordered)
+        kv_index_delete(&shard->index, ITEM_KEY(item), item->key_len);
+    kv_item_free(store, shard, item);
+    slot->item = KV_TOMBSTONE;
+    kv_ctrl_set(table, slot - table->slots, KV_CTRL_DELETED);
+    table->used--;
+    table->tombstones++;
+    shard->count--;
+    __atomic_sub_fetch(&store->count, 1, __ATOMIC_RELAXED);
+}
+
+/* Function: kv_shard_drop_expired() - To delete an expired item
+ *   Logged as a delete, a replay or replica must not keep the key
+ *   whatever its clock says.
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard
+ *   table - table holding slot
+ *   slot - live slot whose item has expired
+ *
+ * return:
+ *   void
+ */
+static void kv_shard_drop_expired(struct kv_store *store, struct kv_shard *shard,
+                                  struct kv_table *table, struct kv_slot *slot)
+{
+    if (store->journal != NULL)
+        store->journal(store->journal_arg, KV_MUT_DEL, ITEM_KEY(slot->item),
+                       slot->item->key_len, NULL, 0, 0);
+    kv_shard_remove(store, shard, table, slot);
+    __atomic_store_n(&shard->expired, shard->expired + 1, __ATOMIC_RELAXED);
+}
+
+/* Function: kv_shard_evict() - To evict one key with the CLOCK policy
+ *   The hand sweeps the current table, a referenced slot loses its
+ *   bit and is passed over, the first unreferenced one is evicted.
+ *   No list is kept, the bit lives in the slot meta.
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard
+ *   spare - slot of the current table never evicted, may be NULL
+ *
+ * return:
+ *   status - FAILURE if the shard holds no other key
+ */
+static int kv_shard_evict(struct kv_store *store, struct kv_shard *shard,
+                          const struct kv_slot *spare)
+{
+    struct kv_table *table = &shard->cur;
+    struct kv_slot *slot;
+    size_t n;
+
+    /* all keys in one table so the hand sees each of them*/
+    kv_rehash_step(shard, (size_t)-1);
+    if (shard->count == 0)
+        return FAILURE;
+
+    /* two rounds: every bit is clear after the first*/
+    for (n = 0; n < 2 * (table->mask + 1); n++)
+    {
+        slot = &table->slots[shard->clock_hand++ & table->mask];
+        if (!SLOT_LIVE(slot) || slot == spare)
+            continue;
+        if (slot->meta & KV_META_REF)
+        {
+            slot->meta &= ~KV_META_REF;
+            continue;
+        }
+
+        if (store->journal != NULL)
+            store->journal(store->journal_arg, KV_MUT_DEL, ITEM_KEY(slot->item),
+                           slot->item->key_len, NULL, 0, 0);
+        kv_shard_remove(store, shard, table, slot);
+        __atomic_store_n(&shard->evictions, shard->evictions + 1, __ATOMIC_RELAXED);
+        return SUCCESS;
+    }
+    return FAILURE;
+}
+
+/* Function: kv_shard_insert() - To add a key known to be absent
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard owning the key
+ *   hash - hash of the key
+ *   key - key to be added
+ *   key_len - length of the key
+ *   value - value of the key
+ *   value_len - length of value
+ *   expire - unix time in seconds the key expires at, 0 = never
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_MAXLMT or FAILURE
+ */
+static int kv_shard_insert(struct kv_store *store, struct kv_shard *shard, uint64_t hash,
+                           const char *key, int key_len, const char *value, int value_len,
+                           uint32_t expire)
+{
+    struct kv_slot slot;
+    struct kv_item *item = NULL;
+    size_t size = ITEM_SIZE(key_len, value_len);
+    size_t chunk = kv_slab_chunk_size(&shard->slab, size);
+    size_t memory;
+    int status = ENTRY_MAXLMT;
+
+    /* limits are global but a shard only evicts its own keys, the
+       hash spreads keys evenly so every shard is about as full*/
+    while (store->evict == KV_EVICT_CLOCK &&
+           (__atomic_load_n(&store->count, __ATOMIC_RELAXED) >= store->max_entries ||
+            (store->max_memory != 0 &&
+             __atomic_load_n(&store->memory, __ATOMIC_RELAXED) + chunk > store->max_memory)))
+    {
+        if (kv_shard_evict(store, shard, NULL) != SUCCESS)
+            break;
+    }
+
+    /* reserve room in the global key count and memory*/
+    if (__atomic_add_fetch(&store->count, 1, __ATOMIC_RELAXED) > store->max_entries)
+        goto undo_count;
+    memory = __atomic_add_fetch(&store->memory, chunk, __ATOMIC_RELAXED);
+    if (store->max_memory != 0 && memory > store->max_memory)
+        goto undo_memory;
+
+    /* one slab chunk for header, key and value*/
+    if (kv_maybe_grow(shard) == SUCCESS)
+        item = kv_slab_alloc(&shard->slab, size);
+    if (NULL == item)
+    {
+        status = FAILURE;
+        goto undo_memory;
+    }
+
+    item->version = ++shard->version;
+    item->key_len = key_len;
+    item->value_len = value_len;
+    item->expire = expire;
+    item->refs = 0;
+    memcpy(ITEM_KEY(item), key, key_len);
+    ITEM_KEY(item)[key_len] = '\0';
+    memcpy(ITEM_VALUE(item), value, value_len);
+    ITEM_VALUE(item)[value_len] = '\0';
+
+    if (store->ordered && kv_index_insert(&shard->index, item) != SUCCESS)
+    {
+        kv_slab_free(&shard->slab, item, size);
+        status = FAILURE;
+        goto undo_memory;
+    }
+
+    slot.hash = hash;
+    slot.key_len = key_len;
+    slot.meta = KV_META_REF;
+    slot.item = item;
+    kv_table_place(&shard->cur, &slot);
+    shard->count++;
+    __atomic_store_n(&shard->bytes, shard->bytes + key_len + value_len, __ATOMIC_RELAXED);
+
+    /* without a timer the key still expires, on its next access*/
+    if (expire != 0)
+        kv_wheel_add(&shard->wheel, hash, expire);
+    return SUCCESS;
+
+undo_memory:
+    __atomic_sub_fetch(&store->memory, chunk, __ATOMIC_RELAXED);
+undo_count:
+    __atomic_sub_fetch(&store->count, 1, __ATOMIC_RELAXED);
+    return status;
+}
+
+/*
+ * Function: add_entry() - To add a key-value pair if the key is not in db
+ * in parameters:
+ *   store - key-value store
+ *   key - key value to be added
+ *   key_len - length of the key
+ *   value - value of the key to be added
+ *   value_len - length of value
+ *   ttl - seconds until the key expires, 0 = never
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_EXIST, ENTRY_MAXLMT or FAILURE
+ */
+int add_entry(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+              uint32_t ttl)
+{
+    uint64_t hash;
+    struct kv_shard *shard;
+    uint32_t expire = 0;
+    int status;
+
+    if (key_len < 1 || key_len > KV_MAX_KEY || value_len > KV_MAX_VALUE)
+        return FAILURE;
+
+    hash = kv_hash(key, key_len);
+    shard = kv_get_shard(store, hash);
+    if (ttl != 0)
+        expire = __atomic_load_n(&store->clock, __ATOMIC_RELAXED) + ttl;
+
+    /* existence check and insert under one lock, two clients setting
+       the same key cannot both succeed*/
+    if (kv_shard_lookup(store, shard, hash, key, key_len, NULL) != NULL)
+        status = ENTRY_EXIST;
+    else
+        status = kv_shard_insert(store, shard, hash, key, key_len, value, value_len, expire);
+
+    if (status == SUCCESS && store->journal != NULL)
+        store->journal(store->journal_arg, KV_MUT_SET, key, key_len, value, value_len, expire);
+
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/* Function: kv_table_find_item() - To find the slot holding an item
+ * in parameters:
+ *   table - table holding the item
+ *   hash - hash of its key
+ *   item - live item
+ *
+ * return:
+ *   slot of item
+ */
+static struct kv_slot *kv_table_find_item(struct kv_table *table, uint64_t hash,
+                                          const struct kv_item *item)
+{
+    size_t idx = hash & table->mask;
+
+    while (table->slots[idx].item != item)
+        idx = (idx + 1) & table->mask;
+    return &table->slots[idx];
+}
+
+/* Function: kv_shard_replace() - To give a live key a new value
+ *   The item is rewritten in place when the new size falls in the
+ *   same slab class and no reader has it pinned, otherwise a chunk
+ *   of the right class replaces it. Over the memory limit a bigger
+ *   chunk first evicts other keys under CLOCK, as an insert does,
+ *   and is refused when that cannot free enough room.
+ * in parameters:
+ *   store - key-value store
+ *   shard - locked shard
+ *   slotp - live slot of the key, updated when evicting moves it
+ *   keep - bytes of the current value kept in front of value, 0
+ *          to replace it all
+ *   value - new value bytes, must not point into the item
+ *   value_len - length of value
+ *   expire - unix time in seconds the key expires at, 0 = never
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_MAXLMT or FAILURE
+ */
+static int kv_shard_replace(struct kv_store *store, struct kv_shard *shard, struct kv_slot **slotp,
+                            int keep, const char *value, int value_len, uint32_t expire)
+{
+    struct kv_slot *slot = *slotp;
+    struct kv_item *item = slot->item;
+    size_t old_size = ITEM_SIZE(item->key_len, item->value_len);
+    size_t size = ITEM_SIZE(item->key_len, keep + value_len);
+    size_t old_chunk = kv_slab_chunk_size(&shard->slab, old_size);
+    size_t chunk = kv_slab_chunk_size(&shard->slab, size);
+
+    /* refs only grows under the shard lock, 0 here stays 0*/
+    if (chunk != old_chunk || __atomic_load_n(&item->refs, __ATOMIC_RELAXED) != 0)
+    {
+        if (chunk > old_chunk && store->max_memory != 0 &&
+            __atomic_load_n(&store->memory, __ATOMIC_RELAXED) + chunk - old_chunk > store->max_memory)
+        {
+            if (store->evict == KV_EVICT_CLOCK)
+            {
+                /* the sweep first moves every key to the current table*/
+                kv_rehash_step(shard, (size_t)-1);
+                slot = *slotp = kv_table_find_item(&shard->cur, slot->hash, item);
+                while (__atomic_load_n(&store->memory, __ATOMIC_RELAXED) + chunk - old_chunk >
+                       store->max_memory)
+                {
+                    if (kv_shard_evict(store, shard, slot) != SUCCESS)
+                        return ENTRY_MAXLMT;
+                }
+            }
+            else
+            {
+                return ENTRY_MAXLMT;
+            }
+        }
+
+        item = kv_slab_alloc(&shard->slab, size);
+        if (NULL == item)
+            return FAILURE;
+        /* header, key and kept bytes move over, the rest is written below*/
+        memcpy(item, slot->item, sizeof(struct kv_item) + slot->item->key_len + 1 + keep);
+        item->refs = 0;
+        __atomic_add_fetch(&store->memory, chunk, __ATOMIC_RELAXED);
+        /* the index compares against the old item, still readable here*/
+        if (store->ordered)
+            kv_index_move(&shard->index, item);
+        kv_item_free(store, shard, slot->item);
+        slot->item = item;
+    }
+
+    value_len += keep;
+    __atomic_store_n(&shard->bytes, shard->bytes + value_len - item->value_len, __ATOMIC_RELAXED);
+    memcpy(ITEM_VALUE(item) + keep, value, value_len - keep);
+    ITEM_VALUE(item)[value_len] = '\0';
+    item->value_len = value_len;
+    item->version = ++shard->version;
+    if (expire != 0 && expire != item->expire)
+        kv_wheel_add(&shard->wheel, slot->hash, expire);
+    item->expire = expire;
+    if (store->evict != KV_EVICT_NONE && !(slot->meta & KV_META_REF))
+        slot->meta |= KV_META_REF;
+    return SUCCESS;
+}
+
+/* Function: kv_store_put() - To set a key whether it exists or not
+ * in parameters:
+ *   store - key-value store
+ *   key - key to be set
+ *   key_len - length of the key
+ *   value - value of the key
+ *   value_len - length of value
+ *   expire - unix time in seconds the key expires at, 0 = never
+ *   expect - version the key must have, 0 for any or none
+ *   version - set to the new version, may be NULL
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_EXIST on a version mismatch, ENTRY_NOEXIST,
+ *   ENTRY_MAXLMT or FAILURE
+ */
+static int kv_store_put(struct kv_store *store, const char *key, int key_len, const char *value,
+                        int value_len, uint32_t expire, uint64_t expect, uint64_t *version)
+{
+    uint64_t hash;
+    struct kv_shard *shard;
+    struct kv_slot *slot;
+    int status;
+
+    if (key_len < 1 || key_len > KV_MAX_KEY || value_len > KV_MAX_VALUE)
+        return FAILURE;
+
+    hash = kv_hash(key, key_len);
+    shard = kv_get_shard(store, hash);
+
+    slot = kv_shard_lookup(store, shard, hash, key, key_len, NULL);
+    if (NULL == slot)
+        status = expect != 0 ? ENTRY_NOEXIST :
+                 kv_shard_insert(store, shard, hash, key, key_len, value, value_len, expire);
+    else if (expect != 0 && slot->item->version != expect)
+        status = ENTRY_EXIST;
+    else
+        status = kv_shard_replace(store, shard, &slot, 0, value, value_len, expire);
+
+    if (status == SUCCESS)
+    {
+        if (store->journal != NULL)
+            store->journal(store->journal_arg, KV_MUT_SET, key, key_len, value, value_len, expire);
+        if (version != NULL)
+            *version = shard->version;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/*
+ * Function: put_entry() - To set a key, replacing its value if it exists
+ *   With expect set this is a compare-and-set: the value is only
+ *   replaced while the key still has the version a get returned.
+ * in parameters:
+ *   store - key-value store
+ *   key - key to be set
+ *   key_len - length of the key
+ *   value - value of the key
+ *   value_len - length of value
+ *   ttl - seconds until the key expires, 0 = never
+ *   expect - version the key must have, 0 to set unconditionally
+ *   version - set to the new version, may be NULL
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_EXIST on a version mismatch, ENTRY_NOEXIST
+ *   when expect is set and the key is gone, ENTRY_MAXLMT or FAILURE
+ */
+int put_entry(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+              uint32_t ttl, uint64_t expect, uint64_t *version)
+{
+    uint32_t expire = 0;
+
+    if (ttl != 0)
+        expire = __atomic_load_n(&store->clock, __ATOMIC_RELAXED) + ttl;
+    return kv_store_put(store, key, key_len, value, value_len, expire, expect, version);
+}
+
+/*
+ * Function: incr_entry() - To add to or subtract from a numeric value
+ *   The value must be a decimal number below 2^64. An increment wraps
+ *   around, a decrement stops at 0. The expiry time is kept.
+ * in parameters:
+ *   store - key-value store
+ *   key - key of the counter
+ *   key_len - length of the key
+ *   delta - amount to add or subtract
+ *   decr - non-zero to subtract
+ *   result - set to the new value
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_NOEXIST, ENTRY_MAXLMT or FAILURE when the
+ *   value is not a number
+ */
+int incr_entry(struct kv_store *store, const char *key, int key_len, uint64_t delta, int decr,
+               uint64_t *result)
+{
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *shard = kv_get_shard(store, hash);
+    struct kv_slot *slot;
+    struct kv_item *item;
+    uint64_t number = 0;
+    char digits[24];
+    uint32_t i;
+    int len;
+    int status = FAILURE;
+
+    slot = kv_shard_lookup(store, shard, hash, key, key_len, NULL);
+    if (NULL == slot)
+    {
+        status = ENTRY_NOEXIST;
+        goto out;
+    }
+
+    item = slot->item;
+    if (item->value_len == 0 || item->value_len > 20)
+        goto out;
+    for (i = 0; i < item->value_len; i++)
+    {
+        if (ITEM_VALUE(item)[i] < '0' || ITEM_VALUE(item)[i] > '9' ||
+            number > (UINT64_MAX - (ITEM_VALUE(item)[i] - '0')) / 10)
+            goto out;
+        number = number * 10 + (ITEM_VALUE(item)[i] - '0');
+    }
+
+    if (decr)
+        number = number > delta ? number - delta : 0;
+    else
+        number += delta;
+    len = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)number);
+
+    status = kv_shard_replace(store, shard, &slot, 0, digits, len, item->expire);
+    if (status == SUCCESS)
+    {
+        if (store->journal != NULL)
+            store->journal(store->journal_arg, KV_MUT_SET, key, key_len, digits, len,
+                           slot->item->expire);
+        *result = number;
+    }
+
+out:
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/*
+ * Function: append_entry() - To add bytes to the end of a value
+ * in parameters:
+ *   store - key-value store
+ *   key - key to be extended
+ *   key_len - length of the key
+ *   value - bytes to be appended
+ *   value_len - number of bytes
+ *   version - set to the new version, may be NULL
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_NOEXIST, ENTRY_MAXLMT or FAILURE when the
+ *   value would grow past KV_MAX_VALUE
+ */
+int append_entry(struct kv_store *store, const char *key, int key_len, const char *value,
+                 int value_len, uint64_t *version)
+{
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *shard = kv_get_shard(store, hash);
+    struct kv_slot *slot;
+    int status = FAILURE;
+
+    slot = kv_shard_lookup(store, shard, hash, key, key_len, NULL);
+    if (NULL == slot)
+    {
+        status = ENTRY_NOEXIST;
+    }
+    else if ((size_t)slot->item->value_len + value_len <= KV_MAX_VALUE)
+    {
+        /* the current value stays in front, no copy of it is built*/
+        status = kv_shard_replace(store, shard, &slot, slot->item->value_len, value, value_len,
+                                  slot->item->expire);
+        if (status == SUCCESS)
+        {
+            /* logged whole, replay needs no earlier record of the key*/
+            if (store->journal != NULL)
+                store->journal(store->journal_arg, KV_MUT_SET, key, key_len,
+                               ITEM_VALUE(slot->item), slot->item->value_len,
+                               slot->item->expire);
+            if (version != NULL)
+                *version = slot->item->version;
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/*
+ * Function: kv_store_load() - To bulk load one entry of a snapshot
+ * in parameters:
+ *   store - key-value store
+ *   key - key to be added, caller guarantees it is not in db
+ *   key_len - length of the key
+ *   value - value of the key
+ *   value_len - length of value
+ *   expire - unix time in seconds the key expires at, 0 = never
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_MAXLMT or FAILURE; FAILURE also for an
+ *   entry that has already expired, it is skipped
+ */
+int kv_store_load(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+                  uint32_t expire)
+{
+    uint64_t hash;
+    struct kv_shard *shard;
+    int status;
+
+    if (key_len < 1 || key_len > KV_MAX_KEY || value_len > KV_MAX_VALUE)
+        return FAILURE;
+    if (expire != 0 && expire <= store->clock)
+        return FAILURE;
+
+    /* no existence check: snapshot keys are unique*/
+    hash = kv_hash(key, key_len);
+    shard = kv_get_shard(store, hash);
+    /* keep the resize moving as kv_shard_lookup() would*/
+    kv_rehash_step(shard, KV_REHASH_STEP);
+    status = kv_shard_insert(store, shard, hash, key, key_len, value, value_len, expire);
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/*
+ * Function: kv_store_expire() - To drop the keys expired by now
+ *   Moves the clock used by lazy expiry, then advances every shard's
+ *   timing wheel and drops the items of its due timers. The shard
+ *   lock is released every KV_EXPIRE_BATCH timers so a burst of
+ *   expiries does not stall the workers.
+ * in parameters:
+ *   store - key-value store
+ *   now - current unix time in seconds
+ *
+ * return:
+ *   number of keys dropped
+ */
+size_t kv_store_expire(struct kv_store *store, uint32_t now)
+{
+    struct kv_shard *shard;
+    struct kv_timer timer;
+    struct kv_slot *slot;
+    struct kv_table *table;
+    size_t dropped = 0;
+    unsigned int i;
+    int n, more;
+
+    if (now > store->clock)
+        __atomic_store_n(&store->clock, now, __ATOMIC_RELAXED);
+
+    for (i = 0; i < store->nshards; i++)
+    {
+        shard = &store->shards[i];
+        do
+        {
+            pthread_mutex_lock(&shard->lock);
+            kv_wheel_advance(&shard->wheel, now);
+            for (n = 0; n < KV_EXPIRE_BATCH; n++)
+            {
+                if (kv_wheel_pop(&shard->wheel, &timer) != SUCCESS)
+                    break;
+                table = &shard->cur;
+                slot = kv_table_find_expired(store, table, timer.hash);
+                if (NULL == slot)
+                {
+                    table = &shard->old;
+                    slot = kv_table_find_expired(store, table, timer.hash);
+                }
+                /* stale timer: key deleted, evicted or set again*/
+                if (slot != NULL)
+                {
+                    kv_shard_drop_expired(store, shard, table, slot);
+                    dropped++;
+                }
+            }
+            more = (n == KV_EXPIRE_BATCH);
+            pthread_mutex_unlock(&shard->lock);
+        } while (more);
+    }
+    return dropped;
+}
+
+/*
+ * Function: kv_store_apply() - To replay one logged set
+ *   Unlike kv_store_load() the key may already exist and is replaced.
+ * in parameters:
+ *   store - key-value store, no journal set
+ *   key - key to be set
+ *   key_len - length of the key
+ *   value - value of the key
+ *   value_len - length of value
+ *   expire - unix time in seconds the key expires at, 0 = never
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_MAXLMT or FAILURE
+ */
+int kv_store_apply(struct kv_store *store, const char *key, int key_len, const char *value,
+                   int value_len, uint32_t expire)
+{
+    /* expired since it was logged: any older value must go as well*/
+    if (expire != 0 && expire <= store->clock)
+    {
+        del_entry(store, key, key_len);
+        return SUCCESS;
+    }
+    return kv_store_put(store, key, key_len, value, value_len, expire, 0, NULL);
+}
+
+/*
+ * Function: kv_store_reserve() - To size empty tables for a bulk load
+ * in parameters:
+ *   store - empty key-value store
+ *   count - number of entries about to be loaded
+ *
+ * return:
+ *   void
+ */
+void kv_store_reserve(struct kv_store *store, size_t count)
+{
+    struct kv_shard *shard;
+    struct kv_table table;
+    size_t per_shard = count / store->nshards + 1;
+    size_t nslots = KV_INIT_SLOTS;
+    unsigned int i;
+
+    /* load factor 1/2 after the load, no resize while loading*/
+    while (nslots < per_shard * 2)
+        nslots *= 2;
+
+    for (i = 0; i < store->nshards; i++)
+    {
+        shard = &store->shards[i];
+        if (shard->count != 0 || nslots <= shard->cur.mask + 1)
+            continue;
+        if (kv_table_alloc(&table, nslots) != SUCCESS)
+            continue;
+        kv_table_free(&shard->cur);
+        shard->cur = table;
+    }
+}
+
+/*
+ * Function: kv_store_for_each() - To visit every item of the store
+ * in parameters:
+ *   store - key-value store, caller holds all shard locks or is the
+ *           only thread (forked snapshot child)
+ *   fn - called once per item
+ *   arg - passed to fn
+ *
+ * return:
+ *   void
+ */
+void kv_store_for_each(struct kv_store *store, void (*fn)(void *arg, const struct kv_item *item),
+                       void *arg)
+{
+    struct kv_shard *shard;
+    struct kv_table *tables[2];
+    struct kv_slot *slot;
+    unsigned int n;
+    size_t i;
+    int t;
+
+    for (n = 0; n < store->nshards; n++)
+    {
+        shard = &store->shards[n];
+        tables[0] = &shard->cur;
+        tables[1] = &shard->old;
+
+        for (t = 0; t < 2; t++)
+        {
+            if (NULL == tables[t]->slots)
+                continue;
+            for (i = 0; i <= tables[t]->mask; i++)
+            {
+                slot = &tables[t]->slots[i];
+                if (SLOT_LIVE(slot))
+                    fn(arg, slot->item);
+            }
+        }
+    }
+}
+
+/*
+ * Function: kv_store_clear() - To delete every key while serving
+ *   One shard at a time, every key is logged as deleted. A replica
+ *   empties its store this way before it takes a full copy.
+ * in parameters:
+ *   store - key-value store
+ *
+ * return:
+ *   number of keys deleted
+ */
+size_t kv_store_clear(struct kv_store *store)
+{
+    struct kv_shard *shard;
+    struct kv_table *tables[2];
+    struct kv_slot *slot;
+    size_t deleted = 0;
+    unsigned int n;
+    size_t i;
+    int t;
+
+    for (n = 0; n < store->nshards; n++)
+    {
+        shard = &store->shards[n];
+        pthread_mutex_lock(&shard->lock);
+        tables[0] = &shard->cur;
+        tables[1] = &shard->old;
+        for (t = 0; t < 2; t++)
+        {
+            if (NULL == tables[t]->slots)
+                continue;
+            for (i = 0; i <= tables[t]->mask; i++)
+            {
+                slot = &tables[t]->slots[i];
+                if (!SLOT_LIVE(slot))
+                    continue;
+                if (store->journal != NULL)
+                    store->journal(store->journal_arg, KV_MUT_DEL, ITEM_KEY(slot->item),
+                                   slot->item->key_len, NULL, 0, 0);
+                kv_shard_remove(store, shard, tables[t], slot);
+                deleted++;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return deleted;
+}
+
+/*
+ * Function: kv_store_lock_all() - To stop all writers, e.g. around fork
+ * in parameters:
+ *   store - key-value store
+ *
+ * return:
+ *   void
+ */
+void kv_store_lock_all(struct kv_store *store)
+{
+    unsigned int i;
+
+    for (i = 0; i < store->nshards; i++)
+        pthread_mutex_lock(&store->shards[i].lock);
+}
+
+void kv_store_unlock_all(struct kv_store *store)
+{
+    unsigned int i;
+
+    for (i = 0; i < store->nshards; i++)
+        pthread_mutex_unlock(&store->shards[i].lock);
+}
+
+/* Function: kv_store_usage() - To read the store size without locking
+ * in parameters:
+ *   store - key-value store
+ *   usage - filled with the sizes
+ *
+ * return:
+ *   void
+ */
+void kv_store_usage(struct kv_store *store, struct kv_usage *usage)
+{
+    unsigned int i;
+
+    memset(usage, 0, sizeof(*usage));
+    usage->keys = __atomic_load_n(&store->count, __ATOMIC_RELAXED);
+    usage->memory = __atomic_load_n(&store->memory, __ATOMIC_RELAXED);
+    for (i = 0; i < store->nshards; i++)
+    {
+        usage->bytes += __atomic_load_n(&store->shards[i].bytes, __ATOMIC_RELAXED);
+        usage->evictions += __atomic_load_n(&store->shards[i].evictions, __ATOMIC_RELAXED);
+        usage->expired += __atomic_load_n(&store->shards[i].expired, __ATOMIC_RELAXED);
+    }
+}
+
+/* Function: kv_store_set_limits() - To bound memory and pick the eviction policy
+ * in parameters:
+ *   store - key-value store, no worker may be running
+ *   max_memory - max slab chunk bytes of all items, 0 for no limit
+ *   evict - KV_EVICT_NONE or KV_EVICT_CLOCK
+ *
+ * return:
+ *   void
+ */
+void kv_store_set_limits(struct kv_store *store, size_t max_memory, int evict)
+{
+    store->max_memory = max_memory;
+    store->evict = evict;
+}
+
+/* Function: kv_store_set_journal() - To install the mutation hook
+ * in parameters:
+ *   store - key-value store, no worker may be running
+ *   fn - hook, NULL to stop journaling
+ *   arg - passed to fn
+ *
+ * return:
+ *   void
+ */
+void kv_store_set_journal(struct kv_store *store, kv_journal_fn fn, void *arg)
+{
+    store->journal = fn;
+    store->journal_arg = arg;
+}
+
+/* Function: kv_store_set_probe() - To choose the key lookup version
+ * in parameters:
+ *   store - key-value store, no worker may be running
+ *   probe - KV_PROBE_*, see kv_probe.h
+ *
+ * return:
+ *   status - FAILURE when the CPU cannot run that version
+ */
+int kv_store_set_probe(struct kv_store *store, int probe)
+{
+    kv_probe_fn fn = kv_probe_select(probe);
+
+    if (NULL == fn)
+        return FAILURE;
+    store->probe = fn;
+    store->probe_impl = (probe == KV_PROBE_AUTO) ? kv_probe_best() : probe;
+    return SUCCESS;
+}
+
+/* Function: kv_store_set_ordered() - To keep keys in the ordered indexes
+ *   Needed by kv_store_scan(), costs an index update on every insert
+ *   and delete.
+ * in parameters:
+ *   store - empty key-value store, no worker may be running
+ *   ordered - 1 to index keys, 0 not to
+ *
+ * return:
+ *   void
+ */
+void kv_store_set_ordered(struct kv_store *store, int ordered)
+{
+    store->ordered = ordered;
+}
+
+/*
+ * Function: kv_store_scan() - To list the keys of a range in order
+ *   Every shard indexes its own keys, so each one is walked from the
+ *   start of the range in turn, under its own lock, and merged into a
+ *   page kept sorted. A shard's walk stops at the end of the range or
+ *   once its keys sort past the last key of a full page, a shard is
+ *   never locked for more than one page of keys. Expired keys are
+ *   skipped. Keys are copied out, the page stays valid without locks
+ *   but is not a snapshot: keys written meanwhile may or may not show.
+ * in parameters:
+ *   store - ordered key-value store
+ *   range - keys to list
+ *   keys - max pointers to key buffers, reordered so the first ones
+ *          point to the keys found, in order
+ *   max - page size, at least 1
+ *
+ * return:
+ *   number of keys found, max when there may be more; FAILURE when
+ *   the store keeps no index
+ */
+int kv_store_scan(struct kv_store *store, const struct kv_scan_range *range,
+                  struct kv_scan_key **keys, int max)
+{
+    struct kv_shard *shard;
+    struct kv_index_iter iter;
+    struct kv_scan_key *key;
+    struct kv_item *item;
+    uint32_t now = __atomic_load_n(&store->clock, __ATOMIC_RELAXED);
+    unsigned int i;
+    int n = 0;
+    int lo, hi, mid;
+
+    if (!store->ordered)
+        return FAILURE;
+
+    for (i = 0; i < store->nshards; i++)
+    {
+        shard = &store->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        kv_index_seek(&shard->index, range->from, range->from_len, range->after, &iter);
+        while ((item = kv_index_next(&iter)) != NULL)
+        {
+            if (range->to != NULL &&
+                kv_index_compare(ITEM_KEY(item), item->key_len, range->to, range->to_len) >= 0)
+                break;
+            if (n == max &&
+                kv_index_compare(ITEM_KEY(item), item->key_len, keys[n - 1]->key, keys[n - 1]->len) >= 0)
+                break;
+            if (item->expire != 0 && item->expire <= now)
+                continue;
+
+            /* keys of different shards never tie*/
+            lo = 0;
+            hi = n;
+            while (lo < hi)
+            {
+                mid = (lo + hi) / 2;
+                if (kv_index_compare(keys[mid]->key, keys[mid]->len, ITEM_KEY(item), item->key_len) < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            /* a full page drops its last key, its buffer takes the new one*/
+            if (n < max)
+                n++;
+            key = keys[n - 1];
+            memmove(&keys[lo + 1], &keys[lo], (n - 1 - lo) * sizeof(keys[0]));
+            keys[lo] = key;
+            memcpy(key->key, ITEM_KEY(item), item->key_len);
+            key->len = item->key_len;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return n;
+}
+
+/*
+ * Function: del_entry() - To find the if a key-value pair exists
+ * in parameters:
+ *   store - key-value store
+ *   key - key value to be found in db
+ *   length - length of the key
+ *
+ * return:
+ *   status - status of the operation
+ */
+int del_entry(struct kv_store *store, const char *key, int length)
+{
+    uint64_t hash = kv_hash(key, length);
+    struct kv_shard *shard = kv_get_shard(store, hash);
+    struct kv_table *table;
+    struct kv_slot *slot;
+    int status = FAILURE;
+
+    slot = kv_shard_lookup(store, shard, hash, key, length, &table);
+    if (slot != NULL)
+    {
+        if (store->journal != NULL)
+            store->journal(store->journal_arg, KV_MUT_DEL, key, length, NULL, 0, 0);
+        kv_shard_remove(store, shard, table, slot);
+        status = SUCCESS;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+/* Function: kv_store_slab_stats() - To add up slab usage of all shards
+ * in parameters:
+ *   store - key-value store
+ *   stats - filled with the totals
+ *
+ * return:
+ *   void
+ */
+void kv_store_slab_stats(struct kv_store *store, struct kv_slab_stats *stats)
+{
+    unsigned int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < store->nshards; i++)
+    {
+        pthread_mutex_lock(&store->shards[i].lock);
+        kv_slab_get_stats(&store->shards[i].slab, stats);
+        pthread_mutex_unlock(&store->shards[i].lock);
+    }
+}
+
+/*
+ * Function: del_all_entry() - Free all allocated mem to avoid memleak
+ * in parameters:
+ *   store - key-value store
+ *
+ * return:
+ *   void
+ */
+void del_all_entry(struct kv_store *store)
+{
+    struct kv_shard *shard;
+    unsigned int n;
+
+    for (n = 0; n < store->nshards; n++)
+    {
+        shard = &store->shards[n];
+        kv_table_free(&shard->cur);
+        kv_table_free(&shard->old);
+        kv_wheel_free(&shard->wheel);
+        kv_index_free(&shard->index);
+        /* items live in slab pages, released in one go*/
+        kv_slab_destroy(&shard->slab);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(store->shards);
+    memset(store, 0, sizeof(*store));
+}
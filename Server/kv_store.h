@@ -0,0 +1,210 @@
+/* kv_store.h
+ *
+ * Key-value store of the UDP Server
+ * - Open-addressing hash table with linear probing
+ * - Each slot keeps the key hash and key length inline so that a
+ *   probe only touches key memory when hash and length already match
+ * - A control byte per slot holds a 7-bit tag of the hash, lookups
+ *   test a group of tags at once with SSE2 or AVX2 (kv_probe.h)
+ * - Table grows incrementally: a bigger table is allocated and slots
+ *   are migrated a few at a time on every operation, so no single
+ *   request pays for rehashing the whole store
+ * - Key and value live in one item carved from the slab allocator,
+ *   an overwrite reuses the item when the new value fits its chunk
+ * - find_entry() pins the item instead of copying the value out, the
+ *   Server sends straight from it; an item deleted or overwritten
+ *   while pinned is freed by the last release_entry()
+ * - Keys are spread over lock-striped shards by hash, each shard owns
+ *   its table and slab so worker threads rarely contend
+ * - A key may carry an expiry time: an expired key is dropped when it
+ *   is next accessed, or by kv_store_expire() when the timing wheel of
+ *   its shard reaches it
+ * - Optionally each shard also keeps its keys in an ordered index
+ *   (kv_index.h); kv_store_scan() merges the shards' ranges into one
+ *   sorted page
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_STORE_H
+#define KV_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "kv_slab.h"
+#include "kv_wheel.h"
+#include "kv_index.h"
+
+/* return status codes*/
+#define FAILURE -1
+#define ENTRY_EXIST 1
+#define ENTRY_MAXLMT 2
+#define ENTRY_NOEXIST 3
+#define SUCCESS 0
+
+/* Due timers handled per shard lock hold by kv_store_expire()*/
+#define KV_EXPIRE_BATCH 256
+
+/* Initial number of slots, must be a power of 2*/
+#define KV_INIT_SLOTS 1024
+
+/* Max length of key and value, an item must fit in one slab page*/
+#define KV_MAX_KEY 256
+#define KV_MAX_VALUE (1000 * 1024)
+
+/* Longest ttl in seconds, 10 years*/
+#define KV_MAX_TTL (10U * 365 * 24 * 3600)
+
+/* key-value item: "key\0value\0" stored right after the header*/
+struct kv_item{
+    uint64_t version;   /* new on every write, the cas token*/
+    uint32_t key_len;
+    uint32_t value_len;
+    uint32_t expire;    /* unix time in seconds, 0 = never*/
+    uint32_t refs;      /* pins by find_entry(), KV_ITEM_UNLINKED once
+                           the store dropped the item*/
+    char data[];
+};
+
+#define KV_ITEM_UNLINKED 0x80000000U
+
+#define ITEM_KEY(it)   ((it)->data)
+#define ITEM_VALUE(it) ((it)->data + (it)->key_len + 1)
+#define ITEM_SIZE(key_len, value_len) \
+    (sizeof(struct kv_item) + (key_len) + 1 + (value_len) + 1)
+
+/* slot meta bits*/
+#define KV_META_REF 0x1     /* CLOCK reference bit, set on insert and get*/
+
+/* eviction policies*/
+#define KV_EVICT_NONE  0    /* full store answers ENTRY_MAXLMT*/
+#define KV_EVICT_CLOCK 1    /* full store evicts unreferenced keys*/
+
+/* slot in the hash table, item == NULL means slot never used*/
+struct kv_slot{
+    uint64_t hash;
+    uint32_t key_len;
+    uint32_t meta;
+    struct kv_item *item;
+};
+
+/* one generation of the hash table*/
+struct kv_table{
+    struct kv_slot *slots;
+    uint8_t *ctrl;      /* control byte per slot, see kv_probe.h*/
+    size_t mask;        /* number of slots - 1*/
+    size_t used;        /* live entries*/
+    size_t tombstones;  /* deleted entries still in probe chains*/
+};
+
+/* key lookup in one table, the versions are in kv_probe.c*/
+typedef struct kv_slot *(*kv_probe_fn)(const struct kv_table *table, uint64_t hash,
+                                       const char *key, size_t length);
+
+/* shard = current table + old table while a resize is in progress*/
+struct kv_shard{
+    pthread_mutex_t lock;
+    struct kv_table cur;
+    struct kv_table old;
+    size_t rehash_idx;  /* next slot of old table to migrate*/
+    size_t count;
+    size_t bytes;       /* key and value bytes of the items*/
+    size_t clock_hand;  /* next slot of cur table the eviction looks at*/
+    uint64_t evictions;
+    uint64_t expired;
+    uint64_t version;   /* last item version given out, per shard is
+                           enough: a key never leaves its shard*/
+    struct kv_wheel wheel;
+    struct kv_index index;  /* empty unless the store is ordered*/
+    struct kv_slab slab;
+} __attribute__((aligned(64)));
+
+/* mutation kinds passed to the journal hook*/
+#define KV_MUT_SET 1
+#define KV_MUT_DEL 2
+
+/* called for every applied mutation while the shard lock is held, so
+   the journal sees the mutations of one key in the order they were
+   applied; value is NULL for KV_MUT_DEL, expire is the item's expiry
+   time for KV_MUT_SET*/
+typedef void (*kv_journal_fn)(void *arg, int op, const char *key, int key_len,
+                              const char *value, int value_len, uint32_t expire);
+
+struct kv_store{
+    struct kv_shard *shards;
+    unsigned int nshards;   /* power of 2*/
+    size_t max_entries;
+    size_t count;           /* keys in all shards, updated atomically*/
+    size_t max_memory;      /* slab chunk bytes of all items, 0 = no limit*/
+    size_t memory;          /* updated atomically*/
+    int evict;              /* KV_EVICT_* */
+    int ordered;            /* keys kept in the shard indexes as well*/
+    uint32_t clock;         /* unix time in seconds, see kv_store_expire()*/
+    kv_probe_fn probe;      /* best the CPU runs, see kv_store_set_probe()*/
+    int probe_impl;         /* KV_PROBE_* of probe*/
+    kv_journal_fn journal;  /* NULL when nothing is logged*/
+    void *journal_arg;
+};
+
+/* sizes reported by kv_store_usage()*/
+struct kv_usage{
+    size_t keys;
+    size_t bytes;           /* key and value bytes*/
+    size_t memory;          /* slab chunk bytes of the items*/
+    uint64_t evictions;
+    uint64_t expired;
+};
+
+/* key range of kv_store_scan()*/
+struct kv_scan_range{
+    const char *from;       /* lowest key, "" for the start of the store*/
+    int from_len;
+    int after;              /* from itself is left out, a page cursor*/
+    const char *to;         /* keys sort before it, NULL for no end*/
+    int to_len;
+};
+
+/* one key returned by kv_store_scan()*/
+struct kv_scan_key{
+    int len;
+    char key[KV_MAX_KEY];
+};
+
+/* Function prototypes */
+int kv_store_init(struct kv_store *store, unsigned int nshards, size_t max_entries);
+int find_entry(struct kv_store *store, const char *key, int length, const struct kv_item **item);
+void release_entry(struct kv_store *store, const struct kv_item *item);
+int add_entry(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+              uint32_t ttl);
+int put_entry(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+              uint32_t ttl, uint64_t expect, uint64_t *version);
+int incr_entry(struct kv_store *store, const char *key, int key_len, uint64_t delta, int decr,
+               uint64_t *result);
+int append_entry(struct kv_store *store, const char *key, int key_len, const char *value,
+                 int value_len, uint64_t *version);
+int del_entry(struct kv_store *store, const char *key, int length);
+void del_all_entry(struct kv_store *store);
+size_t kv_store_clear(struct kv_store *store);
+void kv_store_slab_stats(struct kv_store *store, struct kv_slab_stats *stats);
+int kv_store_load(struct kv_store *store, const char *key, int key_len, const char *value, int value_len,
+                  uint32_t expire);
+int kv_store_apply(struct kv_store *store, const char *key, int key_len, const char *value,
+                   int value_len, uint32_t expire);
+size_t kv_store_expire(struct kv_store *store, uint32_t now);
+void kv_store_reserve(struct kv_store *store, size_t count);
+void kv_store_for_each(struct kv_store *store, void (*fn)(void *arg, const struct kv_item *item),
+                       void *arg);
+void kv_store_lock_all(struct kv_store *store);
+void kv_store_usage(struct kv_store *store, struct kv_usage *usage);
+void kv_store_set_limits(struct kv_store *store, size_t max_memory, int evict);
+void kv_store_set_journal(struct kv_store *store, kv_journal_fn fn, void *arg);
+void kv_store_set_ordered(struct kv_store *store, int ordered);
+int kv_store_set_probe(struct kv_store *store, int probe);
+int kv_store_scan(struct kv_store *store, const struct kv_scan_range *range,
+                  struct kv_scan_key **keys, int max);
+void kv_store_unlock_all(struct kv_store *store);
+
+#endif /* KV_STORE_H */
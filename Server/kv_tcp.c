@@ -0,0 +1,484 @@
+/* kv_tcp.c
+ *
+ * TCP event loop, see kv_tcp.h
+ *
+ * Every connection is registered once for input and output, edge
+ * triggered. An event of any kind runs the connection: read until
+ * the socket is drained (or the output backs up), run the complete
+ * frames, write until the socket is full. Output space coming back
+ * raises the next edge, which resumes a connection that stopped
+ * reading.
+ *
+ * Author: Kapil
+ *
+ */
+
+#define _GNU_SOURCE     /* accept4*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "kv_tcp.h"
+#include "kv_log.h"
+#include "kv_store.h"
+#include "../Common/kv_proto.h"
+#include "../Common/kv_hist.h"
+
+/* longest frame*/
+#define KV_TCP_FRAME_MAX (KV_PROTO_FRAME_LEN + KV_PROTO_MAX_DATAGRAM)
+
+struct kv_tcp_conn{
+    int fd;
+    struct sockaddr_in addr;
+    char *in;                           /* frames read, the last maybe partial*/
+    uint32_t in_len;
+    uint32_t in_cap;
+    char *out;                          /* framed replies, sent from out_off*/
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+    int paused;                         /* output backed up, input left unread*/
+    int eof;                            /* client closed its side*/
+    struct kv_tcp_conn *prev;
+    struct kv_tcp_conn *next;
+};
+
+/* Function: kv_tcp_listen() - To create a non-blocking TCP listener
+ * in parameters:
+ *   addr - address to listen on
+ *   reuseport - set SO_REUSEPORT so every loop listens on the port
+ *
+ * return:
+ *   socket, FAILURE on error
+ */
+int kv_tcp_listen(const struct sockaddr_in *addr, int reuseport)
+{
+    int one = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return FAILURE;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+        bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0)
+    {
+        close(fd);
+        return FAILURE;
+    }
+    return fd;
+}
+
+/* Function: kv_tcp_init() - To set up a loop on a listener
+ * in parameters:
+ *   loop - loop to fill
+ *   listenfd - socket from kv_tcp_listen(), stays the caller's
+ *   handler - runs the requests
+ *   stats - stats of the thread that will run the loop
+ *
+ * return:
+ *   status - SUCCESS or FAILURE
+ */
+int kv_tcp_init(struct kv_tcp_loop *loop, int listenfd, const struct kv_tcp_handler *handler,
+                struct kv_stats *stats)
+{
+    struct epoll_event ev;
+
+    memset(loop, 0, sizeof(*loop));
+    loop->listenfd = listenfd;
+    loop->handler = *handler;
+    loop->stats = stats;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epfd < 0 || loop->wakefd < 0)
+        goto fail;
+
+    /* the listener and the wakeup are told apart by these addresses*/
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &loop->listenfd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+        goto fail;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->wakefd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0)
+        goto fail;
+    return SUCCESS;
+
+fail:
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    if (loop->wakefd >= 0)
+        close(loop->wakefd);
+    loop->epfd = loop->wakefd = -1;
+    return FAILURE;
+}
+
+static void kv_tcp_close(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn)
+{
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        loop->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    loop->num_conns--;
+    KV_HIST_ADD(loop->stats->tcp_closed, 1);
+
+    /* closing drops it from the epoll set*/
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static void kv_tcp_accept(struct kv_tcp_loop *loop)
+{
+    struct kv_tcp_conn *conn;
+    struct epoll_event ev;
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int one = 1;
+    int fd;
+
+    /* edge triggered: take every pending connection*/
+    while (1)
+    {
+        addr_len = sizeof(addr);
+        KV_HIST_ADD(loop->stats->io_syscalls, 1);
+        fd = accept4(loop->listenfd, (struct sockaddr *)&addr, &addr_len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (EMFILE == errno || ENFILE == errno)
+                KV_LOG(KV_LOG_WARN, "TCP accept: %s", strerror(errno));
+            else if (EINTR == errno || ECONNABORTED == errno)
+                continue;
+            return;
+        }
+
+        conn = NULL;
+        if (loop->num_conns < KV_TCP_MAX_CONNS)
+            conn = calloc(1, sizeof(*conn));
+        if (NULL == conn)
+        {
+            KV_LOG(KV_LOG_WARN, "TCP connection refused, %d open", loop->num_conns);
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->fd = fd;
+        conn->addr = addr;
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = loop->conns;
+        if (loop->conns != NULL)
+            loop->conns->prev = conn;
+        loop->conns = conn;
+        loop->num_conns++;
+        KV_HIST_ADD(loop->stats->tcp_accepted, 1);
+    }
+}
+
+/* Function: kv_tcp_reserve() - To make room for more output
+ *   Sent bytes are dropped from the front before the buffer grows.
+ */
+static int kv_tcp_reserve(struct kv_tcp_conn *conn, size_t need)
+{
+    size_t cap = conn->out_cap ? conn->out_cap : KV_TCP_BUF;
+    char *out;
+
+    if (conn->out_off > 0 && conn->out_len + need > conn->out_cap)
+    {
+        memmove(conn->out, conn->out + conn->out_off, conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+    if (conn->out_len + need <= conn->out_cap)
+        return SUCCESS;
+
+    while (cap < conn->out_len + need)
+        cap *= 2;
+    out = realloc(conn->out, cap);
+    if (NULL == out)
+        return FAILURE;
+    conn->out = out;
+    conn->out_cap = cap;
+    return SUCCESS;
+}
+
+/* Function: kv_tcp_reply() - To run one frame and queue its reply
+ * in parameters:
+ *   loop - loop of the connection
+ *   conn - connection
+ *   req - frame body
+ *   len - length of req
+ *
+ * return:
+ *   status - SUCCESS or FAILURE when out of memory or the handler
+ *   wants the connection closed
+ */
+static int kv_tcp_reply(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn, char *req,
+                        uint32_t len)
+{
+    struct kv_io_reply reply;
+    size_t total = 0;
+    char *p;
+    int status = SUCCESS;
+    int i;
+
+    status = loop->handler.request(loop->handler.arg, &conn->addr, req, len, &reply);
+    if (status < 0)
+        return (-2 == status) ? FAILURE : SUCCESS;
+
+    for (i = 0; i < reply.iovcnt; i++)
+        total += reply.iov[i].iov_len;
+    if (kv_tcp_reserve(conn, KV_PROTO_FRAME_LEN + total) == SUCCESS)
+    {
+        p = conn->out + conn->out_len;
+        kv_proto_put_u32((unsigned char *)p, total);
+        p += KV_PROTO_FRAME_LEN;
+        for (i = 0; i < reply.iovcnt; i++)
+        {
+            memcpy(p, reply.iov[i].iov_base, reply.iov[i].iov_len);
+            p += reply.iov[i].iov_len;
+        }
+        conn->out_len = p - conn->out;
+    }
+    else
+    {
+        status = FAILURE;
+    }
+    loop->handler.release(loop->handler.arg);
+    return status;
+}
+
+/* Function: kv_tcp_frames() - To run the complete frames read so far
+ *   Stops early once the output backs up, the rest waits in the
+ *   input buffer.
+ * return:
+ *   status - SUCCESS or FAILURE on a malformed frame
+ */
+static int kv_tcp_frames(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn)
+{
+    struct kv_proto_cursor c;
+    uint32_t off = 0;
+    uint32_t len;
+    uint32_t need;
+    char *in;
+
+    while (conn->in_len - off >= KV_PROTO_FRAME_LEN)
+    {
+        kv_proto_cursor_init(&c, conn->in + off, KV_PROTO_FRAME_LEN);
+        len = kv_proto_get_u32(&c);
+        if (len > KV_PROTO_MAX_DATAGRAM)
+            return FAILURE;
+        if (conn->in_len - off - KV_PROTO_FRAME_LEN < len)
+            break;
+        if (kv_tcp_reply(loop, conn, conn->in + off + KV_PROTO_FRAME_LEN, len) != SUCCESS)
+            return FAILURE;
+        off += KV_PROTO_FRAME_LEN + len;
+        if (conn->out_len - conn->out_off > KV_TCP_OUT_MAX)
+        {
+            conn->paused = 1;
+            break;
+        }
+    }
+
+    memmove(conn->in, conn->in + off, conn->in_len - off);
+    conn->in_len -= off;
+
+    /* a partial frame must fit*/
+    if (conn->in_len >= KV_PROTO_FRAME_LEN)
+    {
+        kv_proto_cursor_init(&c, conn->in, KV_PROTO_FRAME_LEN);
+        need = KV_PROTO_FRAME_LEN + kv_proto_get_u32(&c);
+        if (need > conn->in_cap && need <= KV_TCP_FRAME_MAX)
+        {
+            in = realloc(conn->in, need);
+            if (NULL == in)
+                return FAILURE;
+            conn->in = in;
+            conn->in_cap = need;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_tcp_read() - To read and run requests until the socket is drained
+ * return:
+ *   status - SUCCESS or FAILURE when the connection is to be closed
+ */
+static int kv_tcp_read(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn)
+{
+    ssize_t n;
+
+    if (NULL == conn->in)
+    {
+        conn->in = malloc(KV_TCP_BUF);
+        if (NULL == conn->in)
+            return FAILURE;
+        conn->in_cap = KV_TCP_BUF;
+    }
+
+    while (!conn->paused && !conn->eof)
+    {
+        KV_HIST_ADD(loop->stats->io_syscalls, 1);
+        n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n > 0)
+        {
+            conn->in_len += n;
+            if (kv_tcp_frames(loop, conn) != SUCCESS)
+                return FAILURE;
+        }
+        else if (0 == n)
+        {
+            conn->eof = 1;
+        }
+        else if (EAGAIN == errno || EWOULDBLOCK == errno)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Function: kv_tcp_write() - To write queued replies until the socket is full
+ * return:
+ *   status - SUCCESS or FAILURE when the connection is to be closed
+ */
+static int kv_tcp_write(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn)
+{
+    ssize_t n;
+
+    while (conn->out_off < conn->out_len)
+    {
+        KV_HIST_ADD(loop->stats->io_syscalls, 1);
+        n = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off,
+                 MSG_NOSIGNAL);
+        if (n >= 0)
+            conn->out_off += n;
+        else if (EAGAIN == errno || EWOULDBLOCK == errno)
+            break;
+        else if (errno != EINTR)
+            return FAILURE;
+    }
+    if (conn->out_off == conn->out_len)
+        conn->out_off = conn->out_len = 0;
+    return SUCCESS;
+}
+
+/* Function: kv_tcp_service() - To run a connection after an event
+ *   Closes it on error or once the client closed and got every reply.
+ */
+static void kv_tcp_service(struct kv_tcp_loop *loop, struct kv_tcp_conn *conn, uint32_t events)
+{
+    if (events & EPOLLERR)
+    {
+        kv_tcp_close(loop, conn);
+        return;
+    }
+
+    while (1)
+    {
+        if (kv_tcp_read(loop, conn) != SUCCESS)
+        {
+            kv_tcp_close(loop, conn);
+            return;
+        }
+        /* with --aof-fsync always the mutations are on disk before
+           they are acknowledged*/
+        if (conn->out_len > conn->out_off)
+            loop->handler.commit(loop->handler.arg);
+        if (kv_tcp_write(loop, conn) != SUCCESS)
+        {
+            kv_tcp_close(loop, conn);
+            return;
+        }
+        /* no edge comes for input that arrived while paused*/
+        if (conn->paused && conn->out_len - conn->out_off <= KV_TCP_OUT_MAX)
+        {
+            conn->paused = 0;
+            if (kv_tcp_frames(loop, conn) != SUCCESS)
+            {
+                kv_tcp_close(loop, conn);
+                return;
+            }
+            continue;
+        }
+        break;
+    }
+
+    if (conn->eof && conn->out_len == conn->out_off)
+        kv_tcp_close(loop, conn);
+}
+
+/* Function: kv_tcp_run() - To serve connections until kv_tcp_stop()
+ * in parameters:
+ *   loop - loop set up by kv_tcp_init()
+ *
+ * return:
+ *   void
+ */
+void kv_tcp_run(struct kv_tcp_loop *loop)
+{
+    struct epoll_event events[KV_TCP_EVENTS];
+    int num_events;
+    int i;
+
+    while (!loop->stop)
+    {
+        KV_HIST_ADD(loop->stats->io_syscalls, 1);
+        num_events = epoll_wait(loop->epfd, events, KV_TCP_EVENTS, -1);
+        for (i = 0; i < num_events; i++)
+        {
+            if (events[i].data.ptr == &loop->listenfd)
+                kv_tcp_accept(loop);
+            else if (events[i].data.ptr == &loop->wakefd)
+                loop->stop = 1;
+            else
+                kv_tcp_service(loop, events[i].data.ptr, events[i].events);
+        }
+    }
+}
+
+/* Function: kv_tcp_stop() - To make kv_tcp_run() return
+ *   Safe from any thread, the loop finishes the events it holds.
+ */
+void kv_tcp_stop(struct kv_tcp_loop *loop)
+{
+    uint64_t one = 1;
+
+    if (loop->wakefd >= 0 && write(loop->wakefd, &one, sizeof(one)) < 0)
+        KV_LOG(KV_LOG_ERROR, "TCP loop wakeup failed: %s", strerror(errno));
+}
+
+/* Function: kv_tcp_free() - To close every connection of a stopped loop
+ *   Replies still queued are dropped.
+ */
+void kv_tcp_free(struct kv_tcp_loop *loop)
+{
+    while (loop->conns != NULL)
+        kv_tcp_close(loop, loop->conns);
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    if (loop->wakefd >= 0)
+        close(loop->wakefd);
+    loop->epfd = loop->wakefd = -1;
+}
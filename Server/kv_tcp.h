@@ -0,0 +1,72 @@
+/* kv_tcp.h
+ *
+ * TCP transport of the Server, next to the UDP workers
+ * - Requests and replies are framed by a u32 length
+ *   (KV_PROTO_FRAME_LEN, Common/kv_proto.h); inside a frame a command
+ *   is the same text or binary as in a datagram
+ * - A loop is one thread with an edge-triggered epoll set and its own
+ *   SO_REUSEPORT listener, the kernel spreads connections over loops
+ * - Connections are non-blocking and keep their own input and output
+ *   buffers. Every complete request read is run in order and the
+ *   replies go out together, so a client may pipeline requests
+ * - A connection with more than KV_TCP_OUT_MAX reply bytes not yet
+ *   taken by the client is not read until it catches up
+ * - Requests run through the same dispatcher as datagrams, given to
+ *   kv_tcp_init() as a handler; a reply value is copied into the
+ *   output buffer, so no item stays pinned while a client is slow
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_TCP_H
+#define KV_TCP_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "kv_io.h"
+#include "kv_stats.h"
+
+/* first size of a connection buffer, grown to the frames it holds*/
+#define KV_TCP_BUF 4096
+/* reply bytes pending on a connection before it stops being read*/
+#define KV_TCP_OUT_MAX (4 * 1024 * 1024)
+/* connections per loop*/
+#define KV_TCP_MAX_CONNS 65536
+/* events taken per epoll_wait*/
+#define KV_TCP_EVENTS 256
+
+struct kv_tcp_handler{
+    /* runs one request, reply points at the bytes to send; -1 when
+       nothing is to be sent, -2 to close the connection*/
+    int (*request)(void *arg, const struct sockaddr_in *from, char *req, int len,
+                   struct kv_io_reply *reply);
+    /* the reply of the last request was copied*/
+    void (*release)(void *arg);
+    /* called before the replies of a read are written*/
+    void (*commit)(void *arg);
+    void *arg;
+};
+
+struct kv_tcp_conn;
+
+struct kv_tcp_loop{
+    int epfd;
+    int listenfd;
+    int wakefd;                         /* eventfd, written by kv_tcp_stop()*/
+    int stop;
+    int num_conns;
+    struct kv_tcp_conn *conns;          /* list, for teardown*/
+    struct kv_tcp_handler handler;
+    struct kv_stats *stats;             /* of the loop thread*/
+};
+
+int kv_tcp_listen(const struct sockaddr_in *addr, int reuseport);
+int kv_tcp_init(struct kv_tcp_loop *loop, int listenfd, const struct kv_tcp_handler *handler,
+                struct kv_stats *stats);
+void kv_tcp_run(struct kv_tcp_loop *loop);
+void kv_tcp_stop(struct kv_tcp_loop *loop);
+void kv_tcp_free(struct kv_tcp_loop *loop);
+
+#endif /* KV_TCP_H */
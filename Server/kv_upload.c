@@ -0,0 +1,187 @@
+/* kv_upload.c
+ *
+ * Staging of chunked values, see kv_upload.h
+ *
+ * Chunked uploads are rare next to single datagram requests, one
+ * list under one mutex is shared by all workers.
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kv_upload.h"
+
+static pthread_mutex_t upload_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kv_upload *uploads;
+static int num_uploads;
+
+/* Function: kv_upload_expire() - To drop uploads idle for too long
+ *   Called with upload_lock held.
+ */
+static void kv_upload_expire(time_t now)
+{
+    struct kv_upload **link = &uploads;
+    struct kv_upload *upload;
+
+    while (*link != NULL)
+    {
+        upload = *link;
+        if (now - upload->last >= KV_UPLOAD_TIMEOUT)
+        {
+            *link = upload->next;
+            num_uploads--;
+            kv_upload_free(upload);
+        }
+        else
+        {
+            link = &upload->next;
+        }
+    }
+}
+
+/* Function: kv_upload_chunk() - To add one chunk to an upload
+ *   The chunk at offset 0 opens the upload, later ones must carry
+ *   the same key and total length and continue where the last one
+ *   ended.
+ * in parameters:
+ *   addr - client address
+ *   id - upload id chosen by the client
+ *   key - key the value is for
+ *   key_len - length of key
+ *   total - length of the whole value
+ *   offset - position of the chunk in the value
+ *   data - chunk bytes
+ *   len - length of the chunk
+ *   ttl - ttl of the key, used from the first chunk
+ *   received - set to the bytes received so far
+ *   done - set to the complete upload, detached from the list and to
+ *          be released with kv_upload_free(), NULL while incomplete
+ *
+ * return:
+ *   status - SUCCESS, ENTRY_MAXLMT when too many uploads are open or
+ *   FAILURE for a chunk that does not fit the upload
+ */
+int kv_upload_chunk(const struct sockaddr_in *addr, uint32_t id, const char *key, int key_len,
+                    uint32_t total, uint32_t offset, const char *data, uint32_t len,
+                    uint32_t ttl, uint32_t *received, struct kv_upload **done)
+{
+    struct kv_upload **link;
+    struct kv_upload *upload;
+    time_t now = time(NULL);
+    int status = SUCCESS;
+
+    *done = NULL;
+    if (key_len > KV_MAX_KEY || total > KV_MAX_VALUE || offset > total || len > total - offset)
+        return FAILURE;
+
+    pthread_mutex_lock(&upload_lock);
+    for (link = &uploads; *link != NULL; link = &(*link)->next)
+    {
+        upload = *link;
+        if (upload->id == id && upload->addr.sin_port == addr->sin_port &&
+            upload->addr.sin_addr.s_addr == addr->sin_addr.s_addr)
+            break;
+    }
+
+    if (NULL == *link)
+    {
+        if (offset != 0)
+        {
+            status = FAILURE;
+            goto out;
+        }
+        kv_upload_expire(now);
+        if (num_uploads >= KV_UPLOAD_MAX)
+        {
+            status = ENTRY_MAXLMT;
+            goto out;
+        }
+
+        upload = calloc(1, sizeof(*upload));
+        if (upload != NULL)
+            upload->value = malloc(total + 1);
+        if (NULL == upload || NULL == upload->value)
+        {
+            free(upload);
+            status = FAILURE;
+            goto out;
+        }
+        upload->addr = *addr;
+        upload->id = id;
+        upload->total = total;
+        upload->ttl = ttl;
+        upload->key_len = key_len;
+        memcpy(upload->key, key, key_len);
+        upload->next = uploads;
+        uploads = upload;
+        link = &uploads;
+        num_uploads++;
+    }
+
+    upload = *link;
+    if (upload->total != total || upload->key_len != key_len ||
+        memcmp(upload->key, key, key_len) != 0 || offset > upload->received)
+    {
+        status = FAILURE;
+        goto out;
+    }
+
+    /* a chunk ending at or before received is a retransmit*/
+    if (offset + len > upload->received)
+    {
+        memcpy(upload->value + offset, data, len);
+        upload->received = offset + len;
+    }
+    upload->last = now;
+    *received = upload->received;
+
+    if (upload->received == upload->total)
+    {
+        *link = upload->next;
+        num_uploads--;
+        *done = upload;
+    }
+
+out:
+    pthread_mutex_unlock(&upload_lock);
+    return status;
+}
+
+/* Function: kv_upload_free() - To release an upload
+ * in parameters:
+ *   upload - upload returned complete by kv_upload_chunk()
+ *
+ * return:
+ *   void
+ */
+void kv_upload_free(struct kv_upload *upload)
+{
+    if (NULL == upload)
+        return;
+    free(upload->value);
+    free(upload);
+}
+
+/* Function: kv_upload_clear() - To drop all open uploads at shutdown
+ *
+ * return:
+ *   void
+ */
+void kv_upload_clear(void)
+{
+    struct kv_upload *upload;
+
+    pthread_mutex_lock(&upload_lock);
+    while (uploads != NULL)
+    {
+        upload = uploads;
+        uploads = upload->next;
+        kv_upload_free(upload);
+    }
+    num_uploads = 0;
+    pthread_mutex_unlock(&upload_lock);
+}
@@ -0,0 +1,49 @@
+/* kv_upload.h
+ *
+ * Staging of values too big for one datagram (KV_OP_PUTCHUNK)
+ * - An upload is named by the client address and an upload id the
+ *   client picks, so uploads of different clients never mix
+ * - Chunks must come in order. A chunk already received (a client
+ *   retransmit) is acknowledged again without being applied twice
+ * - The value is assembled in one buffer sized by the first chunk
+ *   and handed back to the caller once complete, which stores it
+ *   with a single put
+ * - At most KV_UPLOAD_MAX uploads are open at once; an upload that
+ *   got no chunk for KV_UPLOAD_TIMEOUT seconds is dropped
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_UPLOAD_H
+#define KV_UPLOAD_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "kv_store.h"
+
+#define KV_UPLOAD_MAX     64
+#define KV_UPLOAD_TIMEOUT 10
+
+struct kv_upload{
+    struct sockaddr_in addr;
+    uint32_t id;
+    uint32_t total;         /* value length announced by every chunk*/
+    uint32_t received;      /* bytes in order so far*/
+    uint32_t ttl;           /* taken from the first chunk*/
+    time_t last;            /* time of the last chunk*/
+    int key_len;
+    char key[KV_MAX_KEY];
+    char *value;
+    struct kv_upload *next;
+};
+
+int kv_upload_chunk(const struct sockaddr_in *addr, uint32_t id, const char *key, int key_len,
+                    uint32_t total, uint32_t offset, const char *data, uint32_t len,
+                    uint32_t ttl, uint32_t *received, struct kv_upload **done);
+void kv_upload_free(struct kv_upload *upload);
+void kv_upload_clear(void);
+
+#endif /* KV_UPLOAD_H */
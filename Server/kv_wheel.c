@@ -0,0 +1,226 @@
+/* kv_wheel.c
+ *
+ * Hierarchical timing wheel, see kv_wheel.h
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kv_wheel.h"
+#include "kv_store.h"
+
+#define KV_WHEEL_MASK (KV_WHEEL_SLOTS - 1)
+/* seconds covered by all levels, later timers are clamped to it*/
+#define KV_WHEEL_SPAN ((uint32_t)1 << (KV_WHEEL_BITS * KV_WHEEL_LEVELS))
+
+static int kv_timer_append(struct kv_timer_list *list, const struct kv_timer *timer)
+{
+    struct kv_timer *timers;
+    uint32_t cap;
+
+    if (list->count == list->cap)
+    {
+        cap = list->cap ? list->cap * 2 : 16;
+        timers = realloc(list->timers, cap * sizeof(struct kv_timer));
+        if (NULL == timers)
+            return FAILURE;
+        list->timers = timers;
+        list->cap = cap;
+    }
+    list->timers[list->count++] = *timer;
+    return SUCCESS;
+}
+
+/* Function: kv_wheel_place() - To put a timer in the slot it expires from
+ * in parameters:
+ *   wheel - timing wheel
+ *   timer - timer to be placed
+ *
+ * return:
+ *   status - FAILURE when out of memory
+ */
+static int kv_wheel_place(struct kv_wheel *wheel, const struct kv_timer *timer)
+{
+    uint32_t when = timer->expire;
+    uint32_t delta;
+    int level;
+
+    if (when <= wheel->now)
+        return kv_timer_append(&wheel->due, timer);
+
+    /* smallest level whose turn covers the delay*/
+    delta = when - wheel->now;
+    for (level = 0; level < KV_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < (uint32_t)1 << (KV_WHEEL_BITS * (level + 1)))
+            break;
+    }
+    if (delta >= KV_WHEEL_SPAN)
+        when = wheel->now + KV_WHEEL_SPAN - 1;
+
+    return kv_timer_append(&wheel->slots[level][(when >> (KV_WHEEL_BITS * level)) & KV_WHEEL_MASK],
+                           timer);
+}
+
+/* Function: kv_wheel_cascade() - To spread a slot over the levels below
+ *   The slot list is detached first, timers placed back into the same
+ *   slot (clamped far timers) land in a fresh list.
+ */
+static void kv_wheel_cascade(struct kv_wheel *wheel, struct kv_timer_list *slot)
+{
+    struct kv_timer_list list = *slot;
+    uint32_t i;
+
+    memset(slot, 0, sizeof(*slot));
+    for (i = 0; i < list.count; i++)
+    {
+        /* out of memory drops the timer, lazy expiry still applies*/
+        if (kv_wheel_place(wheel, &list.timers[i]) != SUCCESS)
+            wheel->count--;
+    }
+
+    /* hand the array back when nothing was placed into it again*/
+    if (NULL == slot->timers)
+    {
+        list.count = 0;
+        *slot = list;
+    }
+    else
+    {
+        free(list.timers);
+    }
+}
+
+/* Function: kv_wheel_init() - To initialise an empty wheel
+ * in parameters:
+ *   wheel - timing wheel
+ *   now - current unix time in seconds
+ *
+ * return:
+ *   void
+ */
+void kv_wheel_init(struct kv_wheel *wheel, uint32_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+/* Function: kv_wheel_free() - To release all timers
+ * in parameters:
+ *   wheel - timing wheel
+ *
+ * return:
+ *   void
+ */
+void kv_wheel_free(struct kv_wheel *wheel)
+{
+    int level, i;
+
+    for (level = 0; level < KV_WHEEL_LEVELS; level++)
+    {
+        for (i = 0; i < KV_WHEEL_SLOTS; i++)
+            free(wheel->slots[level][i].timers);
+    }
+    free(wheel->due.timers);
+    memset(wheel, 0, sizeof(*wheel));
+}
+
+/* Function: kv_wheel_add() - To start a timer
+ * in parameters:
+ *   wheel - timing wheel
+ *   hash - hash of the key
+ *   expire - unix time in seconds the key expires at
+ *
+ * return:
+ *   status - status of the operation
+ */
+int kv_wheel_add(struct kv_wheel *wheel, uint64_t hash, uint32_t expire)
+{
+    struct kv_timer timer;
+
+    timer.hash = hash;
+    timer.expire = expire;
+    if (kv_wheel_place(wheel, &timer) != SUCCESS)
+        return FAILURE;
+    wheel->count++;
+    return SUCCESS;
+}
+
+/* Function: kv_wheel_advance() - To move the wheel forward to now
+ *   Each second first cascades the higher level slots starting a
+ *   new turn, highest first so a timer can fall through several
+ *   levels at once, then moves its level 0 slot to the due list.
+ * in parameters:
+ *   wheel - timing wheel
+ *   now - current unix time in seconds
+ *
+ * return:
+ *   void
+ */
+void kv_wheel_advance(struct kv_wheel *wheel, uint32_t now)
+{
+    struct kv_timer_list *slot;
+    struct kv_timer_list swap;
+    uint32_t i;
+    int level;
+
+    /* nothing to move, skip the idle seconds*/
+    if (wheel->count == 0 && now > wheel->now)
+        wheel->now = now;
+
+    while (wheel->now < now)
+    {
+        wheel->now++;
+        for (level = KV_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            if ((wheel->now & (((uint32_t)1 << (KV_WHEEL_BITS * level)) - 1)) == 0)
+                kv_wheel_cascade(wheel,
+                                 &wheel->slots[level][(wheel->now >> (KV_WHEEL_BITS * level)) &
+                                                      KV_WHEEL_MASK]);
+        }
+
+        slot = &wheel->slots[0][wheel->now & KV_WHEEL_MASK];
+        if (slot->count == 0)
+            continue;
+        if (wheel->due.count == 0)
+        {
+            /* swap instead of copying, the slot keeps the old due array*/
+            swap = wheel->due;
+            wheel->due = *slot;
+            *slot = swap;
+            continue;
+        }
+        for (i = 0; i < slot->count; i++)
+        {
+            if (kv_timer_append(&wheel->due, &slot->timers[i]) != SUCCESS)
+                wheel->count--;
+        }
+        slot->count = 0;
+    }
+}
+
+/* Function: kv_wheel_pop() - To take one due timer
+ * in parameters:
+ *   wheel - timing wheel
+ *   timer - filled with the timer
+ *
+ * return:
+ *   status - FAILURE when no timer is due
+ */
+int kv_wheel_pop(struct kv_wheel *wheel, struct kv_timer *timer)
+{
+    if (wheel->due.count == 0)
+        return FAILURE;
+
+    *timer = wheel->due.timers[--wheel->due.count];
+    wheel->count--;
+    if (wheel->due.count == 0 && wheel->due.cap > KV_WHEEL_KEEP)
+    {
+        free(wheel->due.timers);
+        memset(&wheel->due, 0, sizeof(wheel->due));
+    }
+    return SUCCESS;
+}
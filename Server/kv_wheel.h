@@ -0,0 +1,58 @@
+/* kv_wheel.h
+ *
+ * Hierarchical timing wheel driving key expiry
+ * - KV_WHEEL_LEVELS wheels of KV_WHEEL_SLOTS slots, one slot of level
+ *   L spans KV_WHEEL_SLOTS^L seconds, so the wheels reach about 194
+ *   days; later timers wait in the last level and are placed again
+ *   each time it turns
+ * - Adding a timer appends it to one slot. Every second one level 0
+ *   slot becomes due, and a higher level slot is spread over the
+ *   level below once per turn of that level, so a timer is moved at
+ *   most KV_WHEEL_LEVELS times whatever the number of timers
+ * - A timer is only the key hash and the expiry time, it holds no
+ *   pointer into the store: a key deleted, evicted or set again
+ *   before it expires leaves a stale timer that is dropped when due
+ * - Not thread safe, every store shard owns one wheel under its lock
+ *
+ * Author: Kapil
+ *
+ */
+
+#ifndef KV_WHEEL_H
+#define KV_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KV_WHEEL_BITS   6
+#define KV_WHEEL_SLOTS  (1 << KV_WHEEL_BITS)
+#define KV_WHEEL_LEVELS 4
+
+/* due list capacity kept once drained, bigger lists are freed*/
+#define KV_WHEEL_KEEP 1024
+
+struct kv_timer{
+    uint64_t hash;      /* hash of the key*/
+    uint32_t expire;    /* unix time in seconds*/
+};
+
+struct kv_timer_list{
+    struct kv_timer *timers;
+    uint32_t count;
+    uint32_t cap;
+};
+
+struct kv_wheel{
+    struct kv_timer_list slots[KV_WHEEL_LEVELS][KV_WHEEL_SLOTS];
+    struct kv_timer_list due;   /* expire <= now, not popped yet*/
+    uint32_t now;               /* last second advanced to*/
+    size_t count;               /* timers in slots and due list*/
+};
+
+void kv_wheel_init(struct kv_wheel *wheel, uint32_t now);
+void kv_wheel_free(struct kv_wheel *wheel);
+int kv_wheel_add(struct kv_wheel *wheel, uint64_t hash, uint32_t expire);
+void kv_wheel_advance(struct kv_wheel *wheel, uint32_t now);
+int kv_wheel_pop(struct kv_wheel *wheel, struct kv_timer *timer);
+
+#endif /* KV_WHEEL_H */
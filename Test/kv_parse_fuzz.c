@@ -0,0 +1,245 @@
+/* kv_parse_fuzz.c
+ *
+ * Fuzz test of the text command parser, Server/kv_parse.c
+ * - Every input is parsed from a buffer that ends exactly where the
+ *   input ends, so under -fsanitize=address any read past it aborts
+ * - After each parse the input must be unchanged, every view must lie
+ *   inside it without a space or NUL, the keys must fit KV_MAX_KEY and
+ *   kv_parse_next() must give back exactly the keys counted
+ * - Standalone it mutates a few valid commands (flipped bytes, extra
+ *   spaces and NULs, cut and repeated pieces, long tokens):
+ *     gcc -g -O1 -fsanitize=address,undefined -o kv_parse_fuzz \
+ *         Test/kv_parse_fuzz.c Server/kv_parse.c
+ *     ./kv_parse_fuzz [<iterations> [<seed>]]
+ * - With -DKV_FUZZ_LIBFUZZER and clang -fsanitize=fuzzer,address the
+ *   same checks run under libFuzzer instead
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../Server/kv_parse.h"
+#include "../Server/kv_store.h"
+#include "../Common/kv_proto.h"
+
+#define FUZZ_MAX_INPUT 4096
+
+static const char *seeds[] = {
+    "--set k v", "--set key value 10", "--get key", "--del key", "--fin fin", "--fin",
+    "--mset a 1 b 2 c 3", "--mget a b c", "--mdel a", "--put k v 5", "--cas k v 3 60",
+    "--incr n 5", "--decr n 18446744073709551615", "--append k tail", "--gets k",
+    "--scan a z 10 m", "--scan  z", "--prefix us 5 user1", "--prefix ", "--stats",
+    "--loglevel debug",
+};
+
+/* Function: fuzz_fail() - To report a broken invariant and abort*/
+static void fuzz_fail(const char *what, const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    fprintf(stderr, "kv_parse_fuzz: %s, input of %zu bytes:\n", what, size);
+    for (i = 0; i < size; i++)
+        fprintf(stderr, "%02x", data[i]);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+/* Function: fuzz_view() - To check one view lies inside the input*/
+static int fuzz_view(const struct kv_view *v, const char *buf, size_t len)
+{
+    return v->ptr >= buf && v->len <= len && v->ptr + v->len <= buf + len &&
+           memchr(v->ptr, ' ', v->len) == NULL && memchr(v->ptr, '\0', v->len) == NULL;
+}
+
+/* Function: LLVMFuzzerTestOneInput() - To parse one input and check the result
+ * in parameters:
+ *   data - input
+ *   size - length of data
+ *
+ * return:
+ *   0
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct kv_request req;
+    struct kv_view list;
+    struct kv_view token;
+    uint64_t value;
+    char *buf;
+    char digits[24];
+    int status;
+    int n;
+
+    /* exactly sized, an over-read hits the redzone*/
+    buf = malloc(size ? size : 1);
+    if (NULL == buf)
+        return 0;
+    memcpy(buf, data, size);
+
+    status = kv_parse_request(buf, size, &req);
+    if (memcmp(buf, data, size) != 0)
+        fuzz_fail("input written to", data, size);
+    if (status != KV_PARSE_OK && status != KV_PARSE_UNKNOWN && status != KV_PARSE_BADREQ)
+        fuzz_fail("unknown status", data, size);
+    if ((status == KV_PARSE_UNKNOWN) != (req.opcode == 0))
+        fuzz_fail("opcode set for an unknown command", data, size);
+
+    if (status == KV_PARSE_OK)
+    {
+        if (req.num_args < 0 || req.list.ptr < buf || req.list.ptr + req.list.len != buf + size)
+            fuzz_fail("list out of the input", data, size);
+        if (req.opcode != KV_OP_MSET && req.opcode != KV_OP_MGET && req.opcode != KV_OP_MDEL &&
+            req.opcode != KV_OP_FIN && req.opcode != KV_PARSE_STATS &&
+            req.opcode != KV_PARSE_LOGLEVEL && req.args[0].len > KV_MAX_KEY)
+            fuzz_fail("key longer than KV_MAX_KEY", data, size);
+
+        for (n = 0; n < req.num_args && n < KV_PARSE_MAX_ARGS; n++)
+        {
+            if (!fuzz_view(&req.args[n], buf, size))
+                fuzz_fail("argument out of the input", data, size);
+        }
+
+        /* the list is walked for the keys of the multi-key commands,
+           which have no empty token*/
+        if (req.opcode != KV_OP_MSET && req.opcode != KV_OP_MGET && req.opcode != KV_OP_MDEL)
+        {
+            free(buf);
+            return 0;
+        }
+        n = 0;
+        list = req.list;
+        while (kv_parse_next(&list, &token))
+        {
+            if (!fuzz_view(&token, buf, size))
+                fuzz_fail("token out of the input", data, size);
+            if (n < KV_PARSE_MAX_ARGS &&
+                (token.ptr != req.args[n].ptr || token.len != req.args[n].len))
+                fuzz_fail("args and list differ", data, size);
+            /* a number token reads back the same*/
+            if (kv_parse_u64(&token, &value) == SUCCESS)
+            {
+                snprintf(digits, sizeof(digits), "%llu", (unsigned long long)value);
+                if (token.len > 20 || (token.ptr[0] != '0' &&
+                    (strlen(digits) != token.len || memcmp(digits, token.ptr, token.len) != 0)))
+                    fuzz_fail("number misread", data, size);
+            }
+            n++;
+        }
+        if (n != req.num_args)
+            fuzz_fail("tokens miscounted", data, size);
+    }
+
+    free(buf);
+    return 0;
+}
+
+#ifndef KV_FUZZ_LIBFUZZER
+
+/* Function: fuzz_rand() - xorshift64*/
+static uint64_t fuzz_rand(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Function: fuzz_mutate() - To turn a seed into a test input
+ * in parameters:
+ *   rng - random state
+ *   out - buffer of FUZZ_MAX_INPUT bytes
+ *
+ * return:
+ *   length of the input
+ */
+static size_t fuzz_mutate(uint64_t *rng, uint8_t *out)
+{
+    static const uint8_t special[] = { ' ', '\0', '-', '0', '9', '#', '\n', 0xB5, 0xff };
+    const char *seed = seeds[fuzz_rand(rng) % (sizeof(seeds) / sizeof(seeds[0]))];
+    size_t len = strlen(seed);
+    size_t pos;
+    size_t n;
+    int rounds = fuzz_rand(rng) % 6;
+
+    memcpy(out, seed, len);
+    while (rounds-- > 0)
+    {
+        pos = len ? fuzz_rand(rng) % (len + 1) : 0;
+        switch (fuzz_rand(rng) % 6)
+        {
+            case 0:     /* flip a byte*/
+                if (pos < len)
+                    out[pos] ^= 1 << (fuzz_rand(rng) % 8);
+            break;
+            case 1:     /* put in a separator or digit*/
+                if (len < FUZZ_MAX_INPUT)
+                {
+                    memmove(out + pos + 1, out + pos, len - pos);
+                    out[pos] = special[fuzz_rand(rng) % sizeof(special)];
+                    len++;
+                }
+            break;
+            case 2:     /* cut the end*/
+                len = pos;
+            break;
+            case 3:     /* drop a byte*/
+                if (pos < len)
+                {
+                    memmove(out + pos, out + pos + 1, len - pos - 1);
+                    len--;
+                }
+            break;
+            case 4:     /* a long token around KV_MAX_KEY*/
+                n = KV_MAX_KEY - 2 + fuzz_rand(rng) % 5;
+                if (len + n <= FUZZ_MAX_INPUT)
+                {
+                    memmove(out + pos + n, out + pos, len - pos);
+                    memset(out + pos, 'x', n);
+                    len += n;
+                }
+            break;
+            default:    /* repeat the tail, more tokens*/
+                n = len - pos;
+                if (len + n <= FUZZ_MAX_INPUT)
+                {
+                    memcpy(out + len, out + pos, n);
+                    len += n;
+                }
+            break;
+        }
+    }
+    return len;
+}
+
+/* main function*/
+int main(int argc, char **argv)
+{
+    static uint8_t input[FUZZ_MAX_INPUT];
+    struct kv_request req;
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+    uint64_t rng = (argc > 2) ? strtoull(argv[2], NULL, 10) : 0x9E3779B97F4A7C15ULL;
+    unsigned long i;
+    unsigned int s;
+
+    if (0 == rng)
+        rng = 1;
+
+    /* the seeds are all well formed*/
+    for (s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++)
+    {
+        if (kv_parse_request(seeds[s], strlen(seeds[s]), &req) != KV_PARSE_OK)
+            fuzz_fail("seed not accepted", (const uint8_t *)seeds[s], strlen(seeds[s]));
+        LLVMFuzzerTestOneInput((const uint8_t *)seeds[s], strlen(seeds[s]));
+    }
+    for (i = 0; i < iterations; i++)
+        LLVMFuzzerTestOneInput(input, fuzz_mutate(&rng, input));
+    printf("kv_parse_fuzz: %lu inputs, no failure\n", iterations);
+    return 0;
+}
+
+#endif /* KV_FUZZ_LIBFUZZER */
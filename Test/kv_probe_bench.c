@@ -0,0 +1,192 @@
+/* kv_probe_bench.c
+ *
+ * Microbenchmark of the key lookup versions, Server/kv_probe.c
+ * - Fills a one shard store with <keys> keys of each length, then
+ *   times hits and misses of every version the CPU runs: the table
+ *   probe alone (key already hashed) and the whole find_entry()
+ * - Every version must find every stored key and none of the others,
+ *   a mismatch aborts
+ *     gcc -O2 -o kv_probe_bench Test/kv_probe_bench.c Server/kv_store.c \
+ *         Server/kv_slab.c Server/kv_wheel.c Server/kv_index.c \
+ *         Server/kv_probe.c -lpthread
+ *     ./kv_probe_bench [<keys> [<lookups>]]
+ *
+ * Author: Kapil
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../Server/kv_store.h"
+#include "../Server/kv_probe.h"
+#include "../Server/kv_hash.h"
+
+static const int key_lengths[] = { 8, 16, 40, 100, 250 };
+
+/* Function: now_ns() - To read the monotonic clock in nanoseconds*/
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function: bench_fail() - To report a wrong lookup and abort*/
+static void bench_fail(const char *what, const char *probe, int length)
+{
+    fprintf(stderr, "%s: %s lookup wrong for key length %d\n", what, probe, length);
+    exit(1);
+}
+
+/* Function: make_key() - To write key number n padded to length bytes
+ *   Keys share all but a few bytes, as user:<id> style keys do, so a
+ *   comparison reads the whole key.
+ */
+static void make_key(char *key, int length, char kind, unsigned int n)
+{
+    char digits[16];
+    int len = snprintf(digits, sizeof(digits), "%c%07x", kind, n);
+
+    memset(key, '.', length);
+    memcpy(key + length - len, digits, len);
+}
+
+/* Function: bench_probe() - To time one version over hits and misses
+ * in parameters:
+ *   store - filled store, probe set to the version
+ *   keys - stored keys then missing keys, stride KV_MAX_KEY
+ *   hashes - kv_hash() of the keys
+ *   order - random key numbers below nkeys
+ *   nkeys - keys stored
+ *   lookups - length of order
+ *   length - key length
+ *
+ * return:
+ *   void
+ */
+static void bench_probe(struct kv_store *store, const char *keys, const uint64_t *hashes,
+                        const unsigned int *order, unsigned int nkeys, unsigned int lookups,
+                        int length)
+{
+    const char *name = kv_probe_name(store->probe_impl);
+    const struct kv_table *table = &store->shards[0].cur;
+    const struct kv_item *item;
+    const char *key;
+    uint64_t start;
+    double ns[4];
+    unsigned int i;
+    unsigned int k;
+    int miss;
+
+    for (miss = 0; miss < 2; miss++)
+    {
+        start = now_ns();
+        for (i = 0; i < lookups; i++)
+        {
+            k = order[i] + miss * nkeys;
+            if ((store->probe(table, hashes[k], keys + (size_t)k * KV_MAX_KEY, length) == NULL)
+                != miss)
+                bench_fail("probe", name, length);
+        }
+        ns[miss] = (double)(now_ns() - start) / lookups;
+
+        start = now_ns();
+        for (i = 0; i < lookups; i++)
+        {
+            k = order[i] + miss * nkeys;
+            key = keys + (size_t)k * KV_MAX_KEY;
+            if (find_entry(store, key, length, &item) == SUCCESS)
+            {
+                if (miss)
+                    bench_fail("find_entry", name, length);
+                release_entry(store, item);
+            }
+            else if (!miss)
+            {
+                bench_fail("find_entry", name, length);
+            }
+        }
+        ns[2 + miss] = (double)(now_ns() - start) / lookups;
+    }
+    printf("%-8s %6d %12.1f %12.1f %12.1f %12.1f\n", name, length, ns[0], ns[1], ns[2], ns[3]);
+}
+
+/* main function*/
+int main(int argc, char **argv)
+{
+    unsigned int nkeys = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+    unsigned int lookups = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2000000;
+    struct kv_store store;
+    char *keys;
+    uint64_t *hashes;
+    unsigned int *order;
+    unsigned int i;
+    unsigned int l;
+    int probe;
+    int length;
+
+    if (0 == nkeys || 0 == lookups)
+    {
+        fprintf(stderr, "usage: %s [<keys> [<lookups>]]\n", argv[0]);
+        return 1;
+    }
+    keys = malloc((size_t)nkeys * 2 * KV_MAX_KEY);
+    hashes = malloc((size_t)nkeys * 2 * sizeof(uint64_t));
+    order = malloc((size_t)lookups * sizeof(unsigned int));
+    if (NULL == keys || NULL == hashes || NULL == order)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < lookups; i++)
+        order[i] = ((unsigned int)rand() * 2654435761U) % nkeys;
+
+    printf("%u keys, %u lookups, best version %s, ns per lookup\n", nkeys, lookups,
+           kv_probe_name(kv_probe_best()));
+    printf("%-8s %6s %12s %12s %12s %12s\n", "probe", "keylen", "probe_hit", "probe_miss",
+           "find_hit", "find_miss");
+
+    for (l = 0; l < sizeof(key_lengths) / sizeof(key_lengths[0]); l++)
+    {
+        length = key_lengths[l];
+        for (i = 0; i < nkeys * 2; i++)
+        {
+            make_key(keys + (size_t)i * KV_MAX_KEY, length, i < nkeys ? 'k' : 'm', i % nkeys);
+            hashes[i] = kv_hash(keys + (size_t)i * KV_MAX_KEY, length);
+        }
+
+        /* one shard sized up front: no resize, the old table stays empty*/
+        if (kv_store_init(&store, 1, nkeys) != SUCCESS)
+        {
+            fprintf(stderr, "store allocation failed\n");
+            return 1;
+        }
+        kv_store_reserve(&store, nkeys);
+        for (i = 0; i < nkeys; i++)
+        {
+            if (add_entry(&store, keys + (size_t)i * KV_MAX_KEY, length, "v", 1, 0) != SUCCESS)
+            {
+                fprintf(stderr, "add_entry failed\n");
+                return 1;
+            }
+        }
+
+        for (probe = KV_PROBE_SCALAR; probe <= KV_PROBE_AVX2; probe++)
+        {
+            if (kv_store_set_probe(&store, probe) == SUCCESS)
+                bench_probe(&store, keys, hashes, order, nkeys, lookups, length);
+        }
+        del_all_entry(&store);
+    }
+
+    free(order);
+    free(hashes);
+    free(keys);
+    return 0;
+}